@@ -1,6 +1,7 @@
 
 
 #include <camera/perspective.h>
+#include <core/light.h>
 
 namespace platinum
 {
@@ -39,6 +40,9 @@ namespace platinum
         p_min /= p_min.z;
         p_max /= p_max.z;
         _area = glm::abs((p_max.x - p_min.x) * (p_max.y - p_min.y));
+        _film_min = Vector2f(p_min.x, p_min.y);
+        _film_max = Vector2f(p_max.x, p_max.y);
+        _world2camera = Inverse(_camera2world);
     }
 
     float PerspectiveCamera::CastingRay(const CameraSample &sample, Ray &ray) const
@@ -52,4 +56,74 @@ namespace platinum
         ray = _camera2world.ExecOn(ray);
         return 1.f;
     }
+
+    bool PerspectiveCamera::DirectionToRaster(const Vector3f &d, Vector2f &pRaster) const
+    {
+        if (d.z <= 0)
+            return false;
+        Vector2f pFocus(d.x / d.z, d.y / d.z);
+        Vector2f res(_film->GetResolution());
+        pRaster = (pFocus - _film_min) / (_film_max - _film_min) * res;
+
+        Bounds2i sampleBounds = _film->GetSampleBounds();
+        return pRaster.x >= sampleBounds._p_min.x && pRaster.x < sampleBounds._p_max.x &&
+               pRaster.y >= sampleBounds._p_min.y && pRaster.y < sampleBounds._p_max.y;
+    }
+
+    Spectrum PerspectiveCamera::We(const Ray &ray, Vector2f *pRaster) const
+    {
+        //相机坐标系下的方向，z分量即与视线方向夹角的余弦
+        Vector3f d = glm::normalize(_world2camera.ExecOn(ray._direction, 0.f));
+        Vector2f raster;
+        bool inside = DirectionToRaster(d, raster);
+        if (pRaster)
+            *pRaster = raster;
+        if (!inside)
+            return Spectrum(0.f);
+
+        //针孔相机：We = 1 / (A cos^4θ)，A为z=1处的胶片面积
+        float cos2Theta = d.z * d.z;
+        return Spectrum(1 / (_area * cos2Theta * cos2Theta));
+    }
+
+    void PerspectiveCamera::PdfWe(const Ray &ray, float &pdfPos, float &pdfDir) const
+    {
+        Vector3f d = glm::normalize(_world2camera.ExecOn(ray._direction, 0.f));
+        Vector2f raster;
+        if (!DirectionToRaster(d, raster))
+        {
+            pdfPos = pdfDir = 0;
+            return;
+        }
+        //针孔的位置是确定的（delta分布），按pbrt的约定pdfPos取1
+        pdfPos = 1;
+        pdfDir = 1 / (_area * d.z * d.z * d.z);
+    }
+
+    Spectrum PerspectiveCamera::SampleWi(const Interaction &ref, const Vector2f &u, Vector3f &wi, float &pdf,
+                                         Vector2f &pRaster, VisibilityTester &vis) const
+    {
+        Interaction lens;
+        lens.p = _camera2world.ExecOn(Vector3f(0.f), 1.f);
+        lens.n = glm::normalize(_camera2world.ExecOn(Vector3f(0.f, 0.f, 1.f), 0.f));
+
+        wi = lens.p - ref.p;
+        float dist = glm::length(wi);
+        if (dist == 0)
+        {
+            pdf = 0;
+            return Spectrum(0.f);
+        }
+        wi /= dist;
+
+        float cosTheta = glm::abs(glm::dot(lens.n, wi));
+        if (cosTheta == 0)
+        {
+            pdf = 0;
+            return Spectrum(0.f);
+        }
+        pdf = dist * dist / cosTheta;
+        vis = VisibilityTester(ref, lens);
+        return We(lens.SpawnRay(-wi), &pRaster);
+    }
 }
@@ -17,14 +17,31 @@ namespace platinum
 
         virtual float CastingRay(const CameraSample &sample, Ray &ray) const override;
 
+        virtual Spectrum We(const Ray &ray, Vector2f *pRaster = nullptr) const override;
+
+        virtual void PdfWe(const Ray &ray, float &pdfPos, float &pdfDir) const override;
+
+        virtual Spectrum SampleWi(const Interaction &ref, const Vector2f &u, Vector3f &wi, float &pdf,
+                                  Vector2f &pRaster, VisibilityTester &vis) const override;
+
         virtual std::string ToString() const { return "PerspectiveCamera"; }
 
     protected:
         virtual void Initialize() override;
 
+    private:
+        /**
+         * @brief 相机坐标系下的方向d对应的胶片坐标，d在视野外（含背后）时返回false
+         */
+        bool DirectionToRaster(const Vector3f &d, Vector2f &pRaster) const;
+
     private:
         //z=1时的film面积
         float _area;
+        //raster坐标(0,0)与(res.x,res.y)投影到z=1平面上的位置，两者之间是线性关系
+        Vector2f _film_min, _film_max;
+        //_camera2world的逆，供We/PdfWe把世界方向变换到相机坐标系
+        Transform _world2camera;
     };
 }
 
@@ -1,9 +1,30 @@
 
 
 #include <core/camera.h>
+#include <core/light.h>
 
 namespace platinum
 {
+    Spectrum Camera::We(const Ray &ray, Vector2f *pRaster) const
+    {
+        LOG(ERROR) << "Camera::We() is not implemented for " << ToString();
+        return Spectrum(0.f);
+    }
+
+    void Camera::PdfWe(const Ray &ray, float &pdfPos, float &pdfDir) const
+    {
+        LOG(ERROR) << "Camera::PdfWe() is not implemented for " << ToString();
+        pdfPos = pdfDir = 0;
+    }
+
+    Spectrum Camera::SampleWi(const Interaction &ref, const Vector2f &u, Vector3f &wi, float &pdf,
+                              Vector2f &pRaster, VisibilityTester &vis) const
+    {
+        LOG(ERROR) << "Camera::SampleWi() is not implemented for " << ToString();
+        pdf = 0;
+        return Spectrum(0.f);
+    }
+
     ProjectiveCamera::ProjectiveCamera(const Transform &cameraToWorld, const Transform &cameraToScreen, UPtr<Film> film)
         : Camera(cameraToWorld, std::move(film)), _camera2screen(cameraToScreen)
     {
@@ -7,12 +7,14 @@
 #include <math/transform.h>
 #include <core/film.h>
 #include <core/object.h>
+#include <core/spectrum.h>
 
 namespace platinum
 {
     struct alignas(4) CameraSample
     {
         Vector2f p_film;
+        float filter_weight = 1.f; //filter importance sampling only, see Sampler::GetCameraSample
     };
 
     inline std::ostream &operator<<(std::ostream &os, const CameraSample &cs)
@@ -40,6 +42,29 @@ namespace platinum
          */
         virtual float CastingRay(const CameraSample &sample, Ray &ray) const = 0;
 
+        /**
+         * @brief 相机沿ray（世界坐标，起点在镜头上）方向的重要性函数We，用于从光源出发的路径与相机相连
+         * @param  pRaster          返回ray对应的胶片（raster）坐标，可为nullptr
+         * @return Spectrum         ray不在视野内时为0
+         */
+        virtual Spectrum We(const Ray &ray, Vector2f *pRaster = nullptr) const;
+
+        /**
+         * @brief 相机生成ray的pdf：pdfPos为镜头上的位置pdf（关于面积），pdfDir为方向pdf（关于立体角）
+         */
+        virtual void PdfWe(const Ray &ray, float &pdfPos, float &pdfDir) const;
+
+        /**
+         * @brief 从场景中的点ref采样镜头上的一点，返回该点沿-wi方向的重要性We
+         * @param  u                2维随机变量，用于采样镜头
+         * @param  wi               返回从ref指向镜头的方向
+         * @param  pdf              返回关于ref处立体角的pdf
+         * @param  pRaster          返回对应的胶片坐标
+         * @param  vis              ref与镜头之间的可见测试器
+         */
+        virtual Spectrum SampleWi(const Interaction &ref, const Vector2f &u, Vector3f &wi, float &pdf,
+                                  Vector2f &pRaster, VisibilityTester &vis) const;
+
         Transform _camera2world;
         UPtr<Film> _film;
     };
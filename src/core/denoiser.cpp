@@ -0,0 +1,175 @@
+
+
+#include <core/denoiser.h>
+#include <tbb/parallel_for.h>
+
+namespace platinum
+{
+    Denoiser::Denoiser(const PropertyTree &root)
+    {
+        _iterations = glm::max(1, root.Get<int>("Iterations", 5));
+        _sigma_color = glm::max(1e-4f, root.Get<float>("SigmaColor", 4.f));
+        _sigma_normal = glm::max(1e-4f, root.Get<float>("SigmaNormal", 0.3f));
+        _sigma_depth = glm::max(1e-4f, root.Get<float>("SigmaDepth", 0.1f));
+        _sigma_albedo = glm::max(1e-4f, root.Get<float>("SigmaAlbedo", 0.1f));
+
+        LOG(INFO) << "Denoiser: " << _iterations << " a-trous iterations, sigma color " << _sigma_color
+                  << ", normal " << _sigma_normal << ", depth " << _sigma_depth << ", albedo " << _sigma_albedo;
+    }
+
+    void Denoiser::Denoise(float *rgb, const GuideBuffers &guides) const
+    {
+        const int width = guides.width, height = guides.height;
+        const int nPixels = width * height;
+        if (nPixels == 0)
+            return;
+
+        // Note: filter the illumination (color over albedo) instead of the color,
+        //       the albedo is multiplied back in at the end.
+        constexpr float minAlbedo = 1e-3f;
+        std::vector<float> color[4], filtered[4]; //RGB and the variance of the luminance
+        for (int c = 0; c < 4; ++c)
+        {
+            color[c].resize(nPixels);
+            filtered[c].resize(nPixels);
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int i = 0; i < nPixels; ++i)
+                color[c][i] = rgb[3 * i + c] / glm::max(guides.albedo[c][i], minAlbedo);
+        }
+
+        // Note: the film keeps no per-pixel variance, so the noise level is estimated
+        //       from the luminance variance in a 5x5 neighbourhood
+        std::vector<float> luminance(nPixels);
+        for (int i = 0; i < nPixels; ++i)
+            luminance[i] = 0.2126f * color[0][i] + 0.7152f * color[1][i] + 0.0722f * color[2][i];
+        tbb::parallel_for(tbb::blocked_range<int>(0, height, 8), [&](const tbb::blocked_range<int> &range)
+        {
+            for (int y = range.begin(); y != range.end(); ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    float sum = 0, sum2 = 0;
+                    int count = 0;
+                    for (int yy = glm::max(0, y - 2); yy <= glm::min(height - 1, y + 2); ++yy)
+                    {
+                        for (int xx = glm::max(0, x - 2); xx <= glm::min(width - 1, x + 2); ++xx)
+                        {
+                            float l = luminance[yy * width + xx];
+                            sum += l;
+                            sum2 += l * l;
+                            ++count;
+                        }
+                    }
+                    float mean = sum / count;
+                    color[3][y * width + x] = glm::max(0.f, sum2 / count - mean * mean);
+                }
+            }
+        });
+
+        // B3-spline kernel
+        static const float kernel[5] = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+        const float invSigmaNormal2 = 1 / (_sigma_normal * _sigma_normal);
+        const float invSigmaDepth2 = 1 / (_sigma_depth * _sigma_depth);
+        const float invSigmaAlbedo2 = 1 / (_sigma_albedo * _sigma_albedo);
+
+        for (int iteration = 0; iteration < _iterations; ++iteration)
+        {
+            const int step = 1 << iteration;
+
+            tbb::parallel_for(tbb::blocked_range<int>(0, height, 8), [&](const tbb::blocked_range<int> &range)
+            {
+                // Note: a row of 6 * width floats is too large for the stack of a task on wide images
+                thread_local std::vector<float> sumBuffer;
+                sumBuffer.resize(6 * size_t(width));
+                float *sum = sumBuffer.data();
+                for (int y = range.begin(); y != range.end(); ++y)
+                {
+                    std::fill(sum, sum + 6 * width, 0.f);
+                    float *sumR = sum, *sumG = sum + width, *sumB = sum + 2 * width;
+                    float *sumVar = sum + 3 * width, *sumW = sum + 4 * width, *lumScale = sum + 5 * width;
+
+                    const int row = y * width;
+                    const float *cpR = &color[0][row], *cpG = &color[1][row], *cpB = &color[2][row];
+                    const float *npX = &guides.normal[0][row], *npY = &guides.normal[1][row], *npZ = &guides.normal[2][row];
+                    const float *apR = &guides.albedo[0][row], *apG = &guides.albedo[1][row], *apB = &guides.albedo[2][row];
+                    const float *zp = &guides.depth[row];
+
+                    // Luminance differences are measured relative to the noise level at the center pixel
+                    for (int x = 0; x < width; ++x)
+                        lumScale[x] = 1 / (_sigma_color * glm::sqrt(color[3][row + x]) + 1e-4f);
+
+                    for (int ky = 0; ky < 5; ++ky)
+                    {
+                        const int yy = y + (ky - 2) * step;
+                        if (yy < 0 || yy >= height)
+                            continue;
+                        for (int kx = 0; kx < 5; ++kx)
+                        {
+                            // Only the pixels whose tap falls inside the image, no bounds checks in the loop
+                            const int offset = (kx - 2) * step;
+                            const int x0 = glm::max(0, -offset), x1 = glm::min(width, width - offset);
+                            const float h = kernel[ky] * kernel[kx];
+
+                            const int rowq = yy * width;
+                            const float *cqR = &color[0][rowq], *cqG = &color[1][rowq], *cqB = &color[2][rowq];
+                            const float *varq = &color[3][rowq];
+                            const float *nqX = &guides.normal[0][rowq], *nqY = &guides.normal[1][rowq],
+                                        *nqZ = &guides.normal[2][rowq];
+                            const float *aqR = &guides.albedo[0][rowq], *aqG = &guides.albedo[1][rowq],
+                                        *aqB = &guides.albedo[2][rowq];
+                            const float *zq = &guides.depth[rowq];
+
+                            for (int x = x0; x < x1; ++x)
+                            {
+                                const int q = x + offset;
+                                float lumDist = glm::abs(0.2126f * (cpR[x] - cqR[q]) + 0.7152f * (cpG[x] - cqG[q]) +
+                                                         0.0722f * (cpB[x] - cqB[q])) *
+                                                lumScale[x];
+
+                                float nX = npX[x] - nqX[q], nY = npY[x] - nqY[q], nZ = npZ[x] - nqZ[q];
+                                float normalDist = nX * nX + nY * nY + nZ * nZ;
+
+                                float aR = apR[x] - aqR[q], aG = apG[x] - aqG[q], aB = apB[x] - aqB[q];
+                                float albedoDist = aR * aR + aG * aG + aB * aB;
+
+                                // Relative depth difference, so the tolerance does not depend on the scene scale
+                                float dz = zp[x] - zq[q];
+                                float zMax = glm::max(zp[x], zq[q]);
+                                float depthDist = dz * dz / (zMax * zMax + 1e-8f);
+
+                                float w = h * std::exp(-(lumDist + normalDist * invSigmaNormal2 +
+                                                         depthDist * invSigmaDepth2 + albedoDist * invSigmaAlbedo2));
+                                sumR[x] += w * cqR[q];
+                                sumG[x] += w * cqG[q];
+                                sumB[x] += w * cqB[q];
+                                sumVar[x] += w * w * varq[q];
+                                sumW[x] += w;
+                            }
+                        }
+                    }
+
+                    // The center tap always has a positive weight
+                    for (int x = 0; x < width; ++x)
+                    {
+                        float invW = 1 / sumW[x];
+                        filtered[0][row + x] = sumR[x] * invW;
+                        filtered[1][row + x] = sumG[x] * invW;
+                        filtered[2][row + x] = sumB[x] * invW;
+                        filtered[3][row + x] = sumVar[x] * invW * invW;
+                    }
+                }
+            });
+
+            for (int c = 0; c < 4; ++c)
+                std::swap(color[c], filtered[c]);
+        }
+
+        for (int i = 0; i < nPixels; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+                rgb[3 * i + c] = color[c][i] * glm::max(guides.albedo[c][i], minAlbedo);
+        }
+    }
+}
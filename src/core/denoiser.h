@@ -0,0 +1,55 @@
+
+
+#ifndef CORE_DENOISER_H_
+#define CORE_DENOISER_H_
+
+#include <core/utilities.h>
+#include <core/object.h>
+#include <vector>
+
+namespace platinum
+{
+    /**
+     * @brief Per-pixel feature buffers gathered from the first intersection of the camera rays,
+     *        stored as separate planes so that the filter loops run over contiguous floats.
+     *        Depth is the distance to the first hit, 0 where the camera ray escaped.
+     */
+    struct GuideBuffers
+    {
+        int width = 0, height = 0;
+        std::vector<float> albedo[3];
+        std::vector<float> normal[3];
+        std::vector<float> depth;
+    };
+
+    /**
+     * @brief Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by albedo,
+     *        normal and depth buffers. The color is divided by the albedo before filtering and
+     *        multiplied back afterwards, so texture detail is not blurred away with the noise.
+     *        Each iteration applies the 5x5 B3-spline kernel with holes of 2^i pixels. A tap is
+     *        attenuated by its normal, depth and albedo differences to the center, and by the
+     *        luminance difference in units of SigmaColor standard deviations of the noise, as in SVGF;
+     *        the variance is estimated spatially and filtered along with the color.
+     *        Rows are distributed over threads, and for each tap the inner loop runs over a row
+     *        segment without branches so that the compiler can vectorize it.
+     */
+    class Denoiser
+    {
+    public:
+        Denoiser(const PropertyTree &root);
+
+        /**
+         * @brief Filter the image in place.
+         * @param rgb interleaved linear RGB, width * height pixels
+         */
+        void Denoise(float *rgb, const GuideBuffers &guides) const;
+
+        int GetIterations() const { return _iterations; }
+
+    private:
+        int _iterations;
+        float _sigma_color, _sigma_normal, _sigma_depth, _sigma_albedo;
+    };
+}
+
+#endif
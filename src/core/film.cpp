@@ -1,13 +1,70 @@
 
 #include <core/film.h>
+#include <core/image_io.h>
 
+//Note: also provides stbi_zlib_compress() to WritePNG() in core/image_io.cpp
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #include <stb/stb_image_write.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include <sstream>
+#include <cstring>
 namespace platinum
 {
     REGISTER_CLASS(Film, "Film");
 
+    const char *AOVName(AOVType type)
+    {
+        static const char *names[(int)AOVType::Count] = {"Albedo", "Normal", "Depth", "Emission", "Direct", "Indirect", "Lights"};
+        return names[(int)type];
+    }
+
+    namespace
+    {
+        int AOVChannels(AOVType type) { return type == AOVType::Depth ? 1 : 3; }
+
+        int PixelWords(FilmStorage storage) { return storage == FilmStorage::Float ? 4 : (storage == FilmStorage::Half ? 3 : 2); }
+
+        // Shared-exponent RGB9E5 as in EXT_texture_shared_exponent: three 9-bit mantissas and a 5-bit exponent
+        constexpr int RGB9E5MantissaBits = 9;
+        constexpr int RGB9E5ExponentBias = 15;
+        constexpr float RGB9E5Max = 511.f / 512.f * 65536.f;
+
+        uint32_t EncodeRGB9E5(const float v[3])
+        {
+            float c[3];
+            for (int i = 0; i < 3; ++i)
+                c[i] = v[i] > 0 ? glm::min(v[i], RGB9E5Max) : 0.f; //also maps NaN to 0
+            float maxC = glm::max(c[0], glm::max(c[1], c[2]));
+            if (maxC == 0)
+                return 0;
+
+            // The shared exponent fits the largest component, maxC < 2^(exponent - bias)
+            int e;
+            std::frexp(maxC, &e);
+            int exponent = glm::max(0, e + RGB9E5ExponentBias);
+            float denom = std::ldexp(1.f, exponent - RGB9E5ExponentBias - RGB9E5MantissaBits);
+            if (uint32_t(maxC / denom + 0.5f) == 1u << RGB9E5MantissaBits)
+            {
+                ++exponent;
+                denom *= 2;
+            }
+
+            uint32_t packed = uint32_t(exponent) << 27;
+            for (int i = 0; i < 3; ++i)
+                packed |= glm::min(uint32_t(c[i] / denom + 0.5f), 511u) << (RGB9E5MantissaBits * i);
+            return packed;
+        }
+
+        void DecodeRGB9E5(uint32_t packed, float v[3])
+        {
+            float scale = std::ldexp(1.f, int(packed >> 27) - RGB9E5ExponentBias - RGB9E5MantissaBits);
+            for (int i = 0; i < 3; ++i)
+                v[i] = float((packed >> (RGB9E5MantissaBits * i)) & 511u) * scale;
+        }
+    }
+
     Film::Film(const PropertyTree &root)
     {
         _resolution = root.Get<Vector2f>("Resolution");
@@ -34,6 +91,67 @@ namespace platinum
         _diagonal = root.Get<float>("Diagonal", 35.f);
         _scale = root.Get<float>("Scale", 1.f);
         _max_sample_luminance = root.Get<float>("MaxLum", Infinity);
+        _filter_importance_sampling = root.Get<bool>("FilterImportanceSampling", false);
+        _async_write = root.Get<bool>("AsyncWrite", true);
+        _live_filename = root.Get<std::string>("LiveFile", "");
+        _out_of_core = root.Get<bool>("OutOfCore", false);
+        _band_rows = glm::max(1, root.Get<int>("BandRows", 16));
+
+        // "Float" (default), "Half" or "RGB9E5", see FilmStorage
+        std::string storage = root.Get<std::string>("Storage", "Float");
+        std::transform(storage.begin(), storage.end(), storage.begin(), ::tolower);
+        if (storage == "half")
+            _storage = FilmStorage::Half;
+        else if (storage == "rgb9e5")
+            _storage = FilmStorage::RGB9E5;
+        else if (storage != "float")
+            LOG(ERROR) << "Unknown film Storage " << storage << ", the pixels are stored as floats";
+
+        auto denoiser_node = root.GetChildOptional("Denoiser");
+        if (denoiser_node)
+            _denoiser.reset(new Denoiser(*denoiser_node));
+
+        // "pfm" or "exr": also write the linear image, before scaling and gamma correction
+        _float_format = root.Get<std::string>("FloatFormat", "");
+        std::transform(_float_format.begin(), _float_format.end(), _float_format.begin(), ::tolower);
+        if (!_float_format.empty() && _float_format != "pfm" && _float_format != "exr")
+        {
+            LOG(ERROR) << "Unknown FloatFormat " << _float_format << ", no float image will be written";
+            _float_format.clear();
+        }
+
+        // e.g. "AOVs": "Albedo, Normal, Depth, Direct, Indirect"
+        std::stringstream aovs(root.Get<std::string>("AOVs", ""));
+        std::string name;
+        while (std::getline(aovs, name, ','))
+        {
+            name.erase(0, name.find_first_not_of(" \t"));
+            name.erase(name.find_last_not_of(" \t") + 1);
+            if (name.empty())
+                continue;
+            int type = 0;
+            while (type < (int)AOVType::Count && name != AOVName(AOVType(type)))
+                ++type;
+            if (type == (int)AOVType::Count)
+                LOG(ERROR) << "Unknown AOV " << name << " will be ignored";
+            else
+                _aov_output[type] = true;
+        }
+
+        if (_out_of_core)
+        {
+            LOG(INFO) << "Out-of-core film with bands of " << _band_rows << " rows";
+            if (_denoiser)
+                LOG(WARNING) << "The denoiser needs the whole image and is disabled for an out-of-core film";
+            _denoiser.reset();
+            if (std::find(std::begin(_aov_output), std::end(_aov_output), true) != std::end(_aov_output))
+                LOG(WARNING) << "AOVs need the whole image and are not written by an out-of-core film";
+            std::fill(std::begin(_aov_output), std::end(_aov_output), false);
+            // The mapped file holds the whole frame in memory, which the bands are meant to avoid
+            if (!_live_filename.empty())
+                LOG(WARNING) << "The live framebuffer holds the whole image and is disabled for an out-of-core film";
+            _live_filename.clear();
+        }
 
         Initialize();
     }
@@ -56,10 +174,16 @@ namespace platinum
         Initialize();
     }
 
-    void Film::Initialize()
+    Film::~Film()
     {
-        _pixels = std::unique_ptr<Pixel[]>(new Pixel[_cropped_pixel_bounds.Area()]);
+        WaitForWrites();
+        if (_bands)
+            ReleaseBands(0, (_cropped_pixel_bounds.Diagonal().y + _band_rows - 1) / _band_rows);
+        delete[] _splats.load();
+    }
 
+    void Film::Initialize()
+    {
         // Precompute filter weight table
         // Note: we assume that filtering function f(x,y)=f(|x|,|y|)
         //       hence only store values for the positive quadrant of filter offsets.
@@ -74,109 +198,731 @@ namespace platinum
                 _filter_table[offset] = _filter->Evaluate(p);
             }
         }
+
+        if (_out_of_core)
+        {
+            int nBands = (_cropped_pixel_bounds.Diagonal().y + _band_rows - 1) / _band_rows;
+            _bands.reset(new std::atomic<uint32_t *>[nBands]);
+            for (int b = 0; b < nBands; ++b)
+                _bands[b] = nullptr;
+        }
+        // Note: all-zero words decode to an empty pixel in every layout
+        SetStorage(_storage);
+        _row_mutexes = std::unique_ptr<tbb::spin_mutex[]>(new tbb::spin_mutex[_cropped_pixel_bounds.Diagonal().y]);
+        InitializeAOVs(0);
+        if (!_live_filename.empty())
+            _live.Open(_live_filename, _cropped_pixel_bounds.Diagonal().x, _cropped_pixel_bounds.Diagonal().y);
+
+        if (_filter_importance_sampling)
+        {
+            LOG(INFO) << "Filter importance sampling enabled";
+            _filter->InitializeSampling();
+        }
+    }
+
+    void Film::SetDenoiser(std::unique_ptr<Denoiser> denoiser)
+    {
+        if (_out_of_core && denoiser)
+        {
+            LOG(WARNING) << "The denoiser needs the whole image and is disabled for an out-of-core film";
+            return;
+        }
+        _denoiser = std::move(denoiser);
+        InitializeAOVs(_aov_layout.numLights);
+    }
+
+    void Film::InitializeAOVs(int numLights)
+    {
+        AOVLayout layout;
+        layout.numLights = numLights;
+        int offset = 2; //feature and radiance sample counts
+        for (int type = 0; type < (int)AOVType::Count; ++type)
+        {
+            bool feature = type == (int)AOVType::Albedo || type == (int)AOVType::Normal || type == (int)AOVType::Depth;
+            bool enabled = _aov_output[type] || (feature && _denoiser);
+            int channels = type == (int)AOVType::Lights ? 3 * numLights : AOVChannels(AOVType(type));
+            if (!enabled || channels == 0)
+                continue;
+            layout.offset[type] = offset;
+            offset += channels;
+        }
+        layout.stride = offset > 2 ? offset : 0;
+        _aov_layout = layout;
+
+        size_t size = size_t(_cropped_pixel_bounds.Area()) * layout.stride;
+        _aov_pixels.reset(size > 0 ? new float[size] : nullptr);
+        std::fill(_aov_pixels.get(), _aov_pixels.get() + size, 0.f);
     }
 
     Bounds2i Film::GetSampleBounds() const
     {
+        // Note: with filter importance sampling, samples are generated per pixel of the crop window
+        if (_filter_importance_sampling)
+            return _cropped_pixel_bounds;
+
         Bounds2f floatBounds(
             floor(Vector2f(_cropped_pixel_bounds._p_min) + Vector2f(0.5f, 0.5f) - _filter->_radius),
             ceil(Vector2f(_cropped_pixel_bounds._p_max) - Vector2f(0.5f, 0.5f) + _filter->_radius));
         return (Bounds2i)floatBounds;
     }
 
-    std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds)
+    Bounds2i Film::GetTilePixelBounds(const Bounds2i &sampleBounds) const
     {
+        // Every sample only contributes to the pixel it was generated for, tiles do not overlap
+        if (_filter_importance_sampling)
+            return Intersect(sampleBounds, _cropped_pixel_bounds);
+
         // Bound image pixels that samples in _sampleBounds_ contribute to
         Vector2f halfPixel = Vector2f(0.5f, 0.5f);
         Bounds2f floatBounds = (Bounds2f)sampleBounds;
         Vector2i p0 = (Vector2i)ceil(floatBounds._p_min - halfPixel - _filter->_radius);
         Vector2i p1 = (Vector2i)floor(floatBounds._p_max - halfPixel + _filter->_radius) + Vector2i(1, 1);
-        Bounds2i tilePixelBounds = Intersect(Bounds2i(p0, p1), _cropped_pixel_bounds);
-        return std::unique_ptr<FilmTile>(new FilmTile(tilePixelBounds, _filter->_radius,
-                                                      _filter_table, filter_table_width, _max_sample_luminance));
+        return Intersect(Bounds2i(p0, p1), _cropped_pixel_bounds);
+    }
+
+    std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds)
+    {
+        return std::unique_ptr<FilmTile>(new FilmTile(GetTilePixelBounds(sampleBounds), _filter->_radius,
+                                                      _filter_table, filter_table_width, _max_sample_luminance, &_aov_layout));
+    }
+
+    void Film::ExpectTiles(const Bounds2i &sampleBounds, int tileSize)
+    {
+        if (!_out_of_core)
+            return;
+        if (_row_pending)
+        {
+            LOG(ERROR) << "An out-of-core film only takes a single pass, the tiles of another pass are not streamed";
+            return;
+        }
+
+        const Vector2i extent = _cropped_pixel_bounds.Diagonal();
+        _row_pending.reset(new std::atomic<int>[extent.y]);
+        for (int y = 0; y < extent.y; ++y)
+            _row_pending[y] = 0;
+
+        // Note: the same tile grid as the integrator's; MergeFilmTile() skips tiles without pixels,
+        //       so only the tiles whose pixel bounds are not empty are counted.
+        Vector2i sampleExtent = sampleBounds.Diagonal();
+        Vector2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+        auto tileSampleBounds = [&](int tx, int ty)
+        {
+            Vector2i p0 = sampleBounds._p_min + Vector2i(tx, ty) * tileSize;
+            Vector2i p1(glm::min(p0.x + tileSize, sampleBounds._p_max.x), glm::min(p0.y + tileSize, sampleBounds._p_max.y));
+            return Bounds2i(p0, p1);
+        };
+        int columns = 0;
+        for (int tx = 0; tx < nTiles.x; ++tx)
+        {
+            Bounds2i bounds = GetTilePixelBounds(tileSampleBounds(tx, 0));
+            columns += bounds._p_max.x > bounds._p_min.x ? 1 : 0;
+        }
+        for (int ty = 0; ty < nTiles.y && columns > 0; ++ty)
+        {
+            Bounds2i bounds = GetTilePixelBounds(tileSampleBounds(0, ty));
+            for (int y = bounds._p_min.y; y < bounds._p_max.y; ++y)
+                _row_pending[y - _cropped_pixel_bounds._p_min.y] += columns;
+        }
+
+        _next_row = 0;
+        _png_stream.Open(_filename, extent.x, extent.y, 3);
+        if (!_float_format.empty())
+            _float_stream.Open(SiblingFilename(_filename, "", _float_format), extent.x, extent.y, 3);
+        LOG(INFO) << "Streaming image " << _filename << " as its rows are finished";
+
+        // Rows that no tile covers
+        StreamRows(false);
+    }
+
+    Film::Pixel Film::LoadPixel(const uint32_t *words) const
+    {
+        Pixel pixel;
+        float mean[3];
+        switch (_storage)
+        {
+        case FilmStorage::Float:
+            for (int c = 0; c < 3; ++c)
+                pixel._xyz[c] = bitsToFloat(words[c]);
+            pixel._filter_weight_sum = bitsToFloat(words[3]);
+            return pixel;
+        case FilmStorage::Half:
+            mean[0] = halfToFloat(uint16_t(words[0]));
+            mean[1] = halfToFloat(uint16_t(words[0] >> 16));
+            mean[2] = halfToFloat(uint16_t(words[1]));
+            pixel._filter_weight_sum = bitsToFloat(words[2]);
+            break;
+        case FilmStorage::RGB9E5:
+            DecodeRGB9E5(words[0], mean);
+            pixel._filter_weight_sum = bitsToFloat(words[1]);
+            break;
+        }
+        for (int c = 0; c < 3; ++c)
+            pixel._xyz[c] = mean[c] * pixel._filter_weight_sum;
+        return pixel;
+    }
+
+    void Film::StorePixel(uint32_t *words, const Pixel &pixel) const
+    {
+        if (_storage == FilmStorage::Float)
+        {
+            for (int c = 0; c < 3; ++c)
+                words[c] = floatToBits(pixel._xyz[c]);
+            words[3] = floatToBits(pixel._filter_weight_sum);
+            return;
+        }
+
+        float mean[3];
+        float invWt = pixel._filter_weight_sum != 0 ? 1 / pixel._filter_weight_sum : 0.f;
+        for (int c = 0; c < 3; ++c)
+            mean[c] = pixel._xyz[c] * invWt;
+        if (_storage == FilmStorage::Half)
+        {
+            // Saturate instead of overflowing to infinity
+            for (int c = 0; c < 3; ++c)
+                mean[c] = clamp(mean[c], -65504.f, 65504.f);
+            words[0] = uint32_t(floatToHalf(mean[0])) | uint32_t(floatToHalf(mean[1])) << 16;
+            words[1] = floatToHalf(mean[2]);
+            words[2] = floatToBits(pixel._filter_weight_sum);
+        }
+        else
+        {
+            words[0] = EncodeRGB9E5(mean);
+            words[1] = floatToBits(pixel._filter_weight_sum);
+        }
+    }
+
+    uint32_t *Film::GetPixelRow(int y)
+    {
+        const Vector2i extent = _cropped_pixel_bounds.Diagonal();
+        const size_t rowWords = size_t(extent.x) * _pixel_words;
+        if (!_out_of_core)
+            return &_pixels[y * rowWords];
+
+        std::atomic<uint32_t *> &band = _bands[y / _band_rows];
+        uint32_t *pixels = band.load(std::memory_order_acquire);
+        if (!pixels)
+        {
+            std::lock_guard<std::mutex> lock(_band_mutex);
+            pixels = band.load(std::memory_order_relaxed);
+            if (!pixels)
+            {
+                int rows = glm::min(_band_rows, extent.y - y / _band_rows * _band_rows);
+                pixels = new uint32_t[rows * rowWords]();
+                band.store(pixels, std::memory_order_release);
+            }
+        }
+        return pixels + (y % _band_rows) * rowWords;
+    }
+
+    const uint32_t *Film::FindPixelRow(int y) const
+    {
+        const size_t rowWords = size_t(_cropped_pixel_bounds.Diagonal().x) * _pixel_words;
+        if (!_out_of_core)
+            return &_pixels[y * rowWords];
+        const uint32_t *pixels = _bands[y / _band_rows].load(std::memory_order_acquire);
+        return pixels ? pixels + (y % _band_rows) * rowWords : nullptr;
+    }
+
+    void Film::ReleaseBands(int first, int last)
+    {
+        for (int b = first; b < last; ++b)
+            delete[] _bands[b].exchange(nullptr);
+    }
+
+    void Film::StreamRows(bool all)
+    {
+        // Note: the parallel loops below (and in the PNG writer) run while _stream_mutex is held and
+        //       may be entered from a tile task. Isolated, a thread waiting in them only takes their
+        //       own work, never another tile whose merge would stream and lock again.
+        tbb::this_task_arena::isolate([&]
+        {
+            const Vector2i extent = _cropped_pixel_bounds.Diagonal();
+            while (true)
+            {
+                // Note: a thread that finds another one streaming leaves its rows to it;
+                //       the streaming thread checks for new rows again after unlocking.
+                std::unique_lock<std::mutex> lock(_stream_mutex, std::defer_lock);
+                if (all)
+                    lock.lock();
+                else if (!lock.try_lock())
+                    return;
+
+                int end = _next_row;
+                while (end < extent.y && (all || _row_pending[end] == 0))
+                    ++end;
+
+                // A band at a time, so that all = true does not resolve the whole image at once
+                std::vector<float> rgb;
+                std::vector<Byte> dst;
+                const float *thresholds = SRGB8Thresholds();
+                for (int y0 = _next_row; y0 < end;)
+                {
+                    int y1 = glm::min(end, (y0 / _band_rows + 1) * _band_rows);
+                    rgb.assign(3 * size_t(y1 - y0) * extent.x, 0.f);
+                    dst.resize(rgb.size());
+                    tbb::parallel_for(tbb::blocked_range<int>(y0, y1), [&](const tbb::blocked_range<int> &range)
+                    {
+                        for (int y = range.begin(); y != range.end(); ++y)
+                        {
+                            // Rows no tile reached stay black
+                            float *row = &rgb[3 * size_t(y - y0) * extent.x];
+                            if (const uint32_t *pixels = FindPixelRow(y))
+                                ResolveRow(pixels, nullptr, extent.x, 0.f, row);
+                            for (int i = 0; i < 3 * extent.x; ++i)
+                                dst[3 * size_t(y - y0) * extent.x + i] = ToSRGB8(row[i] * _scale, thresholds);
+                        }
+                    });
+
+                    if (_float_stream.IsOpen())
+                        _float_stream.WriteRows(y0, y1 - y0, rgb.data());
+                    if (_png_stream.IsOpen())
+                        _png_stream.WriteRows(dst.data(), y1 - y0);
+
+                    if (y1 % _band_rows == 0 || y1 == extent.y)
+                        ReleaseBands(y0 / _band_rows, (y1 + _band_rows - 1) / _band_rows);
+                    y0 = y1;
+                }
+                _next_row = end;
+                lock.unlock();
+
+                if (all || end >= extent.y || _row_pending[end] != 0)
+                    return;
+            }
+        });
     }
 
     void Film::MergeFilmTile(std::unique_ptr<FilmTile> tile)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        for (Vector2i pixel : tile->getPixelBounds())
+        const Bounds2i bounds = tile->getPixelBounds();
+        const int width = bounds._p_max.x - bounds._p_min.x;
+        if (width <= 0 || bounds._p_max.y <= bounds._p_min.y)
+            return;
+
+        // Note: convert the tile to XYZ before taking any lock,
+        //       the critical section only contains the additions.
+        const int cropWidth = _cropped_pixel_bounds._p_max.x - _cropped_pixel_bounds._p_min.x;
+        float *xyz = ALLOCA(float, 3 * width);
+        float *weights = ALLOCA(float, width);
+        for (int y = bounds._p_min.y; y < bounds._p_max.y; ++y)
         {
-            // Merge _pixel_ into _Film::pixels_
-            const FilmTilePixel &tilePixel = tile->getPixel(pixel);
-            Pixel &mergePixel = GetPixel(pixel);
-            float xyz[3];
-            tilePixel.m_contribSum.toXYZ(xyz);
-            for (int i = 0; i < 3; ++i)
+            for (int x = bounds._p_min.x; x < bounds._p_max.x; ++x)
+                tile->getPixel(Vector2i(x, y)).m_contribSum.toXYZ(&xyz[3 * (x - bounds._p_min.x)]);
+
+            tbb::spin_mutex::scoped_lock lock(_row_mutexes[y - _cropped_pixel_bounds._p_min.y]);
+            const int offset = (y - _cropped_pixel_bounds._p_min.y) * cropWidth + (bounds._p_min.x - _cropped_pixel_bounds._p_min.x);
+            uint32_t *row = GetPixelRow(y - _cropped_pixel_bounds._p_min.y) + size_t(bounds._p_min.x - _cropped_pixel_bounds._p_min.x) * _pixel_words;
+            const FilmTilePixel *tileRow = &tile->getPixel(Vector2i(bounds._p_min.x, y));
+            for (int i = 0; i < width; ++i)
             {
-                mergePixel._xyz[i] += xyz[i];
+                // Merge _pixel_ into _Film::pixels_
+                uint32_t *words = row + size_t(i) * _pixel_words;
+                Pixel pixel = LoadPixel(words);
+                pixel._xyz[0] += xyz[3 * i + 0];
+                pixel._xyz[1] += xyz[3 * i + 1];
+                pixel._xyz[2] += xyz[3 * i + 2];
+                pixel._filter_weight_sum += tileRow[i].m_filterWeightSum;
+                StorePixel(words, pixel);
+
+                // Keep the merged sums, the live framebuffer is updated once the lock is released
+                xyz[3 * i + 0] = pixel._xyz[0];
+                xyz[3 * i + 1] = pixel._xyz[1];
+                xyz[3 * i + 2] = pixel._xyz[2];
+                weights[i] = pixel._filter_weight_sum;
+            }
+            if (_sample_counts)
+            {
+                for (int i = 0; i < width; ++i)
+                    _sample_counts[offset + i] += tileRow[i].m_sampleCount;
+            }
+
+            if (!tile->m_aovs.empty())
+            {
+                const int stride = _aov_layout.stride;
+                float *aovRow = &_aov_pixels[offset * stride];
+                const float *tileAOVRow = &tile->m_aovs[(y - bounds._p_min.y) * width * stride];
+                for (int i = 0; i < width * stride; ++i)
+                    aovRow[i] += tileAOVRow[i];
+            }
+            lock.release();
+
+            // Note: tiles overlapping through the filter may publish these pixels in any order,
+            //       a stale preview pixel is refreshed by the next merge or image write.
+            if (_live.IsOpen())
+            {
+                float *live = _live.GetRow(y - _cropped_pixel_bounds._p_min.y) + 3 * (bounds._p_min.x - _cropped_pixel_bounds._p_min.x);
+                for (int i = 0; i < width; ++i)
+                {
+                    float invWt = weights[i] != 0 ? 1 / weights[i] : 0.f;
+                    XYZToRGB(&xyz[3 * i], &live[3 * i]);
+                    for (int c = 0; c < 3; ++c)
+                        live[3 * i + c] = glm::max(0.f, live[3 * i + c] * invWt);
+                }
             }
-            mergePixel._filter_weight_sum += tilePixel.m_filterWeightSum;
+        }
+
+        if (_live.IsOpen())
+        {
+            _live.GetHeader()->passTilesDone.fetch_add(1, std::memory_order_relaxed);
+            _live.Publish();
+        }
+
+        if (_row_pending)
+        {
+            bool finished = false;
+            for (int y = bounds._p_min.y; y < bounds._p_max.y; ++y)
+                finished |= _row_pending[y - _cropped_pixel_bounds._p_min.y].fetch_sub(1) == 1;
+            if (finished)
+                StreamRows(false);
+        }
+    }
+
+    void Film::ResolveRow(const uint32_t *row, const std::atomic<float> *splats, int width, float splatScale, float *rgb) const
+    {
+        // Note: gather the row into planes first, so that the color matrix and the
+        //       normalization are plain loops over contiguous floats the compiler vectorizes
+        thread_local std::vector<float> planeBuffer;
+        planeBuffer.resize(8 * size_t(width));
+        float *planes = planeBuffer.data();
+        float *X = planes, *Y = planes + width, *Z = planes + 2 * width;
+        float *sX = planes + 3 * width, *sY = planes + 4 * width, *sZ = planes + 5 * width;
+        float *invWt = planes + 6 * width, *lower = planes + 7 * width;
+        for (int x = 0; x < width; ++x)
+        {
+            Pixel pixel = LoadPixel(row + size_t(x) * _pixel_words);
+            X[x] = pixel._xyz[0];
+            Y[x] = pixel._xyz[1];
+            Z[x] = pixel._xyz[2];
+            sX[x] = splats ? splats[3 * x + 0].load(std::memory_order_relaxed) : 0.f;
+            sY[x] = splats ? splats[3 * x + 1].load(std::memory_order_relaxed) : 0.f;
+            sZ[x] = splats ? splats[3 * x + 2].load(std::memory_order_relaxed) : 0.f;
+
+            // Pixels without samples are neither normalized nor clamped
+            float filterWeightSum = pixel._filter_weight_sum;
+            invWt[x] = filterWeightSum != 0 ? 1 / filterWeightSum : 1.f;
+            lower[x] = filterWeightSum != 0 ? 0.f : -Infinity;
+        }
+
+        // Convert pixel XYZ color to RGB, normalize with the weight sum and add the splats
+        for (int x = 0; x < width; ++x)
+        {
+            float r = glm::max(lower[x], (3.240479f * X[x] - 1.537150f * Y[x] - 0.498535f * Z[x]) * invWt[x]);
+            float g = glm::max(lower[x], (-0.969256f * X[x] + 1.875991f * Y[x] + 0.041556f * Z[x]) * invWt[x]);
+            float b = glm::max(lower[x], (0.055648f * X[x] - 0.204043f * Y[x] + 1.057311f * Z[x]) * invWt[x]);
+            rgb[3 * x + 0] = r + splatScale * (3.240479f * sX[x] - 1.537150f * sY[x] - 0.498535f * sZ[x]);
+            rgb[3 * x + 1] = g + splatScale * (-0.969256f * sX[x] + 1.875991f * sY[x] + 0.041556f * sZ[x]);
+            rgb[3 * x + 2] = b + splatScale * (0.055648f * sX[x] - 0.204043f * sY[x] + 1.057311f * sZ[x]);
         }
     }
 
     void Film::WriteImageToFile(float splatScale)
     {
+        if (_out_of_core)
+        {
+            // Every row has been streamed when all tiles were merged, unless some were skipped
+            if (!_row_pending)
+            {
+                LOG(ERROR) << "No tiles were announced to the out-of-core film, nothing to write";
+                return;
+            }
+            StreamRows(true);
+            if (_float_stream.IsOpen())
+                _float_stream.Close();
+            if (_png_stream.IsOpen() && !_png_stream.Close())
+                LOG(ERROR) << "Failed to write " << _filename;
+            LOG(INFO) << "Finished streaming image " << _filename;
+            return;
+        }
+
         LOG(INFO) << "Converting image to RGB and computing final weighted pixel values";
-        std::unique_ptr<float[]> rgb(new float[3 * _cropped_pixel_bounds.Area()]);
-        std::unique_ptr<Byte[]> dst(new Byte[3 * _cropped_pixel_bounds.Area()]);
-        int offset = 0;
-        for (Vector2i p : _cropped_pixel_bounds)
+        const Vector2i extent = _cropped_pixel_bounds.Diagonal();
+        const int nPixels = _cropped_pixel_bounds.Area();
+        std::vector<float> rgb(3 * size_t(nPixels));
+        const std::atomic<float> *splats = _splats.load(std::memory_order_acquire);
+        tbb::parallel_for(tbb::blocked_range<int>(0, extent.y, 8), [&](const tbb::blocked_range<int> &range)
         {
-            // Convert pixel XYZ color to RGB
-            Pixel &pixel = GetPixel(p);
-            XYZToRGB(pixel._xyz, &rgb[3 * offset]);
+            for (int y = range.begin(); y != range.end(); ++y)
+                ResolveRow(FindPixelRow(y), splats ? &splats[3 * size_t(y) * extent.x] : nullptr, extent.x, splatScale,
+                           &rgb[3 * size_t(y) * extent.x]);
+        });
 
-            // Normalize pixel with weight sum
-            float filterWeightSum = pixel._filter_weight_sum;
-            if (filterWeightSum != 0)
+        if (_denoiser)
+        {
+            GuideBuffers guides;
+            if (GetGuideBuffers(guides))
             {
-                float invWt = (float)1 / filterWeightSum;
-                rgb[3 * offset + 0] = glm::max((float)0, rgb[3 * offset + 0] * invWt);
-                rgb[3 * offset + 1] = glm::max((float)0, rgb[3 * offset + 1] * invWt);
-                rgb[3 * offset + 2] = glm::max((float)0, rgb[3 * offset + 2] * invWt);
+                LOG(INFO) << "Denoising image";
+                _denoiser->Denoise(rgb.data(), guides);
             }
+            else
+                LOG(WARNING) << "No guide buffers were recorded, the image is written without denoising";
+        }
 
-            // Add splat value at pixel
-            float splatRGB[3];
-            float splatXYZ[3] = {pixel._splatXYZ[0], pixel._splatXYZ[1], pixel._splatXYZ[2]};
-            XYZToRGB(splatXYZ, splatRGB);
-            rgb[3 * offset + 0] += splatScale * splatRGB[0];
-            rgb[3 * offset + 1] += splatScale * splatRGB[1];
-            rgb[3 * offset + 2] += splatScale * splatRGB[2];
+        if (_live.IsOpen())
+        {
+            tbb::parallel_for(tbb::blocked_range<int>(0, extent.y, 16), [&](const tbb::blocked_range<int> &range)
+            {
+                for (int y = range.begin(); y != range.end(); ++y)
+                    std::memcpy(_live.GetRow(y), &rgb[3 * size_t(y) * extent.x], 3 * sizeof(float) * extent.x);
+            });
+            _live.Publish();
+        }
+
+        std::vector<FloatImage> aovs;
+        if (RecordsAOVs())
+            CollectAOVs(aovs);
+
+        // Note: everything below only reads the snapshots owned by the job, so
+        //       rendering may go on (and even write to the film) while it runs
+        WaitForWrites();
+        std::string filename = _filename, floatFormat = _float_format;
+        float scale = _scale;
+        auto write = [extent, filename, floatFormat, scale, rgb = std::move(rgb), aovs = std::move(aovs)]()
+        {
+            if (!floatFormat.empty())
+            {
+                std::string floatFilename = SiblingFilename(filename, "", floatFormat);
+                LOG(INFO) << "Writing linear image " << floatFilename;
+                WriteFloatImage(floatFilename, extent.x, extent.y, 3, rgb.data());
+            }
 
             // Scale pixel value by _scale_
-            rgb[3 * offset + 0] *= _scale;
-            rgb[3 * offset + 1] *= _scale;
-            rgb[3 * offset + 2] *= _scale;
+            std::unique_ptr<Byte[]> dst(new Byte[rgb.size()]);
+            const float *thresholds = SRGB8Thresholds();
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, rgb.size(), 1 << 14), [&](const tbb::blocked_range<size_t> &range)
+            {
+                for (size_t i = range.begin(); i != range.end(); ++i)
+                    dst[i] = ToSRGB8(rgb[i] * scale, thresholds);
+            });
+
+            LOG(INFO) << "Writing image " << filename << " (" << extent.x << "x" << extent.y << ")";
+            if (!WritePNG(filename, extent.x, extent.y, 3, dst.get()))
+                LOG(ERROR) << "Failed to write " << filename;
+
+            for (const FloatImage &image : aovs)
+            {
+                LOG(INFO) << "Writing AOV " << image.filename;
+                WriteFloatImage(image.filename, image.width, image.height, image.channels, image.data.data());
+            }
+        };
+
+        if (_async_write)
+            _pending_write = std::async(std::launch::async, std::move(write));
+        else
+            write();
+    }
+
+    void Film::WaitForWrites()
+    {
+        if (_pending_write.valid())
+            _pending_write.get();
+    }
+
+    void Film::ReportProgress(int64_t samplesDone, int64_t passSamples, int64_t totalSamples, int passTiles,
+                              LiveFramebufferHeader::ProgressUnit unit)
+    {
+        if (!_live.IsOpen())
+            return;
+        LiveFramebufferHeader *header = _live.GetHeader();
+        header->samplesDone = samplesDone;
+        header->passSamples = passSamples;
+        header->totalSamples = totalSamples;
+        header->passTilesDone = 0;
+        header->passTiles = passTiles;
+        header->progressUnit = unit;
+        header->state = LiveFramebufferHeader::Rendering;
+        _live.Publish();
+    }
+
+    void Film::MarkFinished()
+    {
+        if (!_live.IsOpen())
+            return;
+        LiveFramebufferHeader *header = _live.GetHeader();
+        header->samplesDone = header->samplesDone + header->passSamples;
+        header->passSamples = 0;
+        header->passTilesDone = 0;
+        header->passTiles = 0;
+        header->state = LiveFramebufferHeader::Finished;
+        _live.Publish();
+    }
+
+    bool Film::GetGuideBuffers(GuideBuffers &guides) const
+    {
+        Vector2i extent = _cropped_pixel_bounds.Diagonal();
+        int nPixels = _cropped_pixel_bounds.Area();
+        guides.width = extent.x;
+        guides.height = extent.y;
+        for (int c = 0; c < 3; ++c)
+        {
+            guides.albedo[c].assign(nPixels, 1.f);
+            guides.normal[c].assign(nPixels, 0.f);
+        }
+        guides.depth.assign(nPixels, 0.f);
+        if (!_aov_layout.HasFeatures())
+            return false;
+
+        const int albedo = _aov_layout.offset[(int)AOVType::Albedo];
+        const int normal = _aov_layout.offset[(int)AOVType::Normal];
+        const int depth = _aov_layout.offset[(int)AOVType::Depth];
+        bool recorded = false;
+        for (int i = 0; i < nPixels; ++i)
+        {
+            const float *record = &_aov_pixels[i * _aov_layout.stride];
+            if (record[0] == 0)
+                continue;
+            recorded = true;
+            float invWeight = 1 / record[0];
+            for (int c = 0; c < 3; ++c)
+            {
+                if (albedo >= 0)
+                    guides.albedo[c][i] = record[albedo + c] * invWeight;
+                if (normal >= 0)
+                    guides.normal[c][i] = record[normal + c] * invWeight;
+            }
+            if (depth >= 0)
+                guides.depth[i] = record[depth] * invWeight;
+        }
+        return recorded;
+    }
+
+    void Film::CollectAOVs(std::vector<FloatImage> &images) const
+    {
+        const Vector2i extent = _cropped_pixel_bounds.Diagonal();
+        const int nPixels = _cropped_pixel_bounds.Area();
+        for (int type = 0; type < (int)AOVType::Count; ++type)
+        {
+            const int offset = _aov_layout.offset[type];
+            if (!_aov_output[type] || offset < 0)
+                continue;
+
+            const bool feature = type == (int)AOVType::Albedo || type == (int)AOVType::Normal || type == (int)AOVType::Depth;
+            const int channels = AOVChannels(AOVType(type));
+            const int layers = type == (int)AOVType::Lights ? _aov_layout.numLights : 1;
+            for (int layer = 0; layer < layers; ++layer)
+            {
+                FloatImage image;
+                image.width = extent.x;
+                image.height = extent.y;
+                image.channels = channels;
+                image.data.assign(nPixels * channels, 0.f);
+                for (int i = 0; i < nPixels; ++i)
+                {
+                    const float *record = &_aov_pixels[i * _aov_layout.stride];
+                    float weight = feature ? record[0] : record[1];
+                    if (weight == 0)
+                        continue;
+                    for (int c = 0; c < channels; ++c)
+                        image.data[i * channels + c] = record[offset + layer * channels + c] / weight;
+                }
+
+                std::string name = AOVName(AOVType(type));
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                if (type == (int)AOVType::Lights)
+                    name = "light" + std::to_string(layer);
+                image.filename = SiblingFilename(_filename, name, _float_format.empty() ? "pfm" : _float_format);
+                images.push_back(std::move(image));
+            }
+        }
+    }
+
+    void Film::EnableSampleCounts()
+    {
+        if (_out_of_core)
+        {
+            LOG(WARNING) << "An out-of-core film does not count samples per pixel";
+            return;
+        }
+        if (!_sample_counts)
+            _sample_counts.reset(new uint32_t[_cropped_pixel_bounds.Area()]());
+    }
+
+    void Film::EnableProgressive()
+    {
+        if (_storage == FilmStorage::Float)
+            return;
+        LOG(WARNING) << "Compact film storage would round the pixels again after every pass, "
+                        "progressive rendering and checkpoints store them as floats";
+        SetStorage(FilmStorage::Float);
+    }
+
+    void Film::SetStorage(FilmStorage storage)
+    {
+        // Note: with negative filter lobes the weight sum of a partially merged pixel can be close to 0
+        //       or below (filter importance sampling gives such samples the weight -1), the mean kept
+        //       by the compact layouts would overflow or be clamped for good.
+        const float *table = _filter_table;
+        if (storage != FilmStorage::Float && *std::min_element(table, table + filter_table_width * filter_table_width) < 0)
+        {
+            LOG(WARNING) << "The filter has negative lobes, the film pixels are stored as floats";
+            storage = FilmStorage::Float;
+        }
+        _storage = storage;
+        _pixel_words = PixelWords(storage);
+        if (_out_of_core)
+            ReleaseBands(0, (_cropped_pixel_bounds.Diagonal().y + _band_rows - 1) / _band_rows);
+        else
+            _pixels.reset(new uint32_t[size_t(_cropped_pixel_bounds.Area()) * _pixel_words]());
+        LOG(INFO) << "Film pixels take " << 4 * _pixel_words << " bytes each";
+    }
 
-#define TO_BYTE(v) (uint8_t) clamp(255.f * gammaCorrect(v) + 0.5f, 0.f, 255.f)
-            dst[3 * offset + 0] = TO_BYTE(rgb[3 * offset + 0]);
-            dst[3 * offset + 1] = TO_BYTE(rgb[3 * offset + 1]);
-            dst[3 * offset + 2] = TO_BYTE(rgb[3 * offset + 2]);
+    double Film::GetMeanSampleCount() const
+    {
+        int nPixels = _cropped_pixel_bounds.Area();
+        if (!_sample_counts || nPixels == 0)
+            return 0.0;
+        uint64_t total = 0;
+        for (int i = 0; i < nPixels; ++i)
+            total += _sample_counts[i];
+        return double(total) / nPixels;
+    }
 
-            ++offset;
+    void Film::WriteSampleCountImage() const
+    {
+        if (!_sample_counts)
+        {
+            LOG(WARNING) << "Samples per pixel were not counted, no sample count image is written";
+            return;
         }
 
-        LOG(INFO) << "Writing image " << _filename << " with bounds " << _cropped_pixel_bounds;
+        int nPixels = _cropped_pixel_bounds.Area();
+        uint32_t maxCount = 1;
+        for (int i = 0; i < nPixels; ++i)
+            maxCount = glm::max(maxCount, _sample_counts[i]);
+
+        std::unique_ptr<Byte[]> dst(new Byte[nPixels]);
+        for (int i = 0; i < nPixels; ++i)
+            dst[i] = (Byte)clamp(255.f * _sample_counts[i] / maxCount + 0.5f, 0.f, 255.f);
+
+        // cornellBox.png -> cornellBox_spp.png
+        std::string filename = _filename;
+        size_t dot = filename.find_last_of('.');
+        filename.insert(dot == std::string::npos ? filename.size() : dot, "_spp");
+
+        LOG(INFO) << "Writing sample count image " << filename << " (max " << maxCount << " samples per pixel)";
         auto extent = _cropped_pixel_bounds.Diagonal();
-        stbi_write_png(_filename.c_str(),
-                       extent.x,
-                       extent.y,
-                       3,
-                       static_cast<void *>(dst.get()),
-                       extent.x * 3);
+        WritePNG(filename, extent.x, extent.y, 1, dst.get());
     }
 
     void Film::SetImage(const Spectrum *img) const
     {
+        if (_out_of_core)
+        {
+            LOG(ERROR) << "An out-of-core film cannot take a whole image";
+            return;
+        }
+
         int nPixels = _cropped_pixel_bounds.Area();
         for (int i = 0; i < nPixels; ++i)
         {
-            Pixel &p = _pixels[i];
-            img[i].toXYZ(p._xyz);
-            p._filter_weight_sum = 1;
-            p._splatXYZ[0] = p._splatXYZ[1] = p._splatXYZ[2] = 0;
+            Pixel pixel;
+            img[i].toXYZ(pixel._xyz);
+            pixel._filter_weight_sum = 1;
+            StorePixel(&_pixels[size_t(i) * _pixel_words], pixel);
+            if (_sample_counts)
+                _sample_counts[i] = 1;
         }
+        if (std::atomic<float> *splats = _splats.load())
+            std::fill(splats, splats + 3 * size_t(nPixels), 0.f);
     }
 
     void Film::AddSplat(const Vector2f &p, Spectrum v)
@@ -184,6 +930,13 @@ namespace platinum
         // Note:Rather than computing the final pixel value as a weighted
         //      average of contributing splats, splats are simply summed.
 
+        if (_out_of_core)
+        {
+            if (!_dropped_splats.exchange(true))
+                LOG(ERROR) << "Splats land anywhere on the image and are dropped by an out-of-core film";
+            return;
+        }
+
         if (v.hasNaNs())
         {
             LOG(ERROR) << StringPrintf("Ignoring splatted spectrum with NaN values "
@@ -218,23 +971,171 @@ namespace platinum
         float xyz[3];
         v.toXYZ(xyz);
 
-        Pixel &pixel = GetPixel(pi);
+        int width = _cropped_pixel_bounds._p_max.x - _cropped_pixel_bounds._p_min.x;
+        size_t index = (pi.x - _cropped_pixel_bounds._p_min.x) + size_t(pi.y - _cropped_pixel_bounds._p_min.y) * width;
+        std::atomic<float> *splat = GetSplats() + 3 * index;
         for (int i = 0; i < 3; ++i)
         {
-            pixel._splatXYZ[i].add(xyz[i]);
+            float sum = splat[i].load(std::memory_order_relaxed);
+            while (!splat[i].compare_exchange_weak(sum, sum + xyz[i], std::memory_order_relaxed))
+                ;
         }
     }
 
-    void Film::Clear()
+    std::atomic<float> *Film::GetSplats()
     {
-        for (Vector2i p : _cropped_pixel_bounds)
+        std::atomic<float> *splats = _splats.load(std::memory_order_acquire);
+        if (!splats)
         {
-            Pixel &pixel = GetPixel(p);
-            for (int c = 0; c < 3; ++c)
+            std::lock_guard<std::mutex> lock(_splat_mutex);
+            splats = _splats.load(std::memory_order_relaxed);
+            if (!splats)
             {
-                pixel._splatXYZ[c] = pixel._xyz[c] = 0;
+                splats = new std::atomic<float>[3 * size_t(_cropped_pixel_bounds.Area())]();
+                _splats.store(splats, std::memory_order_release);
             }
-            pixel._filter_weight_sum = 0;
+        }
+        return splats;
+    }
+
+    void Film::WriteCheckpoint(std::ostream &out) const
+    {
+        if (_out_of_core)
+        {
+            LOG(ERROR) << "An out-of-core film cannot be checkpointed";
+            return;
+        }
+
+        const std::atomic<float> *splats = _splats.load(std::memory_order_acquire);
+        int32_t bounds[4] = {_cropped_pixel_bounds._p_min.x, _cropped_pixel_bounds._p_min.y,
+                             _cropped_pixel_bounds._p_max.x, _cropped_pixel_bounds._p_max.y};
+        out.write(reinterpret_cast<const char *>(bounds), sizeof(bounds));
+
+        // Note: one record of 8 plain 32-bit values per pixel (XYZ and filter weight sums, splats,
+        //       sample count) whatever the storage, buffers that were never allocated write zeros.
+        constexpr int rowChunk = 64;
+        int width = _cropped_pixel_bounds.Diagonal().x;
+        int nPixels = _cropped_pixel_bounds.Area();
+        std::vector<float> buffer(8 * width * rowChunk);
+        for (int first = 0; first < nPixels; first += width * rowChunk)
+        {
+            int count = glm::min(width * rowChunk, nPixels - first);
+            for (int i = 0; i < count; ++i)
+            {
+                const size_t index = size_t(first + i);
+                const Pixel pixel = LoadPixel(&_pixels[index * _pixel_words]);
+                float *record = &buffer[8 * i];
+                record[0] = pixel._xyz[0];
+                record[1] = pixel._xyz[1];
+                record[2] = pixel._xyz[2];
+                record[3] = pixel._filter_weight_sum;
+                for (int c = 0; c < 3; ++c)
+                    record[4 + c] = splats ? splats[3 * index + c].load(std::memory_order_relaxed) : 0.f;
+                record[7] = bitsToFloat(_sample_counts ? _sample_counts[index] : 0u);
+            }
+            out.write(reinterpret_cast<const char *>(buffer.data()), 8 * sizeof(float) * count);
+        }
+
+        // The AOV records follow with their layout, the feature guides are only recorded during
+        // the first samples and could not be recovered after resuming
+        int32_t layout[2 + (int)AOVType::Count] = {_aov_layout.stride, _aov_layout.numLights};
+        std::copy(_aov_layout.offset, _aov_layout.offset + (int)AOVType::Count, layout + 2);
+        out.write(reinterpret_cast<const char *>(layout), sizeof(layout));
+        if (_aov_pixels)
+            out.write(reinterpret_cast<const char *>(_aov_pixels.get()), sizeof(float) * size_t(nPixels) * _aov_layout.stride);
+    }
+
+    bool Film::ReadCheckpoint(std::istream &in)
+    {
+        if (_out_of_core)
+            return false;
+
+        int32_t bounds[4];
+        in.read(reinterpret_cast<char *>(bounds), sizeof(bounds));
+        if (!in || bounds[0] != _cropped_pixel_bounds._p_min.x || bounds[1] != _cropped_pixel_bounds._p_min.y ||
+            bounds[2] != _cropped_pixel_bounds._p_max.x || bounds[3] != _cropped_pixel_bounds._p_max.y)
+            return false;
+
+        constexpr int rowChunk = 64;
+        int width = _cropped_pixel_bounds.Diagonal().x;
+        int nPixels = _cropped_pixel_bounds.Area();
+        std::vector<float> buffer(8 * width * rowChunk);
+        for (int first = 0; first < nPixels; first += width * rowChunk)
+        {
+            int count = glm::min(width * rowChunk, nPixels - first);
+            in.read(reinterpret_cast<char *>(buffer.data()), 8 * sizeof(float) * count);
+            if (!in)
+                return false;
+            for (int i = 0; i < count; ++i)
+            {
+                const size_t index = size_t(first + i);
+                const float *record = &buffer[8 * i];
+                Pixel pixel;
+                pixel._xyz[0] = record[0];
+                pixel._xyz[1] = record[1];
+                pixel._xyz[2] = record[2];
+                pixel._filter_weight_sum = record[3];
+                StorePixel(&_pixels[index * _pixel_words], pixel);
+                std::atomic<float> *splats = _splats.load();
+                if (!splats && (record[4] != 0 || record[5] != 0 || record[6] != 0))
+                    splats = GetSplats();
+                if (splats)
+                {
+                    for (int c = 0; c < 3; ++c)
+                        splats[3 * index + c].store(record[4 + c], std::memory_order_relaxed);
+                }
+                if (_sample_counts)
+                    _sample_counts[index] = floatToBits(record[7]);
+            }
+        }
+
+        int32_t layout[2 + (int)AOVType::Count];
+        in.read(reinterpret_cast<char *>(layout), sizeof(layout));
+        if (!in || layout[0] != _aov_layout.stride || layout[1] != _aov_layout.numLights ||
+            !std::equal(_aov_layout.offset, _aov_layout.offset + (int)AOVType::Count, layout + 2))
+            return false;
+        if (_aov_pixels)
+            in.read(reinterpret_cast<char *>(_aov_pixels.get()), sizeof(float) * size_t(nPixels) * _aov_layout.stride);
+        return bool(in);
+    }
+
+    float Film::GetPixelLuminance(const Vector2i &p) const
+    {
+        CHECK(InsideExclusive(p, _cropped_pixel_bounds));
+        // Rows out of memory (not rendered yet or already streamed) read as empty
+        const uint32_t *row = FindPixelRow(p.y - _cropped_pixel_bounds._p_min.y);
+        if (!row)
+            return 0.f;
+        const Pixel pixel = LoadPixel(row + size_t(p.x - _cropped_pixel_bounds._p_min.x) * _pixel_words);
+        if (pixel._filter_weight_sum == 0)
+            return 0.f;
+        return pixel._xyz[1] / pixel._filter_weight_sum;
+    }
+
+    void Film::Clear()
+    {
+        if (_out_of_core)
+        {
+            // Note: rows streamed already stay in the files, a new pass starts over with ExpectTiles()
+            ReleaseBands(0, (_cropped_pixel_bounds.Diagonal().y + _band_rows - 1) / _band_rows);
+            _row_pending.reset();
+            _next_row = 0;
+        }
+        else
+        {
+            const size_t nPixels = _cropped_pixel_bounds.Area();
+            std::fill(_pixels.get(), _pixels.get() + nPixels * _pixel_words, 0u);
+            if (std::atomic<float> *splats = _splats.load())
+                std::fill(splats, splats + 3 * nPixels, 0.f);
+            if (_sample_counts)
+                std::fill(_sample_counts.get(), _sample_counts.get() + nPixels, 0u);
+        }
+        if (_aov_pixels)
+            std::fill(_aov_pixels.get(), _aov_pixels.get() + size_t(_cropped_pixel_bounds.Area()) * _aov_layout.stride, 0.f);
+        if (_live.IsOpen())
+        {
+            std::fill(_live.GetRow(0), _live.GetRow(0) + 3 * size_t(_cropped_pixel_bounds.Area()), 0.f);
+            _live.Publish();
         }
     }
 }
\ No newline at end of file
@@ -9,7 +9,15 @@
 #include <core/spectrum.h>
 #include <math/bounds.h>
 #include <core/filter.h>
+#include <core/denoiser.h>
+#include <core/image_io.h>
+#include <core/live_framebuffer.h>
 #include <atomic>
+#include <future>
+#include <mutex>
+#include <tbb/spin_mutex.h>
+#include <vector>
+#include <iostream>
 
 namespace platinum
 {
@@ -45,6 +53,100 @@ namespace platinum
         std::atomic<uint32_t> bits;
     };
 
+    /**
+     * @brief Arbitrary output variables, written next to the image from the same camera samples.
+     *        Albedo, Normal and Depth are features of the camera ray's first hit (also the denoiser's
+     *        guides); Emission is the radiance emitted by the first hit, Direct the light sampled at the
+     *        first hit, Indirect everything else, and Lights splits Direct into one layer per light.
+     *        Integrators that do not separate their estimate report all of it as Indirect.
+     */
+    enum class AOVType
+    {
+        Albedo,
+        Normal,
+        Depth,
+        Emission,
+        Direct,
+        Indirect,
+        Lights,
+        Count
+    };
+
+    const char *AOVName(AOVType type);
+
+    /**
+     * @brief The AOV values of one camera sample, filled in by the integrator while tracing it.
+     */
+    struct AOVSample
+    {
+        Spectrum albedo = Spectrum(1.f);
+        Vector3f normal = Vector3f(0.f);
+        float depth = 0.f;
+        Spectrum emission = Spectrum(0.f);
+        Spectrum direct = Spectrum(0.f);
+        Spectrum indirect = Spectrum(0.f);
+        std::vector<std::pair<int, Spectrum>> lights; //(light index, direct contribution)
+
+        void Reset()
+        {
+            albedo = Spectrum(1.f);
+            normal = Vector3f(0.f);
+            depth = 0.f;
+            emission = direct = indirect = Spectrum(0.f);
+            lights.clear();
+        }
+
+        /**
+         * @brief Direct lighting from light _light_ at the first hit, adds to Direct as well.
+         */
+        void AddLight(int light, const Spectrum &L)
+        {
+            direct += L;
+            lights.emplace_back(light, L);
+        }
+    };
+
+    /**
+     * @brief Where each enabled AOV lives in the per-pixel float record. The record starts with the
+     *        number of samples that recorded features (Albedo, Normal, Depth) and the number of
+     *        samples that recorded radiance, the AOVs are averaged over these counts.
+     */
+    struct AOVLayout
+    {
+        AOVLayout() { std::fill(offset, offset + (int)AOVType::Count, -1); }
+
+        int offset[(int)AOVType::Count]; //-1 for disabled AOVs
+        int numLights = 0;
+        int stride = 0;
+
+        bool Enabled(AOVType type) const { return stride > 0 && offset[(int)type] >= 0; }
+
+        bool HasFeatures() const
+        {
+            return Enabled(AOVType::Albedo) || Enabled(AOVType::Normal) || Enabled(AOVType::Depth);
+        }
+    };
+
+    /**
+     * @brief How the film stores the accumulated pixels (the Storage option).
+     *        Float keeps the weighted XYZ sums and the filter weight sum, 16 bytes per pixel.
+     *        Half and RGB9E5 keep the weighted mean XYZ instead of the sums, as half floats
+     *        (12 bytes) or shared-exponent RGB9E5 (8 bytes) next to the float weight sum:
+     *        tiles accumulate in float and every merge flushes them into the compact value, the
+     *        mean stays within the encoded range however many samples are taken. Both round the
+     *        mean to about 3 significant digits, RGB9E5 clamps negative components to 0 and
+     *        the dim components of a pixel lose precision to the brightest one.
+     *        A render of many passes would round the mean again after each of them and drift,
+     *        so progressive rendering and checkpoints store floats, see Film::EnableProgressive().
+     *        Filters with negative lobes (e.g. Mitchell) need floats as well, see Film::SetStorage().
+     */
+    enum class FilmStorage
+    {
+        Float,
+        Half,
+        RGB9E5
+    };
+
     class Film : public Object
     {
     public:
@@ -54,8 +156,35 @@ namespace platinum
              std::unique_ptr<Filter> filter, const std::string &filename, float diagonal = 35.f,
              float scale = 1.f, float maxSampleLuminance = Infinity);
 
+        ~Film();
+
         void SetFilter(std::unique_ptr<Filter> filter) { _filter = std::move(filter); }
 
+        const Filter *GetFilter() const { return _filter.get(); }
+
+        /**
+         * @brief In filter importance sampling mode camera samples are distributed according to
+         *        the filter and every sample contributes to exactly one pixel (FilmTile::AddPixelSample),
+         *        hence film tiles do not overlap.
+         */
+        bool IsFilterImportanceSampling() const { return _filter_importance_sampling; }
+
+        /**
+         * @brief The integrator has to record an AOVSample per camera sample with FilmTile::AddAOVSample(),
+         *        because the film writes AOVs or needs the feature buffers as denoiser guides.
+         */
+        bool RecordsAOVs() const { return _aov_layout.stride > 0; }
+
+        const AOVLayout &GetAOVLayout() const { return _aov_layout; }
+
+        /**
+         * @brief Lay out the AOV buffers for a scene with numLights lights (one Lights layer each).
+         *        Clears the recorded AOVs.
+         */
+        void InitializeAOVs(int numLights);
+
+        void SetDenoiser(std::unique_ptr<Denoiser> denoiser);
+
         Bounds2i GetSampleBounds() const;
 
         const Vector2i GetResolution() const { return _resolution; }
@@ -63,16 +192,113 @@ namespace platinum
         std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds);
         void MergeFilmTile(std::unique_ptr<FilmTile> tile);
 
+        /**
+         * @brief In out-of-core mode (OutOfCore) only the bands of pixel rows that unmerged tiles still
+         *        touch are kept in memory. A row is resolved and streamed to the image files as soon as
+         *        the last tile covering it is merged, hence the integrator announces its tiles with
+         *        ExpectTiles(). Everything that needs the whole film (splats, AOVs, the denoiser,
+         *        the live framebuffer, progressive passes, checkpoints and SetImage()) is unavailable.
+         */
+        bool IsOutOfCore() const { return _out_of_core; }
+
+        /**
+         * @brief Announce the grid of tileSize x tileSize sample tiles over sampleBounds that is going
+         *        to be merged, and start streaming the image. Only used in out-of-core mode, where
+         *        the film takes a single pass.
+         */
+        void ExpectTiles(const Bounds2i &sampleBounds, int tileSize);
+
+        /**
+         * @brief Resolve the pixels to RGB and write the image (and the float image and AOVs if requested).
+         *        With AsyncWrite (the default) only the resolve runs here; quantization, PNG encoding
+         *        and the file writes run in the background on a snapshot, overlapping the next pass.
+         *        A write still in flight from the previous call is waited for first.
+         */
         void WriteImageToFile(float splatScale = 1);
 
+        /**
+         * @brief Block until the background write started by WriteImageToFile() is on disk.
+         */
+        void WaitForWrites();
+
+        /**
+         * @brief Update the progress in the live framebuffer (LiveFile), if any: samplesDone samples
+         *        per pixel are finished, a pass of passSamples over passTiles tiles starts now.
+         *        Integrators that render in iterations rather than samples per pixel pass their
+         *        iteration counts with unit Iterations.
+         */
+        void ReportProgress(int64_t samplesDone, int64_t passSamples, int64_t totalSamples, int passTiles,
+                            LiveFramebufferHeader::ProgressUnit unit = LiveFramebufferHeader::SamplesPerPixel);
+
+        /**
+         * @brief Tell the readers of the live framebuffer that rendering is over.
+         */
+        void MarkFinished();
+
+        /**
+         * @brief Write the number of camera samples taken per pixel as a grayscale image
+         *        (normalized by the maximum count), e.g. to inspect adaptive sampling.
+         */
+        void WriteSampleCountImage() const;
+
+        /**
+         * @brief The average number of camera samples taken per pixel, 0 if they were not counted.
+         */
+        double GetMeanSampleCount() const;
+
+        /**
+         * @brief Luminance of the current estimate at pixel p (accumulated Y over the filter
+         *        weight sum, splats ignored), or 0 if no sample has reached p yet.
+         */
+        float GetPixelLuminance(const Vector2i &p) const;
+
+        const Bounds2i &GetCroppedPixelBounds() const { return _cropped_pixel_bounds; }
+
         void SetImage(const Spectrum *img) const;
 
+        /**
+         * @brief Add an unweighted contribution to the pixel containing p. Safe to call from
+         *        any rendering thread, the splats are summed atomically.
+         */
         void AddSplat(const Vector2f &p, Spectrum v);
 
         void Clear();
 
         void Initialize();
 
+        /**
+         * @brief Count the camera samples taken per pixel, e.g. for WriteSampleCountImage().
+         *        The counts take 4 bytes per pixel and are not kept unless requested.
+         */
+        void EnableSampleCounts();
+
+        /**
+         * @brief The integrator accumulates several passes into the film (progressive rendering,
+         *        checkpoints). Compact storage would round the mean of every pixel once per pass and
+         *        drift away from the converged value, hence the pixels are stored as floats instead.
+         */
+        void EnableProgressive();
+
+        /**
+         * @brief Change the pixel layout, clears the accumulated pixels. Compact layouts fall back
+         *        to Float for a filter with negative lobes.
+         */
+        void SetStorage(FilmStorage storage);
+
+        FilmStorage GetStorage() const { return _storage; }
+
+        /**
+         * @brief Serialize the accumulation buffers (weighted XYZ sums, filter weight sums,
+         *        splats, per-pixel sample counts and AOV records) in a compact binary form.
+         */
+        void WriteCheckpoint(std::ostream &out) const;
+
+        /**
+         * @brief Restore the accumulation buffers written by WriteCheckpoint().
+         * @return false if the data is truncated or was written for different pixel bounds or AOVs
+         */
+        bool ReadCheckpoint(std::istream &in);
+
         virtual std::string ToString() const { return "Film"; }
 
     private:
@@ -80,26 +306,106 @@ namespace platinum
         //      and this is why we choose to use XYZ color herein.
         struct Pixel
         {
-            Pixel()
-            {
-                _xyz[0] = _xyz[1] = _xyz[2] = _filter_weight_sum = 0;
-            }
-
-            float _xyz[3];            //xyz color of the pixel
-            float _filter_weight_sum; //the sum of filter weight values
-            AtomicFloat _splatXYZ[3]; //unweighted sum of samples splats
-            float _pad;               //unused, ensure sizeof(Pixel) -> 32 bytes
+            float _xyz[3] = {0.f, 0.f, 0.f}; //xyz color of the pixel
+            float _filter_weight_sum = 0.f;  //the sum of filter weight values
         };
 
         Vector2i _resolution; //(width, height)
         std::string _filename;
-        std::unique_ptr<Pixel[]> _pixels;
+
+        //Note: a pixel takes _pixel_words 32-bit words in the _storage layout, read and
+        //      written as a Pixel with LoadPixel() and StorePixel(). Splats and sample counts
+        //      live in separate buffers that are only allocated when they are used.
+        FilmStorage _storage = FilmStorage::Float;
+        int _pixel_words = 4;
+        std::unique_ptr<uint32_t[]> _pixels;
+        std::atomic<std::atomic<float> *> _splats{nullptr}; //unweighted XYZ sums of the splats, see GetSplats()
+        std::unique_ptr<uint32_t[]> _sample_counts; //number of camera samples taken, see EnableSampleCounts()
+
+        Pixel LoadPixel(const uint32_t *words) const;
+
+        void StorePixel(uint32_t *words, const Pixel &pixel) const;
+
+        /**
+         * @brief The stored pixels of row y (relative to the crop window); for an out-of-core film
+         *        the band is allocated if needed.
+         */
+        uint32_t *GetPixelRow(int y);
+
+        /**
+         * @brief Row y, or nullptr if an out-of-core film does not hold it in memory
+         */
+        const uint32_t *FindPixelRow(int y) const;
 
         float _diagonal;
         Bounds2i _cropped_pixel_bounds; //actual rendering window
 
         std::unique_ptr<Filter> _filter;
-        std::mutex _mutex;
+        bool _filter_importance_sampling = false;
+
+        std::unique_ptr<Denoiser> _denoiser;
+
+        std::string _float_format; //"pfm" or "exr" to also write the linear image, empty for none
+
+        bool _aov_output[(int)AOVType::Count] = {}; //AOVs requested in the scene file
+        AOVLayout _aov_layout;
+        std::unique_ptr<float[]> _aov_pixels;       //_aov_layout.stride floats per pixel
+
+        /**
+         * @brief Normalize the feature AOVs. Returns false if no camera sample recorded them.
+         */
+        bool GetGuideBuffers(GuideBuffers &guides) const;
+
+        /**
+         * @brief Resolve every requested AOV to a float image named after the image, e.g. cornellBox_normal.pfm
+         */
+        void CollectAOVs(std::vector<FloatImage> &images) const;
+
+        //Note: with LiveFile set, the normalized pixels (without splats) are copied to a memory-mapped
+        //      file as each tile is merged, and the whole image every time it is written.
+        std::string _live_filename;
+        LiveFramebuffer _live;
+
+        bool _async_write = true;
+        std::future<void> _pending_write; //the background write of the last WriteImageToFile()
+
+        //Note: in out-of-core mode the pixels live in bands of _band_rows rows, allocated by the first
+        //      tile merged into the band and freed once all of its rows are streamed. _row_pending[y]
+        //      counts the tiles that row y still waits for, rows before _next_row are streamed.
+        bool _out_of_core = false;
+        int _band_rows = 16;
+        std::unique_ptr<std::atomic<uint32_t *>[]> _bands;
+        std::mutex _band_mutex;
+        std::unique_ptr<std::atomic<int>[]> _row_pending;
+        std::mutex _stream_mutex;
+        int _next_row = 0;
+        PNGWriter _png_stream;
+        FloatImageWriter _float_stream;
+        std::atomic<bool> _dropped_splats{false};
+
+        void ReleaseBands(int first, int last);
+
+        /**
+         * @brief Stream the finished rows following _next_row; all = true streams every remaining row
+         *        and waits for a concurrent call, otherwise the call returns if another thread streams.
+         */
+        void StreamRows(bool all);
+
+        /**
+         * @brief The pixels a tile over sampleBounds contributes to
+         */
+        Bounds2i GetTilePixelBounds(const Bounds2i &sampleBounds) const;
+
+        /**
+         * @brief Convert a row of pixels to RGB normalized by the filter weights, plus the splats
+         *        (none if splats is nullptr).
+         */
+        void ResolveRow(const uint32_t *row, const std::atomic<float> *splats, int width, float splatScale, float *rgb) const;
+
+        //Note: one lock per pixel row instead of a single film-wide mutex, so that
+        //      tiles in different rows (and the non-overlapping parts of neighbouring
+        //      tiles) are merged concurrently.
+        std::unique_ptr<tbb::spin_mutex[]> _row_mutexes;
 
         //Note: precomputed filter weights table
         static constexpr int filter_table_width = 16;
@@ -108,19 +414,27 @@ namespace platinum
         float _scale;
         float _max_sample_luminance;
 
-        Pixel &GetPixel(const Vector2i &p)
-        {
-            CHECK(InsideExclusive(p, _cropped_pixel_bounds));
-            int width = _cropped_pixel_bounds._p_max.x - _cropped_pixel_bounds._p_min.x;
-            int index = (p.x - _cropped_pixel_bounds._p_min.x) + (p.y - _cropped_pixel_bounds._p_min.y) * width;
-            return _pixels[index];
-        }
+        //Note: splats (e.g. light subpaths connected to the camera) land on arbitrary pixels and
+        //      rarely on the same one at the same time, so all threads add them to one XYZ buffer
+        //      with atomic floats; a buffer per thread would take a full frame per thread.
+        std::mutex _splat_mutex;
+
+        /**
+         * @brief The splat buffer, allocated by the first call
+         */
+        std::atomic<float> *GetSplats();
     };
 
     struct FilmTilePixel
     {
         Spectrum m_contribSum = 0.f;   //sum of the weighted spectrum contributions
         float m_filterWeightSum = 0.f; //sum of the filter weights
+
+        //Note: running statistics of the luminance of the samples taken at this pixel
+        //      (Welford's online algorithm), used by adaptive sampling.
+        uint32_t m_sampleCount = 0;
+        float m_lumMean = 0.f;
+        float m_lumM2 = 0.f;
     };
 
     class FilmTile final
@@ -128,13 +442,18 @@ namespace platinum
     public:
         // FilmTile Public Methods
         FilmTile(const Bounds2i &pixelBounds, const Vector2f &filterRadius, const float *filterTable,
-                 int filterTableSize, float maxSampleLuminance)
+                 int filterTableSize, float maxSampleLuminance, const AOVLayout *aovLayout = nullptr)
             : m_pixelBounds(pixelBounds), m_filterRadius(filterRadius),
               m_invFilterRadius(1 / filterRadius.x, 1 / filterRadius.y),
               m_filterTable(filterTable), m_filterTableSize(filterTableSize),
               m_maxSampleLuminance(maxSampleLuminance)
         {
             m_pixels = std::vector<FilmTilePixel>(glm::max(0, pixelBounds.Area()));
+            if (aovLayout && aovLayout->stride > 0)
+            {
+                m_aovLayout = *aovLayout;
+                m_aovs = std::vector<float>(m_pixels.size() * m_aovLayout.stride, 0.f);
+            }
         }
 
         void AddSample(const Vector2f &pFilm, Spectrum L, float sampleWeight = 1.f)
@@ -182,6 +501,98 @@ namespace platinum
             }
         }
 
+        /**
+         * @brief Filter importance sampling: the sample was drawn from the filter around pixel p,
+         *        so it only contributes to p with the given filter weight.
+         */
+        void AddPixelSample(const Vector2i &p, Spectrum L, float sampleWeight = 1.f, float filterWeight = 1.f)
+        {
+            if (!InsideExclusive(p, m_pixelBounds))
+                return;
+            if (L.y() > m_maxSampleLuminance)
+                L *= m_maxSampleLuminance / L.y();
+
+            FilmTilePixel &pixel = getPixel(p);
+            pixel.m_contribSum += L * sampleWeight * filterWeight;
+            pixel.m_filterWeightSum += filterWeight;
+        }
+
+        /**
+         * @brief Record the luminance of a camera sample taken at pixel p,
+         *        updating the pixel's running mean and variance.
+         */
+        void AddPixelStatistics(const Vector2i &p, float luminance)
+        {
+            if (!InsideExclusive(p, m_pixelBounds))
+                return;
+            FilmTilePixel &pixel = getPixel(p);
+            ++pixel.m_sampleCount;
+            float delta = luminance - pixel.m_lumMean;
+            pixel.m_lumMean += delta / pixel.m_sampleCount;
+            pixel.m_lumM2 += delta * (luminance - pixel.m_lumMean);
+        }
+
+        /**
+         * @brief Record the AOVs of a camera sample taken at pixel p, ignored unless the film
+         *        records AOVs. The features (Albedo, Normal, Depth) are only counted if hasFeatures.
+         */
+        void AddAOVSample(const Vector2i &p, const AOVSample &sample, bool hasFeatures)
+        {
+            if (m_aovs.empty() || !InsideExclusive(p, m_pixelBounds))
+                return;
+            int width = m_pixelBounds._p_max.x - m_pixelBounds._p_min.x;
+            float *record = &m_aovs[((p.x - m_pixelBounds._p_min.x) + (p.y - m_pixelBounds._p_min.y) * width) * m_aovLayout.stride];
+            const int *offset = m_aovLayout.offset;
+
+            auto add = [record](int offset, const float *v, int n)
+            {
+                if (offset >= 0)
+                    for (int i = 0; i < n; ++i)
+                        record[offset + i] += v[i];
+            };
+            if (hasFeatures)
+            {
+                record[0] += 1;
+                float albedo[3] = {sample.albedo[0], sample.albedo[1], sample.albedo[2]};
+                add(offset[(int)AOVType::Albedo], albedo, 3);
+                add(offset[(int)AOVType::Normal], &sample.normal[0], 3);
+                add(offset[(int)AOVType::Depth], &sample.depth, 1);
+            }
+            record[1] += 1;
+            float emission[3] = {sample.emission[0], sample.emission[1], sample.emission[2]};
+            float direct[3] = {sample.direct[0], sample.direct[1], sample.direct[2]};
+            float indirect[3] = {sample.indirect[0], sample.indirect[1], sample.indirect[2]};
+            add(offset[(int)AOVType::Emission], emission, 3);
+            add(offset[(int)AOVType::Direct], direct, 3);
+            add(offset[(int)AOVType::Indirect], indirect, 3);
+            if (offset[(int)AOVType::Lights] >= 0)
+            {
+                for (const auto &light : sample.lights)
+                {
+                    if (light.first < 0 || light.first >= m_aovLayout.numLights)
+                        continue;
+                    float L[3] = {light.second[0], light.second[1], light.second[2]};
+                    add(offset[(int)AOVType::Lights] + 3 * light.first, L, 3);
+                }
+            }
+        }
+
+        /**
+         * @brief Relative standard error of the pixel's mean luminance estimate.
+         *        Pixels outside the tile's pixel bounds (sample margin of the filter) report 0.
+         */
+        float RelativeError(const Vector2i &p) const
+        {
+            if (!InsideExclusive(p, m_pixelBounds))
+                return 0.f;
+            const FilmTilePixel &pixel = getPixel(p);
+            if (pixel.m_sampleCount < 2)
+                return Infinity;
+            float variance = pixel.m_lumM2 / (pixel.m_sampleCount - 1);
+            float stdError = glm::sqrt(variance / pixel.m_sampleCount);
+            return stdError / (glm::abs(pixel.m_lumMean) + 1e-4f);
+        }
+
         FilmTilePixel &getPixel(const Vector2i &p)
         {
             CHECK(InsideExclusive(p, m_pixelBounds));
@@ -206,6 +617,8 @@ namespace platinum
         const float *m_filterTable;
         const int m_filterTableSize;
         std::vector<FilmTilePixel> m_pixels;
+        AOVLayout m_aovLayout;
+        std::vector<float> m_aovs; //empty unless the film records AOVs
         const float m_maxSampleLuminance;
 
         friend class Film;
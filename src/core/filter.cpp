@@ -11,4 +11,38 @@ namespace platinum
         _inv_radius[1] = 1.f / _radius[1];
        
     }
+
+    void Filter::InitializeSampling()
+    {
+        if (_sampling_distribution)
+            return;
+
+        // Tabulate f over [-radius, radius]^2, the distribution is built from |f|
+        // so that filters with negative lobes (e.g. Mitchell) can be sampled as well.
+        _sampling_table.resize(sampling_table_width * sampling_table_width);
+        std::vector<float> absTable(_sampling_table.size());
+        for (int y = 0; y < sampling_table_width; ++y)
+        {
+            for (int x = 0; x < sampling_table_width; ++x)
+            {
+                Vector2f p(((x + 0.5f) / sampling_table_width * 2.f - 1.f) * _radius.x,
+                           ((y + 0.5f) / sampling_table_width * 2.f - 1.f) * _radius.y);
+                int offset = y * sampling_table_width + x;
+                _sampling_table[offset] = Evaluate(p);
+                absTable[offset] = glm::abs(_sampling_table[offset]);
+            }
+        }
+        _sampling_distribution.reset(new Distribution2D(absTable.data(), sampling_table_width, sampling_table_width));
+    }
+
+    Vector2f Filter::Sample(const Vector2f &u, float *weight) const
+    {
+        CHECK(_sampling_distribution != nullptr);
+        float pdf;
+        Vector2f p = _sampling_distribution->SampleContinuous(u, &pdf);
+        int x = glm::min(int(p.x * sampling_table_width), sampling_table_width - 1);
+        int y = glm::min(int(p.y * sampling_table_width), sampling_table_width - 1);
+        *weight = _sampling_table[y * sampling_table_width + x] < 0.f ? -1.f : 1.f;
+        return Vector2f((p.x * 2.f - 1.f) * _radius.x, (p.y * 2.f - 1.f) * _radius.y);
+    }
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include <core/utilities.h>
 #include <core/object.h>
+#include <core/sampler.h>
 
 namespace platinum
 {
@@ -20,7 +21,25 @@ namespace platinum
 
         virtual float Evaluate(const Vector2f &p) const = 0;
 
+        /**
+         * @brief Tabulate the filter over its support so that it can be importance sampled.
+         *        Must be called before Sample().
+         */
+        void InitializeSampling();
+
+        /**
+         * @brief Sample an offset from the pixel center with density proportional to |f|.
+         * @param weight the sign of the filter at the sampled offset, i.e. f/pdf up to the constant
+         *               integral of |f|, which cancels when the film normalizes by the weight sum
+         */
+        Vector2f Sample(const Vector2f &u, float *weight) const;
+
         Vector2f _radius, _inv_radius;
+
+    private:
+        static constexpr int sampling_table_width = 32;
+        std::vector<float> _sampling_table; //filter values at the cell centers, row major
+        std::unique_ptr<Distribution2D> _sampling_distribution;
     };
 }
 
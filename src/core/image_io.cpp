@@ -0,0 +1,773 @@
+
+
+#include <core/image_io.h>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <stb/stb_image_write.h>
+#include <tbb/parallel_for.h>
+
+// Compiled along with the rest of stb_image_write in film.cpp, but not declared in its header
+extern "C" unsigned char *stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+
+namespace platinum
+{
+    namespace
+    {
+        std::string Extension(const std::string &filename)
+        {
+            size_t dot = filename.find_last_of('.');
+            if (dot == std::string::npos)
+                return std::string();
+            std::string ext = filename.substr(dot + 1);
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            return ext;
+        }
+
+        template <typename T>
+        void WriteValue(std::ostream &out, const T &v)
+        {
+            out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+        }
+
+        template <typename T>
+        bool ReadValue(std::istream &in, T &v)
+        {
+            return bool(in.read(reinterpret_cast<char *>(&v), sizeof(T)));
+        }
+
+        void WriteAttribute(std::ostream &out, const char *name, const char *type, const void *value, int32_t size)
+        {
+            out.write(name, std::strlen(name) + 1);
+            out.write(type, std::strlen(type) + 1);
+            WriteValue(out, size);
+            out.write(static_cast<const char *>(value), size);
+        }
+
+        bool ReadString(std::istream &in, std::string &s)
+        {
+            s.clear();
+            char c;
+            while (in.get(c))
+            {
+                if (c == '\0')
+                    return true;
+                s.push_back(c);
+            }
+            return false;
+        }
+
+        uint32_t Crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+        {
+            static const std::array<uint32_t, 256> table = []
+            {
+                std::array<uint32_t, 256> t;
+                for (uint32_t n = 0; n < 256; ++n)
+                {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; ++k)
+                        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    t[n] = c;
+                }
+                return t;
+            }();
+            crc = ~crc;
+            for (size_t i = 0; i < size; ++i)
+                crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            return ~crc;
+        }
+
+        uint32_t Adler32(const uint8_t *data, size_t size)
+        {
+            uint32_t s1 = 1, s2 = 0;
+            while (size > 0)
+            {
+                size_t n = glm::min(size, size_t(5552));
+                for (size_t i = 0; i < n; ++i)
+                {
+                    s1 += data[i];
+                    s2 += s1;
+                }
+                s1 %= 65521;
+                s2 %= 65521;
+                data += n;
+                size -= n;
+            }
+            return (s2 << 16) | s1;
+        }
+
+        // Adler-32 of the concatenation of two blocks, the second one being length2 bytes long (from zlib)
+        uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, size_t length2)
+        {
+            const uint32_t base = 65521;
+            uint32_t rem = uint32_t(length2 % base);
+            uint32_t sum1 = adler1 & 0xffff;
+            uint32_t sum2 = uint32_t((uint64_t(rem) * sum1) % base);
+            sum1 += (adler2 & 0xffff) + base - 1;
+            sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+            if (sum1 >= base)
+                sum1 -= base;
+            if (sum1 >= base)
+                sum1 -= base;
+            if (sum2 >= (base << 1))
+                sum2 -= (base << 1);
+            if (sum2 >= base)
+                sum2 -= base;
+            return sum1 | (sum2 << 16);
+        }
+
+        /**
+         * @brief Bit position right after the end-of-block code of a raw deflate stream that consists
+         *        of a single block with fixed Huffman codes, as written by stbi_zlib_compress().
+         *        Returns 0 if the stream is malformed.
+         */
+        size_t FixedHuffmanBlockEnd(const uint8_t *data, size_t size)
+        {
+            static const int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            static const int distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+            const size_t nBits = 8 * size;
+            size_t pos = 3; //BFINAL and BTYPE
+            auto bit = [&]() -> uint32_t
+            {
+                uint32_t b = pos < nBits ? (data[pos >> 3] >> (pos & 7)) & 1 : 0;
+                ++pos;
+                return b;
+            };
+            // Note: Huffman codes are packed starting with their most significant bit
+            auto code = [&](int n)
+            {
+                uint32_t c = 0;
+                for (int i = 0; i < n; ++i)
+                    c = (c << 1) | bit();
+                return c;
+            };
+
+            while (pos < nBits)
+            {
+                uint32_t c = code(7);
+                int symbol;
+                if (c <= 23)
+                    symbol = 256 + c;
+                else
+                {
+                    c = (c << 1) | bit();
+                    if (c >= 48 && c <= 191)
+                        symbol = c - 48;
+                    else if (c >= 192 && c <= 199)
+                        symbol = 280 + (c - 192);
+                    else
+                        symbol = 144 + (((c << 1) | bit()) - 400);
+                }
+
+                if (symbol == 256)
+                    return pos <= nBits ? pos : 0;
+                if (symbol > 256)
+                {
+                    if (symbol > 285)
+                        return 0;
+                    pos += lengthExtra[symbol - 257];
+                    uint32_t distance = code(5);
+                    if (distance > 29)
+                        return 0;
+                    pos += distanceExtra[distance];
+                }
+            }
+            return 0;
+        }
+
+        // PNG filter type _type_ applied to one row, prev is the unfiltered row above or nullptr
+        void FilterRow(int type, const Byte *row, const Byte *prev, int bytesPerPixel, int rowBytes, Byte *out)
+        {
+            for (int i = 0; i < rowBytes; ++i)
+            {
+                int a = i >= bytesPerPixel ? row[i - bytesPerPixel] : 0;
+                int b = prev ? prev[i] : 0;
+                int c = prev && i >= bytesPerPixel ? prev[i - bytesPerPixel] : 0;
+                int predictor = 0;
+                switch (type)
+                {
+                case 1:
+                    predictor = a;
+                    break;
+                case 2:
+                    predictor = b;
+                    break;
+                case 3:
+                    predictor = (a + b) >> 1;
+                    break;
+                case 4:
+                {
+                    int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                    predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                    break;
+                }
+                default:
+                    break;
+                }
+                out[i] = Byte(row[i] - predictor);
+            }
+        }
+
+        void WriteChunk(std::ostream &out, const char *type, const uint8_t *data, size_t size)
+        {
+            uint8_t header[8] = {uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size),
+                                 uint8_t(type[0]), uint8_t(type[1]), uint8_t(type[2]), uint8_t(type[3])};
+            out.write(reinterpret_cast<const char *>(header), 8);
+            out.write(reinterpret_cast<const char *>(data), size);
+            uint32_t crc = Crc32(data, size, Crc32(header + 4, 4));
+            uint8_t trailer[4] = {uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc)};
+            out.write(reinterpret_cast<const char *>(trailer), 4);
+        }
+
+        constexpr int32_t ExrPixelHalf = 1;
+        constexpr int32_t ExrPixelFloat = 2;
+    }
+
+    bool WritePFM(const std::string &filename, int width, int height, int channels, const float *data)
+    {
+        FloatImageWriter writer;
+        return writer.Open(filename, width, height, channels, false) && writer.WriteRows(0, height, data) && writer.Close();
+    }
+
+    bool ReadPFM(const std::string &filename, int &width, int &height, int &channels, std::vector<float> &data)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            LOG(ERROR) << "Cannot open " << filename;
+            return false;
+        }
+        std::string magic;
+        float scale;
+        in >> magic >> width >> height >> scale;
+        in.get(); //single whitespace before the raster
+        if (!in || (magic != "PF" && magic != "Pf") || width <= 0 || height <= 0)
+        {
+            LOG(ERROR) << filename << " is not a valid PFM file";
+            return false;
+        }
+        if (scale > 0)
+        {
+            LOG(ERROR) << "Big endian PFM files are not supported: " << filename;
+            return false;
+        }
+        channels = magic == "PF" ? 3 : 1;
+        data.resize(size_t(width) * height * channels);
+        for (int y = height - 1; y >= 0; --y)
+            in.read(reinterpret_cast<char *>(&data[size_t(y) * width * channels]), sizeof(float) * width * channels);
+        if (!in)
+        {
+            LOG(ERROR) << "Truncated PFM file " << filename;
+            return false;
+        }
+        return true;
+    }
+
+    bool WriteEXR(const std::string &filename, int width, int height, int channels, const float *data)
+    {
+        FloatImageWriter writer;
+        return writer.Open(filename, width, height, channels, true) && writer.WriteRows(0, height, data) && writer.Close();
+    }
+
+    bool ReadEXR(const std::string &filename, int &width, int &height, int &channels, std::vector<float> &data)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            LOG(ERROR) << "Cannot open " << filename;
+            return false;
+        }
+
+        uint8_t magic[4];
+        int32_t version;
+        in.read(reinterpret_cast<char *>(magic), 4);
+        if (!in || magic[0] != 0x76 || magic[1] != 0x2f || magic[2] != 0x31 || magic[3] != 0x01 || !ReadValue(in, version))
+        {
+            LOG(ERROR) << filename << " is not an OpenEXR file";
+            return false;
+        }
+        if ((version & 0xff) != 2 || (version & ~0xff & ~0x400) != 0)
+        {
+            LOG(ERROR) << "Only single-part scanline OpenEXR files are supported: " << filename;
+            return false;
+        }
+
+        struct Channel
+        {
+            std::string name;
+            int32_t type;
+        };
+        std::vector<Channel> channelList;
+        int32_t window[4] = {0, 0, -1, -1};
+        uint8_t compression = 0xff;
+        std::string name, type;
+        while (ReadString(in, name) && !name.empty())
+        {
+            int32_t size;
+            if (!ReadString(in, type) || !ReadValue(in, size) || size < 0)
+                return false;
+            std::vector<char> value(size);
+            if (!in.read(value.data(), size))
+                return false;
+
+            if (name == "channels")
+            {
+                std::istringstream list(std::string(value.begin(), value.end()));
+                std::string channel;
+                while (ReadString(list, channel) && !channel.empty())
+                {
+                    int32_t info[4];
+                    list.read(reinterpret_cast<char *>(info), sizeof(info));
+                    channelList.push_back(Channel{channel, info[0]});
+                }
+            }
+            else if (name == "compression" && size == 1)
+                compression = uint8_t(value[0]);
+            else if (name == "dataWindow" && size == sizeof(window))
+                std::memcpy(window, value.data(), sizeof(window));
+        }
+        if (!in)
+        {
+            LOG(ERROR) << "Truncated OpenEXR header in " << filename;
+            return false;
+        }
+        if (compression != 0)
+        {
+            LOG(ERROR) << "Only uncompressed OpenEXR files are supported: " << filename;
+            return false;
+        }
+
+        width = window[2] - window[0] + 1;
+        height = window[3] - window[1] + 1;
+        if (width <= 0 || height <= 0 || channelList.empty())
+            return false;
+
+        // Map the stored channels to the interleaved output, anything else is skipped
+        int target[64];
+        int lineBytes = 0;
+        bool rgb = false;
+        for (const Channel &c : channelList)
+            rgb |= c.name == "R" || c.name == "G" || c.name == "B";
+        channels = rgb ? 3 : 1;
+        for (size_t i = 0; i < channelList.size() && i < 64; ++i)
+        {
+            const std::string &n = channelList[i].name;
+            target[i] = rgb ? (n == "R" ? 0 : n == "G" ? 1 : n == "B" ? 2 : -1) : (n == "Y" || i == 0 ? 0 : -1);
+            if (channelList[i].type != ExrPixelFloat && channelList[i].type != ExrPixelHalf)
+            {
+                LOG(ERROR) << "Unsupported pixel type of channel " << n << " in " << filename;
+                return false;
+            }
+            lineBytes += (channelList[i].type == ExrPixelFloat ? 4 : 2) * width;
+        }
+
+        std::vector<uint64_t> offsets(height);
+        in.read(reinterpret_cast<char *>(offsets.data()), sizeof(uint64_t) * height);
+        data.assign(size_t(width) * height * channels, 0.f);
+        std::vector<char> line(lineBytes);
+        for (int block = 0; block < height; ++block)
+        {
+            int32_t y, size;
+            in.seekg(std::streamoff(offsets[block]));
+            if (!ReadValue(in, y) || !ReadValue(in, size) || size != lineBytes || !in.read(line.data(), lineBytes))
+            {
+                LOG(ERROR) << "Corrupt scanline in " << filename;
+                return false;
+            }
+            y -= window[1];
+            if (y < 0 || y >= height)
+                continue;
+
+            const char *p = line.data();
+            float *row = &data[size_t(y) * width * channels];
+            for (size_t i = 0; i < channelList.size(); ++i)
+            {
+                bool isFloat = channelList[i].type == ExrPixelFloat;
+                for (int x = 0; x < width; ++x)
+                {
+                    float v;
+                    if (isFloat)
+                    {
+                        std::memcpy(&v, p, 4);
+                        p += 4;
+                    }
+                    else
+                    {
+                        uint16_t h;
+                        std::memcpy(&h, p, 2);
+                        v = halfToFloat(h);
+                        p += 2;
+                    }
+                    if (i < 64 && target[i] >= 0)
+                        row[x * channels + target[i]] = v;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool FloatImageWriter::Open(const std::string &filename, int width, int height, int channels)
+    {
+        std::string ext = Extension(filename);
+        if (ext != "exr" && ext != "pfm")
+        {
+            LOG(ERROR) << "Unknown float image format " << filename;
+            return false;
+        }
+        return Open(filename, width, height, channels, ext == "exr");
+    }
+
+    bool FloatImageWriter::Open(const std::string &filename, int width, int height, int channels, bool exr)
+    {
+        Close();
+        _out.open(filename, std::ios::binary | std::ios::trunc);
+        if (!_out)
+        {
+            LOG(ERROR) << "Cannot open " << filename << " for writing";
+            return false;
+        }
+        _exr = exr;
+        _width = width;
+        _height = height;
+        _channels = channels;
+
+        if (!exr)
+        {
+            // Note: PFM stores the rows bottom to top, the negative scale marks little endian data
+            _out << (channels == 1 ? "Pf" : "PF") << "\n"
+                 << width << " " << height << "\n"
+                 << "-1\n";
+            _data_offset = uint64_t(_out.tellp());
+        }
+        else
+        {
+            const uint8_t magic[4] = {0x76, 0x2f, 0x31, 0x01};
+            _out.write(reinterpret_cast<const char *>(magic), 4);
+            WriteValue(_out, int32_t(2)); //version 2, single-part scanline
+
+            // Note: the channel list has to be sorted by name, hence B, G, R
+            const char *names[3] = {"B", "G", "R"};
+            std::string channelList;
+            for (int i = 0; i < channels; ++i)
+            {
+                channelList += channels == 1 ? "Y" : names[i];
+                channelList.push_back('\0');
+                int32_t info[4] = {ExrPixelFloat, 0, 1, 1}; //type, pLinear + reserved, xSampling, ySampling
+                channelList.append(reinterpret_cast<const char *>(info), sizeof(info));
+            }
+            channelList.push_back('\0');
+            WriteAttribute(_out, "channels", "chlist", channelList.data(), int32_t(channelList.size()));
+
+            uint8_t compression = 0, lineOrder = 0;
+            int32_t window[4] = {0, 0, width - 1, height - 1};
+            float aspect = 1, screenCenter[2] = {0, 0}, screenWidth = 1;
+            WriteAttribute(_out, "compression", "compression", &compression, 1);
+            WriteAttribute(_out, "dataWindow", "box2i", window, sizeof(window));
+            WriteAttribute(_out, "displayWindow", "box2i", window, sizeof(window));
+            WriteAttribute(_out, "lineOrder", "lineOrder", &lineOrder, 1);
+            WriteAttribute(_out, "pixelAspectRatio", "float", &aspect, sizeof(float));
+            WriteAttribute(_out, "screenWindowCenter", "v2f", screenCenter, sizeof(screenCenter));
+            WriteAttribute(_out, "screenWindowWidth", "float", &screenWidth, sizeof(float));
+            _out.put('\0');
+
+            // One scanline per block: y, data size and the channels one after another.
+            // Uncompressed blocks have a fixed size, so the offsets are known up front.
+            const uint64_t blockBytes = 2 * sizeof(int32_t) + sizeof(float) * uint64_t(width) * channels;
+            _data_offset = uint64_t(_out.tellp()) + sizeof(uint64_t) * height;
+            for (int y = 0; y < height; ++y)
+                WriteValue(_out, uint64_t(_data_offset + y * blockBytes));
+        }
+
+        // Give the file its final size, rows are then written in place
+        const uint64_t rowBytes = sizeof(float) * uint64_t(width) * channels + (exr ? 2 * sizeof(int32_t) : 0);
+        if (height > 0 && rowBytes > 0)
+        {
+            _out.seekp(std::streamoff(_data_offset + rowBytes * height - 1));
+            _out.put('\0');
+        }
+        if (!_out)
+        {
+            LOG(ERROR) << "Cannot write " << filename;
+            _out.close();
+            return false;
+        }
+        return true;
+    }
+
+    bool FloatImageWriter::WriteRows(int y, int count, const float *data)
+    {
+        if (!_out.is_open() || y < 0 || y + count > _height)
+            return false;
+
+        const size_t pixelsBytes = sizeof(float) * size_t(_width) * _channels;
+        if (!_exr)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                _out.seekp(std::streamoff(_data_offset + uint64_t(_height - 1 - (y + i)) * pixelsBytes));
+                _out.write(reinterpret_cast<const char *>(data + size_t(i) * _width * _channels), pixelsBytes);
+            }
+            return bool(_out);
+        }
+
+        // source[i] is the interleaved channel stored as the i-th channel
+        const int source[3] = {2, 1, 0};
+        const int32_t lineBytes = int32_t(pixelsBytes);
+        std::vector<float> line(size_t(_width) * _channels);
+        _out.seekp(std::streamoff(_data_offset + uint64_t(y) * (2 * sizeof(int32_t) + pixelsBytes)));
+        for (int i = 0; i < count; ++i)
+        {
+            const float *row = data + size_t(i) * _width * _channels;
+            for (int k = 0; k < _channels; ++k)
+            {
+                int c = _channels == 1 ? 0 : source[k];
+                for (int x = 0; x < _width; ++x)
+                    line[size_t(k) * _width + x] = row[x * _channels + c];
+            }
+            WriteValue(_out, int32_t(y + i));
+            WriteValue(_out, lineBytes);
+            _out.write(reinterpret_cast<const char *>(line.data()), lineBytes);
+        }
+        return bool(_out);
+    }
+
+    bool FloatImageWriter::Close()
+    {
+        if (!_out.is_open())
+            return false;
+        _out.close();
+        return !_out.fail();
+    }
+
+    bool WriteFloatImage(const std::string &filename, int width, int height, int channels, const float *data)
+    {
+        std::string ext = Extension(filename);
+        if (ext == "exr")
+            return WriteEXR(filename, width, height, channels, data);
+        if (ext == "pfm")
+            return WritePFM(filename, width, height, channels, data);
+        LOG(ERROR) << "Unknown float image format " << filename;
+        return false;
+    }
+
+    bool ReadFloatImage(const std::string &filename, int &width, int &height, int &channels, std::vector<float> &data)
+    {
+        std::string ext = Extension(filename);
+        if (ext == "exr")
+            return ReadEXR(filename, width, height, channels, data);
+        if (ext == "pfm")
+            return ReadPFM(filename, width, height, channels, data);
+        LOG(ERROR) << "Unknown float image format " << filename;
+        return false;
+    }
+
+    bool PNGWriter::Open(const std::string &filename, int width, int height, int channels)
+    {
+        Close();
+        if (width <= 0 || height <= 0 || channels < 1 || channels > 4)
+            return false;
+        _out.open(filename, std::ios::binary | std::ios::trunc);
+        if (!_out)
+        {
+            LOG(ERROR) << "Cannot open " << filename << " for writing";
+            return false;
+        }
+        _filename = filename;
+        _width = width;
+        _height = height;
+        _channels = channels;
+        // Stripes of at least 256KB, so that splitting the deflate stream costs little compression
+        _stripe_rows = glm::max(1, (256 << 10) / (width * channels));
+        _rows_written = 0;
+        _pending.clear();
+        _prev_row.clear();
+        _adler = 1;
+        _failed = false;
+
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a};
+        static const uint8_t colorTypes[5] = {0, 0, 4, 2, 6}; //gray, gray + alpha, RGB, RGBA
+        _out.write(reinterpret_cast<const char *>(signature), 8);
+        uint8_t ihdr[13] = {uint8_t(width >> 24), uint8_t(width >> 16), uint8_t(width >> 8), uint8_t(width),
+                            uint8_t(height >> 24), uint8_t(height >> 16), uint8_t(height >> 8), uint8_t(height),
+                            8, colorTypes[channels], 0, 0, 0};
+        WriteChunk(_out, "IHDR", ihdr, sizeof(ihdr));
+        return bool(_out);
+    }
+
+    bool PNGWriter::WriteRows(const Byte *data, int count)
+    {
+        if (!_out.is_open() || _failed)
+            return false;
+        if (_rows_written + count > _height)
+        {
+            LOG(ERROR) << "Too many rows written to " << _filename;
+            _failed = true;
+            return false;
+        }
+        _rows_written += count;
+
+        // Complete the pending stripe first, then compress the complete stripes straight from data
+        const size_t rowBytes = size_t(_width) * _channels;
+        if (!_pending.empty())
+        {
+            int pendingRows = int(_pending.size() / rowBytes);
+            int take = glm::min(count, _stripe_rows - pendingRows);
+            _pending.insert(_pending.end(), data, data + take * rowBytes);
+            data += take * rowBytes;
+            count -= take;
+            if (pendingRows + take < _stripe_rows)
+                return true;
+            if (!WriteStripes(_pending.data(), _stripe_rows, false))
+                return false;
+            _pending.clear();
+        }
+
+        int stripeCount = count / _stripe_rows * _stripe_rows;
+        if (stripeCount > 0 && !WriteStripes(data, stripeCount, false))
+            return false;
+        _pending.assign(data + stripeCount * rowBytes, data + count * rowBytes);
+        return true;
+    }
+
+    bool PNGWriter::Close()
+    {
+        if (!_out.is_open())
+            return false;
+        bool ok = !_failed && _rows_written == _height;
+        if (!ok)
+            LOG(ERROR) << "Incomplete image " << _filename << ": " << _rows_written << " of " << _height << " rows";
+        ok = ok && WriteStripes(_pending.data(), int(_pending.size() / (size_t(_width) * _channels)), true);
+        if (ok)
+            WriteChunk(_out, "IEND", nullptr, 0);
+        _out.close();
+        _pending.clear();
+        _prev_row.clear();
+        return ok && !_out.fail();
+    }
+
+    bool PNGWriter::WriteStripes(const Byte *data, int count, bool final)
+    {
+        struct Stripe
+        {
+            std::vector<uint8_t> deflate;
+            uint32_t adler = 1;
+            size_t filteredSize = 0;
+            bool ok = false;
+        };
+
+        const int rowBytes = _width * _channels;
+        const int nStripes = (count + _stripe_rows - 1) / _stripe_rows;
+        std::vector<Stripe> stripes(nStripes);
+        tbb::parallel_for(tbb::blocked_range<int>(0, nStripes, 1), [&](const tbb::blocked_range<int> &range)
+        {
+            std::vector<Byte> candidate(rowBytes);
+            for (int s = range.begin(); s != range.end(); ++s)
+            {
+                int y0 = s * _stripe_rows, y1 = glm::min(count, y0 + _stripe_rows);
+                std::vector<Byte> filtered(size_t(y1 - y0) * (rowBytes + 1));
+                for (int y = y0; y < y1; ++y)
+                {
+                    // Pick the filter with the smallest sum of absolute residuals, like stb_image_write
+                    const Byte *row = data + size_t(y) * rowBytes;
+                    const Byte *prev = y > 0 ? row - rowBytes : (_prev_row.empty() ? nullptr : _prev_row.data());
+                    Byte *out = &filtered[size_t(y - y0) * (rowBytes + 1)];
+                    int bestCost = std::numeric_limits<int>::max();
+                    for (int type = 0; type < 5; ++type)
+                    {
+                        FilterRow(type, row, prev, _channels, rowBytes, candidate.data());
+                        int cost = 0;
+                        for (int i = 0; i < rowBytes; ++i)
+                            cost += std::abs((int)(signed char)candidate[i]);
+                        if (cost < bestCost)
+                        {
+                            bestCost = cost;
+                            out[0] = Byte(type);
+                            std::copy(candidate.begin(), candidate.end(), out + 1);
+                        }
+                    }
+                }
+
+                Stripe &stripe = stripes[s];
+                stripe.filteredSize = filtered.size();
+                stripe.adler = Adler32(filtered.data(), filtered.size());
+                int zlibSize = 0;
+                uint8_t *zlib = stbi_zlib_compress(filtered.data(), int(filtered.size()), &zlibSize, 8);
+                if (!zlib || zlibSize < 6)
+                {
+                    free(zlib);
+                    continue;
+                }
+                // Drop the 2 byte zlib header and the Adler-32 trailer
+                stripe.deflate.assign(zlib + 2, zlib + zlibSize - 4);
+                free(zlib);
+
+                if (!final || s + 1 < nStripes)
+                {
+                    // Note: clear BFINAL and end the block with an empty stored block, which pads
+                    //       to a byte boundary so that the next stripe's block can follow it.
+                    size_t end = FixedHuffmanBlockEnd(stripe.deflate.data(), stripe.deflate.size());
+                    if (end == 0)
+                        continue;
+                    stripe.deflate[0] &= 0xfe;
+                    stripe.deflate.resize((end + 7) / 8);
+                    int padding = int((8 - end % 8) % 8);
+                    if (padding < 3)
+                        stripe.deflate.push_back(0);
+                    const uint8_t emptyStored[4] = {0x00, 0x00, 0xff, 0xff};
+                    stripe.deflate.insert(stripe.deflate.end(), emptyStored, emptyStored + 4);
+                }
+                stripe.ok = true;
+            }
+        });
+
+        // The zlib header goes in front of the first stripe
+        std::vector<uint8_t> idat;
+        if (_prev_row.empty())
+            idat = {0x78, 0x5e};
+        for (const Stripe &stripe : stripes)
+        {
+            if (!stripe.ok)
+            {
+                LOG(ERROR) << "Failed to compress " << _filename;
+                _failed = true;
+                return false;
+            }
+            idat.insert(idat.end(), stripe.deflate.begin(), stripe.deflate.end());
+            _adler = Adler32Combine(_adler, stripe.adler, stripe.filteredSize);
+        }
+        if (final)
+        {
+            // A final empty stored block when the last stripe was already written
+            if (nStripes == 0)
+                idat.insert(idat.end(), {0x01, 0x00, 0x00, 0xff, 0xff});
+            for (int shift = 24; shift >= 0; shift -= 8)
+                idat.push_back(uint8_t(_adler >> shift));
+        }
+        if (count > 0)
+            _prev_row.assign(data + size_t(count - 1) * rowBytes, data + size_t(count) * rowBytes);
+
+        WriteChunk(_out, "IDAT", idat.data(), idat.size());
+        if (!_out)
+        {
+            LOG(ERROR) << "Cannot write " << _filename;
+            _failed = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool WritePNG(const std::string &filename, int width, int height, int channels, const Byte *data)
+    {
+        PNGWriter writer;
+        return writer.Open(filename, width, height, channels) && writer.WriteRows(data, height) && writer.Close();
+    }
+
+    std::string SiblingFilename(const std::string &filename, const std::string &suffix, const std::string &extension)
+    {
+        size_t dot = filename.find_last_of('.');
+        size_t slash = filename.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            dot = filename.size();
+        return filename.substr(0, dot) + (suffix.empty() ? "" : "_" + suffix) + "." + extension;
+    }
+}
@@ -0,0 +1,164 @@
+
+
+#ifndef CORE_IMAGE_IO_H_
+#define CORE_IMAGE_IO_H_
+
+#include <core/utilities.h>
+#include <string>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+namespace platinum
+{
+    /**
+     * @brief Float image files holding linear values, used for HDR film output and AOVs.
+     *        Pixels are interleaved with 1 (gray) or 3 (RGB) channels, the top row first.
+     *
+     *        PFM: the Portable Float Map, little endian.
+     *        EXR: single-part scanline OpenEXR with 32-bit float channels (R, G, B or Y)
+     *             and no compression; reading also accepts half channels, other
+     *             compressions are rejected.
+     */
+    bool WritePFM(const std::string &filename, int width, int height, int channels, const float *data);
+
+    bool ReadPFM(const std::string &filename, int &width, int &height, int &channels, std::vector<float> &data);
+
+    bool WriteEXR(const std::string &filename, int width, int height, int channels, const float *data);
+
+    bool ReadEXR(const std::string &filename, int &width, int &height, int &channels, std::vector<float> &data);
+
+    /**
+     * @brief Dispatch on the file extension (.pfm or .exr)
+     */
+    bool WriteFloatImage(const std::string &filename, int width, int height, int channels, const float *data);
+
+    bool ReadFloatImage(const std::string &filename, int &width, int &height, int &channels, std::vector<float> &data);
+
+    /**
+     * @brief Writes a PFM or EXR image (chosen by the extension) whose rows arrive in any order,
+     *        e.g. as the bands of an out-of-core film are finished. The file has its final size
+     *        from Open() on and every row is written in place, nothing is buffered.
+     */
+    class FloatImageWriter
+    {
+    public:
+        ~FloatImageWriter() { Close(); }
+
+        bool Open(const std::string &filename, int width, int height, int channels);
+
+        bool Open(const std::string &filename, int width, int height, int channels, bool exr);
+
+        /**
+         * @brief Write rows [y, y + count), interleaved as for WriteFloatImage().
+         */
+        bool WriteRows(int y, int count, const float *data);
+
+        bool Close();
+
+        bool IsOpen() const { return _out.is_open(); }
+
+    private:
+        std::ofstream _out;
+        bool _exr = false;
+        int _width = 0, _height = 0, _channels = 0;
+        uint64_t _data_offset = 0; //of the first pixel row (PFM: the bottom one) or scanline block
+    };
+
+    /**
+     * @brief An image waiting to be written, e.g. by the film's background writer
+     */
+    struct FloatImage
+    {
+        std::string filename;
+        int width = 0, height = 0, channels = 0;
+        std::vector<float> data;
+    };
+
+    /**
+     * @brief thresholds[k] is the smallest linear value that is quantized to k or more
+     *        by clamp(255 * gammaCorrect(v) + 0.5, 0, 255); thresholds[0] is -infinity.
+     */
+    inline const float *SRGB8Thresholds()
+    {
+        static const std::array<float, 256> thresholds = []
+        {
+            auto quantize = [](float v) { return (int)clamp(255.f * gammaCorrect(v) + 0.5f, 0.f, 255.f); };
+            std::array<float, 256> t;
+            t[0] = -Infinity;
+            for (int k = 1; k < 256; ++k)
+            {
+                // Invert the sRGB curve, then step to the exact float where the rounding flips
+                float s = (k - 0.5f) / 255.f;
+                float v = s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+                while (quantize(v) < k)
+                    v = std::nextafter(v, Infinity);
+                while (quantize(std::nextafter(v, -Infinity)) >= k)
+                    v = std::nextafter(v, -Infinity);
+                t[k] = v;
+            }
+            return t;
+        }();
+        return thresholds.data();
+    }
+
+    /**
+     * @brief Quantize a linear value to 8-bit sRGB, the same as
+     *        clamp(255 * gammaCorrect(v) + 0.5, 0, 255) but with a branchless binary search
+     *        in SRGB8Thresholds() instead of pow(). NaN maps to 0.
+     */
+    inline Byte ToSRGB8(float v, const float *thresholds = SRGB8Thresholds())
+    {
+        int i = 0;
+        for (int step = 128; step > 0; step >>= 1)
+            i += thresholds[i + step] <= v ? step : 0;
+        return Byte(i);
+    }
+
+    /**
+     * @brief Encodes an 8-bit PNG whose rows arrive top to bottom, using all cores: horizontal
+     *        stripes are filtered and deflated in parallel, and the independent deflate streams
+     *        are joined into a single zlib stream. Every complete stripe is compressed and written
+     *        as soon as its rows arrive, so only a partial stripe is ever held in memory.
+     */
+    class PNGWriter
+    {
+    public:
+        ~PNGWriter() { Close(); }
+
+        bool Open(const std::string &filename, int width, int height, int channels);
+
+        bool WriteRows(const Byte *data, int count);
+
+        /**
+         * @brief Compress the last rows and finish the file. Fails if fewer than height rows were written.
+         */
+        bool Close();
+
+        bool IsOpen() const { return _out.is_open(); }
+
+    private:
+        std::string _filename;
+        std::ofstream _out;
+        int _width = 0, _height = 0, _channels = 0;
+        int _stripe_rows = 0;
+        int _rows_written = 0;
+        std::vector<Byte> _pending;  //rows of the incomplete stripe
+        std::vector<Byte> _prev_row; //last row of the previous stripe, the PNG filters predict from it
+        uint32_t _adler = 1;
+        bool _failed = false;
+
+        bool WriteStripes(const Byte *data, int count, bool final);
+    };
+
+    bool WritePNG(const std::string &filename, int width, int height, int channels, const Byte *data);
+
+    /**
+     * @brief filename with its extension replaced, and _suffix appended to the stem if not empty,
+     *        e.g. (cornellBox.png, "normal", "pfm") -> cornellBox_normal.pfm
+     */
+    std::string SiblingFilename(const std::string &filename, const std::string &suffix, const std::string &extension);
+}
+
+#endif
@@ -1,126 +1,499 @@
 
 #include <core/integrator.h>
 #include <core/bsdf.h>
+#include <core/light.h>
+#include <glm/gtx/norm.hpp>
 #include <core/camera.h>
 #include <tbb/parallel_for.h>
 #include <core/memory.h>
 #include <core/timer.h>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
 namespace platinum
 {
+    SamplerIntegrator::SamplerIntegrator(const PropertyTree &root)
+    {
+        _sampler = UPtr<Sampler>(static_cast<Sampler *>(ObjectFactory::CreateInstance(root.Get<std::string>("Sampler.Type"), root.GetChild("Sampler"))));
+
+        _camera = UPtr<Camera>(static_cast<Camera *>(ObjectFactory::CreateInstance(root.Get<std::string>("Camera.Type"), root.GetChild("Camera"))));
+
+        auto adaptive_node = root.GetChildOptional("Adaptive");
+        if (adaptive_node)
+        {
+            _adaptive.enabled = true;
+            _adaptive.threshold = adaptive_node->Get<float>("Threshold", 0.01f);
+            _adaptive.minSPP = adaptive_node->Get<int64_t>("MinSPP", 16);
+            _adaptive.maxSPP = adaptive_node->Get<int64_t>("MaxSPP", 4 * _sampler->_samplesPerPixel);
+            LOG(INFO) << "Adaptive sampling: threshold " << _adaptive.threshold << ", spp range ["
+                      << _adaptive.minSPP << ", " << _adaptive.maxSPP << "]";
+        }
+
+        auto progressive_node = root.GetChildOptional("Progressive");
+        if (progressive_node)
+        {
+            _progressive.enabled = true;
+            _progressive.passSPP = progressive_node->Get<int64_t>("PassSPP", 1);
+            _progressive.timeBudget = progressive_node->Get<float>("TimeBudget", 0.f);
+        }
+
+        auto checkpoint_node = root.GetChildOptional("Checkpoint");
+        if (checkpoint_node)
+        {
+            _checkpoint.enabled = true;
+            _checkpoint.filename = checkpoint_node->Get<std::string>("Filename");
+            _checkpoint.interval = checkpoint_node->Get<float>("Interval", 600.f);
+            //检查点只能在两遍之间保存
+            if (!_progressive.enabled)
+            {
+                _progressive.enabled = true;
+                _progressive.passSPP = checkpoint_node->Get<int64_t>("PassSPP", 16);
+            }
+        }
+
+        auto reservoir_node = root.GetChildOptional("RIS");
+        if (reservoir_node)
+        {
+            _reservoir.candidates = glm::max(1, reservoir_node->Get<int>("Candidates", 32));
+            _reservoir.spatialReuse = reservoir_node->Get<bool>("SpatialReuse", false);
+            _reservoir.temporalReuse = reservoir_node->Get<bool>("TemporalReuse", false);
+        }
+    }
+
+    bool SamplerIntegrator::ContinueAdaptiveSampling(const FilmTile &tile, const Vector2i &pixel, int64_t n, int64_t spp,
+                                                     std::atomic<int64_t> &budget) const
+    {
+        if (n < _adaptive.minSPP)
+            return true;
+
+        bool converged = n >= _adaptive.maxSPP || tile.RelativeError(pixel) < _adaptive.threshold;
+        if (converged)
+        {
+            //把没用完的预算留给后面未收敛的像素
+            if (n < spp)
+                budget.fetch_add(spp - n, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (n < spp)
+            return true;
+
+        //超出平均预算后，只能借用其他像素节省下来的样本
+        if (budget.fetch_sub(1, std::memory_order_relaxed) > 0)
+            return true;
+        budget.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
     void SamplerIntegrator::Render(const Scene &scene)
     {
         LOG(INFO) << "Start rendering...";
         Timer timer("Integrator");
+
+        const int64_t spp = _sampler->_samplesPerPixel;
+        if (_adaptive.enabled && _progressive.enabled)
+        {
+            //渐进式渲染的每一遍只有少量样本，无法据此判断像素是否收敛
+            LOG(WARNING) << "Adaptive sampling is not supported in progressive mode and will be ignored";
+            _adaptive.enabled = false;
+        }
+        if (_camera->_film->IsOutOfCore() && _progressive.enabled)
+        {
+            //out-of-core胶片渲染完一行就写出一行，不能再累积后续的遍
+            LOG(WARNING) << "Progressive rendering and checkpoints are not supported by an out-of-core film and will be ignored";
+            _progressive.enabled = false;
+            _checkpoint.enabled = false;
+        }
+        if (_progressive.enabled)
+            _camera->_film->EnableProgressive();
+
+        //自适应采样时，采样器需要能提供最多maxSPP个样本
+        _adaptive_spp = spp;
+        _adaptive_budget = 0;
+        if (_adaptive.enabled)
+        {
+            _adaptive.minSPP = glm::max<int64_t>(_adaptive.minSPP, 2);
+            _adaptive.maxSPP = glm::max(_adaptive.maxSPP, _adaptive.minSPP);
+            _sampler->SetSamplesPerPixel(_adaptive.maxSPP);
+            //胶片默认不统计每个像素的样本数，输出样本数图像时才需要
+            _camera->_film->EnableSampleCounts();
+        }
+
+        //每个光源一层Lights AOV
+        _camera->_film->InitializeAOVs(int(scene._lights.size()));
+
         Preprocess(scene, *_sampler);
-        Vector2i resolution = _camera->_film->GetResolution();
 
+        if (_progressive.enabled)
+        {
+            RenderProgressive(scene);
+        }
+        else
+        {
+            RenderPass(scene, 0, _sampler->_samplesPerPixel, 0);
+            LOG(INFO) << "Rendering finished";
+            //splat是所有样本贡献的和，按每个像素的平均样本数归一化。
+            //自适应采样时各像素的样本数不同，且上限是maxSPP而不是spp，要用实际统计的平均值
+            double meanSPP = spp;
+            if (_adaptive.enabled && _camera->_film->GetMeanSampleCount() > 0)
+                meanSPP = _camera->_film->GetMeanSampleCount();
+            _camera->_film->WriteImageToFile(float(1.0 / meanSPP));
+        }
+
+        if (_adaptive.enabled)
+        {
+            LOG(INFO) << "Adaptive sampling left " << _adaptive_budget.load() << " samples of the budget unused";
+            _camera->_film->WriteSampleCountImage();
+        }
+
+        //图像在后台写入，返回前确保已经落盘
+        _camera->_film->WaitForWrites();
+        _camera->_film->MarkFinished();
+    }
+
+    void SamplerIntegrator::RenderProgressive(const Scene &scene)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        const int64_t spp = _sampler->_samplesPerPixel;
+        const int64_t passSPP = clamp(_progressive.passSPP, (int64_t)1, spp);
+        const bool hasBudget = _progressive.timeBudget > 0.f;
+        const Clock::time_point start = Clock::now();
+        const Clock::time_point deadline = start + std::chrono::duration_cast<Clock::duration>(
+                                                       std::chrono::duration<float>(_progressive.timeBudget));
+
+        LOG(INFO) << "Progressive rendering: " << passSPP << " spp per pass, target " << spp << " spp"
+                  << (hasBudget ? StringPrintf(", time budget %fs", _progressive.timeBudget) : std::string());
+
+        int64_t samplesDone = 0;
+        int firstPass = 0;
+        if (_resume && _checkpoint.enabled && LoadCheckpoint(samplesDone, firstPass))
+        {
+            LOG(INFO) << "Resumed from checkpoint " << _checkpoint.filename << " at " << samplesDone << " spp";
+            _camera->_film->WriteImageToFile(1.f / samplesDone);
+        }
+
+        Clock::time_point lastCheckpoint = start;
+        for (int pass = firstPass; samplesDone < spp; ++pass)
+        {
+            int64_t sampleCount = glm::min(passSPP, spp - samplesDone);
+            bool finished = RenderPass(scene, samplesDone, sampleCount, pass, hasBudget ? &deadline : nullptr);
+            samplesDone += sampleCount;
+
+            //每一遍结束后都把当前的累积结果写入文件，随时可以拿到目前最好的图像
+            _camera->_film->WriteImageToFile(1.f / samplesDone);
+
+            float elapsed = std::chrono::duration<float>(Clock::now() - start).count();
+            LOG(INFO) << "Pass " << pass + 1 << " finished: " << samplesDone << "/" << spp << " spp, "
+                      << elapsed << "s elapsed";
+
+            //被截止时间打断的一遍不完整，不能作为继续渲染的起点
+            if (finished && _checkpoint.enabled &&
+                (samplesDone >= spp ||
+                 std::chrono::duration<float>(Clock::now() - lastCheckpoint).count() >= _checkpoint.interval))
+            {
+                SaveCheckpoint(samplesDone, pass + 1);
+                lastCheckpoint = Clock::now();
+            }
+
+            if (!finished || (hasBudget && Clock::now() >= deadline))
+            {
+                LOG(INFO) << "Time budget of " << _progressive.timeBudget << "s reached, stop rendering";
+                break;
+            }
+        }
+        LOG(INFO) << "Rendering finished";
+    }
+
+    namespace
+    {
+        constexpr char CheckpointMagic[4] = {'P', 'T', 'C', 'K'};
+        constexpr uint32_t CheckpointVersion = 2;
+    }
+
+    void SamplerIntegrator::SaveCheckpoint(int64_t samplesDone, int pass) const
+    {
+        Timer timer("SaveCheckpoint");
+        //先写入临时文件再替换，保存过程中被抢占也不会破坏已有的检查点
+        std::string tmpFilename = _checkpoint.filename + ".tmp";
+        {
+            std::ofstream out(tmpFilename, std::ios::binary | std::ios::trunc);
+            if (!out)
+            {
+                LOG(ERROR) << "Could not open checkpoint file " << tmpFilename;
+                return;
+            }
+            int32_t pass32 = pass;
+            out.write(CheckpointMagic, sizeof(CheckpointMagic));
+            out.write(reinterpret_cast<const char *>(&CheckpointVersion), sizeof(CheckpointVersion));
+            out.write(reinterpret_cast<const char *>(&samplesDone), sizeof(samplesDone));
+            out.write(reinterpret_cast<const char *>(&pass32), sizeof(pass32));
+            _camera->_film->WriteCheckpoint(out);
+            if (!out)
+            {
+                LOG(ERROR) << "Failed to write checkpoint file " << tmpFilename;
+                return;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmpFilename, _checkpoint.filename, ec);
+        if (ec)
+        {
+            LOG(ERROR) << "Could not replace checkpoint file " << _checkpoint.filename << ": " << ec.message();
+            return;
+        }
+        LOG(INFO) << "Saved checkpoint " << _checkpoint.filename << " at " << samplesDone << " spp";
+    }
+
+    bool SamplerIntegrator::LoadCheckpoint(int64_t &samplesDone, int &pass)
+    {
+        std::ifstream in(_checkpoint.filename, std::ios::binary);
+        if (!in)
+        {
+            LOG(WARNING) << "No checkpoint " << _checkpoint.filename << " to resume from, start from scratch";
+            return false;
+        }
+
+        char magic[4];
+        uint32_t version;
+        int64_t done;
+        int32_t pass32;
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char *>(&version), sizeof(version));
+        in.read(reinterpret_cast<char *>(&done), sizeof(done));
+        in.read(reinterpret_cast<char *>(&pass32), sizeof(pass32));
+        if (!in || std::memcmp(magic, CheckpointMagic, sizeof(magic)) != 0 || version != CheckpointVersion)
+        {
+            LOG(ERROR) << "Invalid checkpoint file " << _checkpoint.filename;
+            return false;
+        }
+        if (done > _sampler->_samplesPerPixel)
+        {
+            LOG(ERROR) << "Checkpoint has " << done << " spp, more than the target " << _sampler->_samplesPerPixel;
+            return false;
+        }
+        if (!_camera->_film->ReadCheckpoint(in))
+        {
+            LOG(ERROR) << "Checkpoint " << _checkpoint.filename << " does not match the film";
+            _camera->_film->Clear();
+            return false;
+        }
+
+        samplesDone = done;
+        pass = pass32;
+        return true;
+    }
+
+    namespace
+    {
+        //当前线程正在追踪的相机样本的AOV
+        thread_local AOVSample *currentAOVSample = nullptr;
+    }
+
+    AOVSample *SamplerIntegrator::PrimaryAOVSample()
+    {
+        return currentAOVSample;
+    }
+
+    bool SamplerIntegrator::RenderPass(const Scene &scene, int64_t firstSample, int64_t sampleCount, int pass,
+                                       const std::chrono::steady_clock::time_point *deadline)
+    {
         auto &sampler = _sampler;
+        Film *film = _camera->_film.get();
+        const bool filterSampling = film->IsFilterImportanceSampling();
+        const bool recordAOVs = film->RecordsAOVs();
+        const bool recordFeatures = film->GetAOVLayout().HasFeatures();
+        //特征AOV只需要少量样本就能收敛，前几个样本之后不再重复求交
+        constexpr int64_t maxFeatureSamples = 16;
 
         // Compute number of tiles, _nTiles_, to use for parallel rendering
-        Bounds2i sampleBounds = _camera->_film->GetSampleBounds();
+        Bounds2i sampleBounds = film->GetSampleBounds();
         Vector2i sampleExtent = sampleBounds.Diagonal();
         //每一块大小为16*16
         constexpr int tileSize = 16;
         //划分为nTiles.x * nTiles.y 块tiles
         Vector2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
-        LOG(INFO) << nTiles;
+        VLOG(1) << nTiles;
+        //_adaptive_spp即目标的每像素样本数
+        film->ReportProgress(firstSample, sampleCount, _adaptive_spp, nTiles.x * nTiles.y);
+        film->ExpectTiles(sampleBounds, tileSize);
+
+        //out-of-core胶片只在内存中保留渲染前沿附近的像素行，因此按tile行分批渲染，每批至少minBatchTiles个tile
+        constexpr int minBatchTiles = 256;
+        const size_t totalTiles = size_t(nTiles.x) * nTiles.y;
+        const size_t batchTiles = film->IsOutOfCore()
+                                      ? size_t(nTiles.x) * ((minBatchTiles + nTiles.x - 1) / nTiles.x)
+                                      : totalTiles;
+
+        //超过截止时间后，剩下的tile直接跳过
+        std::atomic<int> skippedTiles(0);
+        for (size_t batchBegin = 0; batchBegin < totalTiles; batchBegin += batchTiles)
+        {
+            const size_t batchEnd = glm::min(totalTiles, batchBegin + batchTiles);
 //#define DEBUG
 #ifndef DEBUG
-        tbb::parallel_for(tbb::blocked_range<size_t>(0, nTiles.x * nTiles.y),
-                          [&](tbb::blocked_range<size_t> r)
-                          {
-                              MemoryArena arena;
-                              for (size_t t = r.begin(); t != r.end(); ++t)
+            tbb::parallel_for(tbb::blocked_range<size_t>(batchBegin, batchEnd),
+                              [&](tbb::blocked_range<size_t> r)
                               {
+                                  MemoryArena arena;
+                                  for (size_t t = r.begin(); t != r.end(); ++t)
+                                  {
 #else
-        MemoryArena arena;
-        for (size_t t = 0; t < nTiles.x * nTiles.y; ++t)
-        {
+            MemoryArena arena;
+            for (size_t t = batchBegin; t < batchEnd; ++t)
+            {
 #endif  
-                                //获取tile的坐标
-                                  Vector2i tile(t % nTiles.x, t / nTiles.x);
-                                  // Get sampler instance for tile
-                                  int seed = t;
-                                  std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-
-                                  // Compute sample bounds for tile
-                                  int x0 = sampleBounds._p_min.x + tile.x * tileSize;
-                                  int x1 = glm::min(x0 + tileSize, sampleBounds._p_max.x);
-                                  int y0 = sampleBounds._p_min.y + tile.y * tileSize;
-                                  int y1 = glm::min(y0 + tileSize, sampleBounds._p_max.y);
-                                  Bounds2i tileBounds(Vector2i(x0, y0), Vector2i(x1, y1));
-
-                                  // Get _FilmTile_ for tile
-                                  std::unique_ptr<FilmTile> filmTile = _camera->_film->GetFilmTile(tileBounds);
-
-                                  // Loop over pixels in tile to render them
-                                  for (Vector2i pixel : tileBounds)
-                                  {
-                                      tileSampler->StartPixel(pixel);
-
-                                      do
+                                      if (deadline && std::chrono::steady_clock::now() >= *deadline)
                                       {
-                                          // Initialize _CameraSample_ for current sample
-                                          CameraSample cameraSample = tileSampler->GetCameraSample(pixel);
-
-                                          // Generate camera ray for current sample
-                                          Ray ray;
-                                          float rayWeight = _camera->CastingRay(cameraSample, ray);
-
-                                          // Evaluate radiance along camera ray
-                                          Spectrum L(0.f);
-                                          if (rayWeight > 0)
-                                          {
-                                              L = Li(scene, ray, *tileSampler, arena);
-                                          }
+                                          ++skippedTiles;
+                                          continue;
+                                      }
+                                    //获取tile的坐标
+                                      Vector2i tile(t % nTiles.x, t / nTiles.x);
+                                      // Get sampler instance for tile
+                                      // Note: every pass uses different seeds, otherwise passes would repeat the same samples
+                                      int seed = pass * nTiles.x * nTiles.y + t;
+                                      std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+
+                                      // Compute sample bounds for tile
+                                      int x0 = sampleBounds._p_min.x + tile.x * tileSize;
+                                      int x1 = glm::min(x0 + tileSize, sampleBounds._p_max.x);
+                                      int y0 = sampleBounds._p_min.y + tile.y * tileSize;
+                                      int y1 = glm::min(y0 + tileSize, sampleBounds._p_max.y);
+                                      Bounds2i tileBounds(Vector2i(x0, y0), Vector2i(x1, y1));
+
+                                      // Get _FilmTile_ for tile
+                                      std::unique_ptr<FilmTile> filmTile = _camera->_film->GetFilmTile(tileBounds);
+
+                                      AOVSample aovSample;
+
+                                      // Loop over pixels in tile to render them
+                                      for (Vector2i pixel : tileBounds)
+                                      {
+                                          tileSampler->StartPixel(pixel);
+                                          if (firstSample > 0)
+                                              tileSampler->SetSampleNumber(firstSample);
+                                          int64_t pixelSamples = 0;
 
-                                          // Issue warning if unexpected radiance value returned
-                                          if (L.hasNaNs())
-                                          {
-                                              LOG(ERROR) << StringPrintf(
-                                                  "Not-a-number radiance value returned "
-                                                  "for pixel (%d, %d), sample %d. Setting to black.",
-                                                  pixel.x, pixel.y,
-                                                  (int)tileSampler->CurrentSampleIndex());
-                                              L = Spectrum(0.f);
-                                          }
-                                          else if (L.y() < -1e-5)
+                                          do
                                           {
-                                              LOG(ERROR) << StringPrintf(
-                                                  "Negative luminance value, %f, returned "
-                                                  "for pixel (%d, %d), sample %d. Setting to black.",
-                                                  L.y(), pixel.x, pixel.y,
-                                                  (int)tileSampler->CurrentSampleIndex());
-                                              L = Spectrum(0.f);
-                                          }
-                                          else if (std::isinf(L.y()))
-                                          {
-                                              LOG(ERROR) << StringPrintf(
-                                                  "Infinite luminance value returned "
-                                                  "for pixel (%d, %d), sample %d. Setting to black.",
-                                                  pixel.x, pixel.y,
-                                                  (int)tileSampler->CurrentSampleIndex());
-                                              L = Spectrum(0.f);
-                                          }
-                                          VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " << ray << " -> L = " << L;
-
-                                          // Add camera ray's contribution to image
-                                          filmTile->AddSample(cameraSample.p_film, L, rayWeight);
-
-                                          arena.Reset();
-                                      } while (tileSampler->StartNextSample());
+                                              // Initialize _CameraSample_ for current sample
+                                              CameraSample cameraSample = tileSampler->GetCameraSample(pixel, filterSampling ? film->GetFilter() : nullptr);
+
+                                              // Generate camera ray for current sample
+                                              Ray ray;
+                                              float rayWeight = _camera->CastingRay(cameraSample, ray);
+
+                                              // Evaluate radiance along camera ray
+                                              Spectrum L(0.f);
+                                              if (recordAOVs)
+                                              {
+                                                  aovSample.Reset();
+                                                  currentAOVSample = &aovSample;
+                                              }
+                                              if (rayWeight > 0)
+                                              {
+                                                  L = Li(scene, ray, *tileSampler, arena);
+                                              }
+                                              currentAOVSample = nullptr;
+
+                                              // Issue warning if unexpected radiance value returned
+                                              if (L.hasNaNs())
+                                              {
+                                                  LOG(ERROR) << StringPrintf(
+                                                      "Not-a-number radiance value returned "
+                                                      "for pixel (%d, %d), sample %d. Setting to black.",
+                                                      pixel.x, pixel.y,
+                                                      (int)tileSampler->CurrentSampleIndex());
+                                                  L = Spectrum(0.f);
+                                              }
+                                              else if (L.y() < -1e-5)
+                                              {
+                                                  LOG(ERROR) << StringPrintf(
+                                                      "Negative luminance value, %f, returned "
+                                                      "for pixel (%d, %d), sample %d. Setting to black.",
+                                                      L.y(), pixel.x, pixel.y,
+                                                      (int)tileSampler->CurrentSampleIndex());
+                                                  L = Spectrum(0.f);
+                                              }
+                                              else if (std::isinf(L.y()))
+                                              {
+                                                  LOG(ERROR) << StringPrintf(
+                                                      "Infinite luminance value returned "
+                                                      "for pixel (%d, %d), sample %d. Setting to black.",
+                                                      pixel.x, pixel.y,
+                                                      (int)tileSampler->CurrentSampleIndex());
+                                                  L = Spectrum(0.f);
+                                              }
+                                              VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " << ray << " -> L = " << L;
+
+                                              // Add camera ray's contribution to image
+                                              if (filterSampling)
+                                                  filmTile->AddPixelSample(pixel, L, rayWeight, cameraSample.filter_weight);
+                                              else
+                                                  filmTile->AddSample(cameraSample.p_film, L, rayWeight);
+                                              filmTile->AddPixelStatistics(pixel, L.y() * rayWeight);
+
+                                              if (recordAOVs)
+                                              {
+                                                  bool features = recordFeatures && firstSample + pixelSamples < maxFeatureSamples;
+                                                  if (features && rayWeight > 0)
+                                                      FirstHitFeatures(scene, ray, *tileSampler, arena, aovSample);
+                                                  //积分器没有单独记录的部分都算作间接光照
+                                                  for (int c = 0; c < Spectrum::nSamples; ++c)
+                                                      aovSample.indirect[c] = glm::max(0.f, L[c] - aovSample.emission[c] - aovSample.direct[c]);
+                                                  filmTile->AddAOVSample(pixel, aovSample, features);
+                                              }
+                                              ++pixelSamples;
+
+                                              arena.Reset();
+
+                                              if (pixelSamples >= sampleCount)
+                                                  break;
+                                              if (_adaptive.enabled &&
+                                                  !ContinueAdaptiveSampling(*filmTile, pixel, pixelSamples, _adaptive_spp, _adaptive_budget))
+                                                  break;
+                                          } while (tileSampler->StartNextSample());
+                                      }
+                                      //   LOG(INFO) << "Finished image tile " << tileBounds;
+
+                                      _camera->_film->MergeFilmTile(std::move(filmTile));
                                   }
-                                  //   LOG(INFO) << "Finished image tile " << tileBounds;
-
-                                  _camera->_film->MergeFilmTile(std::move(filmTile));
-                              }
 #ifndef DEBUG
-                        //simple partitioner按莫顿码遍历，对矩阵的遍历更快。
-                        //但是这里没必要按莫顿码遍历，因为最初没有矩阵，而是在迭代器遍历一个tile时才生成坐标。
-                          },tbb::auto_partitioner());
+                            //simple partitioner按莫顿码遍历，对矩阵的遍历更快。
+                            //但是这里没必要按莫顿码遍历，因为最初没有矩阵，而是在迭代器遍历一个tile时才生成坐标。
+                              },tbb::auto_partitioner());
 #endif
-        LOG(INFO) << "Rendering finished";
-        _camera->_film->WriteImageToFile();
+        }
+        if (skippedTiles > 0)
+            LOG(INFO) << "Deadline reached, skipped " << skippedTiles << " tiles of the pass";
+        return skippedTiles == 0;
+    }
+
+    void SamplerIntegrator::FirstHitFeatures(const Scene &scene, const Ray &ray, Sampler &sampler, MemoryArena &arena,
+                                             AOVSample &aov) const
+    {
+        aov.albedo = Spectrum(1.f);
+        aov.normal = Vector3f(0.f);
+        aov.depth = 0.f;
+
+        SurfaceInteraction isect;
+        if (!scene.Hit(ray, isect))
+            return;
+        aov.depth = glm::length(isect.p - ray._origin);
+        aov.normal = glm::dot(isect.n, isect.wo) < 0 ? -isect.n : isect.n;
+
+        isect.ComputeScatteringFunctions(ray, arena);
+        if (!isect._bsdf)
+            return;
+
+        // ρ(wo) ≈ f(wo, wi) |cosθi| / pdf(wi)，对余弦采样的漫反射是精确值
+        Vector3f wi;
+        float pdf;
+        BxDFType sampledType;
+        Spectrum f = isect._bsdf->SampleF(isect.wo, wi, sampler.Get2D(), pdf, sampledType);
+        aov.albedo = pdf > 0 ? f * glm::abs(glm::dot(wi, isect.n)) / pdf : Spectrum(0.f);
     }
 
     Spectrum SamplerIntegrator::SpecularReflect(const Ray &ray, const SurfaceInteraction &inter,
@@ -172,7 +545,8 @@ namespace platinum
     }
 
     Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
-                                    MemoryArena &arena, Sampler &sampler, const std::vector<int> &nLightSamples)
+                                    MemoryArena &arena, Sampler &sampler, const std::vector<int> &nLightSamples,
+                                    AOVSample *aov)
     {
         Spectrum L(0.f);
         for (size_t j = 0; j < scene._lights.size(); ++j)
@@ -188,7 +562,10 @@ namespace platinum
                 // Use a single sample for illumination from _light_
                 Vector2f uLight = sampler.Get2D();
                 Vector2f uScattering = sampler.Get2D();
-                L += EstimateDirect(it, uScattering, *light, uLight, scene, sampler, arena);
+                Spectrum Ld = EstimateDirect(it, uScattering, *light, uLight, scene, sampler, arena);
+                if (aov)
+                    aov->AddLight(int(j), Ld);
+                L += Ld;
             }
             else
             {
@@ -198,6 +575,8 @@ namespace platinum
                 {
                     Ld += EstimateDirect(it, uScatteringArray[k], *light, uLightArray[k], scene, sampler, arena);
                 }
+                if (aov)
+                    aov->AddLight(int(j), Ld / nSamples);
                 L += Ld / nSamples;
             }
         }
@@ -205,7 +584,8 @@ namespace platinum
     }
 
     Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
-                                   MemoryArena &arena, Sampler &sampler, const Distribution1D *lightDistrib)
+                                   MemoryArena &arena, Sampler &sampler, const Distribution1D *lightDistrib,
+                                   AOVSample *aov)
     {
         // Randomly choose a single light to sample, _light_
         int nLights = int(scene._lights.size());
@@ -232,7 +612,228 @@ namespace platinum
         Vector2f uLight = sampler.Get2D();
         Vector2f uScattering = sampler.Get2D();
 
-        return EstimateDirect(it, uScattering, *light, uLight, scene, sampler, arena) / lightPdf;
+        Spectrum Ld = EstimateDirect(it, uScattering, *light, uLight, scene, sampler, arena) / lightPdf;
+        if (aov)
+            aov->AddLight(lightSampledIndex, Ld);
+        return Ld;
+    }
+
+    Spectrum SampleOneLight(const Interaction &it, const Scene &scene, MemoryArena &arena,
+                            Sampler &sampler, const LightDistribution &lightDistrib, AOVSample *aov)
+    {
+        float lightPmf;
+        int lightSampledIndex = lightDistrib.Sample(it, sampler.Get1D(), lightPmf);
+        if (lightSampledIndex < 0 || lightPmf == 0)
+            return Spectrum(0.f);
+
+        const Ptr<Light> &light = scene._lights[lightSampledIndex];
+        Vector2f uLight = sampler.Get2D();
+        Vector2f uScattering = sampler.Get2D();
+
+        Spectrum Ld = EstimateDirect(it, uScattering, *light, uLight, scene, sampler, arena) / lightPmf;
+        if (aov)
+            aov->AddLight(lightSampledIndex, Ld);
+        return Ld;
+    }
+
+    namespace
+    {
+        // A light sample considered by reservoir resampling. Samples on area lights are kept
+        // in area measure so that they can be re-evaluated at another shading point.
+        struct LightCandidate
+        {
+            int light = -1;
+            Interaction pLight;
+            Spectrum contrib = 0.f; //unshadowed contribution f * Li * |cos|, including the geometry term for area lights
+            bool onArea = false;
+        };
+
+        struct Reservoir
+        {
+            LightCandidate y;
+            float wSum = 0;
+            float M = 0;
+            float W = 0; //unbiased contribution weight of y
+
+            void Update(const LightCandidate &candidate, float w, float M_candidate, float u)
+            {
+                wSum += w;
+                M += M_candidate;
+                if (w > 0 && u * wSum < w)
+                    y = candidate;
+            }
+
+            void Finalize()
+            {
+                float target = y.contrib.y();
+                W = (target > 0 && M > 0) ? wSum / (M * target) : 0.f;
+            }
+        };
+
+        // Reservoirs of the first vertex of the camera paths recently rendered by this thread
+        struct ReservoirHistory
+        {
+            Vector2i pixel = Vector2i(-1, -1);
+            Vector3f n;
+            Reservoir current;  //previous sample of _pixel_
+            Vector2i previousPixel = Vector2i(-1, -1);
+            Vector3f previousN;
+            Reservoir previous; //last sample of the pixel rendered before _pixel_
+        };
+        thread_local ReservoirHistory reservoirHistory;
+
+        const BxDFType directFlags = BxDFType((int)BxDFType::BSDF_ALL & ~(int)BxDFType::BSDF_SPECULAR);
+
+        // Re-evaluate a sample on an area light at shading point _it_
+        bool EvaluateAreaCandidate(const SurfaceInteraction &it, const Scene &scene, LightCandidate &candidate)
+        {
+            const Light &light = *scene._lights[candidate.light];
+            Vector3f d = candidate.pLight.p - it.p;
+            float dist2 = glm::length2(d);
+            if (dist2 == 0)
+                return false;
+            Vector3f wi = d / glm::sqrt(dist2);
+            Spectrum Li = static_cast<const AreaLight &>(light).L(candidate.pLight, -wi);
+            Spectrum f = it._bsdf->F(it.wo, wi, directFlags) * glm::abs(glm::dot(wi, it.n));
+            candidate.contrib = f * Li * (glm::abs(glm::dot(candidate.pLight.n, wi)) / dist2);
+            return true;
+        }
+
+        void MergeReservoir(Reservoir &r, const Reservoir &other, const SurfaceInteraction &it, const Scene &scene, float u)
+        {
+            if (other.M == 0)
+                return;
+            LightCandidate candidate = other.y;
+            float w = 0;
+            if (candidate.light >= 0 && candidate.onArea && EvaluateAreaCandidate(it, scene, candidate))
+                w = candidate.contrib.y() * other.W * other.M;
+            r.Update(candidate, w, other.M, u);
+        }
+    }
+
+    Spectrum ReservoirSampleLights(const SurfaceInteraction &it, const Scene &scene, MemoryArena &arena,
+                                   Sampler &sampler, const ReservoirSettings &settings,
+                                   const LightDistribution *lightDistrib, bool reuse, AOVSample *aov)
+    {
+        int nLights = int(scene._lights.size());
+        if (nLights == 0)
+            return Spectrum(0.f);
+
+        // Generate candidates and keep one by weighted reservoir sampling,
+        // the target function is the luminance of the unshadowed contribution
+        Reservoir r;
+        for (int i = 0; i < settings.candidates; ++i)
+        {
+            float lightPmf;
+            int lightIndex;
+            if (lightDistrib != nullptr)
+            {
+                lightIndex = lightDistrib->Sample(it, sampler.Get1D(), lightPmf);
+            }
+            else
+            {
+                lightIndex = glm::min((int)(sampler.Get1D() * nLights), nLights - 1);
+                lightPmf = float(1) / nLights;
+            }
+            Vector2f uLight = sampler.Get2D();
+            float uReservoir = sampler.Get1D();
+            if (lightIndex < 0 || lightPmf == 0)
+            {
+                r.Update(LightCandidate(), 0.f, 1.f, uReservoir);
+                continue;
+            }
+
+            const Light &light = *scene._lights[lightIndex];
+            Vector3f wi;
+            float lightPdf;
+            VisibilityTester visibility;
+            Spectrum Li = light.SampleLi(it, uLight, wi, lightPdf, visibility);
+            if (lightPdf == 0 || Li.isBlack())
+            {
+                r.Update(LightCandidate(), 0.f, 1.f, uReservoir);
+                continue;
+            }
+
+            LightCandidate candidate;
+            candidate.light = lightIndex;
+            candidate.pLight = visibility.P1();
+            Spectrum f = it._bsdf->F(it.wo, wi, directFlags) * glm::abs(glm::dot(wi, it.n));
+            candidate.contrib = f * Li;
+            float sourcePdf = lightPmf * lightPdf;
+
+            // Convert samples on area lights to area measure
+            candidate.onArea = (light._flags & (int)LightFlags::LightArea) != 0;
+            if (candidate.onArea)
+            {
+                float dist2 = glm::length2(candidate.pLight.p - it.p);
+                float G = glm::abs(glm::dot(candidate.pLight.n, wi)) / dist2;
+                if (dist2 == 0 || G == 0)
+                {
+                    r.Update(LightCandidate(), 0.f, 1.f, uReservoir);
+                    continue;
+                }
+                candidate.contrib *= G;
+                sourcePdf *= G;
+            }
+            r.Update(candidate, candidate.contrib.y() / sourcePdf, 1.f, uReservoir);
+        }
+        r.Finalize();
+
+        // Optionally combine with the reservoirs of the previous sample of this pixel (temporal)
+        // and of the neighbouring pixel rendered before it (spatial)
+        if (reuse && (settings.temporalReuse || settings.spatialReuse))
+        {
+            ReservoirHistory &history = reservoirHistory;
+            const Vector2i &pixel = sampler.CurrentPixel();
+            if (pixel != history.pixel)
+            {
+                history.previousPixel = history.pixel;
+                history.previousN = history.n;
+                history.previous = history.current;
+                history.pixel = pixel;
+                history.current = Reservoir();
+            }
+
+            // Note: only reuse reservoirs of shading points with similar normals
+            constexpr float minCosNormal = 0.9f;
+            bool merged = false;
+            if (settings.temporalReuse && history.current.M > 0 && glm::dot(history.n, it.n) > minCosNormal)
+            {
+                // Limit the history so that old samples do not dominate
+                Reservoir previous = history.current;
+                float maxM = 20.f * settings.candidates;
+                if (previous.M > maxM)
+                {
+                    previous.wSum *= maxM / previous.M;
+                    previous.M = maxM;
+                }
+                MergeReservoir(r, previous, it, scene, sampler.Get1D());
+                merged = true;
+            }
+            Vector2i offset = pixel - history.previousPixel;
+            if (settings.spatialReuse && history.previous.M > 0 && glm::abs(offset.x) + glm::abs(offset.y) == 1 &&
+                glm::dot(history.previousN, it.n) > minCosNormal)
+            {
+                MergeReservoir(r, history.previous, it, scene, sampler.Get1D());
+                merged = true;
+            }
+            if (merged)
+                r.Finalize();
+
+            history.current = r;
+            history.n = it.n;
+        }
+
+        if (r.y.light < 0 || r.W == 0)
+            return Spectrum(0.f);
+
+        // Trace a single shadow ray for the selected sample
+        if (!VisibilityTester(it, r.y.pLight).Unoccluded(scene))
+            return Spectrum(0.f);
+        Spectrum Ld = r.y.contrib * r.W;
+        if (aov)
+            aov->AddLight(r.y.light, Ld);
+        return Ld;
     }
 
     Spectrum EstimateDirect(const Interaction &it, const Vector2f &uScattering, const Light &light,
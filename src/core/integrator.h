@@ -9,6 +9,7 @@
 #include <core/film.h>
 #include <core/sampler.h>
 #include <core/object.h>
+#include <chrono>
 
 namespace platinum
 {
@@ -17,11 +18,79 @@ namespace platinum
     {
     public:
         virtual void Render(const Scene &scene) = 0;
+
+        /**
+         * @brief 渲染时先尝试从检查点文件恢复（仅对支持检查点的积分器有效）
+         */
+        void SetResume(bool resume) { _resume = resume; }
+
+    protected:
+        bool _resume = false;
+    };
+
+    /**
+     * @brief 自适应采样的参数。每个像素至少采样MinSPP次，之后当像素亮度估计的相对误差
+     *        低于Threshold时停止；节省下来的样本可以被其他未收敛的像素借用，直到MaxSPP。
+     */
+    struct AdaptiveSamplingSettings
+    {
+        bool enabled = false;
+        float threshold = 0.01f;
+        int64_t minSPP = 16;
+        int64_t maxSPP = 0;
+    };
+
+    /**
+     * @brief 渐进式渲染的参数。整幅图像按每遍PassSPP个样本分多遍渲染，每遍结束后写出图像，
+     *        达到采样器的SPP或TimeBudget（秒，0表示不限时）后停止。
+     */
+    struct ProgressiveSettings
+    {
+        bool enabled = false;
+        int64_t passSPP = 1;
+        float timeBudget = 0.f;
+    };
+
+    /**
+     * @brief 检查点的参数。渐进式渲染每遍结束后，若距离上次保存已超过Interval秒，
+     *        就把Film的累积缓冲和采样进度写入Filename，以便节点被抢占后用--resume继续渲染。
+     */
+    struct CheckpointSettings
+    {
+        bool enabled = false;
+        std::string filename;
+        float interval = 0.f;
+    };
+
+    /**
+     * @brief 直接光照的估计方式
+     *        UniformSampleAll: 对每个光源都采样；UniformSampleOne: 随机选择一个光源采样；
+     *        ReservoirResampling: 生成多个光源候选样本，用加权蓄水池采样（RIS）保留一个，只追踪一条阴影光线
+     */
+    enum class LightStrategy
+    {
+        UniformSampleAll,
+        UniformSampleOne,
+        ReservoirResampling
+    };
+
+    /**
+     * @brief 蓄水池重采样（RIS）的参数。Candidates为每个着色点生成的候选样本数；
+     *        SpatialReuse/TemporalReuse打开时，相机光线的第一个交点会合并同一tile中相邻像素/同一像素上一个样本的蓄水池
+     *        （有偏，但在法线相近的表面上能大幅降低噪声）。
+     */
+    struct ReservoirSettings
+    {
+        int candidates = 32;
+        bool spatialReuse = false;
+        bool temporalReuse = false;
     };
 
     class SamplerIntegrator : public Integrator
     {
     public:
+        SamplerIntegrator(const PropertyTree &root);
+
         SamplerIntegrator(UPtr<Camera> camera, UPtr<Sampler> sampler)
             : _camera(std::move(camera)), _sampler(std::move(sampler)) {}
 
@@ -36,6 +105,14 @@ namespace platinum
 
         void SetCamera(UPtr<Camera> camera) { _camera = std::move(camera); }
 
+        void SetAdaptiveSampling(const AdaptiveSamplingSettings &settings) { _adaptive = settings; }
+
+        void SetProgressive(const ProgressiveSettings &settings) { _progressive = settings; }
+
+        void SetCheckpoint(const CheckpointSettings &settings) { _checkpoint = settings; }
+
+        void SetReservoirSampling(const ReservoirSettings &settings) { _reservoir = settings; }
+
     protected:
         /**
          * @brief  Li() 方法计算有多少光照量沿着该 Ray 到达成像平面，
@@ -55,16 +132,89 @@ namespace platinum
         // 高光透射
         Spectrum SpecularTransmit(const Ray &ray, const SurfaceInteraction &inter, const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) const;
 
+        /**
+         * @brief 渲染一遍：每个像素采样编号为[firstSample, firstSample + sampleCount)的样本，并合并到Film中
+         *
+         * @param pass 当前是第几遍，用于给每个tile的采样器生成不同的种子
+         * @param deadline 截止时间，超过之后剩余的tile不再渲染；为nullptr时不限时
+         * @return true 所有tile都已渲染
+         * @return false 因超过截止时间跳过了部分tile
+         */
+        bool RenderPass(const Scene &scene, int64_t firstSample, int64_t sampleCount, int pass,
+                        const std::chrono::steady_clock::time_point *deadline = nullptr);
+
+        void RenderProgressive(const Scene &scene);
+
+        /**
+         * @brief 保存检查点：每个像素已完成的样本数及下一遍的编号，以及Film的累积缓冲
+         */
+        void SaveCheckpoint(int64_t samplesDone, int pass) const;
+
+        /**
+         * @brief 读取检查点，成功时返回已完成的样本数和下一遍的编号
+         */
+        bool LoadCheckpoint(int64_t &samplesDone, int &pass);
+
+        /**
+         * @brief 判断自适应采样时像素是否需要继续采样
+         *
+         * @param tile 当前像素所在的FilmTile，记录了像素的亮度统计量
+         * @param pixel 像素坐标
+         * @param n 该像素已采样的样本数
+         * @param spp 每个像素的平均样本预算
+         * @param budget 已收敛像素节省下来、可被其他像素借用的样本数
+         */
+        bool ContinueAdaptiveSampling(const FilmTile &tile, const Vector2i &pixel, int64_t n, int64_t spp,
+                                      std::atomic<int64_t> &budget) const;
+
+        /**
+         * @brief 相机光线第一个交点处的特征AOV：反照率（用一个BSDF样本估计）、朝向观察方向的法线及距离。
+         *        没有相交时反照率为1，法线和距离为0；没有BSDF的表面（如不带材质的光源）反照率为1
+         */
+        void FirstHitFeatures(const Scene &scene, const Ray &ray, Sampler &sampler, MemoryArena &arena,
+                              AOVSample &aov) const;
+
+        /**
+         * @brief 当前线程正在追踪的相机样本的AOV，Film不记录AOV时为nullptr。
+         *        Li()在相机光线的第一个交点处把自发光记入其中，并把它传给光源采样函数以记录直接光照
+         */
+        static AOVSample *PrimaryAOVSample();
+
     protected:
         UPtr<Camera> _camera;
         UPtr<Sampler> _sampler;
+        AdaptiveSamplingSettings _adaptive;
+        ProgressiveSettings _progressive;
+        CheckpointSettings _checkpoint;
+        ReservoirSettings _reservoir;
+
+    private:
+        int64_t _adaptive_spp = 0;
+        std::atomic<int64_t> _adaptive_budget{0};
     };
 
+    /**
+     * @brief 以下光源采样函数的aov不为空时，把每个光源的贡献记入aov的直接光照（只用于相机光线的第一个交点）
+     */
     Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene, MemoryArena &arena, Sampler &sampler,
-                                    const std::vector<int> &nLightSamples);
+                                    const std::vector<int> &nLightSamples, AOVSample *aov = nullptr);
     Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene, MemoryArena &arena,
                                    Sampler &sampler,
-                                   const Distribution1D *lightDistrib = nullptr);
+                                   const Distribution1D *lightDistrib = nullptr, AOVSample *aov = nullptr);
+    /**
+     * @brief 按lightDistrib在着色点it处选择一个光源并估计直接光照（如光源BVH）
+     */
+    Spectrum SampleOneLight(const Interaction &it, const Scene &scene, MemoryArena &arena,
+                            Sampler &sampler, const LightDistribution &lightDistrib, AOVSample *aov = nullptr);
+    /**
+     * @brief 用蓄水池重采样（RIS）估计着色点it处的直接光照：按lightDistrib（为空时均匀）选择光源，
+     *        生成settings.candidates个候选样本，以未遮挡的贡献为目标函数保留一个，只对它追踪阴影光线
+     * @param  reuse            是否允许与相邻像素/上一个样本的蓄水池合并（仅用于相机光线的第一个交点）
+     */
+    Spectrum ReservoirSampleLights(const SurfaceInteraction &it, const Scene &scene, MemoryArena &arena,
+                                   Sampler &sampler, const ReservoirSettings &settings,
+                                   const LightDistribution *lightDistrib = nullptr, bool reuse = false,
+                                   AOVSample *aov = nullptr);
     Spectrum EstimateDirect(const Interaction &it, const Vector2f &uShading,
                             const Light &light, const Vector2f &uLight,
                             const Scene &scene, Sampler &sampler,
@@ -31,7 +31,8 @@ namespace platinum
         inline Ray SpawnRayTo(const Vector3f &p2) const
         {
             Vector3f origin = p;
-            return Ray(origin, p2 - p, 1.f - ShadowEpsilon);
+            //Ray会把方向归一化，所以tMax要按距离给出
+            return Ray(origin, p2 - p, glm::length(p2 - p) * (1.f - ShadowEpsilon));
         }
 
         inline Ray SpawnRayTo(const Interaction &it) const
@@ -39,7 +40,7 @@ namespace platinum
             Vector3f origin = p;
             Vector3f target = it.p;
             Vector3f d = target - origin;
-            return Ray(origin, d, 1.f - ShadowEpsilon);
+            return Ray(origin, d, glm::length(d) * (1.f - ShadowEpsilon));
         }
 
         Vector3f p;  //surface point
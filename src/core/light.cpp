@@ -2,6 +2,9 @@
 
 #include <core/light.h>
 #include <core/scene.h>
+#include <glm/gtx/norm.hpp>
+#include <algorithm>
+#include <numeric>
 namespace platinum
 {
     bool VisibilityTester::Unoccluded(const Scene &scene) const
@@ -19,15 +22,45 @@ namespace platinum
     std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
         const std::string &name, const Scene &scene)
     {
+        if (name == "uniform" || scene._lights.size() == 1)
+            return std::unique_ptr<LightDistribution>{
+                new UniformLightDistribution(scene)};
+        else if (name == "power")
+            return std::unique_ptr<LightDistribution>{
+                new PowerLightDistribution(scene)};
+        else if (name == "bvh")
+            return std::unique_ptr<LightDistribution>{
+                new BVHLightDistribution(scene)};
+        else if (name == "spatial")
+            return std::unique_ptr<LightDistribution>{
+                new SpatialLightDistribution(scene)};
 
+        LOG(ERROR) << "Light sample distribution type \"" << name << "\" unknown. Using \"spatial\".";
         return std::unique_ptr<LightDistribution>{
-            new UniformLightDistribution(scene)};
+            new SpatialLightDistribution(scene)};
+    }
+
+    int LightDistribution::Sample(const Interaction &it, float u, float &pmf) const
+    {
+        const Distribution1D *distrib = Lookup(it.p);
+        if (distrib == nullptr || distrib->Count() == 0)
+        {
+            pmf = 0;
+            return -1;
+        }
+        return distrib->SampleDiscrete(u, &pmf);
+    }
 
-        //TODO:: other distribution type
+    float LightDistribution::Pmf(const Interaction &it, int lightIndex) const
+    {
+        const Distribution1D *distrib = Lookup(it.p);
+        return distrib == nullptr ? 0.f : distrib->DiscretePDF(lightIndex);
     }
 
     UniformLightDistribution::UniformLightDistribution(const Scene &scene)
     {
+        if (scene._lights.empty())
+            return;
         std::vector<float> prob(scene._lights.size(), float(1));
         distrib.reset(new Distribution1D(&prob[0], int(prob.size())));
     }
@@ -36,4 +69,555 @@ namespace platinum
     {
         return distrib.get();
     }
-}
\ No newline at end of file
+
+    PowerLightDistribution::PowerLightDistribution(const Scene &scene)
+    {
+        if (scene._lights.empty())
+            return;
+        std::vector<float> lightPower;
+        for (const auto &light : scene._lights)
+            lightPower.push_back(light->Power().y());
+        // Note: Distribution1D would return a zero pmf for every light if no light had any power
+        if (std::accumulate(lightPower.begin(), lightPower.end(), 0.f) == 0.f)
+            std::fill(lightPower.begin(), lightPower.end(), 1.f);
+        distrib.reset(new Distribution1D(&lightPower[0], int(lightPower.size())));
+    }
+
+    const Distribution1D *PowerLightDistribution::Lookup(const Vector3f &p) const
+    {
+        return distrib.get();
+    }
+
+    // A packed voxel position that can't be a valid one
+    static const uint64_t invalidPackedPos = 0xffffffffffffffff;
+
+    // Radical inverse in the first few prime bases, used to place the
+    // sample points in a voxel
+    static float RadicalInverse(int baseIndex, uint64_t a)
+    {
+        static const int primes[] = {2, 3, 5, 7, 11};
+        CHECK_LT(baseIndex, 5);
+        const uint64_t base = primes[baseIndex];
+        const float invBase = 1.f / base;
+        uint64_t reversedDigits = 0;
+        float invBaseN = 1;
+        while (a)
+        {
+            uint64_t next = a / base;
+            uint64_t digit = a - next * base;
+            reversedDigits = reversedDigits * base + digit;
+            invBaseN *= invBase;
+            a = next;
+        }
+        return glm::min(reversedDigits * invBaseN, OneMinusEpsilon);
+    }
+
+    SpatialLightDistribution::SpatialLightDistribution(const Scene &scene, int maxVoxels)
+        : _scene(scene), _power_distribution(scene)
+    {
+        // Compute the number of voxels so that the widest scene bounding box
+        // dimension has maxVoxels voxels and the other dimensions have a number
+        // of voxels so that voxels are roughly cube shaped.
+        Bounds3f b = scene.WorldBound();
+        Vector3f diag = b.Diagonal();
+        float bmax = diag[b.MaximumExtent()];
+        for (int i = 0; i < 3; ++i)
+        {
+            _num_voxels[i] = glm::max(1, int(glm::round(diag[i] / bmax * maxVoxels)));
+            // In the Lookup() method, we require that 20 or fewer bits be
+            // sufficient to represent each coordinate value. It's fairly hard
+            // to imagine that this would ever be a problem.
+            CHECK_LT(_num_voxels[i], 1 << 20);
+        }
+
+        _hash_table_size = 4 * size_t(_num_voxels[0]) * _num_voxels[1] * _num_voxels[2];
+        _hash_table.reset(new HashEntry[_hash_table_size]);
+        for (size_t i = 0; i < _hash_table_size; ++i)
+        {
+            _hash_table[i].packedPos.store(invalidPackedPos);
+            _hash_table[i].distribution.store(nullptr);
+        }
+
+        LOG(INFO) << "SpatialLightDistribution: scene bounds " << b << ", voxel res (" << _num_voxels[0] << ", "
+                  << _num_voxels[1] << ", " << _num_voxels[2] << ")";
+    }
+
+    SpatialLightDistribution::~SpatialLightDistribution()
+    {
+        // Gather statistics about how well the computed distributions are
+        // distributed in the hash table
+        size_t numEntries = 0;
+        for (size_t i = 0; i < _hash_table_size; ++i)
+        {
+            HashEntry &entry = _hash_table[i];
+            if (entry.distribution.load())
+            {
+                delete entry.distribution.load();
+                ++numEntries;
+            }
+        }
+        LOG(INFO) << "SpatialLightDistribution: used " << numEntries << " of " << _hash_table_size << " hash table entries";
+    }
+
+    const Distribution1D *SpatialLightDistribution::Lookup(const Vector3f &p) const
+    {
+        if (_scene._lights.empty())
+            return nullptr;
+
+        // First, compute integer voxel coordinates for the given point |p|
+        // with respect to the overall voxel grid.
+        Vector3f offset = _scene.WorldBound().Offset(p); // offset in [0,1].
+        Vector3i pi;
+        for (int i = 0; i < 3; ++i)
+            // The clamp should almost never be necessary, but is there to be
+            // robust to computed intersection points being slightly outside
+            // the scene bounds due to floating-point roundoff error.
+            pi[i] = glm::clamp(int(offset[i] * _num_voxels[i]), 0, _num_voxels[i] - 1);
+
+        // Pack the 3D integer voxel coordinates into a single 64-bit value.
+        uint64_t packedPos = (uint64_t(pi[0]) << 40) | (uint64_t(pi[1]) << 20) | pi[2];
+        CHECK_NE(packedPos, invalidPackedPos);
+
+        // Compute a hash value from the packed voxel coordinates. We could
+        // just take packedPos mod the hash table size, but since packedPos
+        // isn't necessarily well distributed on its own, it's worthwhile to do
+        // a little work to make sure that its bits values are individually
+        // fairly random. For details of and motivation for the following, see:
+        // http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
+        uint64_t hash = packedPos;
+        hash ^= (hash >> 31);
+        hash *= 0x7fb5d329728ea185;
+        hash ^= (hash >> 27);
+        hash *= 0x81dadef4bc2dd44d;
+        hash ^= (hash >> 33);
+        hash %= _hash_table_size;
+        CHECK_GE(hash, 0);
+
+        // Now, see if the hash table already has an entry for the voxel. We'll
+        // use quadratic probing when the hash table entry is already used for
+        // another value; step stores the square root of the probe step.
+        int step = 1;
+        while (true)
+        {
+            HashEntry &entry = _hash_table[hash];
+            // Does the hash table entry at offset |hash| match the current point?
+            uint64_t entryPackedPos = entry.packedPos.load(std::memory_order_acquire);
+            if (entryPackedPos == packedPos)
+            {
+                // Yes! Most of the time, there should already by a light
+                // sampling distribution available.
+                Distribution1D *dist = entry.distribution.load(std::memory_order_acquire);
+                if (dist == nullptr)
+                {
+                    // Rarely, another thread will have already done a lookup
+                    // at this point, found that there isn't a sampling
+                    // distribution, and will already be computing the
+                    // distribution for the point. In this case, we spin until
+                    // the sampling distribution is ready. We assume that this
+                    // is a rare case, so don't do anything more sophisticated
+                    // than spinning.
+                    while ((dist = entry.distribution.load(std::memory_order_acquire)) == nullptr)
+                        // spin :-(. If we were fancy, we'd have any threads
+                        // that hit this instead help out with computing the
+                        // distribution for the voxel...
+                        ;
+                }
+                // We have a valid sampling distribution.
+                return dist;
+            }
+            else if (entryPackedPos != invalidPackedPos)
+            {
+                // The hash table entry we're checking has already been
+                // allocated for another voxel. Advance to the next entry with
+                // quadratic probing.
+                hash += step * step;
+                if (hash >= _hash_table_size)
+                    hash %= _hash_table_size;
+                ++step;
+            }
+            else
+            {
+                // We have found an invalid entry. (Though this may have
+                // changed by the time we get to the compare_exchange below.)
+                // Try to claim it for the current voxel.
+                uint64_t invalid = invalidPackedPos;
+                if (entry.packedPos.compare_exchange_weak(invalid, packedPos))
+                {
+                    // Success; we've claimed this position for this voxel's
+                    // distribution. Now compute the sampling distribution and
+                    // add it to the hash table. As long as packedPos has been
+                    // set but the entry's distribution pointer is nullptr, any
+                    // other threads looking up the distribution for this voxel
+                    // will spin wait until the distribution pointer is
+                    // written.
+                    Distribution1D *dist = ComputeDistribution(pi);
+                    entry.distribution.store(dist, std::memory_order_release);
+                    return dist;
+                }
+            }
+        }
+    }
+
+    Distribution1D *SpatialLightDistribution::ComputeDistribution(const Vector3i &pi) const
+    {
+        // Compute the world-space bounding box of the voxel corresponding to
+        // |pi|.
+        const Bounds3f &worldBound = _scene.WorldBound();
+        Vector3f p0, p1;
+        for (int i = 0; i < 3; ++i)
+        {
+            p0[i] = lerp(float(pi[i]) / _num_voxels[i], worldBound._p_min[i], worldBound._p_max[i]);
+            p1[i] = lerp(float(pi[i] + 1) / _num_voxels[i], worldBound._p_min[i], worldBound._p_max[i]);
+        }
+
+        // Compute the sampling distribution. Sample a number of points inside
+        // voxelBounds using a 3D Halton sequence; at each one, sample each
+        // light source and compute a weight based on Li/pdf for the light's
+        // sample (ignoring visibility between the point in the voxel and the
+        // point on the light source) as an approximation to how much the light
+        // is likely to contribute to illumination in the voxel.
+        const int nSamples = 128;
+        std::vector<float> lightContrib(_scene._lights.size(), float(0));
+        for (int i = 0; i < nSamples; ++i)
+        {
+            Vector3f po(lerp(RadicalInverse(0, i), p0.x, p1.x),
+                        lerp(RadicalInverse(1, i), p0.y, p1.y),
+                        lerp(RadicalInverse(2, i), p0.z, p1.z));
+            Interaction intr(po);
+
+            // Use the next two Halton dimensions to sample a point on the
+            // light source.
+            Vector2f u(RadicalInverse(3, i), RadicalInverse(4, i));
+            for (size_t j = 0; j < _scene._lights.size(); ++j)
+            {
+                float pdf;
+                Vector3f wi;
+                VisibilityTester vis;
+                Spectrum Li = _scene._lights[j]->SampleLi(intr, u, wi, pdf, vis);
+                if (pdf > 0)
+                    lightContrib[j] += Li.y() / pdf;
+            }
+        }
+
+        // We don't want to leave any lights with a zero probability; it's
+        // possible that a light contributes to points in the voxel even though
+        // we didn't find such a point when sampling above. Therefore, compute
+        // a minimum (small) weight and ensure that all lights are given at
+        // least the corresponding probability.
+        float sumContrib = std::accumulate(lightContrib.begin(), lightContrib.end(), float(0));
+        if (sumContrib == 0)
+        {
+            // None of the lights was seen from the voxel, fall back to the lights' power
+            const Distribution1D *power = _power_distribution.Lookup(Vector3f(0.f));
+            return new Distribution1D(&power->func[0], power->Count());
+        }
+        float avgContrib = sumContrib / (nSamples * lightContrib.size());
+        float minContrib = .001f * avgContrib;
+        for (size_t i = 0; i < lightContrib.size(); ++i)
+            lightContrib[i] = glm::max(lightContrib[i], minContrib);
+
+        // Compute a sampling distribution from the accumulated contributions.
+        return new Distribution1D(&lightContrib[0], int(lightContrib.size()));
+    }
+
+    float LightBounds::Importance(const Vector3f &p, const Vector3f &n) const
+    {
+        // cos(max(0, a - b)) and sin(max(0, a - b)) given the sines and cosines of a and b
+        auto cosSubClamped = [](float sinTheta_a, float cosTheta_a, float sinTheta_b, float cosTheta_b) -> float
+        {
+            if (cosTheta_a > cosTheta_b)
+                return 1;
+            return cosTheta_a * cosTheta_b + sinTheta_a * sinTheta_b;
+        };
+        auto sinSubClamped = [](float sinTheta_a, float cosTheta_a, float sinTheta_b, float cosTheta_b) -> float
+        {
+            if (cosTheta_a > cosTheta_b)
+                return 0;
+            return sinTheta_a * cosTheta_b - cosTheta_a * sinTheta_b;
+        };
+        auto safeSqrt = [](float x) { return glm::sqrt(glm::max(0.f, x)); };
+
+        // Compute clamped squared distance to reference point
+        Vector3f pc = Centroid();
+        float d2 = glm::length2(p - pc);
+        d2 = glm::max(d2, glm::length(bounds.Diagonal()) / 2);
+
+        // Compute sine and cosine of angle to vector _w_, theta_w
+        Vector3f wi = d2 > 0 ? glm::normalize(p - pc) : Vector3f(0, 0, 1);
+        float cosTheta_w = glm::dot(w, wi);
+        if (twoSided)
+            cosTheta_w = glm::abs(cosTheta_w);
+        float sinTheta_w = safeSqrt(1 - cosTheta_w * cosTheta_w);
+
+        // Compute cos(theta_b) for reference point, the angle subtended by the bounds
+        Vector3f center = pc;
+        float radius = glm::distance(center, bounds._p_max);
+        float distance2 = glm::length2(p - center);
+        float cosTheta_b = distance2 < radius * radius ? -1.f : safeSqrt(1 - radius * radius / distance2);
+        float sinTheta_b = safeSqrt(1 - cosTheta_b * cosTheta_b);
+
+        // Compute cos(theta') and test against cos(theta_e)
+        float sinTheta_o = safeSqrt(1 - cosTheta_o * cosTheta_o);
+        float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+        float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+        float cosThetap = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+        if (cosThetap <= cosTheta_e)
+            return 0;
+
+        // Return final importance at reference point
+        float importance = phi * cosThetap / d2;
+
+        // Account for cos(theta_i) in importance at surfaces
+        if (n != Vector3f(0, 0, 0))
+        {
+            float cosTheta_i = glm::abs(glm::dot(wi, n));
+            float sinTheta_i = safeSqrt(1 - cosTheta_i * cosTheta_i);
+            importance *= cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+        }
+
+        return glm::max(importance, 0.f);
+    }
+
+    LightBounds Union(const LightBounds &a, const LightBounds &b)
+    {
+        // If one LightBounds has zero power, return the other
+        if (a.phi == 0)
+            return b;
+        if (b.phi == 0)
+            return a;
+
+        DirectionCone cone = Union(DirectionCone(a.w, a.cosTheta_o), DirectionCone(b.w, b.cosTheta_o));
+        return LightBounds(UnionBounds(a.bounds, b.bounds), cone.w, a.phi + b.phi, cone.cosTheta,
+                           glm::min(a.cosTheta_e, b.cosTheta_e), a.twoSided || b.twoSided);
+    }
+
+    BVHLightDistribution::BVHLightDistribution(const Scene &scene)
+    {
+        _bit_trails.assign(scene._lights.size(), -1);
+
+        std::vector<std::pair<int, LightBounds>> bvhLights;
+        for (size_t i = 0; i < scene._lights.size(); ++i)
+        {
+            LightBounds lightBounds;
+            if (!scene._lights[i]->GetLightBounds(lightBounds))
+            {
+                // Note: lights with zero power are never sampled
+                if (scene._lights[i]->_flags & (int)LightFlags::LightInfinite)
+                    _infinite_lights.push_back(int(i));
+            }
+            else if (lightBounds.phi > 0)
+            {
+                bvhLights.push_back(std::make_pair(int(i), lightBounds));
+            }
+        }
+
+        if (!bvhLights.empty())
+            BuildBVH(bvhLights, 0, int(bvhLights.size()), 0, 0);
+
+        LOG(INFO) << "Light BVH: " << bvhLights.size() << " bounded lights, " << _nodes.size() << " nodes, "
+                  << _infinite_lights.size() << " infinite lights";
+    }
+
+    int BVHLightDistribution::BuildBVH(std::vector<std::pair<int, LightBounds>> &lights, int start, int end,
+                                       uint64_t bitTrail, int depth)
+    {
+        DCHECK_LT(start, end);
+        // Initialize leaf node if only a single light remains
+        if (end - start == 1)
+        {
+            int nodeIndex = int(_nodes.size());
+            _nodes.push_back({lights[start].second, lights[start].first, true});
+            _bit_trails[lights[start].first] = int64_t(bitTrail);
+            return nodeIndex;
+        }
+        CHECK_LT(depth, 63) << "Light BVH is too deep";
+
+        // Compute bounds and centroid bounds for lights
+        Bounds3f bounds, centroidBounds;
+        for (int i = start; i < end; ++i)
+        {
+            bounds = UnionBounds(bounds, lights[i].second.bounds);
+            centroidBounds = UnionBounds(centroidBounds, lights[i].second.Centroid());
+        }
+
+        // Find the split with the lowest surface area orientation heuristic (SAOH) cost
+        constexpr int nBuckets = 12;
+        float minCost = Infinity;
+        int minCostSplitBucket = -1, minCostSplitDim = -1;
+        for (int dim = 0; dim < 3; ++dim)
+        {
+            // Compute minimum cost bucket for splitting along dimension _dim_
+            if (centroidBounds._p_max[dim] == centroidBounds._p_min[dim])
+                continue;
+
+            LightBounds bucketLightBounds[nBuckets];
+            for (int i = start; i < end; ++i)
+            {
+                Vector3f pc = lights[i].second.Centroid();
+                int b = int(nBuckets * centroidBounds.Offset(pc)[dim]);
+                b = glm::clamp(b, 0, nBuckets - 1);
+                bucketLightBounds[b] = Union(bucketLightBounds[b], lights[i].second);
+            }
+
+            // Compute costs for splitting lights after each bucket
+            for (int i = 0; i < nBuckets - 1; ++i)
+            {
+                LightBounds b0, b1;
+                for (int j = 0; j <= i; ++j)
+                    b0 = Union(b0, bucketLightBounds[j]);
+                for (int j = i + 1; j < nBuckets; ++j)
+                    b1 = Union(b1, bucketLightBounds[j]);
+
+                float cost = EvaluateCost(b0, bounds, dim) + EvaluateCost(b1, bounds, dim);
+                if (cost > 0 && cost < minCost)
+                {
+                    minCost = cost;
+                    minCostSplitBucket = i;
+                    minCostSplitDim = dim;
+                }
+            }
+        }
+
+        // Partition lights according to the chosen split, or in half if no split was found
+        int mid;
+        if (minCostSplitDim == -1)
+        {
+            mid = (start + end) / 2;
+        }
+        else
+        {
+            auto pmid = std::partition(lights.begin() + start, lights.begin() + end,
+                                       [=](const std::pair<int, LightBounds> &l)
+                                       {
+                                           int b = int(nBuckets * centroidBounds.Offset(l.second.Centroid())[minCostSplitDim]);
+                                           b = glm::clamp(b, 0, nBuckets - 1);
+                                           return b <= minCostSplitBucket;
+                                       });
+            mid = int(pmid - lights.begin());
+            if (mid == start || mid == end)
+                mid = (start + end) / 2;
+        }
+
+        // Allocate interior node and recursively initialize its children
+        int nodeIndex = int(_nodes.size());
+        _nodes.push_back({LightBounds(), -1, false});
+        BuildBVH(lights, start, mid, bitTrail, depth + 1);
+        int secondChild = BuildBVH(lights, mid, end, bitTrail | (uint64_t(1) << depth), depth + 1);
+
+        _nodes[nodeIndex].lightBounds = Union(_nodes[nodeIndex + 1].lightBounds, _nodes[secondChild].lightBounds);
+        _nodes[nodeIndex].childOrLightIndex = secondChild;
+        return nodeIndex;
+    }
+
+    float BVHLightDistribution::EvaluateCost(const LightBounds &b, const Bounds3f &bounds, int dim) const
+    {
+        if (b.phi == 0)
+            return 0;
+        // Evaluate direction bounds measure for LightBounds
+        float theta_o = glm::acos(glm::clamp(b.cosTheta_o, -1.f, 1.f));
+        float theta_e = glm::acos(glm::clamp(b.cosTheta_e, -1.f, 1.f));
+        float theta_w = glm::min(theta_o + theta_e, Pi);
+        float sinTheta_o = glm::sqrt(glm::max(0.f, 1 - b.cosTheta_o * b.cosTheta_o));
+        float M_omega = 2 * Pi * (1 - b.cosTheta_o) +
+                        Pi / 2 * (2 * theta_w * sinTheta_o - glm::cos(theta_o - 2 * theta_w) - 2 * theta_o * sinTheta_o + b.cosTheta_o);
+
+        // Return complete cost estimate, penalizing thin slabs of the node's bounds
+        Vector3f d = bounds.Diagonal();
+        float Kr = d[dim] > 0 ? maxComponent(d) / d[dim] : 1.f;
+        return b.phi * M_omega * Kr * b.bounds.SurfaceArea();
+    }
+
+    int BVHLightDistribution::Sample(const Interaction &it, float u, float &pmf) const
+    {
+        // Sample the infinite lights with probability _pInfinite_
+        float pInfinite = InfiniteProbability();
+        if (u < pInfinite)
+        {
+            u /= pInfinite;
+            int index = glm::min(int(u * _infinite_lights.size()), int(_infinite_lights.size()) - 1);
+            pmf = pInfinite / _infinite_lights.size();
+            return _infinite_lights[index];
+        }
+
+        if (_nodes.empty())
+        {
+            pmf = 0;
+            return -1;
+        }
+
+        // Traverse the light BVH, choosing children according to their importance
+        u = glm::min((u - pInfinite) / (1 - pInfinite), OneMinusEpsilon);
+        const Vector3f &p = it.p, &n = it.n;
+        int nodeIndex = 0;
+        pmf = 1 - pInfinite;
+        while (true)
+        {
+            const LightBVHNode &node = _nodes[nodeIndex];
+            if (node.isLeaf)
+            {
+                if (nodeIndex > 0 || node.lightBounds.Importance(p, n) > 0)
+                    return node.childOrLightIndex;
+                pmf = 0;
+                return -1;
+            }
+
+            // Compute the probability of the first child and descend
+            float ci[2] = {_nodes[nodeIndex + 1].lightBounds.Importance(p, n),
+                           _nodes[node.childOrLightIndex].lightBounds.Importance(p, n)};
+            if (ci[0] == 0 && ci[1] == 0)
+            {
+                pmf = 0;
+                return -1;
+            }
+            float p0 = ci[0] / (ci[0] + ci[1]);
+            if (u < p0)
+            {
+                u = glm::min(u / p0, OneMinusEpsilon);
+                pmf *= p0;
+                nodeIndex = nodeIndex + 1;
+            }
+            else
+            {
+                u = glm::min((u - p0) / (1 - p0), OneMinusEpsilon);
+                pmf *= 1 - p0;
+                nodeIndex = node.childOrLightIndex;
+            }
+        }
+    }
+
+    float BVHLightDistribution::Pmf(const Interaction &it, int lightIndex) const
+    {
+        if (lightIndex < 0 || lightIndex >= int(_bit_trails.size()))
+            return 0;
+
+        // Infinite lights are chosen uniformly
+        float pInfinite = InfiniteProbability();
+        if (_bit_trails[lightIndex] == -1)
+        {
+            if (std::find(_infinite_lights.begin(), _infinite_lights.end(), lightIndex) != _infinite_lights.end())
+                return pInfinite / _infinite_lights.size();
+            return 0;
+        }
+
+        // Follow the light's bit trail down the BVH, accumulating the probability of each choice
+        const Vector3f &p = it.p, &n = it.n;
+        uint64_t bitTrail = uint64_t(_bit_trails[lightIndex]);
+        int nodeIndex = 0;
+        float pmf = 1 - pInfinite;
+        while (true)
+        {
+            const LightBVHNode &node = _nodes[nodeIndex];
+            if (node.isLeaf)
+                return (nodeIndex > 0 || node.lightBounds.Importance(p, n) > 0) ? pmf : 0;
+
+            float ci[2] = {_nodes[nodeIndex + 1].lightBounds.Importance(p, n),
+                           _nodes[node.childOrLightIndex].lightBounds.Importance(p, n)};
+            int child = bitTrail & 1;
+            if (ci[child] == 0)
+                return 0;
+            pmf *= ci[child] / (ci[0] + ci[1]);
+            nodeIndex = child ? node.childOrLightIndex : nodeIndex + 1;
+            bitTrail >>= 1;
+        }
+    }
+}
@@ -8,6 +8,9 @@
 #include <core/spectrum.h>
 #include <math/transform.h>
 #include <core/object.h>
+#include <core/sampler.h>
+#include <core/shape.h>
+#include <atomic>
 namespace platinum
 {
     //隐含类型指定为int
@@ -24,6 +27,34 @@ namespace platinum
         return flags & (int)LightFlags::LightDeltaPosition || flags & (int)LightFlags::LightDeltaDirection;
     }
 
+    /**
+     * @brief 光源（或一组光源）发射的空间与方向范围，用于光源BVH的重要性估计
+     *        bounds: 发光表面的包围盒；phi: 发射功率；
+     *        法线都在以w为轴、cosTheta_o为半角余弦的锥内，发射方向与法线夹角不超过acos(cosTheta_e)
+     */
+    struct LightBounds
+    {
+        LightBounds() = default;
+
+        LightBounds(const Bounds3f &bounds, const Vector3f &w, float phi, float cosTheta_o, float cosTheta_e, bool twoSided)
+            : bounds(bounds), w(glm::normalize(w)), phi(phi), cosTheta_o(cosTheta_o), cosTheta_e(cosTheta_e), twoSided(twoSided) {}
+
+        Vector3f Centroid() const { return (bounds._p_min + bounds._p_max) * 0.5f; }
+
+        /**
+         * @brief 估计这些光源对位置p（法线为n，n为0时忽略）处的贡献
+         */
+        float Importance(const Vector3f &p, const Vector3f &n) const;
+
+        Bounds3f bounds;
+        Vector3f w;
+        float phi = 0;
+        float cosTheta_o = 1, cosTheta_e = 1;
+        bool twoSided = false;
+    };
+
+    LightBounds Union(const LightBounds &a, const LightBounds &b);
+
     class Light : public Object
     {
     public:
@@ -95,6 +126,11 @@ namespace platinum
          */
         virtual void Preprocess(const Scene &scene) {}
 
+        /**
+         * @brief 返回光源的LightBounds，无法界定空间范围的光源（如环境光）返回false
+         */
+        virtual bool GetLightBounds(LightBounds &bounds) const { return false; }
+
         int _flags;
         int _num_samples;
 
@@ -139,115 +175,6 @@ namespace platinum
         Interaction _p0, _p1;
     };
 
-    class Distribution1D
-    {
-    public:
-        Distribution1D(const float *f, int n) : func(f, f + n), cdf(n + 1)
-        {
-            // Compute integral of step function at $x_i$
-            cdf[0] = 0;
-            for (int i = 1; i < n + 1; ++i)
-                cdf[i] = cdf[i - 1] + func[i - 1] / n;
-
-            // Transform step function integral into CDF
-            funcInt = cdf[n];
-            if (funcInt == 0)
-            {
-                for (int i = 1; i < n + 1; ++i)
-                    cdf[i] = float(i) / float(n);
-            }
-            else
-            {
-                for (int i = 1; i < n + 1; ++i)
-                    cdf[i] /= funcInt;
-            }
-        }
-
-        int Count() const
-        {
-            return (int)func.size();
-        }
-
-        float SampleContinuous(float u, float *pdf, int *off = nullptr) const
-        {
-            // Find surrounding CDF segments and _offset_
-            int offset = findInterval((int)cdf.size(), [&](int index)
-                                      { return cdf[index] <= u; });
-
-            if (off)
-                *off = offset;
-
-            // Compute offset along CDF segment
-            float du = u - cdf[offset];
-            if ((cdf[offset + 1] - cdf[offset]) > 0)
-            {
-                CHECK_GT(cdf[offset + 1], cdf[offset]);
-                du /= (cdf[offset + 1] - cdf[offset]);
-            }
-            DCHECK(!glm::isnan(du));
-
-            // Compute PDF for sampled offset
-            if (pdf)
-                *pdf = (funcInt > 0) ? func[offset] / funcInt : 0;
-
-            // Return $x\in{}[0,1)$ corresponding to sample
-            return (offset + du) / Count();
-        }
-
-        int SampleDiscrete(float u, float *pdf = nullptr, float *uRemapped = nullptr) const
-        {
-            // Find surrounding CDF segments and _offset_
-            int offset = findInterval((int)cdf.size(), [&](int index)
-                                      { return cdf[index] <= u; });
-
-            if (pdf)
-                *pdf = (funcInt > 0) ? func[offset] / (funcInt * Count()) : 0;
-            if (uRemapped)
-                *uRemapped = (u - cdf[offset]) / (cdf[offset + 1] - cdf[offset]);
-            if (uRemapped)
-                CHECK(*uRemapped >= 0.f && *uRemapped <= 1.f);
-            return offset;
-        }
-
-        float DiscretePDF(int index) const
-        {
-            CHECK(index >= 0 && index < Count());
-            return func[index] / (funcInt * Count());
-        }
-
-        std::vector<float> func, cdf;
-        float funcInt;
-    };
-
-    class Distribution2D
-    {
-    public:
-        // Distribution2D Public Methods
-        Distribution2D(const float *data, int nu, int nv);
-        Vector2f SampleContinuous(const Vector2f &u, float *pdf) const
-        {
-            float pdfs[2];
-            int v;
-            float d1 = pMarginal->SampleContinuous(u[1], &pdfs[1], &v);
-            float d0 = pConditionalV[v]->SampleContinuous(u[0], &pdfs[0]);
-            *pdf = pdfs[0] * pdfs[1];
-            return Vector2f(d0, d1);
-        }
-        float Pdf(const Vector2f &p) const
-        {
-            int iu = glm::clamp(int(p[0] * pConditionalV[0]->Count()), 0,
-                                pConditionalV[0]->Count() - 1);
-            int iv =
-                glm::clamp(int(p[1] * pMarginal->Count()), 0, pMarginal->Count() - 1);
-            return pConditionalV[iv]->func[iu] / pMarginal->funcInt;
-        }
-
-    private:
-        // Distribution2D Private Data
-        std::vector<std::unique_ptr<Distribution1D>> pConditionalV;
-        std::unique_ptr<Distribution1D> pMarginal;
-    };
-
     // LightDistribution defines a general interface for classes that provide
     // probability distributions for sampling light sources at a given point in
     // space.
@@ -258,7 +185,22 @@ namespace platinum
 
         // Given a point |p| in space, this method returns a (hopefully
         // effective) sampling distribution for light sources at that point.
+        // Distributions that are not tabulated per point (e.g. the light BVH)
+        // return nullptr and are only accessible through Sample()/Pmf().
         virtual const Distribution1D *Lookup(const Vector3f &p) const = 0;
+
+        /**
+         * @brief 为着色点it选择一个光源
+         * @param  u                一维随机变量
+         * @param  pmf              返回选中该光源的概率
+         * @return int              光源在Scene::_lights中的下标，没有可选的光源时返回-1
+         */
+        virtual int Sample(const Interaction &it, float u, float &pmf) const;
+
+        /**
+         * @brief 在着色点it处选中下标为lightIndex的光源的概率
+         */
+        virtual float Pmf(const Interaction &it, int lightIndex) const;
     };
 
     // The simplest possible implementation of LightDistribution: this returns
@@ -279,6 +221,96 @@ namespace platinum
         std::unique_ptr<Distribution1D> distrib;
     };
 
+    /**
+     * @brief 按光源功率选择光源，与着色点位置无关
+     */
+    class PowerLightDistribution : public LightDistribution
+    {
+    public:
+        PowerLightDistribution(const Scene &scene);
+
+        virtual const Distribution1D *Lookup(const Vector3f &p) const override;
+
+    private:
+        std::unique_ptr<Distribution1D> distrib;
+    };
+
+    /**
+     * @brief 把场景包围盒划分为体素，第一次用到某个体素时，在体素内取若干点估计每个光源的贡献，
+     *        生成该体素的Distribution1D；结果存放在所有渲染线程共享的无锁哈希表中。
+     *        体素内所有光源的估计都为0时，退回到按功率选择光源。
+     */
+    class SpatialLightDistribution : public LightDistribution
+    {
+    public:
+        SpatialLightDistribution(const Scene &scene, int maxVoxels = 64);
+
+        ~SpatialLightDistribution();
+
+        virtual const Distribution1D *Lookup(const Vector3f &p) const override;
+
+    private:
+        // Compute the sampling distribution for the voxel with integer coordinates |pi|
+        Distribution1D *ComputeDistribution(const Vector3i &pi) const;
+
+        const Scene &_scene;
+        int _num_voxels[3];
+        PowerLightDistribution _power_distribution;
+
+        // The hash table is a fixed number of HashEntry structs (where we
+        // allocate more than enough entries in the SpatialLightDistribution
+        // constructor). During rendering, the table is allocated without
+        // locks, using atomic operations. (See the Lookup() method
+        // implementation for details.)
+        struct HashEntry
+        {
+            std::atomic<uint64_t> packedPos;
+            std::atomic<Distribution1D *> distribution;
+        };
+        mutable std::unique_ptr<HashEntry[]> _hash_table;
+        size_t _hash_table_size;
+    };
+
+    /**
+     * @brief 光源BVH（light tree）：按LightBounds把光源组织成二叉树，采样时从根节点出发，
+     *        按两个子节点对着色点的重要性随机选择子树，直到叶节点（单个光源）。
+     *        无法界定范围的光源（环境光）与整棵树一起均匀选择。
+     */
+    class BVHLightDistribution : public LightDistribution
+    {
+    public:
+        BVHLightDistribution(const Scene &scene);
+
+        virtual const Distribution1D *Lookup(const Vector3f &p) const override { return nullptr; }
+
+        virtual int Sample(const Interaction &it, float u, float &pmf) const override;
+
+        virtual float Pmf(const Interaction &it, int lightIndex) const override;
+
+    private:
+        struct LightBVHNode
+        {
+            LightBounds lightBounds;
+            int childOrLightIndex; //leaf: index of the light; interior: index of the second child (the first one follows the node)
+            bool isLeaf;
+        };
+
+        int BuildBVH(std::vector<std::pair<int, LightBounds>> &lights, int start, int end, uint64_t bitTrail, int depth);
+
+        float EvaluateCost(const LightBounds &b, const Bounds3f &bounds, int dim) const;
+
+        float InfiniteProbability() const
+        {
+            return _infinite_lights.empty() ? 0.f : float(_infinite_lights.size()) / float(_infinite_lights.size() + (_nodes.empty() ? 0 : 1));
+        }
+
+        std::vector<int> _infinite_lights;
+        std::vector<LightBVHNode> _nodes;
+        //Note: for every light, the path from the root to its leaf (bit i set: take the second child at depth i),
+        //      -1 if the light is not in the BVH
+        std::vector<int64_t> _bit_trails;
+    };
+
     std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
         const std::string &name, const Scene &scene);
 }
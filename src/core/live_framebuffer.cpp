@@ -0,0 +1,114 @@
+
+
+#include <core/live_framebuffer.h>
+#include <cstring>
+#include <new>
+
+#ifdef PLT_IS_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace platinum
+{
+    namespace
+    {
+        // Pixels start on a cache line
+        constexpr size_t LiveHeaderSize = (sizeof(LiveFramebufferHeader) + 63) / 64 * 64;
+    }
+
+    bool LiveFramebuffer::Open(const std::string &filename, int width, int height)
+    {
+        Close();
+        const size_t size = LiveHeaderSize + 3 * sizeof(float) * size_t(width) * height;
+        void *memory = nullptr;
+
+#ifdef PLT_IS_WINDOWS
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                  nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            LOG(ERROR) << "Cannot create live framebuffer " << filename;
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(uint64_t(size) >> 32), DWORD(size), nullptr);
+        if (mapping)
+            memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (!memory)
+        {
+            LOG(ERROR) << "Cannot map live framebuffer " << filename;
+            if (mapping)
+                CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+        _file = file;
+        _mapping = mapping;
+#else
+        int file = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (file < 0)
+        {
+            LOG(ERROR) << "Cannot create live framebuffer " << filename;
+            return false;
+        }
+        // Note: truncate to 0 first, so that a stale image of the same size does not show through
+        if (ftruncate(file, 0) != 0 || ftruncate(file, off_t(size)) != 0)
+        {
+            LOG(ERROR) << "Cannot resize live framebuffer " << filename << " to " << size << " bytes";
+            close(file);
+            return false;
+        }
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        if (memory == MAP_FAILED)
+        {
+            LOG(ERROR) << "Cannot map live framebuffer " << filename;
+            close(file);
+            return false;
+        }
+        _file = file;
+#endif
+
+        _size = size;
+        _header = new (memory) LiveFramebufferHeader;
+        _pixels = reinterpret_cast<float *>(static_cast<char *>(memory) + LiveHeaderSize);
+        std::memcpy(_header->magic, "PTLIVEFB", 8);
+        _header->version = 2;
+        _header->headerSize = uint32_t(LiveHeaderSize);
+        _header->width = width;
+        _header->height = height;
+        _header->channels = 3;
+        _header->updateCount = 0;
+        _header->samplesDone = 0;
+        _header->passSamples = 0;
+        _header->totalSamples = 0;
+        _header->passTilesDone = 0;
+        _header->passTiles = 0;
+        _header->progressUnit = LiveFramebufferHeader::SamplesPerPixel;
+        _header->state.store(LiveFramebufferHeader::Starting, std::memory_order_release);
+
+        LOG(INFO) << "Publishing the live framebuffer to " << filename;
+        return true;
+    }
+
+    void LiveFramebuffer::Close()
+    {
+        if (!_header)
+            return;
+#ifdef PLT_IS_WINDOWS
+        UnmapViewOfFile(_header);
+        CloseHandle(_mapping);
+        CloseHandle(_file);
+        _file = _mapping = nullptr;
+#else
+        munmap(_header, _size);
+        close(_file);
+        _file = -1;
+#endif
+        _header = nullptr;
+        _pixels = nullptr;
+        _size = 0;
+    }
+}
@@ -0,0 +1,98 @@
+
+
+#ifndef CORE_LIVE_FRAMEBUFFER_H_
+#define CORE_LIVE_FRAMEBUFFER_H_
+
+#include <core/utilities.h>
+#include <atomic>
+#include <string>
+
+namespace platinum
+{
+    /**
+     * @brief Layout of the start of a live framebuffer file, followed at headerSize bytes by
+     *        width * height interleaved float RGB pixels (linear, normalized, top row first).
+     *        All fields are little endian on the supported platforms.
+     *
+     *        Readers map the file read-only and poll updateCount: it is incremented after every
+     *        update of the pixels. Single pixels may be read while they are being written, a viewer
+     *        that needs a consistent frame copies the pixels until updateCount stays the same.
+     */
+    struct LiveFramebufferHeader
+    {
+        enum State : uint32_t
+        {
+            Starting = 0,
+            Rendering = 1,
+            Finished = 2
+        };
+
+        enum ProgressUnit : uint32_t
+        {
+            SamplesPerPixel = 0,
+            Iterations = 1 //e.g. SPPM, one iteration per pass
+        };
+
+        char magic[8];       //"PTLIVEFB"
+        uint32_t version;    //2
+        uint32_t headerSize; //offset of the pixels in bytes
+        int32_t width, height;
+        int32_t channels; //3
+        std::atomic<uint32_t> state;
+        std::atomic<uint64_t> updateCount;
+
+        // Progress: samplesDone samples per pixel were finished before the current pass of passSamples,
+        // out of totalSamples; passTilesDone of passTiles tiles of the pass are merged (0 tiles if unknown).
+        // The three counts are in progressUnit, integrators without samples per pixel count iterations.
+        std::atomic<int64_t> samplesDone, passSamples, totalSamples;
+        std::atomic<int32_t> passTilesDone, passTiles;
+        std::atomic<uint32_t> progressUnit;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<int64_t>::is_always_lock_free,
+                  "the live framebuffer header is shared between processes");
+
+    /**
+     * @brief A file mapped into memory that the film publishes its image to while rendering,
+     *        e.g. /dev/shm/platinum.live, so that viewers watch the render without the renderer
+     *        encoding any image. The file is resized to fit and overwritten.
+     */
+    class LiveFramebuffer
+    {
+    public:
+        LiveFramebuffer() = default;
+        LiveFramebuffer(const LiveFramebuffer &) = delete;
+        LiveFramebuffer &operator=(const LiveFramebuffer &) = delete;
+        ~LiveFramebuffer() { Close(); }
+
+        bool Open(const std::string &filename, int width, int height);
+
+        void Close();
+
+        bool IsOpen() const { return _header != nullptr; }
+
+        LiveFramebufferHeader *GetHeader() const { return _header; }
+
+        /**
+         * @brief The first pixel of row y
+         */
+        float *GetRow(int y) const { return _pixels + 3 * size_t(y) * _header->width; }
+
+        /**
+         * @brief Tell readers that pixels changed.
+         */
+        void Publish() const { _header->updateCount.fetch_add(1, std::memory_order_release); }
+
+    private:
+        LiveFramebufferHeader *_header = nullptr;
+        float *_pixels = nullptr;
+        size_t _size = 0;
+#ifdef PLT_IS_WINDOWS
+        void *_file = nullptr, *_mapping = nullptr;
+#else
+        int _file = -1;
+#endif
+    };
+}
+
+#endif
@@ -2,8 +2,10 @@
 
 #include <fstream>
 #include <exception>
+#include <unordered_set>
 #include <material/matte.h>
 #include <light/diffuse_light.h>
+#include <light/mesh_light.h>
 #include <accelerator/linear.h>
 #include <material/mirror.h>
 #include <integrator/whitted_integrator.h>
@@ -45,9 +47,11 @@ namespace platinum
 
             ParseObject(root);
 
+            //网格光源被多个图元共享，只加入一次
+            std::unordered_set<const AreaLight *> added_lights;
             for (const auto &p : _primitives)
             {
-                if (p->GetAreaLight())
+                if (p->GetAreaLight() && added_lights.insert(p->GetAreaLight()).second)
                 {
                     _scene->_lights.emplace_back(std::static_pointer_cast<Light>(dynamic_cast<GeometricPrimitive *>(p.get())->GetAreaLightPtr()));
                 }
@@ -117,31 +121,34 @@ namespace platinum
         }
         material = _materials[mat_string.get()];
 
-        auto is_emit = root.GetChildOptional("Emission");
+        //整个发光网格共用一个光源，而不是每个三角形一个DiffuseAreaLight
+        Ptr<AreaLight> area_light = nullptr;
+        if (auto is_emit = root.GetChildOptional("Emission"))
+        {
+            auto mesh_light = Ptr<MeshAreaLight>(static_cast<MeshAreaLight *>(ObjectFactory::CreateInstance("MeshAreaLight", is_emit.get())));
+            mesh_light->SetMesh(mesh.get(), obj2world, world2obj);
+            area_light = mesh_light;
+        }
 
         auto &meshIndices = mesh->GetIndices();
-        _primitives.reserve(_primitives.size() + meshIndices.size() / 3 + 1);
+        const size_t num_triangles = meshIndices.size() / 3;
+        _primitives.reserve(_primitives.size() + num_triangles);
 
         if (meshIndices.size() > 20)
         {
             std::mutex mtx;
-            tbb::parallel_for(tbb::blocked_range<size_t>(0, meshIndices.size()),
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, num_triangles),
                               [&](tbb::blocked_range<size_t> r)
                               {
                                   std::vector<Ptr<Primitive>> local_vec;
-                                  local_vec.reserve(r.size()/3+1);
-                                  for (auto i = r.begin(); i < r.end() - 2; ++i)
+                                  local_vec.reserve(r.size());
+                                  for (auto i = r.begin(); i < r.end(); ++i)
                                   {
                                       std::array<int, 3> indices;
-                                      indices[0] = meshIndices[i + 0];
-                                      indices[1] = meshIndices[i + 1];
-                                      indices[2] = meshIndices[i + 2];
+                                      indices[0] = meshIndices[3 * i + 0];
+                                      indices[1] = meshIndices[3 * i + 1];
+                                      indices[2] = meshIndices[3 * i + 2];
                                       auto triangle = std::make_shared<Triangle>(obj2world, world2obj, indices, mesh.get());
-                                      Ptr<AreaLight> area_light = nullptr;
-                                      if (is_emit)
-                                      {
-                                          area_light = Ptr<AreaLight>(static_cast<AreaLight *>(ObjectFactory::CreateInstance("DiffuseAreaLight", is_emit.get())));
-                                      }
                                       local_vec.emplace_back(std::make_shared<GeometricPrimitive>(triangle, material.get(), area_light));
                                   }
                                   std::lock_guard lck(mtx);
@@ -151,18 +158,13 @@ namespace platinum
         //串行
         else
         {
-            for (size_t i = 0; i < meshIndices.size(); i += 3)
+            for (size_t i = 0; i < num_triangles; ++i)
             {
                 std::array<int, 3> indices;
-                indices[0] = meshIndices[i + 0];
-                indices[1] = meshIndices[i + 1];
-                indices[2] = meshIndices[i + 2];
+                indices[0] = meshIndices[3 * i + 0];
+                indices[1] = meshIndices[3 * i + 1];
+                indices[2] = meshIndices[3 * i + 2];
                 auto triangle = std::make_shared<Triangle>(obj2world, world2obj, indices, mesh.get());
-                Ptr<AreaLight> area_light = nullptr;
-                if (is_emit)
-                {
-                    area_light = Ptr<AreaLight>(static_cast<AreaLight *>(ObjectFactory::CreateInstance("DiffuseAreaLight", is_emit.get())));
-                }
                 _primitives.emplace_back(std::make_shared<GeometricPrimitive>(triangle, material.get(), area_light));
             }
         }
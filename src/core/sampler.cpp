@@ -2,16 +2,26 @@
 
 #include <core/sampler.h>
 #include <core/camera.h>
+#include <core/filter.h>
 namespace platinum
 {
 
     Sampler::Sampler(const PropertyTree &root) : _samplesPerPixel(root.Get<int64_t>("SPP"))
     {
     }
-    CameraSample Sampler::GetCameraSample(const Vector2i &p_raster, Filter *flter)
+    CameraSample Sampler::GetCameraSample(const Vector2i &p_raster, const Filter *filter)
     {
         CameraSample cs;
-        cs.p_film = (Vector2f)p_raster + Get2D();
+        if (filter == nullptr)
+        {
+            cs.p_film = (Vector2f)p_raster + Get2D();
+        }
+        else
+        {
+            // Note: filter importance sampling, the sample is distributed around the pixel center
+            //       according to the filter and only contributes to pixel p_raster.
+            cs.p_film = (Vector2f)p_raster + Vector2f(0.5f, 0.5f) + filter->Sample(Get2D(), &cs.filter_weight);
+        }
         return cs;
     }
 
@@ -70,4 +80,190 @@ namespace platinum
         return &_sampleArray2D[_array2DOffset++][_currentPixelSampleIndex * n];
     }
 
+    std::array<float, 3> SampleSphericalTriangle(const std::array<Vector3f, 3> &v, const Vector3f &p,
+                                                 const Vector2f &u, float *pdf)
+    {
+        auto safeSqrt = [](float x) { return glm::sqrt(glm::max(0.f, x)); };
+        // Numerically robust angle between two normalized vectors
+        auto angleBetween = [](const Vector3f &v1, const Vector3f &v2)
+        {
+            if (glm::dot(v1, v2) < 0)
+                return Pi - 2 * glm::asin(glm::clamp(glm::length(v1 + v2) / 2, -1.f, 1.f));
+            return 2 * glm::asin(glm::clamp(glm::length(v2 - v1) / 2, -1.f, 1.f));
+        };
+        // Component of v orthogonal to the normalized vector w
+        auto gramSchmidt = [](const Vector3f &v, const Vector3f &w) { return v - glm::dot(v, w) * w; };
+
+        *pdf = 0;
+        // Compute vectors _a_, _b_, and _c_ to spherical triangle vertices
+        Vector3f a = glm::normalize(v[0] - p), b = glm::normalize(v[1] - p), c = glm::normalize(v[2] - p);
+
+        // Compute normalized cross products of all direction pairs
+        Vector3f n_ab = glm::cross(a, b), n_bc = glm::cross(b, c), n_ca = glm::cross(c, a);
+        if (glm::dot(n_ab, n_ab) == 0 || glm::dot(n_bc, n_bc) == 0 || glm::dot(n_ca, n_ca) == 0)
+            return {1.f / 3, 1.f / 3, 1.f / 3};
+        n_ab = glm::normalize(n_ab);
+        n_bc = glm::normalize(n_bc);
+        n_ca = glm::normalize(n_ca);
+
+        // Find angles alpha, beta and gamma at spherical triangle vertices
+        float alpha = angleBetween(n_ab, -n_ca);
+        float beta = angleBetween(n_bc, -n_ab);
+        float gamma = angleBetween(n_ca, -n_bc);
+
+        // Uniformly sample triangle area A to compute A'
+        float A_pi = alpha + beta + gamma;
+        float Ap_pi = lerp(u[0], Pi, A_pi);
+        float A = A_pi - Pi;
+        if (A <= 0)
+            return {1.f / 3, 1.f / 3, 1.f / 3};
+        *pdf = 1 / A;
+
+        // Find cos(beta') for point along _b_ for sampled area
+        float cosAlpha = glm::cos(alpha), sinAlpha = glm::sin(alpha);
+        float sinPhi = glm::sin(Ap_pi) * cosAlpha - glm::cos(Ap_pi) * sinAlpha;
+        float cosPhi = glm::cos(Ap_pi) * cosAlpha + glm::sin(Ap_pi) * sinAlpha;
+        float k1 = cosPhi + cosAlpha;
+        float k2 = sinPhi - sinAlpha * glm::dot(a, b) /* cos c */;
+        float cosBp = (k2 + (k2 * cosPhi - k1 * sinPhi) * cosAlpha) / ((k2 * sinPhi + k1 * cosPhi) * sinAlpha);
+        // Happens if the triangle basically covers the entire hemisphere
+        cosBp = glm::clamp(cosBp, -1.f, 1.f);
+
+        // Sample c' along the arc between b' and a
+        float sinBp = safeSqrt(1 - cosBp * cosBp);
+        Vector3f cp = cosBp * a + sinBp * glm::normalize(gramSchmidt(c, a));
+
+        // Compute sampled spherical triangle direction
+        float cosTheta = 1 - u[1] * (1 - glm::dot(cp, b));
+        float sinTheta = safeSqrt(1 - cosTheta * cosTheta);
+        Vector3f w = cosTheta * b + sinTheta * glm::normalize(gramSchmidt(cp, b));
+
+        // Find barycentric coordinates for sampled direction _w_
+        Vector3f e1 = v[1] - v[0], e2 = v[2] - v[0];
+        Vector3f s1 = glm::cross(w, e2);
+        float divisor = glm::dot(s1, e1);
+        if (divisor == 0)
+        {
+            // This happens with triangles that cover (nearly) the whole
+            // hemisphere.
+            return {1.f / 3, 1.f / 3, 1.f / 3};
+        }
+        float invDivisor = 1 / divisor;
+        Vector3f s = p - v[0];
+        float b1 = glm::dot(s, s1) * invDivisor;
+        float b2 = glm::dot(w, glm::cross(s, e1)) * invDivisor;
+
+        // Return clamped barycentrics for sampled direction
+        b1 = glm::clamp(b1, 0.f, 1.f);
+        b2 = glm::clamp(b2, 0.f, 1.f);
+        if (b1 + b2 > 1)
+        {
+            float sum = b1 + b2;
+            b1 /= sum;
+            b2 /= sum;
+        }
+        return {1 - b1 - b2, b1, b2};
+    }
+
+    namespace
+    {
+        // Spherical rectangle in the local frame of Ureña et al.: the rectangle spans
+        // [x0, x1] x [y0, y1] in the plane z = z0 < 0, with the reference point at the origin
+        struct SphericalRectangle
+        {
+            SphericalRectangle(const Vector3f &pRef, const Vector3f &s, const Vector3f &ex, const Vector3f &ey)
+            {
+                float exl = glm::length(ex), eyl = glm::length(ey);
+                x = ex / exl;
+                y = ey / eyl;
+                z = glm::cross(x, y);
+                Vector3f d = s - pRef;
+                x0 = glm::dot(d, x);
+                y0 = glm::dot(d, y);
+                z0 = glm::dot(d, z);
+                // flip 'z' to make it point against the rectangle
+                if (z0 > 0)
+                {
+                    z = -z;
+                    z0 = -z0;
+                }
+                x1 = x0 + exl;
+                y1 = y0 + eyl;
+
+                // Find plane normals to rectangle edges and compute internal angles
+                Vector3f v00(x0, y0, z0), v01(x0, y1, z0);
+                Vector3f v10(x1, y0, z0), v11(x1, y1, z0);
+                n0 = glm::normalize(glm::cross(v00, v10));
+                n1 = glm::normalize(glm::cross(v10, v11));
+                n2 = glm::normalize(glm::cross(v11, v01));
+                n3 = glm::normalize(glm::cross(v01, v00));
+                g0 = glm::acos(glm::clamp(glm::dot(-n0, n1), -1.f, 1.f));
+                g1 = glm::acos(glm::clamp(glm::dot(-n1, n2), -1.f, 1.f));
+                g2 = glm::acos(glm::clamp(glm::dot(-n2, n3), -1.f, 1.f));
+                g3 = glm::acos(glm::clamp(glm::dot(-n3, n0), -1.f, 1.f));
+                solidAngle = (z0 == 0) ? 0.f : g0 + g1 + g2 + g3 - 2 * Pi;
+            }
+
+            Vector3f x, y, z;
+            float x0, y0, z0, x1, y1;
+            Vector3f n0, n1, n2, n3;
+            float g0, g1, g2, g3;
+            float solidAngle;
+        };
+    }
+
+    Vector3f SampleSphericalRectangle(const Vector3f &pRef, const Vector3f &s, const Vector3f &ex, const Vector3f &ey,
+                                      const Vector2f &u, float *pdf)
+    {
+        SphericalRectangle r(pRef, s, ex, ey);
+        if (!(r.solidAngle > 0))
+        {
+            *pdf = 0;
+            return s + u[0] * ex + u[1] * ey;
+        }
+        *pdf = 1 / r.solidAngle;
+
+        // Sample _cu_ for spherical rectangle sample
+        float b0 = r.n0.z, b1 = r.n2.z;
+        float au = u[0] * (r.g0 + r.g1 - 2 * Pi) + (u[0] - 1) * (r.g2 + r.g3);
+        float fu = (glm::cos(au) * b0 - b1) / glm::sin(au);
+        float cu = std::copysign(1 / glm::sqrt(fu * fu + b0 * b0), fu);
+        cu = glm::clamp(cu, -OneMinusEpsilon, OneMinusEpsilon); // avoid NaNs
+
+        // Find _xu_ along x edge for spherical rectangle sample
+        float xu = -(cu * r.z0) / glm::sqrt(glm::max(0.f, 1 - cu * cu));
+        xu = glm::clamp(xu, r.x0, r.x1);
+
+        // Find _yv_ along y edge for spherical rectangle sample
+        float dd = glm::sqrt(xu * xu + r.z0 * r.z0);
+        float h0 = r.y0 / glm::sqrt(dd * dd + r.y0 * r.y0);
+        float h1 = r.y1 / glm::sqrt(dd * dd + r.y1 * r.y1);
+        float hv = h0 + u[1] * (h1 - h0), hvsq = hv * hv;
+        float yv = (hvsq < 1 - 1e-6f) ? (hv * dd) / glm::sqrt(1 - hvsq) : r.y1;
+
+        // Return spherical rectangle sample in original coordinate system
+        return pRef + r.x * xu + r.y * yv + r.z * r.z0;
+    }
+
+    float SphericalRectangleSolidAngle(const Vector3f &pRef, const Vector3f &s, const Vector3f &ex, const Vector3f &ey)
+    {
+        return glm::max(0.f, SphericalRectangle(pRef, s, ex, ey).solidAngle);
+    }
+
+    Distribution2D::Distribution2D(const float *func, int nu, int nv)
+    {
+        pConditionalV.reserve(nv);
+        for (int v = 0; v < nv; ++v)
+        {
+            // Compute conditional sampling distribution for $\tilde{v}$
+            pConditionalV.emplace_back(new Distribution1D(&func[v * nu], nu));
+        }
+        // Compute marginal sampling distribution $p[\tilde{v}]$
+        std::vector<float> marginalFunc;
+        marginalFunc.reserve(nv);
+        for (int v = 0; v < nv; ++v)
+            marginalFunc.push_back(pConditionalV[v]->funcInt);
+        pMarginal.reset(new Distribution1D(&marginalFunc[0], nv));
+    }
+
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include <core/utilities.h>
 #include <core/object.h>
+#include <array>
 
 namespace platinum
 {
@@ -44,7 +45,12 @@ namespace platinum
          */
         virtual Vector2f Get2D() = 0;
 
-        CameraSample GetCameraSample(const Vector2i &p_raster, Filter *flter = nullptr);
+        /**
+         * @brief 为像素p_raster生成相机样本
+         * @param  filter           不为空时按滤波器函数对样本位置做重要性采样（filter importance sampling），
+         *                          样本只累加到p_raster这一个像素上，权重为CameraSample::filter_weight
+         */
+        CameraSample GetCameraSample(const Vector2i &p_raster, const Filter *filter = nullptr);
 
         // 申请一个长度为n的一维随机变量数组
         void Request1DArray(int n);
@@ -102,7 +108,23 @@ namespace platinum
             return _currentPixelSampleIndex;
         }
 
-        const int64_t _samplesPerPixel;
+        const Vector2i &CurrentPixel() const
+        {
+            return _currentPixel;
+        }
+
+        /**
+         * @brief 修改每个像素的样本数（如自适应采样时的最大样本数）
+         *        必须在Request1DArray/Request2DArray之前调用，因为样本数组的长度依赖于它
+         * @param  spp              每个像素的样本数
+         */
+        void SetSamplesPerPixel(int64_t spp)
+        {
+            CHECK(_sampleArray1D.empty() && _sampleArray2D.empty());
+            _samplesPerPixel = spp;
+        }
+
+        int64_t _samplesPerPixel;
 
     protected:
         // 当前处理的像素点
@@ -186,6 +208,28 @@ namespace platinum
         return Vector2f(1 - su0, u[1] * su0);
     }
 
+    /**
+     * @brief 按立体角均匀采样从p看到的球面三角形v（Arvo 1995）
+     * @param  pdf              返回关于立体角的pdf，三角形退化时为0
+     * @return std::array<float, 3> 采样点在三角形上的重心坐标
+     */
+    std::array<float, 3> SampleSphericalTriangle(const std::array<Vector3f, 3> &v, const Vector3f &p,
+                                                 const Vector2f &u, float *pdf);
+
+    /**
+     * @brief 按立体角均匀采样从pRef看到的球面矩形（Ureña 2013）
+     * @param  s                矩形的一个顶点，ex、ey为从s出发且相互垂直的两条边
+     * @param  pdf              返回关于立体角的pdf，矩形退化时为0
+     * @return Vector3f         矩形上的采样点
+     */
+    Vector3f SampleSphericalRectangle(const Vector3f &pRef, const Vector3f &s, const Vector3f &ex, const Vector3f &ey,
+                                      const Vector2f &u, float *pdf);
+
+    /**
+     * @brief 从pRef看到的矩形（定义同SampleSphericalRectangle）所张的立体角
+     */
+    float SphericalRectangleSolidAngle(const Vector3f &pRef, const Vector3f &s, const Vector3f &ex, const Vector3f &ey);
+
     inline float UniformConePdf(float cosThetaMax) { return 1 / (2 * Pi * (1 - cosThetaMax)); }
 
     inline float BalanceHeuristic(int nf, float fPdf, int ng, float gPdf)
@@ -198,6 +242,184 @@ namespace platinum
         float f = nf * fPdf, g = ng * gPdf;
         return (f * f) / (f * f + g * g);
     }
+
+    /**
+     * @brief 分段常数的一维分布。除CDF外还建立了别名表（alias method），离散采样是O(1)，
+     *        不需要在CDF上二分查找；连续采样仍然反演CDF，保持u的顺序，从而保留样本的分层结构
+     */
+    class Distribution1D
+    {
+    public:
+        Distribution1D(const float *f, int n) : func(f, f + n), cdf(n + 1)
+        {
+            // Compute integral of step function at $x_i$
+            cdf[0] = 0;
+            for (int i = 1; i < n + 1; ++i)
+                cdf[i] = cdf[i - 1] + func[i - 1] / n;
+
+            // Transform step function integral into CDF
+            funcInt = cdf[n];
+            if (funcInt == 0)
+            {
+                for (int i = 1; i < n + 1; ++i)
+                    cdf[i] = float(i) / float(n);
+            }
+            else
+            {
+                for (int i = 1; i < n + 1; ++i)
+                    cdf[i] /= funcInt;
+            }
+
+            BuildAliasTable();
+        }
+
+        int Count() const
+        {
+            return (int)func.size();
+        }
+
+        float SampleContinuous(float u, float *pdf, int *off = nullptr) const
+        {
+            // Note: not the alias table, which shuffles the segments: inverting the CDF is
+            //       monotonic in u and keeps stratified and low-discrepancy samples well distributed.
+            // Find surrounding CDF segments and _offset_
+            int offset = findInterval((int)cdf.size(), [&](int index)
+                                      { return cdf[index] <= u; });
+
+            if (off)
+                *off = offset;
+
+            // Compute offset along CDF segment
+            float du = u - cdf[offset];
+            if ((cdf[offset + 1] - cdf[offset]) > 0)
+            {
+                CHECK_GT(cdf[offset + 1], cdf[offset]);
+                du /= (cdf[offset + 1] - cdf[offset]);
+            }
+            DCHECK(!glm::isnan(du));
+
+            // Compute PDF for sampled offset
+            if (pdf)
+                *pdf = (funcInt > 0) ? func[offset] / funcInt : 0;
+
+            // Return $x\in{}[0,1)$ corresponding to sample
+            return (offset + du) / Count();
+        }
+
+        int SampleDiscrete(float u, float *pdf = nullptr, float *uRemapped = nullptr) const
+        {
+            float du;
+            int offset = SampleAlias(u, &du);
+
+            if (pdf)
+                *pdf = (funcInt > 0) ? func[offset] / (funcInt * Count()) : 0;
+            if (uRemapped)
+            {
+                *uRemapped = du;
+                CHECK(*uRemapped >= 0.f && *uRemapped <= 1.f);
+            }
+            return offset;
+        }
+
+        float DiscretePDF(int index) const
+        {
+            CHECK(index >= 0 && index < Count());
+            return func[index] / (funcInt * Count());
+        }
+
+        std::vector<float> func, cdf;
+        float funcInt;
+
+    private:
+        /**
+         * @brief 别名表：第i个格子以aliasProb[i]的概率选中i，否则选中alias[i]
+         */
+        void BuildAliasTable()
+        {
+            // Vose's algorithm
+            int n = Count();
+            aliasProb.assign(n, 1.f);
+            alias.resize(n);
+            std::vector<double> p(n);
+            std::vector<int> small, large;
+            for (int i = 0; i < n; ++i)
+            {
+                alias[i] = i;
+                // Note: sampling an all-zero function falls back to uniform, as with the CDF
+                p[i] = (funcInt > 0) ? double(func[i]) / double(funcInt) : 1.0;
+                if (p[i] < 1.0)
+                    small.push_back(i);
+                else
+                    large.push_back(i);
+            }
+            while (!small.empty() && !large.empty())
+            {
+                int s = small.back(), l = large.back();
+                small.pop_back();
+                large.pop_back();
+                aliasProb[s] = float(p[s]);
+                alias[s] = l;
+                p[l] = (p[l] + p[s]) - 1.0;
+                if (p[l] < 1.0)
+                    small.push_back(l);
+                else
+                    large.push_back(l);
+            }
+            // Remaining entries are (up to round-off) exactly one
+            for (int i : small)
+                aliasProb[i] = 1.f;
+            for (int i : large)
+                aliasProb[i] = 1.f;
+        }
+
+        int SampleAlias(float u, float *uRemapped) const
+        {
+            int n = Count();
+            float un = u * n;
+            int cell = glm::min(int(un), n - 1);
+            float up = glm::min(un - cell, OneMinusEpsilon);
+            float q = aliasProb[cell];
+            if (up < q)
+            {
+                *uRemapped = glm::min(up / q, OneMinusEpsilon);
+                return cell;
+            }
+            *uRemapped = glm::min((up - q) / (1 - q), OneMinusEpsilon);
+            return alias[cell];
+        }
+
+        std::vector<float> aliasProb;
+        std::vector<int> alias;
+    };
+
+    class Distribution2D
+    {
+    public:
+        // Distribution2D Public Methods
+        Distribution2D(const float *data, int nu, int nv);
+        Vector2f SampleContinuous(const Vector2f &u, float *pdf) const
+        {
+            float pdfs[2];
+            int v;
+            float d1 = pMarginal->SampleContinuous(u[1], &pdfs[1], &v);
+            float d0 = pConditionalV[v]->SampleContinuous(u[0], &pdfs[0]);
+            *pdf = pdfs[0] * pdfs[1];
+            return Vector2f(d0, d1);
+        }
+        float Pdf(const Vector2f &p) const
+        {
+            int iu = glm::clamp(int(p[0] * pConditionalV[0]->Count()), 0,
+                                pConditionalV[0]->Count() - 1);
+            int iv =
+                glm::clamp(int(p[1] * pMarginal->Count()), 0, pMarginal->Count() - 1);
+            return pConditionalV[iv]->func[iu] / pMarginal->funcInt;
+        }
+
+    private:
+        // Distribution2D Private Data
+        std::vector<std::unique_ptr<Distribution1D>> pConditionalV;
+        std::unique_ptr<Distribution1D> pMarginal;
+    };
 }
 
 #endif
\ No newline at end of file
@@ -9,6 +9,38 @@
 namespace platinum
 {
 
+    DirectionCone Union(const DirectionCone &a, const DirectionCone &b)
+    {
+        // Handle the cases where one or both cones are empty
+        if (a.IsEmpty())
+            return b;
+        if (b.IsEmpty())
+            return a;
+
+        // Handle the cases where one cone is inside the other
+        float theta_a = glm::acos(glm::clamp(a.cosTheta, -1.f, 1.f));
+        float theta_b = glm::acos(glm::clamp(b.cosTheta, -1.f, 1.f));
+        float theta_d = glm::acos(glm::clamp(glm::dot(a.w, b.w), -1.f, 1.f));
+        if (glm::min(theta_d + theta_b, Pi) <= theta_a)
+            return a;
+        if (glm::min(theta_d + theta_a, Pi) <= theta_b)
+            return b;
+
+        // Compute the spread angle of the merged cone, theta_o
+        float theta_o = (theta_a + theta_d + theta_b) / 2;
+        if (theta_o >= Pi)
+            return DirectionCone::EntireSphere();
+
+        // Rotate a.w around a.w x b.w by theta_o - theta_a to get the merged cone's axis
+        float theta_r = theta_o - theta_a;
+        Vector3f wr = glm::cross(a.w, b.w);
+        if (glm::length2(wr) == 0)
+            return DirectionCone::EntireSphere();
+        wr = glm::normalize(wr);
+        Vector3f w = a.w * glm::cos(theta_r) + glm::cross(wr, a.w) * glm::sin(theta_r);
+        return DirectionCone(w, glm::cos(theta_o));
+    }
+
     bool Shape::Hit(const Ray &ray) const
     {
         float t_hit = ray._t_max;
@@ -56,7 +88,7 @@ namespace platinum
         float pdf = glm::distance2(ref.p, inter_light.p) / (glm::abs(glm::dot(inter_light.n, -wi)) * Area());
         if (std::isinf(pdf))
             pdf = 0.f;
-        return 1.f;
+        return pdf;
     }
 
     float Shape::SolidAngle(const Vector3f &p, int nSamples) const
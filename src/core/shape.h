@@ -8,6 +8,25 @@
 #include <core/object.h>
 namespace platinum
 {
+    /**
+     * @brief 方向锥：以w为轴、半角余弦为cosTheta的一组方向，用于约束曲面法线（如光源BVH）
+     */
+    struct DirectionCone
+    {
+        DirectionCone() = default;
+
+        DirectionCone(const Vector3f &w, float cosTheta) : w(glm::normalize(w)), cosTheta(cosTheta) {}
+
+        bool IsEmpty() const { return cosTheta == Infinity; }
+
+        static DirectionCone EntireSphere() { return DirectionCone(Vector3f(0, 0, 1), -1); }
+
+        Vector3f w;
+        float cosTheta = Infinity;
+    };
+
+    DirectionCone Union(const DirectionCone &a, const DirectionCone &b);
+
     class Shape : public Object
     {
     public:
@@ -18,7 +37,7 @@ namespace platinum
 
         virtual ~Shape() = default;
 
-        void SetTransform(Transform *objectToWorld, Transform *worldToObject);
+        virtual void SetTransform(Transform *objectToWorld, Transform *worldToObject);
 
         virtual Bounds3f ObjectBound() const = 0;
 
@@ -50,6 +69,11 @@ namespace platinum
 
         virtual float Area() const = 0;
 
+        /**
+         * @brief 曲面法线（朝向与Sample()返回的法线一致）的方向范围，默认为整个球面
+         */
+        virtual DirectionCone NormalBounds() const { return DirectionCone::EntireSphere(); }
+
         // Sample a point on the surface of the shape and return the PDF with
         // respect to area on the surface.
         virtual Interaction Sample(const Vector2f &u, float &pdf) const = 0;
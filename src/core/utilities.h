@@ -235,6 +235,49 @@
         return f;
     }
 
+    // IEEE 754 half precision, rounded to nearest even; too large values become infinity
+    inline uint16_t floatToHalf(float f)
+    {
+        uint32_t bits = floatToBits(f);
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t abs = bits & 0x7fffffff;
+        if (abs >= 0x7f800000) //Inf or NaN
+            return uint16_t(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0));
+        if (abs >= 0x477ff000) //rounds to 65536 or more
+            return uint16_t(sign | 0x7c00);
+        if (abs >= 0x38800000) //normal
+        {
+            uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1);
+            return uint16_t(sign | ((rounded >> 13) - (112 << 10)));
+        }
+        // Subnormal, in units of 2^-24
+        int shift = 126 - int(abs >> 23);
+        if (shift > 24)
+            return uint16_t(sign);
+        uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        uint32_t h = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (h & 1)))
+            ++h;
+        return uint16_t(sign | h);
+    }
+
+    inline float halfToFloat(uint16_t h)
+    {
+        uint32_t sign = uint32_t(h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        if (exponent == 0)
+        {
+            // Zero or subnormal
+            float f = std::ldexp(float(mantissa), -24);
+            return sign ? -f : f;
+        }
+        if (exponent == 31)
+            return bitsToFloat(sign | 0x7f800000 | (mantissa << 13));
+        return bitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+    }
+
     inline void stringPrintfRecursive(std::string *s, const char *fmt)
     {
         const char *c = fmt;
@@ -0,0 +1,6 @@
+#include <filter/gaussian_filter.h>
+
+namespace platinum
+{
+    REGISTER_CLASS(GaussianFilter, "Gaussian");
+}
@@ -0,0 +1,46 @@
+#ifndef FILTER_GAUSSIAN_FILTER_H_
+#define FILTER_GAUSSIAN_FILTER_H_
+
+#include <core/filter.h>
+
+namespace platinum
+{
+    /**
+     * @brief Gaussian filter, shifted down so that it falls to zero at the radius
+     */
+    class GaussianFilter final : public Filter
+    {
+    public:
+        GaussianFilter(const PropertyTree &node) : Filter(node), _alpha(node.Get<float>("Alpha", 2.f))
+        {
+            Initialize();
+            LOG(INFO) << "Filter: GaussianFilter";
+        }
+
+        GaussianFilter(const Vector2f &radius, float alpha) : Filter(radius), _alpha(alpha) { Initialize(); }
+
+        virtual std::string ToString() const { return "GaussianFilter"; }
+
+        virtual float Evaluate(const Vector2f &p) const override
+        {
+            return Gaussian(p.x, _exp_x) * Gaussian(p.y, _exp_y);
+        }
+
+    private:
+        void Initialize()
+        {
+            _exp_x = glm::exp(-_alpha * _radius.x * _radius.x);
+            _exp_y = glm::exp(-_alpha * _radius.y * _radius.y);
+        }
+
+        float Gaussian(float d, float expv) const
+        {
+            return glm::max(0.f, float(glm::exp(-_alpha * d * d) - expv));
+        }
+
+        const float _alpha;
+        float _exp_x, _exp_y;
+    };
+}
+
+#endif
@@ -0,0 +1,6 @@
+#include <filter/mitchell_filter.h>
+
+namespace platinum
+{
+    REGISTER_CLASS(MitchellFilter, "Mitchell");
+}
@@ -0,0 +1,47 @@
+#ifndef FILTER_MITCHELL_FILTER_H_
+#define FILTER_MITCHELL_FILTER_H_
+
+#include <core/filter.h>
+
+namespace platinum
+{
+    /**
+     * @brief Mitchell-Netravali filter. Note that it has negative lobes.
+     */
+    class MitchellFilter final : public Filter
+    {
+    public:
+        MitchellFilter(const PropertyTree &node)
+            : Filter(node), _B(node.Get<float>("B", 1.f / 3.f)), _C(node.Get<float>("C", 1.f / 3.f))
+        {
+            LOG(INFO) << "Filter: MitchellFilter";
+        }
+
+        MitchellFilter(const Vector2f &radius, float B, float C) : Filter(radius), _B(B), _C(C) {}
+
+        virtual std::string ToString() const { return "MitchellFilter"; }
+
+        virtual float Evaluate(const Vector2f &p) const override
+        {
+            return Mitchell1D(p.x * _inv_radius.x) * Mitchell1D(p.y * _inv_radius.y);
+        }
+
+    private:
+        float Mitchell1D(float x) const
+        {
+            x = glm::abs(2 * x);
+            if (x > 1)
+                return ((-_B - 6 * _C) * x * x * x + (6 * _B + 30 * _C) * x * x +
+                        (-12 * _B - 48 * _C) * x + (8 * _B + 24 * _C)) *
+                       (1.f / 6.f);
+            else
+                return ((12 - 9 * _B - 6 * _C) * x * x * x +
+                        (-18 + 12 * _B + 6 * _C) * x * x + (6 - 2 * _B)) *
+                       (1.f / 6.f);
+        }
+
+        const float _B, _C;
+    };
+}
+
+#endif
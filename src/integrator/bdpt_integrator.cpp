@@ -0,0 +1,642 @@
+
+
+#include <integrator/bdpt_integrator.h>
+#include <core/bsdf.h>
+#include <glm/gtx/norm.hpp>
+
+namespace platinum
+{
+    REGISTER_CLASS(BDPTIntegrator, "BDPT");
+
+    namespace
+    {
+        using LightIndexMap = std::unordered_map<const Light *, int>;
+
+        /**
+         * @brief 在作用域内临时修改一个变量，离开作用域时恢复原值（用于计算MIS权重时改写顶点的pdf）
+         */
+        template <typename Type>
+        class ScopedAssignment
+        {
+        public:
+            ScopedAssignment(Type *target = nullptr, Type value = Type()) : _target(target)
+            {
+                if (_target)
+                {
+                    _backup = *_target;
+                    *_target = value;
+                }
+            }
+
+            ~ScopedAssignment()
+            {
+                if (_target)
+                    *_target = _backup;
+            }
+
+            ScopedAssignment(const ScopedAssignment &) = delete;
+
+            ScopedAssignment &operator=(const ScopedAssignment &) = delete;
+
+            ScopedAssignment &operator=(ScopedAssignment &&other)
+            {
+                if (_target)
+                    *_target = _backup;
+                _target = other._target;
+                _backup = other._backup;
+                other._target = nullptr;
+                return *this;
+            }
+
+        private:
+            Type *_target;
+            Type _backup;
+        };
+
+        enum class VertexType
+        {
+            Camera,
+            Light,
+            Surface
+        };
+
+        float InfiniteLightDensity(const Scene &scene, const Distribution1D &lightDistr,
+                                   const LightIndexMap &lightToIndex, const Vector3f &w);
+
+        /**
+         * @brief 子路径上的一个顶点。端点（相机、光源）只用到si的p与n；
+         *        pdfFwd为生成该顶点的（关于面积的）pdf，pdfRev为从反方向生成它的pdf，用于MIS
+         */
+        struct Vertex
+        {
+            VertexType type = VertexType::Surface;
+            Spectrum beta = Spectrum(0.f);
+            SurfaceInteraction si;
+            const Camera *camera = nullptr;
+            const Light *light = nullptr; //逃逸到环境中的相机子路径终点为nullptr
+            bool delta = false;
+            float pdfFwd = 0, pdfRev = 0;
+
+            static Vertex CreateCamera(const Camera *camera, const Ray &ray, const Spectrum &beta)
+            {
+                Vertex v;
+                v.type = VertexType::Camera;
+                v.camera = camera;
+                v.si.p = ray._origin;
+                v.beta = beta;
+                return v;
+            }
+
+            static Vertex CreateCamera(const Camera *camera, const Interaction &it, const Spectrum &beta)
+            {
+                Vertex v;
+                v.type = VertexType::Camera;
+                v.camera = camera;
+                v.si.p = it.p;
+                v.si.n = it.n;
+                v.beta = beta;
+                return v;
+            }
+
+            static Vertex CreateLight(const Light *light, const Ray &ray, const Vector3f &nLight,
+                                      const Spectrum &Le, float pdf)
+            {
+                Vertex v;
+                v.type = VertexType::Light;
+                v.light = light;
+                v.si.p = ray._origin;
+                v.si.n = nLight;
+                v.beta = Le;
+                v.pdfFwd = pdf;
+                return v;
+            }
+
+            static Vertex CreateLight(const Light *light, const Interaction &it, const Spectrum &beta, float pdf)
+            {
+                Vertex v;
+                v.type = VertexType::Light;
+                v.light = light;
+                v.si.p = it.p;
+                v.si.n = it.n;
+                v.beta = beta;
+                v.pdfFwd = pdf;
+                return v;
+            }
+
+            //相机光线逃逸出场景：用ray上t = 1处的点代表环境光
+            static Vertex CreateEscaped(const Ray &ray, const Spectrum &beta, float pdf)
+            {
+                Vertex v;
+                v.type = VertexType::Light;
+                v.si.p = ray.GetPointAt(1.f);
+                v.si.n = -ray._direction;
+                v.beta = beta;
+                v.pdfFwd = pdf;
+                return v;
+            }
+
+            static Vertex CreateSurface(const SurfaceInteraction &si, const Spectrum &beta, float pdf, const Vertex &prev)
+            {
+                Vertex v;
+                v.type = VertexType::Surface;
+                v.si = si;
+                v.beta = beta;
+                v.pdfFwd = prev.ConvertDensity(pdf, v);
+                return v;
+            }
+
+            const Vector3f &p() const { return si.p; }
+
+            const Vector3f &n() const { return si.n; }
+
+            bool IsOnSurface() const { return si.n != Vector3f(0.f); }
+
+            Spectrum f(const Vertex &next) const
+            {
+                Vector3f wi = next.p() - p();
+                if (glm::length2(wi) == 0 || type != VertexType::Surface)
+                    return Spectrum(0.f);
+                return si._bsdf->F(si.wo, glm::normalize(wi));
+            }
+
+            bool IsConnectible() const
+            {
+                switch (type)
+                {
+                case VertexType::Light:
+                    return !light || (light->_flags & (int)LightFlags::LightDeltaDirection) == 0;
+                case VertexType::Camera:
+                    return true;
+                case VertexType::Surface:
+                    return si._bsdf->NumComponents(BxDFType((int)BxDFType::BSDF_ALL & ~(int)BxDFType::BSDF_SPECULAR)) > 0;
+                }
+                return false;
+            }
+
+            const AreaLight *GetAreaLight() const
+            {
+                return (type == VertexType::Surface && si._hitable) ? si._hitable->GetAreaLight() : nullptr;
+            }
+
+            bool IsLight() const { return type == VertexType::Light || GetAreaLight(); }
+
+            bool IsDeltaLight() const { return type == VertexType::Light && light && platinum::IsDeltaLight(light->_flags); }
+
+            bool IsInfiniteLight() const
+            {
+                return type == VertexType::Light &&
+                       (!light || light->_flags & (int)LightFlags::LightInfinite ||
+                        light->_flags & (int)LightFlags::LightDeltaDirection);
+            }
+
+            /**
+             * @brief 该顶点（光源）向顶点v发出的辐射度
+             */
+            Spectrum Le(const Scene &scene, const Vertex &v) const
+            {
+                if (!IsLight())
+                    return Spectrum(0.f);
+                Vector3f w = v.p() - p();
+                if (glm::length2(w) == 0)
+                    return Spectrum(0.f);
+                w = glm::normalize(w);
+                if (IsInfiniteLight())
+                {
+                    Spectrum Le(0.f);
+                    for (const auto &light : scene._infinite_lights)
+                        Le += light->Le(Ray(p(), -w));
+                    return Le;
+                }
+                return GetAreaLight()->L(si, w);
+            }
+
+            /**
+             * @brief 把关于立体角的pdf转换为关于顶点next处面积的pdf
+             */
+            float ConvertDensity(float pdf, const Vertex &next) const
+            {
+                if (next.IsInfiniteLight())
+                    return pdf;
+                Vector3f w = next.p() - p();
+                float dist2 = glm::length2(w);
+                if (dist2 == 0)
+                    return 0;
+                float invDist2 = 1 / dist2;
+                if (next.IsOnSurface())
+                    pdf *= glm::abs(glm::dot(next.n(), w * glm::sqrt(invDist2)));
+                return pdf * invDist2;
+            }
+
+            /**
+             * @brief 路径经过prev、本顶点后生成next的pdf（关于next处的面积）
+             */
+            float Pdf(const Scene &scene, const Vertex *prev, const Vertex &next) const
+            {
+                if (type == VertexType::Light)
+                    return PdfLight(scene, next);
+
+                Vector3f wn = next.p() - p();
+                if (glm::length2(wn) == 0)
+                    return 0;
+                wn = glm::normalize(wn);
+
+                float pdf = 0, unused;
+                if (type == VertexType::Camera)
+                {
+                    camera->PdfWe(si.SpawnRay(wn), unused, pdf);
+                }
+                else
+                {
+                    Vector3f wp = glm::normalize(prev->p() - p());
+                    pdf = si._bsdf->Pdf(wp, wn);
+                }
+                return ConvertDensity(pdf, next);
+            }
+
+            /**
+             * @brief 光源（本顶点）向v发射的方向pdf（关于v处的面积）
+             */
+            float PdfLight(const Scene &scene, const Vertex &v) const
+            {
+                Vector3f w = v.p() - p();
+                float invDist2 = 1 / glm::length2(w);
+                w *= glm::sqrt(invDist2);
+
+                float pdf;
+                if (IsInfiniteLight())
+                {
+                    //环境光的光线从垂直于方向、半径为场景包围球半径的圆盘上出发
+                    Vector3f worldCenter;
+                    float worldRadius;
+                    scene.WorldBound().BoundingSphere(&worldCenter, &worldRadius);
+                    pdf = 1 / (Pi * worldRadius * worldRadius);
+                }
+                else
+                {
+                    const Light *l = type == VertexType::Light ? light : GetAreaLight();
+                    float pdfPos, pdfDir;
+                    l->PdfLe(Ray(p(), w), n(), pdfPos, pdfDir);
+                    pdf = pdfDir * invDist2;
+                }
+                if (v.IsOnSurface())
+                    pdf *= glm::abs(glm::dot(v.n(), w));
+                return pdf;
+            }
+
+            /**
+             * @brief 选择该光源并在其上生成本顶点（朝向v）的pdf
+             */
+            float PdfLightOrigin(const Scene &scene, const Vertex &v, const Distribution1D &lightDistr,
+                                 const LightIndexMap &lightToIndex) const
+            {
+                Vector3f w = v.p() - p();
+                if (glm::length2(w) == 0)
+                    return 0;
+                w = glm::normalize(w);
+                if (IsInfiniteLight())
+                    return InfiniteLightDensity(scene, lightDistr, lightToIndex, w);
+
+                const Light *l = type == VertexType::Light ? light : GetAreaLight();
+                auto it = lightToIndex.find(l);
+                if (it == lightToIndex.end())
+                    return 0;
+                float pdfPos, pdfDir;
+                l->PdfLe(Ray(p(), w), n(), pdfPos, pdfDir);
+                return pdfPos * lightDistr.DiscretePDF(it->second);
+            }
+        };
+
+        float InfiniteLightDensity(const Scene &scene, const Distribution1D &lightDistr,
+                                   const LightIndexMap &lightToIndex, const Vector3f &w)
+        {
+            float pdf = 0;
+            for (const auto &light : scene._infinite_lights)
+            {
+                auto it = lightToIndex.find(light.get());
+                if (it != lightToIndex.end())
+                    pdf += light->PdfLi(Interaction(), -w) * lightDistr.DiscretePDF(it->second);
+            }
+            return pdf;
+        }
+
+        Vertex *AllocVertices(MemoryArena &arena, int n)
+        {
+            Vertex *vertices = static_cast<Vertex *>(arena.Alloc(n * sizeof(Vertex)));
+            for (int i = 0; i < n; ++i)
+                new (&vertices[i]) Vertex();
+            return vertices;
+        }
+
+        /**
+         * @brief 从ray开始随机游走，把最多maxDepth个顶点写入path。path[-1]必须是路径的起点（相机或光源）
+         */
+        int RandomWalk(const Scene &scene, Ray ray, Sampler &sampler, MemoryArena &arena, Spectrum beta,
+                       float pdf, int maxDepth, bool fromCamera, Vertex *path)
+        {
+            if (maxDepth == 0)
+                return 0;
+            int bounces = 0;
+            float pdfFwd = pdf, pdfRev = 0;
+            while (true)
+            {
+                SurfaceInteraction isect;
+                bool hit = scene.Hit(ray, isect);
+                if (beta.isBlack())
+                    break;
+                Vertex &vertex = path[bounces], &prev = path[bounces - 1];
+                if (!hit)
+                {
+                    //只有相机子路径需要记录环境光顶点
+                    if (fromCamera)
+                    {
+                        vertex = Vertex::CreateEscaped(ray, beta, pdfFwd);
+                        ++bounces;
+                    }
+                    break;
+                }
+
+                isect.ComputeScatteringFunctions(ray, arena);
+                if (!isect._bsdf)
+                {
+                    ray = isect.SpawnRay(ray._direction);
+                    continue;
+                }
+
+                vertex = Vertex::CreateSurface(isect, beta, pdfFwd, prev);
+                if (++bounces >= maxDepth)
+                    break;
+
+                Vector3f wi, wo = isect.wo;
+                BxDFType type;
+                Spectrum f = isect._bsdf->SampleF(wo, wi, sampler.Get2D(), pdfFwd, type);
+                if (f.isBlack() || pdfFwd == 0)
+                    break;
+                beta *= f * glm::abs(glm::dot(wi, isect.n)) / pdfFwd;
+                pdfRev = isect._bsdf->Pdf(wi, wo);
+                if ((int)type & (int)BxDFType::BSDF_SPECULAR)
+                {
+                    vertex.delta = true;
+                    pdfRev = pdfFwd = 0;
+                }
+                ray = isect.SpawnRay(wi);
+                prev.pdfRev = vertex.ConvertDensity(pdfRev, prev);
+            }
+            return bounces;
+        }
+
+        int GenerateCameraSubpath(const Scene &scene, Sampler &sampler, MemoryArena &arena, int maxDepth,
+                                  const Camera &camera, const Ray &ray, Vertex *path)
+        {
+            if (maxDepth == 0)
+                return 0;
+            Spectrum beta(1.f);
+            path[0] = Vertex::CreateCamera(&camera, ray, beta);
+            float pdfPos, pdfDir;
+            camera.PdfWe(ray, pdfPos, pdfDir);
+            return RandomWalk(scene, ray, sampler, arena, beta, pdfDir, maxDepth - 1, true, path + 1) + 1;
+        }
+
+        int GenerateLightSubpath(const Scene &scene, Sampler &sampler, MemoryArena &arena, int maxDepth,
+                                 const Distribution1D &lightDistr, const LightIndexMap &lightToIndex, Vertex *path)
+        {
+            if (maxDepth == 0)
+                return 0;
+            float lightPdf;
+            int lightNum = lightDistr.SampleDiscrete(sampler.Get1D(), &lightPdf);
+            const Ptr<Light> &light = scene._lights[lightNum];
+
+            Ray ray;
+            Vector3f nLight;
+            float pdfPos, pdfDir;
+            Vector2f u1 = sampler.Get2D();
+            Vector2f u2 = sampler.Get2D();
+            Spectrum Le = light->SampleLe(u1, u2, ray, nLight, pdfPos, pdfDir);
+            if (pdfPos == 0 || pdfDir == 0 || Le.isBlack())
+                return 0;
+
+            path[0] = Vertex::CreateLight(light.get(), ray, nLight, Le, pdfPos * lightPdf);
+            Spectrum beta = Le * glm::abs(glm::dot(nLight, ray._direction)) / (lightPdf * pdfPos * pdfDir);
+            int nVertices = RandomWalk(scene, ray, sampler, arena, beta, pdfDir, maxDepth - 1, false, path + 1);
+
+            //环境光的位置与方向pdf要互换：第一个顶点的pdf是方向的密度，第二个顶点的pdf来自圆盘上的位置
+            if (path[0].IsInfiniteLight())
+            {
+                if (nVertices > 0)
+                {
+                    path[1].pdfFwd = pdfPos;
+                    if (path[1].IsOnSurface())
+                        path[1].pdfFwd *= glm::abs(glm::dot(ray._direction, path[1].n()));
+                }
+                path[0].pdfFwd = InfiniteLightDensity(scene, lightDistr, lightToIndex, ray._direction);
+            }
+            return nVertices + 1;
+        }
+
+        float G(const Scene &scene, const Vertex &v0, const Vertex &v1)
+        {
+            Vector3f d = v0.p() - v1.p();
+            float g = 1 / glm::length2(d);
+            d *= glm::sqrt(g);
+            if (v0.IsOnSurface())
+                g *= glm::abs(glm::dot(v0.n(), d));
+            if (v1.IsOnSurface())
+                g *= glm::abs(glm::dot(v1.n(), d));
+            VisibilityTester vis(v0.si, v1.si);
+            return vis.Unoccluded(scene) ? g : 0.f;
+        }
+
+        /**
+         * @brief 连接策略(s, t)的平衡启发式MIS权重：按顶点的pdfFwd/pdfRev依次计算同一条路径由其他策略生成的pdf之比
+         * @param  sampled          s = 1或t = 1时新采样的端点，替换对应子路径的端点
+         */
+        float MISWeight(const Scene &scene, Vertex *lightVertices, Vertex *cameraVertices, Vertex &sampled,
+                        int s, int t, const Distribution1D &lightDistr, const LightIndexMap &lightToIndex)
+        {
+            if (s + t == 2)
+                return 1;
+            float sumRi = 0;
+            //delta分布的pdf记为0，比值里把它当作1
+            auto remap0 = [](float f) -> float { return f != 0 ? f : 1; };
+
+            Vertex *qs = s > 0 ? &lightVertices[s - 1] : nullptr,
+                   *pt = t > 0 ? &cameraVertices[t - 1] : nullptr,
+                   *qsMinus = s > 1 ? &lightVertices[s - 2] : nullptr,
+                   *ptMinus = t > 1 ? &cameraVertices[t - 2] : nullptr;
+
+            ScopedAssignment<Vertex> a1;
+            if (s == 1)
+                a1 = {qs, sampled};
+            else if (t == 1)
+                a1 = {pt, sampled};
+
+            //连接处的两个顶点都不是delta分布
+            ScopedAssignment<bool> a2, a3;
+            if (pt)
+                a2 = {&pt->delta, false};
+            if (qs)
+                a3 = {&qs->delta, false};
+
+            //更新连接处附近顶点的反向pdf
+            ScopedAssignment<float> a4;
+            if (pt)
+                a4 = {&pt->pdfRev, s > 0 ? qs->Pdf(scene, qsMinus, *pt)
+                                         : pt->PdfLightOrigin(scene, *ptMinus, lightDistr, lightToIndex)};
+            ScopedAssignment<float> a5;
+            if (ptMinus)
+                a5 = {&ptMinus->pdfRev, s > 0 ? pt->Pdf(scene, qs, *ptMinus) : pt->PdfLight(scene, *ptMinus)};
+            ScopedAssignment<float> a6;
+            if (qs)
+                a6 = {&qs->pdfRev, pt->Pdf(scene, ptMinus, *qs)};
+            ScopedAssignment<float> a7;
+            if (qsMinus)
+                a7 = {&qsMinus->pdfRev, qs->Pdf(scene, pt, *qsMinus)};
+
+            float ri = 1;
+            for (int i = t - 1; i > 0; --i)
+            {
+                ri *= remap0(cameraVertices[i].pdfRev) / remap0(cameraVertices[i].pdfFwd);
+                if (!cameraVertices[i].delta && !cameraVertices[i - 1].delta)
+                    sumRi += ri;
+            }
+
+            ri = 1;
+            for (int i = s - 1; i >= 0; --i)
+            {
+                ri *= remap0(lightVertices[i].pdfRev) / remap0(lightVertices[i].pdfFwd);
+                bool deltaLightVertex = i > 0 ? lightVertices[i - 1].delta : lightVertices[0].IsDeltaLight();
+                if (!lightVertices[i].delta && !deltaLightVertex)
+                    sumRi += ri;
+            }
+            return 1 / (1 + sumRi);
+        }
+
+        /**
+         * @brief 用光源子路径的前s个顶点和相机子路径的前t个顶点组成一条路径，返回乘以MIS权重后的贡献。
+         *        t = 1时在pRaster返回光源子路径连到的胶片坐标
+         */
+        Spectrum ConnectBDPT(const Scene &scene, Vertex *lightVertices, Vertex *cameraVertices, int s, int t,
+                             const Distribution1D &lightDistr, const LightIndexMap &lightToIndex,
+                             const Camera &camera, Sampler &sampler, Vector2f &pRaster)
+        {
+            Spectrum L(0.f);
+            //相机子路径逃逸到环境中的终点只能用s = 0的策略
+            if (t > 1 && s != 0 && cameraVertices[t - 1].type == VertexType::Light)
+                return Spectrum(0.f);
+
+            Vertex sampled;
+            if (s == 0)
+            {
+                //相机子路径自己到达了光源
+                const Vertex &pt = cameraVertices[t - 1];
+                if (pt.IsLight())
+                    L = pt.Le(scene, cameraVertices[t - 2]) * pt.beta;
+            }
+            else if (t == 1)
+            {
+                //光源子路径的终点连到相机上
+                const Vertex &qs = lightVertices[s - 1];
+                if (qs.IsConnectible())
+                {
+                    VisibilityTester vis;
+                    Vector3f wi;
+                    float pdf;
+                    Spectrum Wi = camera.SampleWi(qs.si, sampler.Get2D(), wi, pdf, pRaster, vis);
+                    if (pdf > 0 && !Wi.isBlack())
+                    {
+                        sampled = Vertex::CreateCamera(&camera, vis.P1(), Wi / pdf);
+                        L = qs.beta * qs.f(sampled) * sampled.beta;
+                        if (qs.IsOnSurface())
+                            L *= glm::abs(glm::dot(wi, qs.n()));
+                        if (!L.isBlack() && !vis.Unoccluded(scene))
+                            L = Spectrum(0.f);
+                    }
+                }
+            }
+            else if (s == 1)
+            {
+                //在相机子路径的终点处重新采样光源，即直接光照
+                const Vertex &pt = cameraVertices[t - 1];
+                if (pt.IsConnectible())
+                {
+                    float lightPdf;
+                    int lightNum = lightDistr.SampleDiscrete(sampler.Get1D(), &lightPdf);
+                    const Ptr<Light> &light = scene._lights[lightNum];
+                    VisibilityTester vis;
+                    Vector3f wi;
+                    float pdf;
+                    Spectrum lightWeight = light->SampleLi(pt.si, sampler.Get2D(), wi, pdf, vis);
+                    if (pdf > 0 && !lightWeight.isBlack())
+                    {
+                        sampled = Vertex::CreateLight(light.get(), vis.P1(), lightWeight / (pdf * lightPdf), 0);
+                        sampled.pdfFwd = sampled.PdfLightOrigin(scene, pt, lightDistr, lightToIndex);
+                        L = pt.beta * pt.f(sampled) * sampled.beta;
+                        if (pt.IsOnSurface())
+                            L *= glm::abs(glm::dot(wi, pt.n()));
+                        if (!L.isBlack() && !vis.Unoccluded(scene))
+                            L = Spectrum(0.f);
+                    }
+                }
+            }
+            else
+            {
+                //连接两条子路径的终点
+                const Vertex &qs = lightVertices[s - 1], &pt = cameraVertices[t - 1];
+                if (qs.IsConnectible() && pt.IsConnectible())
+                {
+                    L = qs.beta * qs.f(pt) * pt.f(qs) * pt.beta;
+                    if (!L.isBlack())
+                        L *= G(scene, qs, pt);
+                }
+            }
+
+            if (L.isBlack())
+                return L;
+            return L * MISWeight(scene, lightVertices, cameraVertices, sampled, s, t, lightDistr, lightToIndex);
+        }
+    }
+
+    BDPTIntegrator::BDPTIntegrator(const PropertyTree &root)
+        : SamplerIntegrator(root), _max_depth(root.Get<int>("Depth"))
+    {
+    }
+
+    void BDPTIntegrator::Preprocess(const Scene &scene, Sampler &sampler)
+    {
+        _light_distribution = CreateLightSampleDistribution("power", scene);
+        _light_to_index.clear();
+        for (size_t i = 0; i < scene._lights.size(); ++i)
+            _light_to_index[scene._lights[i].get()] = int(i);
+    }
+
+    Spectrum BDPTIntegrator::Li(const Scene &scene, const Ray &ray, Sampler &sampler, MemoryArena &arena, int depth) const
+    {
+        const Distribution1D *lightDistr = _light_distribution->Lookup(ray._origin);
+        if (!lightDistr)
+            return Spectrum(0.f);
+
+        Vertex *cameraVertices = AllocVertices(arena, _max_depth + 2);
+        Vertex *lightVertices = AllocVertices(arena, _max_depth + 1);
+        int nCamera = GenerateCameraSubpath(scene, sampler, arena, _max_depth + 2, *_camera, ray, cameraVertices);
+        int nLight = GenerateLightSubpath(scene, sampler, arena, _max_depth + 1, *lightDistr, _light_to_index, lightVertices);
+
+        Spectrum L(0.f);
+        for (int t = 1; t <= nCamera; ++t)
+        {
+            for (int s = 0; s <= nLight; ++s)
+            {
+                int pathDepth = t + s - 2;
+                if ((s == 1 && t == 1) || pathDepth < 0 || pathDepth > _max_depth)
+                    continue;
+
+                Vector2f pRaster;
+                Spectrum Lpath = ConnectBDPT(scene, lightVertices, cameraVertices, s, t, *lightDistr,
+                                             _light_to_index, *_camera, sampler, pRaster);
+                if (t != 1)
+                    L += Lpath;
+                else if (!Lpath.isBlack())
+                    _camera->_film->AddSplat(pRaster, Lpath);
+            }
+        }
+        return L;
+    }
+}
@@ -0,0 +1,41 @@
+
+
+#ifndef INTEGRATOR_BDPT_INTEGRATOR_H_
+#define INTEGRATOR_BDPT_INTEGRATOR_H_
+
+#include <core/integrator.h>
+#include <core/light.h>
+#include <unordered_map>
+
+namespace platinum
+{
+    /**
+     * @brief 双向路径追踪（Veach 1997，实现参考pbrt-v3）。每个样本分别从相机和光源出发生成子路径，
+     *        把相机子路径的前t个顶点与光源子路径的前s个顶点相连，对所有(s, t)连接策略按平衡启发式做多重重要性采样。
+     *        t = 1的策略（光源子路径直接连到相机）落在任意像素上，通过Film::AddSplat累加。
+     *        目前只支持针孔相机，不支持参与介质。
+     */
+    class BDPTIntegrator : public SamplerIntegrator
+    {
+    public:
+        BDPTIntegrator(const PropertyTree &root);
+
+        BDPTIntegrator(UPtr<Camera> camera, UPtr<Sampler> sampler, int max_depth)
+            : SamplerIntegrator(std::move(camera), std::move(sampler)), _max_depth(max_depth) {}
+
+        virtual std::string ToString() const { return "BDPTIntegrator"; }
+
+        virtual void Preprocess(const Scene &scene, Sampler &sampler) override;
+
+    protected:
+        virtual Spectrum Li(const Scene &scene, const Ray &ray, Sampler &sampler, MemoryArena &arena, int depth) const override;
+
+    private:
+        const int _max_depth;
+        //光源子路径的起点按功率选择光源
+        std::unique_ptr<LightDistribution> _light_distribution;
+        std::unordered_map<const Light *, int> _light_to_index;
+    };
+}
+
+#endif
@@ -5,12 +5,8 @@ namespace platinum
     REGISTER_CLASS(DirectIntegrator, "Direct");
 
     DirectIntegrator::DirectIntegrator(const PropertyTree &root)
-        : SamplerIntegrator(nullptr, nullptr), _max_depth(root.Get<int>("Depth"))
+        : SamplerIntegrator(root), _max_depth(root.Get<int>("Depth"))
     {
-        _sampler = UPtr<Sampler>(static_cast<Sampler *>(ObjectFactory::CreateInstance(root.Get<std::string>("Sampler.Type"), root.GetChild("Sampler"))));
-
-        _camera = UPtr<Camera>(static_cast<Camera *>(ObjectFactory::CreateInstance(root.Get<std::string>("Camera.Type"), root.GetChild("Camera"))));
-
         _strategy = (LightStrategy)root.Get<int>("Strategy", 0);
     }
 
@@ -35,6 +31,7 @@ namespace platinum
     Spectrum DirectIntegrator::Li(const Scene &scene, const Ray &ray, Sampler &sampler, MemoryArena &arena, int depth) const
     {
         Spectrum L(0.f);
+        AOVSample *aov = depth == 0 ? PrimaryAOVSample() : nullptr;
         // Find closest ray intersection or return background radiance
         SurfaceInteraction isect;
         if (!scene.Hit(ray, isect))
@@ -42,6 +39,9 @@ namespace platinum
             //返回lights emission
             for (const auto &light : scene._lights)
                 L += light->Le(ray);
+            if (aov)
+                aov->emission += L;
+            return L;
         }
         isect.ComputeScatteringFunctions(ray, arena);
         // 没有bsdf
@@ -51,14 +51,18 @@ namespace platinum
 
         // 如果光线打到光源，计算其发光值 -> Le (emission term)
         L += isect.Le(wo);
+        if (aov)
+            aov->emission += L;
         if (scene._lights.size() > 0)
         {
             if (_strategy == LightStrategy::UniformSampleAll)
                 //累计所有光源的直接光照值
-                L += UniformSampleAllLights(isect, scene, arena, sampler, _n_light_samples);
-
+                L += UniformSampleAllLights(isect, scene, arena, sampler, _n_light_samples, aov);
+            else if (_strategy == LightStrategy::ReservoirResampling)
+                //多个候选样本中重采样一个，相机光线的第一个交点可以复用相邻像素的蓄水池
+                L += ReservoirSampleLights(isect, scene, arena, sampler, _reservoir, nullptr, depth == 0, aov);
             else
-                L += UniformSampleOneLight(isect, scene, arena, sampler);
+                L += UniformSampleOneLight(isect, scene, arena, sampler, nullptr, aov);
         }
         if (depth + 1 < _max_depth)
         {
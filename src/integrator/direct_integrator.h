@@ -5,12 +5,6 @@
 #include <core/bsdf.h>
 namespace platinum
 {
-    enum class LightStrategy
-    {
-        UniformSampleAll,
-        UniformSampleOne
-    };
-
     class DirectIntegrator final : public SamplerIntegrator
     {
     public:
@@ -0,0 +1,144 @@
+
+
+#include <integrator/irradiance_cache.h>
+#include <glm/gtx/norm.hpp>
+
+namespace platinum
+{
+    IrradianceCache::Node::Node()
+    {
+        for (auto &child : children)
+            child = nullptr;
+        records = nullptr;
+    }
+
+    IrradianceCache::Node::~Node()
+    {
+        for (auto &child : children)
+            delete child.load();
+        RecordNode *node = records;
+        while (node)
+        {
+            RecordNode *next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    IrradianceCache::IrradianceCache(const Bounds3f &bounds, float maxError)
+        : _max_error(maxError)
+    {
+        // Use a slightly enlarged cube so that the octree cells stay isotropic
+        Vector3f diagonal = bounds.Diagonal();
+        float size = glm::max(diagonal.x, glm::max(diagonal.y, diagonal.z)) * 1.01f + 1e-4f;
+        Vector3f center = (bounds._p_min + bounds._p_max) * 0.5f;
+        Vector3f half(0.5f * size, 0.5f * size, 0.5f * size);
+        _bounds = Bounds3f(center - half, center + half);
+    }
+
+    IrradianceCache::~IrradianceCache() = default;
+
+    Bounds3f IrradianceCache::ChildBounds(const Bounds3f &bounds, int child)
+    {
+        Vector3f center = (bounds._p_min + bounds._p_max) * 0.5f;
+        Bounds3f result;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            bool upper = (child >> axis) & 1;
+            result._p_min[axis] = upper ? center[axis] : bounds._p_min[axis];
+            result._p_max[axis] = upper ? bounds._p_max[axis] : center[axis];
+        }
+        return result;
+    }
+
+    void IrradianceCache::Add(const IrradianceRecord &record)
+    {
+        auto it = _records.push_back(std::unique_ptr<IrradianceRecord>(new IrradianceRecord(record)));
+        const IrradianceRecord *stored = it->get();
+        float radius = _max_error * stored->R;
+        Vector3f r(radius, radius, radius);
+        AddToNode(&_root, _bounds, stored, Bounds3f(stored->p - r, stored->p + r), 0);
+    }
+
+    void IrradianceCache::AddToNode(Node *node, const Bounds3f &nodeBounds, const IrradianceRecord *record,
+                                    const Bounds3f &recordBounds, int depth)
+    {
+        //记录的影响范围不小于节点的一半时就存放在该节点
+        if (depth == MaxDepth ||
+            glm::length2(recordBounds.Diagonal()) > 0.25f * glm::length2(nodeBounds.Diagonal()))
+        {
+            RecordNode *recordNode = new RecordNode{record, node->records.load()};
+            while (!node->records.compare_exchange_weak(recordNode->next, recordNode))
+                ;
+            return;
+        }
+
+        for (int child = 0; child < 8; ++child)
+        {
+            Bounds3f childBounds = ChildBounds(nodeBounds, child);
+            if (!Overlaps(childBounds, recordBounds))
+                continue;
+
+            Node *childNode = node->children[child];
+            if (!childNode)
+            {
+                // Another thread may create the same child concurrently, keep whichever was published first
+                Node *created = new Node();
+                if (node->children[child].compare_exchange_strong(childNode, created))
+                    childNode = created;
+                else
+                    delete created;
+            }
+            AddToNode(childNode, childBounds, record, recordBounds, depth + 1);
+        }
+    }
+
+    bool IrradianceCache::Interpolate(const Vector3f &p, const Vector3f &n, Spectrum &E) const
+    {
+        if (!Inside(p, _bounds))
+            return false;
+
+        Spectrum sum(0.f);
+        float weightSum = 0;
+        const Node *node = &_root;
+        Bounds3f nodeBounds = _bounds;
+        while (node)
+        {
+            for (const RecordNode *it = node->records.load(); it; it = it->next)
+            {
+                const IrradianceRecord &record = *it->record;
+                float cosN = glm::dot(n, record.n);
+                if (cosN <= 0)
+                    continue;
+
+                //记录在查询点前方（被遮挡的一侧）时不能使用
+                Vector3f d = p - record.p;
+                if (glm::dot(d, (n + record.n) * 0.5f) < -0.05f * record.R)
+                    continue;
+
+                float error = glm::length(d) / record.R + glm::sqrt(glm::max(0.f, 1 - cosN));
+                if (error >= _max_error)
+                    continue;
+                float weight = 1 / glm::max(error, 1e-4f) - 1 / _max_error;
+
+                Spectrum Ei = record.E;
+                Vector3f axis = glm::cross(record.n, n);
+                for (int c = 0; c < Spectrum::nSamples; ++c)
+                    Ei[c] = glm::max(0.f, Ei[c] + glm::dot(axis, record.rotGrad[c]) + glm::dot(d, record.transGrad[c]));
+                sum += weight * Ei;
+                weightSum += weight;
+            }
+
+            // Descend into the child that contains p
+            Vector3f center = (nodeBounds._p_min + nodeBounds._p_max) * 0.5f;
+            int child = (p.x > center.x ? 1 : 0) | (p.y > center.y ? 2 : 0) | (p.z > center.z ? 4 : 0);
+            nodeBounds = ChildBounds(nodeBounds, child);
+            node = node->children[child].load();
+        }
+
+        if (weightSum <= 0)
+            return false;
+        E = sum / weightSum;
+        return true;
+    }
+}
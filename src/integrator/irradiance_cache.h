@@ -0,0 +1,85 @@
+
+
+#ifndef INTEGRATOR_IRRADIANCE_CACHE_H_
+#define INTEGRATOR_IRRADIANCE_CACHE_H_
+
+#include <core/utilities.h>
+#include <core/spectrum.h>
+#include <math/bounds.h>
+#include <tbb/concurrent_vector.h>
+#include <atomic>
+#include <array>
+
+namespace platinum
+{
+    /**
+     * @brief 辐照度缓存中的一条记录（Ward et al. 1988）：点p（法线n）处的间接辐照度E，
+     *        半球采样光线的调和平均距离R，以及按颜色通道分别保存的旋转梯度与平移梯度（Ward and Heckbert 1992）
+     */
+    struct IrradianceRecord
+    {
+        Vector3f p, n;
+        Spectrum E;
+        float R;
+        std::array<Vector3f, Spectrum::nSamples> rotGrad, transGrad;
+    };
+
+    /**
+     * @brief 存放辐照度记录的八叉树，支持多线程无锁插入与查询：
+     *        每个节点的子节点与记录链表都用原子指针，插入时用compare_exchange挂到链表头部。
+     *        记录的影响范围为以p为中心、半径maxError * R的球，它被放入与该范围相交、且尺寸与之相当的所有节点中，
+     *        查询时只需沿包含查询点的路径向下遍历。
+     */
+    class IrradianceCache
+    {
+    public:
+        IrradianceCache(const Bounds3f &bounds, float maxError);
+
+        ~IrradianceCache();
+
+        IrradianceCache(const IrradianceCache &) = delete;
+
+        IrradianceCache &operator=(const IrradianceCache &) = delete;
+
+        void Add(const IrradianceRecord &record);
+
+        /**
+         * @brief 用权重 w = 1 / ε - 1 / maxError（ε = |p - p_i| / R_i + sqrt(1 - n·n_i)）对附近记录插值，
+         *        并用梯度外推每条记录。没有可用记录时返回false
+         */
+        bool Interpolate(const Vector3f &p, const Vector3f &n, Spectrum &E) const;
+
+        size_t Size() const { return _records.size(); }
+
+    private:
+        struct RecordNode
+        {
+            const IrradianceRecord *record;
+            RecordNode *next;
+        };
+
+        struct Node
+        {
+            Node();
+
+            ~Node();
+
+            std::array<std::atomic<Node *>, 8> children;
+            std::atomic<RecordNode *> records;
+        };
+
+        static constexpr int MaxDepth = 16;
+
+        void AddToNode(Node *node, const Bounds3f &nodeBounds, const IrradianceRecord *record,
+                       const Bounds3f &recordBounds, int depth);
+
+        static Bounds3f ChildBounds(const Bounds3f &bounds, int child);
+
+        Bounds3f _bounds;
+        float _max_error;
+        Node _root;
+        tbb::concurrent_vector<std::unique_ptr<IrradianceRecord>> _records;
+    };
+}
+
+#endif
@@ -0,0 +1,256 @@
+
+
+#include <integrator/irradiance_cache_integrator.h>
+#include <core/bsdf.h>
+#include <glm/gtx/norm.hpp>
+
+namespace platinum
+{
+    REGISTER_CLASS(IrradianceCacheIntegrator, "IrradianceCache");
+
+    IrradianceCacheIntegrator::IrradianceCacheIntegrator(const PropertyTree &root)
+        : SamplerIntegrator(root), _max_depth(root.Get<int>("Depth", 5))
+    {
+        _gather_depth = glm::max(1, root.Get<int>("GatherDepth", 5));
+        _num_samples = glm::max(1, root.Get<int>("Samples", 256));
+        _max_error = glm::max(1e-3f, root.Get<float>("MaxError", 0.3f));
+        _min_spacing = root.Get<float>("MinSpacing", 0.f);
+        _max_spacing = root.Get<float>("MaxSpacing", 0.f);
+    }
+
+    void IrradianceCacheIntegrator::Preprocess(const Scene &scene, Sampler &sampler)
+    {
+        const Bounds3f &bounds = scene.WorldBound();
+        float diagonal = glm::length(bounds.Diagonal());
+        if (_min_spacing <= 0)
+            _min_spacing = 0.002f * diagonal;
+        if (_max_spacing <= 0)
+            _max_spacing = 0.1f * diagonal;
+        _max_spacing = glm::max(_max_spacing, _min_spacing);
+
+        _cache.reset(new IrradianceCache(bounds, _max_error));
+        _light_distribution = CreateLightSampleDistribution("power", scene);
+    }
+
+    Spectrum IrradianceCacheIntegrator::Li(const Scene &scene, const Ray &ray, Sampler &sampler, MemoryArena &arena, int depth) const
+    {
+        Spectrum L(0.f);
+        AOVSample *aov = depth == 0 ? PrimaryAOVSample() : nullptr;
+        SurfaceInteraction isect;
+        if (!scene.Hit(ray, isect))
+        {
+            for (const auto &light : scene._infinite_lights)
+                L += light->Le(ray);
+            if (aov)
+                aov->emission += L;
+            return L;
+        }
+
+        isect.ComputeScatteringFunctions(ray, arena);
+        if (!isect._bsdf)
+            return Li(scene, isect.SpawnRay(ray._direction), sampler, arena, depth);
+        const BSDF &bsdf = *isect._bsdf;
+
+        Vector3f wo = isect.wo;
+        L += isect.Le(wo);
+        if (aov)
+            aov->emission += L;
+
+        const Distribution1D *lightDistr = _light_distribution->Lookup(isect.p);
+        if (bsdf.NumComponents(BxDFType((int)BxDFType::BSDF_ALL & ~(int)BxDFType::BSDF_SPECULAR)) > 0)
+            L += UniformSampleOneLight(isect, scene, arena, sampler, lightDistr, aov);
+
+        // Diffuse indirect lighting from the irradiance cache
+        BxDFType diffuse = BxDFType((int)BxDFType::BSDF_DIFFUSE | (int)BxDFType::BSDF_REFLECTION);
+        if (bsdf.NumComponents(diffuse) > 0)
+        {
+            Vector3f n = glm::dot(isect.n, wo) < 0 ? -isect.n : isect.n;
+            Spectrum f = bsdf.F(wo, n, diffuse);
+            if (!f.isBlack())
+                L += f * IndirectIrradiance(scene, isect, n, sampler, arena);
+        }
+
+        //光泽分量的间接光照无法用辐照度表示，采样一条光线估计
+        BxDFType glossy = BxDFType((int)BxDFType::BSDF_GLOSSY | (int)BxDFType::BSDF_REFLECTION | (int)BxDFType::BSDF_TRANSMISSION);
+        if (bsdf.NumComponents(glossy) > 0)
+        {
+            Vector3f wi;
+            float pdf;
+            BxDFType sampledType;
+            Spectrum f = bsdf.SampleF(wo, wi, sampler.Get2D(), pdf, sampledType, glossy);
+            if (pdf > 0 && !f.isBlack())
+            {
+                float unused;
+                L += f * IncidentRadiance(scene, isect.SpawnRay(wi), sampler, arena, unused) *
+                     glm::abs(glm::dot(wi, isect.n)) / pdf;
+            }
+        }
+
+        if (depth + 1 < _max_depth)
+        {
+            L += SpecularReflect(ray, isect, scene, sampler, arena, depth);
+            L += SpecularTransmit(ray, isect, scene, sampler, arena, depth);
+        }
+        return L;
+    }
+
+    Spectrum IrradianceCacheIntegrator::IndirectIrradiance(const Scene &scene, const SurfaceInteraction &isect, const Vector3f &n,
+                                                           Sampler &sampler, MemoryArena &arena) const
+    {
+        Spectrum E;
+        if (_cache->Interpolate(isect.p, n, E))
+            return E;
+
+        // Stratified cosine-weighted hemisphere sampling: M strata in theta, N in phi (N ≈ πM)
+        int M = glm::max(1, (int)glm::round(glm::sqrt(_num_samples / Pi)));
+        int N = glm::max(1, (int)glm::round(float(_num_samples) / M));
+        std::vector<Spectrum> radiance(M * N);
+        std::vector<float> distance(M * N), sinTheta(M * N);
+
+        Vector3f s, t;
+        coordinateSystem(n, s, t);
+
+        Spectrum sum(0.f);
+        float invDistanceSum = 0;
+        for (int j = 0; j < M; ++j)
+        {
+            for (int k = 0; k < N; ++k)
+            {
+                Vector2f u = sampler.Get2D();
+                float sin2Theta = (j + u.x) / M;
+                float sinT = glm::sqrt(sin2Theta);
+                float cosT = glm::sqrt(glm::max(0.f, 1 - sin2Theta));
+                float phi = 2 * Pi * (k + u.y) / N;
+                Vector3f wi = sinT * glm::cos(phi) * s + sinT * glm::sin(phi) * t + cosT * n;
+
+                float hitDistance;
+                Spectrum Li = IncidentRadiance(scene, isect.SpawnRay(wi), sampler, arena, hitDistance);
+                hitDistance = glm::max(hitDistance, 1e-6f);
+                int index = j * N + k;
+                radiance[index] = Li;
+                distance[index] = hitDistance;
+                sinTheta[index] = sinT;
+                sum += Li;
+                invDistanceSum += 1 / hitDistance;
+            }
+        }
+
+        IrradianceRecord record;
+        record.p = isect.p;
+        record.n = n;
+        record.E = sum * (Pi / (M * N));
+
+        // Rotational and translational gradients (Ward and Heckbert 1992)
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+            record.rotGrad[c] = record.transGrad[c] = Vector3f(0.f);
+        for (int k = 0; k < N; ++k)
+        {
+            float phiCenter = 2 * Pi * (k + 0.5f) / N;
+            float phiMinus = 2 * Pi * k / N;
+            Vector3f uk = glm::cos(phiCenter) * s + glm::sin(phiCenter) * t;
+            Vector3f vk = -glm::sin(phiCenter) * s + glm::cos(phiCenter) * t;
+            Vector3f vkMinus = -glm::sin(phiMinus) * s + glm::cos(phiMinus) * t;
+            int kPrev = (k + N - 1) % N;
+
+            Spectrum rot(0.f), thetaChange(0.f), phiChange(0.f);
+            for (int j = 0; j < M; ++j)
+            {
+                int index = j * N + k;
+                float sinT = glm::max(sinTheta[index], 1e-3f);
+                float tanT = sinT / glm::sqrt(glm::max(1e-6f, 1 - sinT * sinT));
+                rot += -tanT * radiance[index];
+
+                //相邻两个θ分层之间的变化
+                if (j > 0)
+                {
+                    float sin2Minus = float(j) / M;
+                    float minDistance = glm::min(distance[index], distance[index - N]);
+                    thetaChange += glm::sqrt(sin2Minus) * (1 - sin2Minus) / minDistance *
+                                   (radiance[index] - radiance[index - N]);
+                }
+
+                //相邻两个φ分层之间的变化
+                float cosMinus = glm::sqrt(1 - float(j) / M);
+                float cosPlus = glm::sqrt(glm::max(0.f, 1 - float(j + 1) / M));
+                float minDistance = glm::min(distance[index], distance[j * N + kPrev]);
+                phiChange += (cosMinus - cosPlus) / (sinT * minDistance) * (radiance[index] - radiance[j * N + kPrev]);
+            }
+
+            for (int c = 0; c < Spectrum::nSamples; ++c)
+            {
+                record.rotGrad[c] += vk * (rot[c] * Pi / (M * N));
+                record.transGrad[c] += uk * (thetaChange[c] * 2 * Pi / N) + vkMinus * phiChange[c];
+            }
+        }
+
+        //分球启发式：有效半径取调和平均距离，并且不超过辐照度与其梯度之比
+        float R = invDistanceSum > 0 ? (M * N) / invDistanceSum : _max_spacing;
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+        {
+            float gradient = glm::length(record.transGrad[c]);
+            if (gradient > 0)
+                R = glm::min(R, record.E[c] / gradient);
+        }
+        record.R = clamp(R, _min_spacing, _max_spacing);
+
+        _cache->Add(record);
+        return record.E;
+    }
+
+    Spectrum IrradianceCacheIntegrator::IncidentRadiance(const Scene &scene, Ray ray, Sampler &sampler, MemoryArena &arena,
+                                                         float &hitDistance) const
+    {
+        Spectrum L(0.f), beta(1.f);
+        bool specularBounce = false;
+        hitDistance = Infinity;
+        for (int bounces = 0;; ++bounces)
+        {
+            SurfaceInteraction isect;
+            bool hit = scene.Hit(ray, isect);
+            if (bounces == 0 && hit)
+                hitDistance = glm::length(isect.p - ray._origin);
+
+            //光源的自发光已经由上一个顶点的直接光照计入，只有经过镜面反射时才需要加上
+            if (bounces > 0 && specularBounce)
+            {
+                if (hit)
+                    L += beta * isect.Le(-ray._direction);
+                else
+                    for (const auto &light : scene._infinite_lights)
+                        L += beta * light->Le(ray);
+            }
+            if (!hit || bounces >= _gather_depth)
+                break;
+
+            isect.ComputeScatteringFunctions(ray, arena);
+            if (!isect._bsdf)
+            {
+                ray = isect.SpawnRay(ray._direction);
+                --bounces;
+                continue;
+            }
+
+            if (isect._bsdf->NumComponents(BxDFType((int)BxDFType::BSDF_ALL & ~(int)BxDFType::BSDF_SPECULAR)) > 0)
+                L += beta * UniformSampleOneLight(isect, scene, arena, sampler, _light_distribution->Lookup(isect.p));
+
+            Vector3f wi;
+            float pdf;
+            BxDFType sampledType;
+            Spectrum f = isect._bsdf->SampleF(isect.wo, wi, sampler.Get2D(), pdf, sampledType);
+            if (f.isBlack() || pdf == 0)
+                break;
+            beta *= f * glm::abs(glm::dot(wi, isect.n)) / pdf;
+            specularBounce = ((int)sampledType & (int)BxDFType::BSDF_SPECULAR) != 0;
+            ray = isect.SpawnRay(wi);
+
+            if (bounces > 3)
+            {
+                float q = glm::max(0.05f, 1 - beta.maxComponentValue());
+                if (sampler.Get1D() < q)
+                    break;
+                beta /= 1 - q;
+            }
+        }
+        return L;
+    }
+}
@@ -0,0 +1,57 @@
+
+
+#ifndef INTEGRATOR_IRRADIANCE_CACHE_INTEGRATOR_H_
+#define INTEGRATOR_IRRADIANCE_CACHE_INTEGRATOR_H_
+
+#include <core/integrator.h>
+#include <core/light.h>
+#include <integrator/irradiance_cache.h>
+
+namespace platinum
+{
+    /**
+     * @brief 辐照度缓存积分器，适用于以漫反射为主的场景。相机光线第一个交点处的直接光照照常采样光源，
+     *        漫反射的间接光照则从辐照度缓存中插值：附近没有可用记录时，在该点按余弦分层采样Samples条半球光线
+     *        （每条光线再做最多GatherDepth次弹射的路径追踪）计算一条新记录及其梯度，并加入缓存。
+     *        记录的有效半径为光线的调和平均距离（分球启发式），并限制在[MinSpacing, MaxSpacing]内，
+     *        且不超过 E / |∇E|；MaxError为插值的误差阈值。间距为0时按场景包围盒对角线的比例取默认值。
+     *        镜面反射与折射像Whitted积分器一样递归追踪，最多Depth层。
+     */
+    class IrradianceCacheIntegrator : public SamplerIntegrator
+    {
+    public:
+        IrradianceCacheIntegrator(const PropertyTree &root);
+
+        virtual std::string ToString() const { return "IrradianceCacheIntegrator"; }
+
+        virtual void Preprocess(const Scene &scene, Sampler &sampler) override;
+
+    protected:
+        virtual Spectrum Li(const Scene &scene, const Ray &ray, Sampler &sampler, MemoryArena &arena, int depth) const override;
+
+    private:
+        /**
+         * @brief 着色点isect（法线n朝向观察方向）处的间接辐照度：优先从缓存插值，否则计算新记录
+         */
+        Spectrum IndirectIrradiance(const Scene &scene, const SurfaceInteraction &isect, const Vector3f &n,
+                                    Sampler &sampler, MemoryArena &arena) const;
+
+        /**
+         * @brief 沿ray到达起点的间接辐射度（不含第一个交点的自发光，它属于起点的直接光照）
+         * @param  hitDistance      返回第一个交点的距离，没有相交时为Infinity
+         */
+        Spectrum IncidentRadiance(const Scene &scene, Ray ray, Sampler &sampler, MemoryArena &arena,
+                                  float &hitDistance) const;
+
+    private:
+        const int _max_depth;
+        int _gather_depth;
+        int _num_samples;
+        float _max_error;
+        float _min_spacing, _max_spacing;
+        std::unique_ptr<IrradianceCache> _cache;
+        std::unique_ptr<LightDistribution> _light_distribution;
+    };
+}
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "path_integrator.h"
 #include <core/bsdf.h>
+#include <core/timer.h>
 
 namespace platinum
 {
@@ -9,30 +10,155 @@ namespace platinum
     REGISTER_CLASS(PathIntegrator, "Path");
 
     PathIntegrator::PathIntegrator(const PropertyTree &root)
-        : SamplerIntegrator(nullptr, nullptr), _max_depth(root.Get<int>("Depth")), _rr_threshold(root.Get<float>("RR", 0.8f))
+        : SamplerIntegrator(root), _max_depth(root.Get<int>("Depth")), _rr_threshold(root.Get<float>("RR", 0.8f))
     {
-        _sampler = UPtr<Sampler>(static_cast<Sampler *>(ObjectFactory::CreateInstance(root.Get<std::string>("Sampler.Type"), root.GetChild("Sampler"))));
+        _light_sample_strategy = root.Get<std::string>("Strategy", "spatial");
+        //"one": 每个顶点选择一个光源；"ris": 从多个候选样本中重采样一个（候选样本按Strategy对应的分布选择光源）
+        _direct_strategy = root.Get<std::string>("DirectLighting", "one") == "ris" ? LightStrategy::ReservoirResampling
+                                                                                   : LightStrategy::UniformSampleOne;
 
-        _camera = UPtr<Camera>(static_cast<Camera *>(ObjectFactory::CreateInstance(root.Get<std::string>("Camera.Type"), root.GetChild("Camera"))));
+        auto guiding_node = root.GetChildOptional("Guiding");
+        if (guiding_node)
+        {
+            _guiding.enabled = guiding_node->Get<bool>("Enable", true);
+            _guiding.trainingSPP = guiding_node->Get<int64_t>("TrainingSPP", 31);
+            _guiding.bsdfSamplingFraction = clamp(guiding_node->Get<float>("BSDFSamplingFraction", 0.5f), 0.f, 1.f);
+            _guiding.spatialThreshold = guiding_node->Get<float>("SpatialThreshold", 12000.f);
+            _guiding.directionalThreshold = guiding_node->Get<float>("DirectionalThreshold", 0.01f);
+            _guiding.maxDepth = guiding_node->Get<int>("MaxDepth", 20);
+        }
 
-        _light_sample_strategy = root.Get<std::string>("Strategy", "spatial");
+        //ADRRS需要SD-tree提供的入射辐射度估计，没有开启路径引导时仍然训练SD-tree，但不用它采样方向
+        auto adrrs_node = root.GetChildOptional("ADRRS");
+        if (adrrs_node)
+        {
+            _adrrs.enabled = adrrs_node->Get<bool>("Enable", true);
+            _adrrs.windowSize = glm::max(1.f, adrrs_node->Get<float>("WindowSize", 5.f));
+            _adrrs.maxSplit = glm::max(1, adrrs_node->Get<int>("MaxSplit", 8));
+        }
     }
     void PathIntegrator::Preprocess(const Scene &scene, Sampler &sampler)
     {
         _light_distribution = CreateLightSampleDistribution(_light_sample_strategy, scene);
+        //训练的每一遍都要写入胶片再清空，out-of-core胶片做不到
+        if ((_guiding.enabled || _adrrs.enabled) && _camera->_film->IsOutOfCore())
+        {
+            LOG(WARNING) << "Path guiding and ADRRS train on the whole film and are disabled for an out-of-core film";
+            _guiding.enabled = false;
+            _adrrs.enabled = false;
+        }
+        if ((_guiding.enabled || _adrrs.enabled) && _guiding.trainingSPP > 0)
+            TrainGuiding(scene);
+    }
+
+    float PathIntegrator::ADRRSRatio(const Vector3f &p, const Vector3f &wi, const Spectrum &beta, const Vector2i &pixel) const
+    {
+        if (_adrrs_pixels.empty() || !InsideExclusive(pixel, _adrrs_bounds))
+            return 0.f;
+        int width = _adrrs_bounds._p_max.x - _adrrs_bounds._p_min.x;
+        float pixelEstimate = _adrrs_pixels[(pixel.x - _adrrs_bounds._p_min.x) + (pixel.y - _adrrs_bounds._p_min.y) * width];
+        if (pixelEstimate <= 0)
+            return 0.f;
+        float incident = _guiding_tree->Lookup(p).sampling.Radiance(wi);
+        return beta.y() * incident / pixelEstimate;
+    }
+
+    void PathIntegrator::TrainGuiding(const Scene &scene)
+    {
+        Timer timer("Path guiding training");
+        _guiding_tree.reset(new SDTree(scene.WorldBound()));
+
+        //训练的每一遍样本数很少，不做自适应采样
+        AdaptiveSamplingSettings adaptive = _adaptive;
+        _adaptive.enabled = false;
+        _guiding_recording = true;
+
+        const int64_t spp = _sampler->_samplesPerPixel;
+        int64_t trained = 0;
+        for (int iteration = 0; trained < _guiding.trainingSPP; ++iteration)
+        {
+            int64_t sampleCount = glm::min(glm::min(int64_t(1) << glm::min(iteration, 30), _guiding.trainingSPP - trained), spp);
+
+            // Negative pass numbers keep the training seeds apart from the ones of the final render
+            RenderPass(scene, 0, sampleCount, -(iteration + 1));
+            trained += sampleCount;
+
+            uint64_t spatialThreshold = uint64_t(_guiding.spatialThreshold * glm::sqrt(float(sampleCount)));
+            _guiding_tree->Refine(spatialThreshold, _guiding.directionalThreshold, _guiding.maxDepth);
+            LOG(INFO) << "Path guiding iteration " << iteration << ": " << sampleCount << " spp, "
+                      << _guiding_tree->NumLeaves() << " spatial leaves";
+        }
+
+        //所有训练遍的图像都是无偏的，累积的结果作为ADRRS的像素亮度估计
+        const Film &film = *_camera->_film;
+        if (_adrrs.enabled)
+        {
+            _adrrs_bounds = film.GetCroppedPixelBounds();
+            _adrrs_pixels.clear();
+            _adrrs_pixels.reserve(glm::max(0, _adrrs_bounds.Area()));
+            for (Vector2i pixel : _adrrs_bounds)
+                _adrrs_pixels.push_back(film.GetPixelLuminance(pixel));
+        }
+        _camera->_film->Clear();
+
+        _guiding_recording = false;
+        _adaptive = adaptive;
+    }
+
+    Spectrum PathIntegrator::SampleGuided(const SurfaceInteraction &isect, const Vector3f &wo, Vector3f &wi, float &pdf,
+                                          BxDFType &flags, const DTree &guide, Sampler &sampler) const
+    {
+        const float alpha = _guiding.bsdfSamplingFraction;
+        const BSDF &bsdf = *isect._bsdf;
+        Vector2f u = sampler.Get2D();
+        Spectrum f;
+
+        if (sampler.Get1D() < alpha)
+        {
+            float bsdfPdf;
+            f = bsdf.SampleF(wo, wi, u, bsdfPdf, flags, BxDFType::BSDF_ALL);
+            if (f.isBlack() || bsdfPdf == 0)
+            {
+                pdf = 0;
+                return f;
+            }
+            // Delta directions are never generated by the guiding distribution
+            if ((int)flags & (int)BxDFType::BSDF_SPECULAR)
+            {
+                pdf = alpha * bsdfPdf;
+                return f;
+            }
+            pdf = alpha * bsdfPdf + (1 - alpha) * guide.Pdf(wi);
+        }
+        else
+        {
+            float guidePdf;
+            wi = guide.Sample(u, &guidePdf);
+            f = bsdf.F(wo, wi);
+            pdf = alpha * bsdf.Pdf(wo, wi) + (1 - alpha) * guidePdf;
+            flags = glm::dot(wo, isect.n) * glm::dot(wi, isect.n) > 0 ? BxDFType::BSDF_REFLECTION
+                                                                      : BxDFType::BSDF_TRANSMISSION;
+        }
+        return f;
     }
 
     Spectrum PathIntegrator::Li(const Scene &scene, const Ray &r, Sampler &sampler, MemoryArena &arena, int depth) const
     {
         // beta为吞吐量，表示路径中光源发出的辐射亮度沿着该路径传递到摄像机的分量：
-        Spectrum L(0.f), beta(1.f);
-        Ray ray(r);
+        GuidingVertex vertices[MaxGuidingVertices];
+        return TracePath(scene, r, sampler, arena, Spectrum(1.f), 0, false, 1.f, vertices, 0);
+    }
 
-        bool specular_bounce = false;
-        int bounces;
-        float eta_scale = 1.f;
+    Spectrum PathIntegrator::TracePath(const Scene &scene, Ray ray, Sampler &sampler, MemoryArena &arena, Spectrum beta,
+                                       int bounces, bool specular_bounce, float eta_scale,
+                                       GuidingVertex *vertices, int num_vertices) const
+    {
+        Spectrum L(0.f);
+        const bool recording = _guiding_tree && _guiding_recording;
+        //分裂出的子路径只负责记录自己的顶点，之前的顶点由父路径记录
+        const int first_vertex = num_vertices;
 
-        for (bounces = 0;; ++bounces)
+        for (;; ++bounces)
         {
             // 如果当前ray是直接从相机发射，
             // 判断光线是否与场景几何图元相交
@@ -43,18 +169,42 @@ namespace platinum
             // Intersect ray with scene and store intersection in isect
             SurfaceInteraction isect;
             bool hit = scene.Hit(ray, isect);
+            //相机光线的第一个交点记录AOV
+            AOVSample *aov = bounces == 0 ? PrimaryAOVSample() : nullptr;
             // Possibly add emitted light at intersection
             if (bounces == 0 || specular_bounce)
             { // Add emitted light at path vertex or from the environment
+                Spectrum Le(0.f);
                 if (hit)
                 {
-                    L += beta * isect.Le(-ray._direction);
+                    Le = beta * isect.Le(-ray._direction);
                 }
                 else
                 {
                     for (const auto &light : scene._infinite_lights)
-                        L += beta * light->Le(ray);
+                        Le += beta * light->Le(ray);
                 }
+                L += Le;
+                if (aov)
+                    aov->emission += Le;
+                //只经过镜面反射到达光源，之前的顶点都没有通过直接光照采样计入这部分
+                for (int i = 0; i < num_vertices; ++i)
+                    vertices[i].AddContribution(Le.y());
+            }
+            else if (recording && num_vertices > 0)
+            {
+                //上一个顶点的直接光照已经由光源采样计入L，但它的入射辐射度仍然包括这里的自发光
+                Spectrum Le(0.f);
+                if (hit)
+                {
+                    Le = beta * isect.Le(-ray._direction);
+                }
+                else
+                {
+                    for (const auto &light : scene._infinite_lights)
+                        Le += beta * light->Le(ray);
+                }
+                vertices[num_vertices - 1].AddContribution(Le.y());
             }
             // Terminate path if ray escaped or maxDepth was reached
             if (!hit || bounces >= _max_depth)
@@ -69,20 +219,31 @@ namespace platinum
                 --bounces;
                 continue;
             }
-            const Distribution1D *distrib = _light_distribution->Lookup(isect.p);
             // Sample illumination from lights to find path contribution
             if (isect._bsdf->NumComponents(BxDFType((int)BxDFType::BSDF_ALL & ~(int)BxDFType::BSDF_SPECULAR)) > 0)
             {
-                Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena, sampler, distrib);
+                Spectrum Ld = _direct_strategy == LightStrategy::ReservoirResampling
+                                  ? beta * ReservoirSampleLights(isect, scene, arena, sampler, _reservoir, _light_distribution.get(), bounces == 0, aov)
+                                  : beta * SampleOneLight(isect, scene, arena, sampler, *_light_distribution, aov);
                 CHECK_GE(Ld.y(), 0.f);
                 L += Ld;
+                for (int i = 0; i < num_vertices; ++i)
+                    vertices[i].AddContribution(Ld.y());
             }
 
-            // Sample BSDF to get new path direction
+            // Sample BSDF (mixed with the learned incident radiance when guiding) to get new path direction
+            SDTree::Leaf *leaf = nullptr;
+            if (_guiding_tree && isect._bsdf->NumComponents(BxDFType((int)BxDFType::BSDF_ALL & ~(int)BxDFType::BSDF_SPECULAR)) > 0)
+                leaf = &_guiding_tree->Lookup(isect.p);
+
             Vector3f wo = -ray._direction, wi;
             float pdf;
             BxDFType flags;
-            Spectrum f = isect._bsdf->SampleF(wo, wi, sampler.Get2D(), pdf, flags, BxDFType::BSDF_ALL);
+            Spectrum f;
+            if (leaf && _guiding.enabled && leaf->sampling.Energy() > 0)
+                f = SampleGuided(isect, wo, wi, pdf, flags, leaf->sampling, sampler);
+            else
+                f = isect._bsdf->SampleF(wo, wi, sampler.Get2D(), pdf, flags, BxDFType::BSDF_ALL);
 
             if (f.isBlack() || pdf == 0.f)
                 break;
@@ -100,18 +261,51 @@ namespace platinum
             }
             ray = isect.SpawnRay(wi);
 
-            // 为何不直接使用throughput，包含的是radiance，radiance是经过折射缩放的
-            // 但rrThroughput没有经过折射缩放，包含的是power，我们需要根据能量去筛选路径
-            Spectrum rrBeta = beta * eta_scale;
-            if (rrBeta.maxComponentValue() < _rr_threshold && bounces > 3)
+            if (recording && leaf && !((int)flags & (int)BxDFType::BSDF_SPECULAR) && num_vertices < MaxGuidingVertices)
+                vertices[num_vertices++] = GuidingVertex{leaf, wi, pdf, beta.y(), 0.f};
+
+            // Adjoint-driven Russian roulette and splitting: compare the expected contribution of
+            // the continued path with the pixel estimate and keep it inside the weight window
+            float ratio = _adrrs.enabled && !_guiding_recording ? ADRRSRatio(isect.p, wi, beta, sampler.CurrentPixel()) : 0.f;
+            if (ratio > 0)
+            {
+                const float lower = 2 / (1 + _adrrs.windowSize), upper = _adrrs.windowSize * lower;
+                if (ratio < lower)
+                {
+                    if (sampler.Get1D() >= ratio)
+                        break;
+                    beta /= ratio;
+                }
+                else if (ratio > upper && bounces + 1 < _max_depth)
+                {
+                    // Stochastic rounding keeps the expected number of sub-paths equal to the ratio
+                    ratio = glm::min(ratio, float(_adrrs.maxSplit));
+                    int split = glm::min(int(ratio + sampler.Get1D()), _adrrs.maxSplit);
+                    beta /= ratio;
+                    for (int i = 1; i < split; ++i)
+                        L += TracePath(scene, ray, sampler, arena, beta, bounces + 1, specular_bounce, eta_scale,
+                                       vertices, num_vertices);
+                }
+            }
+            else
             {
-                float q = glm::max(0.5f, 1 - rrBeta.maxComponentValue());
-                if (sampler.Get1D() < q)
-                    break;
-                beta /= 1 - q;
-                DCHECK(!glm::isinf(beta.y()));
+                // 为何不直接使用throughput，包含的是radiance，radiance是经过折射缩放的
+                // 但rrThroughput没有经过折射缩放，包含的是power，我们需要根据能量去筛选路径
+                Spectrum rrBeta = beta * eta_scale;
+                if (rrBeta.maxComponentValue() < _rr_threshold && bounces > 3)
+                {
+                    float q = glm::max(0.5f, 1 - rrBeta.maxComponentValue());
+                    if (sampler.Get1D() < q)
+                        break;
+                    beta /= 1 - q;
+                    DCHECK(!glm::isinf(beta.y()));
+                }
             }
         }
+
+        //每个顶点的入射辐射度除以采样该方向的pdf，作为该方向上入射能量的估计
+        for (int i = first_vertex; i < num_vertices; ++i)
+            vertices[i].leaf->building.Record(vertices[i].wi, vertices[i].radiance / vertices[i].pdf);
         return L;
     }
 }
\ No newline at end of file
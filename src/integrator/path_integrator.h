@@ -4,9 +4,39 @@
 #define INTEGRATOR_PATH_INTEGRATOR_H_
 
 #include <core/integrator.h>
+#include <core/bxdf.h>
+#include <integrator/sd_tree.h>
 
 namespace platinum
 {
+    /**
+     * @brief 路径引导（path guiding）的参数。渲染前先进行若干遍训练，每遍的spp依次为1, 2, 4, ...，
+     *        总共不超过TrainingSPP；训练结束后用学到的SD-tree与BSDF按BSDFSamplingFraction混合采样新方向。
+     *        SpatialThreshold为空间节点分裂所需的样本数系数（乘以sqrt(当前遍spp)），
+     *        DirectionalThreshold为方向四叉树节点细分的能量比例阈值，MaxDepth为方向四叉树的最大深度。
+     */
+    struct GuidingSettings
+    {
+        bool enabled = false;
+        int64_t trainingSPP = 31;
+        float bsdfSamplingFraction = 0.5f;
+        float spatialThreshold = 12000.f;
+        float directionalThreshold = 0.01f;
+        int maxDepth = 20;
+    };
+
+    /**
+     * @brief 伴随驱动的俄罗斯轮盘与路径分裂（ADRRS，Vorba and Křivánek 2016）的参数。
+     *        每个顶点用SD-tree的入射辐射度估计与训练得到的像素亮度估计之比衡量路径的期望贡献，
+     *        低于权重窗口[2 / (1 + WindowSize), 2 * WindowSize / (1 + WindowSize)]时轮盘终止，高于时分裂为最多MaxSplit条子路径。
+     *        两个估计都来自渲染前的训练（样本数同Guiding的TrainingSPP）。
+     */
+    struct ADRRSSettings
+    {
+        bool enabled = false;
+        float windowSize = 5.f;
+        int maxSplit = 8;
+    };
 
     class PathIntegrator : public SamplerIntegrator
     {
@@ -21,11 +51,62 @@ namespace platinum
         virtual void Preprocess(const Scene &scene, Sampler &sampler) override;
 
     protected:
+        //训练时每条路径最多记录的顶点数
+        static constexpr int MaxGuidingVertices = 32;
+
+        //路径上一个非镜面顶点：wi方向的入射辐射度（亮度）在路径结束后记录到SD-tree中
+        struct GuidingVertex
+        {
+            SDTree::Leaf *leaf;
+            Vector3f wi;
+            float pdf;
+            float throughput; //该顶点散射之后的吞吐量亮度
+            float radiance;
+
+            void AddContribution(float contribution)
+            {
+                if (throughput > 0)
+                    radiance += contribution / throughput;
+            }
+        };
+
         virtual Spectrum Li(const Scene &scene, const Ray &ray, Sampler &sampler, MemoryArena &arena, int depth) const override;
+
+        /**
+         * @brief 从ray开始继续追踪路径，beta等为路径当前的状态。ADRRS分裂时对每条子路径递归调用，
+         *        子路径共享vertices中之前的num_vertices个顶点
+         */
+        Spectrum TracePath(const Scene &scene, Ray ray, Sampler &sampler, MemoryArena &arena, Spectrum beta,
+                           int bounces, bool specular_bounce, float eta_scale,
+                           GuidingVertex *vertices, int num_vertices) const;
+
+        /**
+         * @brief 沿wi继续的路径的期望贡献与像素亮度估计之比，没有可用的估计时返回0
+         */
+        float ADRRSRatio(const Vector3f &p, const Vector3f &wi, const Spectrum &beta, const Vector2i &pixel) const;
+
+        /**
+         * @brief 训练SD-tree：每遍渲染记录路径各顶点的入射辐射度，结束后细化SD-tree，最后清空Film
+         */
+        void TrainGuiding(const Scene &scene);
+
+        /**
+         * @brief 以单样本MIS混合BSDF采样与SD-tree采样新方向，pdf为两者按bsdfSamplingFraction混合后的pdf
+         */
+        Spectrum SampleGuided(const SurfaceInteraction &isect, const Vector3f &wo, Vector3f &wi, float &pdf,
+                              BxDFType &flags, const DTree &guide, Sampler &sampler) const;
+
         const int _max_depth;
         float _rr_threshold;
-        std::string _light_sample_strategy;
+        std::string _light_sample_strategy = "spatial";
+        LightStrategy _direct_strategy = LightStrategy::UniformSampleOne;
         std::unique_ptr<LightDistribution> _light_distribution;
+        GuidingSettings _guiding;
+        std::unique_ptr<SDTree> _guiding_tree;
+        bool _guiding_recording = false;
+        ADRRSSettings _adrrs;
+        Bounds2i _adrrs_bounds;
+        std::vector<float> _adrrs_pixels; //训练得到的每个像素的亮度估计
     };
 }
 #endif
\ No newline at end of file
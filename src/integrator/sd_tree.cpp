@@ -0,0 +1,301 @@
+
+
+#include <integrator/sd_tree.h>
+
+namespace platinum
+{
+    DTree::Node::Node(const Node &other)
+    {
+        *this = other;
+    }
+
+    DTree::Node &DTree::Node::operator=(const Node &other)
+    {
+        for (int i = 0; i < 4; ++i)
+            _sum[i] = float(other._sum[i]);
+        _children = other._children;
+        return *this;
+    }
+
+    int DTree::Node::ChildIndex(Vector2f &p)
+    {
+        int cx = p.x >= 0.5f ? 1 : 0;
+        int cy = p.y >= 0.5f ? 1 : 0;
+        p = p * 2.f - Vector2f(cx, cy);
+        return cx + 2 * cy;
+    }
+
+    DTree::DTree()
+    {
+        _nodes.emplace_back();
+    }
+
+    DTree::DTree(const DTree &other)
+        : _nodes(other._nodes), _sample_count(other._sample_count.load())
+    {
+    }
+
+    DTree &DTree::operator=(const DTree &other)
+    {
+        _nodes = other._nodes;
+        _sample_count = other._sample_count.load();
+        return *this;
+    }
+
+    Vector2f DTree::DirToCanonical(const Vector3f &d)
+    {
+        float cosTheta = glm::clamp(d.z, -1.f, 1.f);
+        float phi = glm::atan(d.y, d.x);
+        if (phi < 0)
+            phi += 2 * Pi;
+        return Vector2f((cosTheta + 1) * 0.5f, glm::clamp(phi * Inv2Pi, 0.f, OneMinusEpsilon));
+    }
+
+    Vector3f DTree::CanonicalToDir(const Vector2f &p)
+    {
+        float cosTheta = 2 * p.x - 1;
+        float sinTheta = glm::sqrt(glm::max(0.f, 1 - cosTheta * cosTheta));
+        float phi = 2 * Pi * p.y;
+        return Vector3f(sinTheta * glm::cos(phi), sinTheta * glm::sin(phi), cosTheta);
+    }
+
+    void DTree::Record(const Vector3f &d, float value)
+    {
+        if (!(value >= 0) || std::isinf(value))
+            return;
+        // Zero-valued records only count towards the sample number used for the mean
+        ++_sample_count;
+        if (value == 0)
+            return;
+
+        Vector2f p = DirToCanonical(d);
+        uint32_t node = 0;
+        while (true)
+        {
+            int child = Node::ChildIndex(p);
+            _nodes[node]._sum[child].add(value);
+            if (_nodes[node].IsLeaf(child))
+                break;
+            node = _nodes[node]._children[child];
+        }
+    }
+
+    float DTree::Radiance(const Vector3f &d) const
+    {
+        uint64_t count = _sample_count;
+        if (count == 0)
+            return 0.f;
+        return Energy() / count * Pdf(d);
+    }
+
+    void DTree::Scale(float s)
+    {
+        for (auto &node : _nodes)
+        {
+            for (int i = 0; i < 4; ++i)
+                node._sum[i] = node._sum[i] * s;
+        }
+    }
+
+    float DTree::Pdf(const Vector3f &d) const
+    {
+        Vector2f p = DirToCanonical(d);
+        float pdf = 1.f;
+        uint32_t node = 0;
+        while (true)
+        {
+            const Node &n = _nodes[node];
+            float total = n.Sum();
+            if (total <= 0)
+                break;
+            int child = Node::ChildIndex(p);
+            pdf *= 4 * n._sum[child] / total;
+            if (n.IsLeaf(child) || pdf == 0)
+                break;
+            node = n._children[child];
+        }
+        // The cylindrical mapping is area preserving, dω = 4π dx dy
+        return pdf * Inv4Pi;
+    }
+
+    Vector3f DTree::Sample(const Vector2f &u, float *pdf) const
+    {
+        Vector2f sample = u, origin(0.f, 0.f);
+        float size = 1.f;
+        uint32_t node = 0;
+        while (true)
+        {
+            const Node &n = _nodes[node];
+            float total = n.Sum();
+            if (total <= 0)
+                break;
+
+            // Choose the column (x) first, then the quadrant (y) within it
+            int cx, cy;
+            float fx = (n._sum[0] + n._sum[2]) / total;
+            if (sample.x < fx)
+            {
+                sample.x /= fx;
+                cx = 0;
+            }
+            else
+            {
+                sample.x = (sample.x - fx) / (1 - fx);
+                cx = 1;
+            }
+
+            float column = n._sum[cx] + n._sum[cx + 2];
+            float fy = column > 0 ? n._sum[cx] / column : 0.5f;
+            if (sample.y < fy)
+            {
+                sample.y /= fy;
+                cy = 0;
+            }
+            else
+            {
+                sample.y = (sample.y - fy) / (1 - fy);
+                cy = 1;
+            }
+            sample = glm::min(sample, Vector2f(OneMinusEpsilon, OneMinusEpsilon));
+
+            size *= 0.5f;
+            origin += Vector2f(cx, cy) * size;
+
+            int child = cx + 2 * cy;
+            if (n.IsLeaf(child))
+                break;
+            node = n._children[child];
+        }
+
+        Vector3f d = CanonicalToDir(origin + sample * size);
+        *pdf = Pdf(d);
+        return d;
+    }
+
+    DTree DTree::Refine(float threshold, int maxDepth) const
+    {
+        DTree tree;
+        float total = Energy();
+        if (total > 0)
+            tree.RefineNode(*this, 0, total, 0, total, threshold, 1, maxDepth);
+        return tree;
+    }
+
+    void DTree::RefineNode(const DTree &source, int sourceNode, float sourceEnergy, int node,
+                           float total, float threshold, int depth, int maxDepth)
+    {
+        if (depth >= maxDepth)
+            return;
+
+        for (int child = 0; child < 4; ++child)
+        {
+            // Regions that were leaves in the source tree spread their energy evenly
+            float energy = sourceNode >= 0 ? float(source._nodes[sourceNode]._sum[child]) : sourceEnergy * 0.25f;
+            if (energy / total <= threshold)
+                continue;
+
+            uint32_t index = uint32_t(_nodes.size());
+            _nodes.emplace_back();
+            _nodes[node]._children[child] = index;
+
+            int sourceChild = (sourceNode >= 0 && !source._nodes[sourceNode].IsLeaf(child))
+                                  ? int(source._nodes[sourceNode]._children[child])
+                                  : -1;
+            RefineNode(source, sourceChild, energy, index, total, threshold, depth + 1, maxDepth);
+        }
+    }
+
+    SDTree::SDTree(const Bounds3f &bounds)
+    {
+        // Use a slightly enlarged cube so that subdivided cells stay roughly isotropic
+        Vector3f diagonal = bounds.Diagonal();
+        float size = glm::max(diagonal.x, glm::max(diagonal.y, diagonal.z)) * 1.01f + 1e-4f;
+        Vector3f center = (bounds._p_min + bounds._p_max) * 0.5f;
+        Vector3f half(0.5f * size, 0.5f * size, 0.5f * size);
+        _bounds = Bounds3f(center - half, center + half);
+
+        Node root;
+        root.leaf = 0;
+        _nodes.push_back(root);
+        _leaves.emplace_back(new Leaf());
+    }
+
+    int SDTree::LookupLeaf(const Vector3f &p) const
+    {
+        Vector3f size = _bounds.Diagonal();
+        Vector3f local = glm::clamp((p - _bounds._p_min) / size, Vector3f(0.f, 0.f, 0.f), Vector3f(1.f, 1.f, 1.f));
+        int node = 0;
+        while (_nodes[node].leaf < 0)
+        {
+            int axis = _nodes[node].axis;
+            if (local[axis] < 0.5f)
+            {
+                local[axis] *= 2;
+                node = _nodes[node].children[0];
+            }
+            else
+            {
+                local[axis] = (local[axis] - 0.5f) * 2;
+                node = _nodes[node].children[1];
+            }
+        }
+        return _nodes[node].leaf;
+    }
+
+    SDTree::Leaf &SDTree::Lookup(const Vector3f &p)
+    {
+        return *_leaves[LookupLeaf(p)];
+    }
+
+    const SDTree::Leaf &SDTree::Lookup(const Vector3f &p) const
+    {
+        return *_leaves[LookupLeaf(p)];
+    }
+
+    void SDTree::Subdivide(int node, uint64_t spatialThreshold)
+    {
+        if (_nodes[node].leaf < 0)
+        {
+            Subdivide(_nodes[node].children[0], spatialThreshold);
+            Subdivide(_nodes[node].children[1], spatialThreshold);
+            return;
+        }
+
+        int leaf = _nodes[node].leaf;
+        uint64_t count = _leaves[leaf]->building.SampleCount();
+        if (count <= spatialThreshold)
+            return;
+
+        // Both halves start from the parent's distributions, each with half of its samples
+        // (and energy, so that the mean radiance stays the same)
+        _leaves[leaf]->building.SetSampleCount(count / 2);
+        _leaves[leaf]->building.Scale(0.5f);
+        int sibling = int(_leaves.size());
+        _leaves.emplace_back(new Leaf(*_leaves[leaf]));
+
+        int axis = _nodes[node].axis;
+        Node child0, child1;
+        child0.axis = child1.axis = (axis + 1) % 3;
+        child0.leaf = leaf;
+        child1.leaf = sibling;
+
+        int index = int(_nodes.size());
+        _nodes.push_back(child0);
+        _nodes.push_back(child1);
+        _nodes[node].leaf = -1;
+        _nodes[node].children = {index, index + 1};
+
+        Subdivide(index, spatialThreshold);
+        Subdivide(index + 1, spatialThreshold);
+    }
+
+    void SDTree::Refine(uint64_t spatialThreshold, float directionalThreshold, int maxDepth)
+    {
+        Subdivide(0, spatialThreshold);
+        for (auto &leaf : _leaves)
+        {
+            leaf->sampling = leaf->building;
+            leaf->building = leaf->sampling.Refine(directionalThreshold, maxDepth);
+        }
+    }
+}
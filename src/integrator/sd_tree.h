@@ -0,0 +1,144 @@
+
+
+#ifndef INTEGRATOR_SD_TREE_H_
+#define INTEGRATOR_SD_TREE_H_
+
+#include <core/utilities.h>
+#include <core/film.h>
+#include <math/bounds.h>
+#include <atomic>
+#include <array>
+
+namespace platinum
+{
+    /**
+     * @brief 方向四叉树（D-tree），记录某个空间区域内入射辐射度的方向分布（Müller et al. 2017）。
+     *        方向用圆柱等面积映射表示为[0,1]^2上的点：x = (cosθ + 1) / 2，y = φ / 2π，
+     *        每个节点保存四个子象限的能量和，记录时沿路径用原子加法累加，因此可以多线程无锁更新。
+     */
+    class DTree
+    {
+    public:
+        DTree();
+
+        /**
+         * @brief 在方向d上记录一个入射辐射度估计（已除以该方向的采样pdf）
+         */
+        void Record(const Vector3f &d, float value);
+
+        /**
+         * @brief 按记录的能量分布采样方向，返回关于立体角的pdf
+         */
+        Vector3f Sample(const Vector2f &u, float *pdf) const;
+
+        /**
+         * @brief 方向d关于立体角的pdf
+         */
+        float Pdf(const Vector3f &d) const;
+
+        float Energy() const { return _nodes[0].Sum(); }
+
+        /**
+         * @brief 方向d上入射辐射度的估计：记录的平均值（即对所有方向积分的估计）乘以d的pdf
+         */
+        float Radiance(const Vector3f &d) const;
+
+        /**
+         * @brief 所有节点的能量乘以s，分布不变
+         */
+        void Scale(float s);
+
+        uint64_t SampleCount() const { return _sample_count; }
+
+        void SetSampleCount(uint64_t count) { _sample_count = count; }
+
+        /**
+         * @brief 根据本树（上一轮记录的结果）的能量分布细分：占总能量比例超过threshold的象限继续细分，
+         *        其余的合并为叶子。返回一棵结构细化、能量清零的新树，用于下一轮记录
+         */
+        DTree Refine(float threshold, int maxDepth) const;
+
+        DTree(const DTree &other);
+
+        DTree &operator=(const DTree &other);
+
+        static Vector2f DirToCanonical(const Vector3f &d);
+
+        static Vector3f CanonicalToDir(const Vector2f &p);
+
+    private:
+        struct Node
+        {
+            Node() = default;
+
+            Node(const Node &other);
+
+            Node &operator=(const Node &other);
+
+            float Sum() const { return _sum[0] + _sum[1] + _sum[2] + _sum[3]; }
+
+            bool IsLeaf(int child) const { return _children[child] == 0; }
+
+            //子象限编号为 x + 2y，x/y为该象限在当前节点中的位置
+            static int ChildIndex(Vector2f &p);
+
+            std::array<AtomicFloat, 4> _sum;
+            std::array<uint32_t, 4> _children{{0, 0, 0, 0}}; //0表示该象限是叶子（根节点不会是子节点）
+        };
+
+        void RefineNode(const DTree &source, int sourceNode, float sourceEnergy, int node,
+                        float total, float threshold, int depth, int maxDepth);
+
+        std::vector<Node> _nodes;
+        std::atomic<uint64_t> _sample_count{0};
+    };
+
+    /**
+     * @brief 空间二叉树（S-tree）：把场景包围盒按x、y、z轴轮流对半划分，每个叶子保存两棵D-tree：
+     *        sampling为上一轮训练得到的分布（只读，用于采样），building为本轮正在记录的分布。
+     *        每轮训练结束后调用Refine()，记录样本数较多的叶子继续细分，并交换两棵D-tree。
+     */
+    class SDTree
+    {
+    public:
+        struct Leaf
+        {
+            DTree sampling;
+            DTree building;
+        };
+
+        SDTree(const Bounds3f &bounds);
+
+        /**
+         * @brief 返回点p所在的叶子
+         */
+        Leaf &Lookup(const Vector3f &p);
+
+        const Leaf &Lookup(const Vector3f &p) const;
+
+        /**
+         * @brief 一轮训练结束后重建：记录数超过spatialThreshold的叶子分裂，然后细化各叶子的D-tree
+         */
+        void Refine(uint64_t spatialThreshold, float directionalThreshold, int maxDepth);
+
+        size_t NumLeaves() const { return _leaves.size(); }
+
+    private:
+        struct Node
+        {
+            int axis = 0;
+            std::array<int, 2> children{{-1, -1}};
+            int leaf = -1; //叶子节点在_leaves中的编号，内部节点为-1
+        };
+
+        int LookupLeaf(const Vector3f &p) const;
+
+        void Subdivide(int node, uint64_t spatialThreshold);
+
+        Bounds3f _bounds;
+        std::vector<Node> _nodes;
+        std::vector<std::unique_ptr<Leaf>> _leaves;
+    };
+}
+
+#endif
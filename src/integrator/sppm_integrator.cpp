@@ -0,0 +1,440 @@
+
+
+#include <integrator/sppm_integrator.h>
+#include <core/bsdf.h>
+#include <core/memory.h>
+#include <core/timer.h>
+#include <glm/gtx/norm.hpp>
+#include <tbb/parallel_for.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <random>
+
+namespace platinum
+{
+    REGISTER_CLASS(SPPMIntegrator, "SPPM");
+
+    namespace
+    {
+        struct SPPMPixel
+        {
+            float radius = 0;
+            //直接光照与相机路径上镜面反射看到的自发光之和（所有迭代累加）
+            Spectrum Ld = Spectrum(0.f);
+
+            //本次迭代的可见点：相机路径上第一个漫反射表面（或达到最大深度时的光泽表面）
+            struct VisiblePoint
+            {
+                Vector3f p, wo;
+                const BSDF *bsdf = nullptr;
+                Spectrum beta = Spectrum(0.f);
+            } vp;
+
+            //本次迭代落在搜索半径内的光子贡献与数目，光子追踪时多线程原子更新
+            AtomicFloat Phi[Spectrum::nSamples];
+            std::atomic<int> M{0};
+
+            //渐进更新的光子数与通量
+            float N = 0;
+            Spectrum tau = Spectrum(0.f);
+        };
+
+        //哈希网格中每个格子是一个无锁链表，记录与该格子相交的可见点
+        struct SPPMPixelListNode
+        {
+            SPPMPixel *pixel;
+            SPPMPixelListNode *next;
+        };
+
+        bool ToGrid(const Vector3f &p, const Bounds3f &bounds, const int gridRes[3], Vector3i *pi)
+        {
+            bool inBounds = true;
+            Vector3f pg = bounds.Offset(p);
+            for (int i = 0; i < 3; ++i)
+            {
+                (*pi)[i] = (int)(gridRes[i] * pg[i]);
+                inBounds &= ((*pi)[i] >= 0 && (*pi)[i] < gridRes[i]);
+                (*pi)[i] = glm::clamp((*pi)[i], 0, gridRes[i] - 1);
+            }
+            return inBounds;
+        }
+
+        inline unsigned int HashGrid(const Vector3i &p, int hashSize)
+        {
+            return (unsigned int)((p.x * 73856093) ^ (p.y * 19349663) ^ (p.z * 83492791)) % hashSize;
+        }
+    }
+
+    SPPMIntegrator::SPPMIntegrator(const PropertyTree &root)
+    {
+        _sampler = UPtr<Sampler>(static_cast<Sampler *>(ObjectFactory::CreateInstance(root.Get<std::string>("Sampler.Type"), root.GetChild("Sampler"))));
+
+        _camera = UPtr<Camera>(static_cast<Camera *>(ObjectFactory::CreateInstance(root.Get<std::string>("Camera.Type"), root.GetChild("Camera"))));
+
+        _iterations = root.Get<int>("Iterations", (int)_sampler->_samplesPerPixel);
+        _photons_per_iteration = root.Get<int>("PhotonsPerIteration", -1);
+        _max_depth = root.Get<int>("Depth", 5);
+        _initial_radius = root.Get<float>("Radius", 1.f);
+
+        auto progressive_node = root.GetChildOptional("Progressive");
+        if (progressive_node)
+        {
+            _progressive.enabled = true;
+            _progressive.passSPP = progressive_node->Get<int64_t>("PassSPP", 1);
+            _progressive.timeBudget = progressive_node->Get<float>("TimeBudget", 0.f);
+        }
+    }
+
+    void SPPMIntegrator::Render(const Scene &scene)
+    {
+        LOG(INFO) << "Start rendering...";
+        Timer timer("Integrator");
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point start = Clock::now();
+
+        Film *film = _camera->_film.get();
+        if (film->IsOutOfCore())
+        {
+            //SPPM每次迭代都重写整幅图像
+            LOG(ERROR) << "SPPM needs the whole film in memory and cannot render to an out-of-core film";
+            return;
+        }
+        const Bounds2i pixelBounds = film->GetCroppedPixelBounds();
+        const int nPixels = pixelBounds.Area();
+        const int photonsPerIteration = _photons_per_iteration > 0 ? _photons_per_iteration : nPixels;
+        const bool filterSampling = film->IsFilterImportanceSampling();
+        LOG(INFO) << "SPPM: " << _iterations << " iterations, " << photonsPerIteration << " photons per iteration";
+
+        //每次迭代在每个像素上使用采样器的一个样本
+        if (_sampler->_samplesPerPixel < _iterations)
+            _sampler->SetSamplesPerPixel(_iterations);
+
+        std::unique_ptr<SPPMPixel[]> pixels(new SPPMPixel[nPixels]);
+        for (int i = 0; i < nPixels; ++i)
+            pixels[i].radius = _initial_radius;
+
+        //光子与直接光照都按功率选择光源
+        std::unique_ptr<LightDistribution> lightDistribution = CreateLightSampleDistribution("power", scene);
+        const Distribution1D *lightDistr = lightDistribution->Lookup(Vector3f(0.f));
+        if (!lightDistr)
+        {
+            //没有光源时既没有光子也没有直接光照，图像全黑
+            LOG(WARNING) << "SPPM: the scene has no lights, the image is black";
+            std::unique_ptr<Spectrum[]> image(new Spectrum[nPixels]);
+            film->SetImage(image.get());
+            film->WriteImageToFile();
+            film->WaitForWrites();
+            film->MarkFinished();
+            return;
+        }
+
+        //可见点的BSDF要保留到本次迭代的光子追踪结束，所以每个线程使用一个贯穿整次迭代的arena
+        tbb::enumerable_thread_specific<MemoryArena> perThreadArenas;
+
+        constexpr int tileSize = 16;
+        Vector2i pixelExtent = pixelBounds.Diagonal();
+        Vector2i nTiles((pixelExtent.x + tileSize - 1) / tileSize, (pixelExtent.y + tileSize - 1) / tileSize);
+
+        for (int iter = 0; iter < _iterations; ++iter)
+        {
+            film->ReportProgress(iter, 1, _iterations, 0, LiveFramebufferHeader::Iterations);
+            // Generate SPPM visible points
+            tbb::parallel_for(tbb::blocked_range<int>(0, nTiles.x * nTiles.y),
+                              [&](const tbb::blocked_range<int> &r)
+                              {
+                                  MemoryArena &arena = perThreadArenas.local();
+                                  for (int t = r.begin(); t != r.end(); ++t)
+                                  {
+                                      Vector2i tile(t % nTiles.x, t / nTiles.x);
+                                      std::unique_ptr<Sampler> tileSampler = _sampler->Clone(iter * nTiles.x * nTiles.y + t);
+
+                                      int x0 = pixelBounds._p_min.x + tile.x * tileSize;
+                                      int x1 = glm::min(x0 + tileSize, pixelBounds._p_max.x);
+                                      int y0 = pixelBounds._p_min.y + tile.y * tileSize;
+                                      int y1 = glm::min(y0 + tileSize, pixelBounds._p_max.y);
+                                      Bounds2i tileBounds(Vector2i(x0, y0), Vector2i(x1, y1));
+
+                                      for (Vector2i pPixel : tileBounds)
+                                      {
+                                          tileSampler->StartPixel(pPixel);
+                                          tileSampler->SetSampleNumber(iter);
+
+                                          CameraSample cameraSample = tileSampler->GetCameraSample(pPixel, filterSampling ? film->GetFilter() : nullptr);
+                                          Ray ray;
+                                          Spectrum beta(_camera->CastingRay(cameraSample, ray));
+                                          if (beta.isBlack())
+                                              continue;
+
+                                          Vector2i pLocal = pPixel - pixelBounds._p_min;
+                                          SPPMPixel &pixel = pixels[pLocal.x + pLocal.y * pixelExtent.x];
+                                          bool specularBounce = false;
+                                          for (int depth = 0; depth < _max_depth; ++depth)
+                                          {
+                                              SurfaceInteraction isect;
+                                              if (!scene.Hit(ray, isect))
+                                              {
+                                                  for (const auto &light : scene._infinite_lights)
+                                                      pixel.Ld += beta * light->Le(ray);
+                                                  break;
+                                              }
+
+                                              isect.ComputeScatteringFunctions(ray, arena);
+                                              if (!isect._bsdf)
+                                              {
+                                                  ray = isect.SpawnRay(ray._direction);
+                                                  --depth;
+                                                  continue;
+                                              }
+                                              const BSDF &bsdf = *isect._bsdf;
+
+                                              Vector3f wo = -ray._direction;
+                                              if (depth == 0 || specularBounce)
+                                                  pixel.Ld += beta * isect.Le(wo);
+                                              pixel.Ld += beta * UniformSampleOneLight(isect, scene, arena, *tileSampler, lightDistr);
+
+                                              //漫反射表面（或到达最大深度的光泽表面）作为可见点，镜面表面继续追踪
+                                              bool isDiffuse = bsdf.NumComponents(BxDFType((int)BxDFType::BSDF_DIFFUSE | (int)BxDFType::BSDF_REFLECTION |
+                                                                                           (int)BxDFType::BSDF_TRANSMISSION)) > 0;
+                                              bool isGlossy = bsdf.NumComponents(BxDFType((int)BxDFType::BSDF_GLOSSY | (int)BxDFType::BSDF_REFLECTION |
+                                                                                          (int)BxDFType::BSDF_TRANSMISSION)) > 0;
+                                              if (isDiffuse || (isGlossy && depth == _max_depth - 1))
+                                              {
+                                                  pixel.vp.p = isect.p;
+                                                  pixel.vp.wo = wo;
+                                                  pixel.vp.bsdf = &bsdf;
+                                                  pixel.vp.beta = beta;
+                                                  break;
+                                              }
+
+                                              if (depth < _max_depth - 1)
+                                              {
+                                                  float pdf;
+                                                  Vector3f wi;
+                                                  BxDFType type;
+                                                  Spectrum f = bsdf.SampleF(wo, wi, tileSampler->Get2D(), pdf, type);
+                                                  if (pdf == 0 || f.isBlack())
+                                                      break;
+                                                  specularBounce = ((int)type & (int)BxDFType::BSDF_SPECULAR) != 0;
+                                                  beta *= f * glm::abs(glm::dot(wi, isect.n)) / pdf;
+                                                  if (beta.y() < 0.25f)
+                                                  {
+                                                      float continueProb = glm::min(1.f, beta.y());
+                                                      if (tileSampler->Get1D() > continueProb)
+                                                          break;
+                                                      beta /= continueProb;
+                                                  }
+                                                  ray = isect.SpawnRay(wi);
+                                              }
+                                          }
+                                      }
+                                  }
+                              });
+
+            // Create grid of all SPPM visible points
+            int gridRes[3];
+            Bounds3f gridBounds;
+            float maxRadius = 0.f;
+            bool hasVisiblePoints = false;
+            for (int i = 0; i < nPixels; ++i)
+            {
+                const SPPMPixel &pixel = pixels[i];
+                if (pixel.vp.beta.isBlack())
+                    continue;
+                Vector3f r(pixel.radius, pixel.radius, pixel.radius);
+                Bounds3f vpBound(pixel.vp.p - r, pixel.vp.p + r);
+                gridBounds = hasVisiblePoints ? UnionBounds(gridBounds, vpBound) : vpBound;
+                hasVisiblePoints = true;
+                maxRadius = glm::max(maxRadius, pixel.radius);
+            }
+
+            //网格大小使每个格子的边长与最大搜索半径相当，哈希表大小取像素数
+            const int hashSize = nPixels;
+            std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
+            for (auto &cell : grid)
+                cell = nullptr;
+            if (hasVisiblePoints)
+            {
+                Vector3f diag = gridBounds.Diagonal();
+                float maxDiag = maxComponent(diag);
+                int baseGridRes = (int)(maxDiag / maxRadius);
+                for (int i = 0; i < 3; ++i)
+                    gridRes[i] = glm::max((int)(baseGridRes * diag[i] / maxDiag), 1);
+
+                // Add visible points to SPPM grid
+                tbb::parallel_for(tbb::blocked_range<int>(0, nPixels, 4096),
+                                  [&](const tbb::blocked_range<int> &r)
+                                  {
+                                      MemoryArena &arena = perThreadArenas.local();
+                                      for (int i = r.begin(); i != r.end(); ++i)
+                                      {
+                                          SPPMPixel &pixel = pixels[i];
+                                          if (pixel.vp.beta.isBlack())
+                                              continue;
+                                          float radius = pixel.radius;
+                                          Vector3i pMin, pMax;
+                                          ToGrid(pixel.vp.p - Vector3f(radius, radius, radius), gridBounds, gridRes, &pMin);
+                                          ToGrid(pixel.vp.p + Vector3f(radius, radius, radius), gridBounds, gridRes, &pMax);
+                                          for (int z = pMin.z; z <= pMax.z; ++z)
+                                              for (int y = pMin.y; y <= pMax.y; ++y)
+                                                  for (int x = pMin.x; x <= pMax.x; ++x)
+                                                  {
+                                                      int h = HashGrid(Vector3i(x, y, z), hashSize);
+                                                      SPPMPixelListNode *node = ARENA_ALLOC(arena, SPPMPixelListNode);
+                                                      node->pixel = &pixel;
+                                                      node->next = grid[h];
+                                                      while (!grid[h].compare_exchange_weak(node->next, node))
+                                                          ;
+                                                  }
+                                      }
+                                  });
+
+                // Trace photons and accumulate contributions
+                tbb::parallel_for(tbb::blocked_range<int>(0, photonsPerIteration, 8192),
+                                  [&](const tbb::blocked_range<int> &r)
+                                  {
+                                      MemoryArena photonArena;
+                                      //Note: every range of photons draws from its own stream, seeded by the global photon index
+                                      std::mt19937 engine((uint32_t)((int64_t)iter * photonsPerIteration + r.begin()));
+                                      std::uniform_real_distribution<float> dist(0.f, 1.f);
+                                      auto uniform = [&]()
+                                      { return glm::min(dist(engine), OneMinusEpsilon); };
+
+                                      for (int photonIndex = r.begin(); photonIndex != r.end(); ++photonIndex)
+                                      {
+                                          float lightPdf;
+                                          int lightNum = lightDistr->SampleDiscrete(uniform(), &lightPdf);
+                                          const Ptr<Light> &light = scene._lights[lightNum];
+
+                                          Vector2f uLight0(uniform(), uniform());
+                                          Vector2f uLight1(uniform(), uniform());
+                                          Ray photonRay;
+                                          Vector3f nLight;
+                                          float pdfPos, pdfDir;
+                                          Spectrum Le = light->SampleLe(uLight0, uLight1, photonRay, nLight, pdfPos, pdfDir);
+                                          if (pdfPos == 0 || pdfDir == 0 || Le.isBlack())
+                                              continue;
+                                          Spectrum beta = Le * glm::abs(glm::dot(nLight, photonRay._direction)) / (lightPdf * pdfPos * pdfDir);
+                                          if (beta.isBlack())
+                                              continue;
+
+                                          for (int depth = 0; depth < _max_depth; ++depth)
+                                          {
+                                              SurfaceInteraction isect;
+                                              if (!scene.Hit(photonRay, isect))
+                                                  break;
+
+                                              //第一次相交是直接光照，已经在可见点处计算过
+                                              if (depth > 0)
+                                              {
+                                                  Vector3i photonGridIndex;
+                                                  if (ToGrid(isect.p, gridBounds, gridRes, &photonGridIndex))
+                                                  {
+                                                      int h = HashGrid(photonGridIndex, hashSize);
+                                                      for (SPPMPixelListNode *node = grid[h].load(std::memory_order_relaxed); node; node = node->next)
+                                                      {
+                                                          SPPMPixel &pixel = *node->pixel;
+                                                          float radius = pixel.radius;
+                                                          if (glm::length2(pixel.vp.p - isect.p) > radius * radius)
+                                                              continue;
+                                                          Vector3f wi = -photonRay._direction;
+                                                          Spectrum Phi = beta * pixel.vp.bsdf->F(pixel.vp.wo, wi);
+                                                          for (int i = 0; i < Spectrum::nSamples; ++i)
+                                                              pixel.Phi[i].add(Phi[i]);
+                                                          ++pixel.M;
+                                                      }
+                                                  }
+                                              }
+
+                                              isect.ComputeScatteringFunctions(photonRay, photonArena);
+                                              if (!isect._bsdf)
+                                              {
+                                                  --depth;
+                                                  photonRay = isect.SpawnRay(photonRay._direction);
+                                                  continue;
+                                              }
+                                              const BSDF &photonBSDF = *isect._bsdf;
+
+                                              Vector3f wi, wo = -photonRay._direction;
+                                              float pdf;
+                                              BxDFType flags;
+                                              Vector2f u(uniform(), uniform());
+                                              Spectrum fr = photonBSDF.SampleF(wo, wi, u, pdf, flags);
+                                              if (fr.isBlack() || pdf == 0.f)
+                                                  break;
+                                              Spectrum bnew = beta * fr * glm::abs(glm::dot(wi, isect.n)) / pdf;
+
+                                              //俄罗斯轮盘：保持光子的能量大致不变
+                                              float q = glm::max(0.f, 1 - bnew.y() / beta.y());
+                                              if (uniform() < q)
+                                                  break;
+                                              beta = bnew / (1 - q);
+                                              photonRay = isect.SpawnRay(wi);
+                                          }
+                                          photonArena.Reset();
+                                      }
+                                  });
+            }
+
+            // Update pixel values from this pass's photons
+            tbb::parallel_for(tbb::blocked_range<int>(0, nPixels, 4096),
+                              [&](const tbb::blocked_range<int> &r)
+                              {
+                                  for (int i = r.begin(); i != r.end(); ++i)
+                                  {
+                                      SPPMPixel &p = pixels[i];
+                                      int M = p.M;
+                                      if (M > 0)
+                                      {
+                                          //新光子只保留gamma的比例，半径按比例缩小
+                                          constexpr float gamma = 2.f / 3.f;
+                                          float Nnew = p.N + gamma * M;
+                                          float Rnew = p.radius * glm::sqrt(Nnew / (p.N + M));
+                                          Spectrum Phi;
+                                          for (int j = 0; j < Spectrum::nSamples; ++j)
+                                          {
+                                              Phi[j] = p.Phi[j];
+                                              p.Phi[j] = 0;
+                                          }
+                                          p.tau = (p.tau + p.vp.beta * Phi) * (Rnew * Rnew) / (p.radius * p.radius);
+                                          p.N = Nnew;
+                                          p.radius = Rnew;
+                                          p.M = 0;
+                                      }
+                                      p.vp.beta = Spectrum(0.f);
+                                      p.vp.bsdf = nullptr;
+                                  }
+                              });
+            for (MemoryArena &arena : perThreadArenas)
+                arena.Reset();
+
+            float elapsed = std::chrono::duration<float>(Clock::now() - start).count();
+            bool outOfTime = _progressive.enabled && _progressive.timeBudget > 0 && elapsed >= _progressive.timeBudget;
+            bool lastIteration = iter + 1 == _iterations || outOfTime;
+            bool writeImage = lastIteration || (_progressive.enabled && (iter + 1) % glm::max<int64_t>(_progressive.passSPP, 1) == 0);
+
+            if (writeImage)
+            {
+                // Compute radiance estimate: direct lighting plus the photon density estimate
+                uint64_t Np = (uint64_t)(iter + 1) * (uint64_t)photonsPerIteration;
+                std::unique_ptr<Spectrum[]> image(new Spectrum[nPixels]);
+                for (int i = 0; i < nPixels; ++i)
+                {
+                    const SPPMPixel &pixel = pixels[i];
+                    image[i] = pixel.Ld / float(iter + 1);
+                    image[i] += pixel.tau / (Np * Pi * pixel.radius * pixel.radius);
+                }
+                film->SetImage(image.get());
+                film->WriteImageToFile();
+                LOG(INFO) << "Iteration " << iter + 1 << "/" << _iterations << " finished, " << elapsed << "s elapsed";
+            }
+
+            if (outOfTime)
+            {
+                LOG(INFO) << "Time budget of " << _progressive.timeBudget << "s exhausted after " << iter + 1 << " iterations";
+                break;
+            }
+        }
+        film->WaitForWrites();
+        film->MarkFinished();
+        LOG(INFO) << "Rendering finished";
+    }
+}
@@ -0,0 +1,46 @@
+
+
+#ifndef INTEGRATOR_SPPM_INTEGRATOR_H_
+#define INTEGRATOR_SPPM_INTEGRATOR_H_
+
+#include <core/integrator.h>
+#include <core/light.h>
+
+namespace platinum
+{
+    /**
+     * @brief 随机渐进式光子映射（SPPM，Hachisuka and Jensen 2009，实现参考pbrt-v3）。
+     *        每次迭代先从相机出发，在每个像素第一个非镜面表面处记录可见点（visible point），并放入空间哈希网格；
+     *        然后从光源发射光子，光子落在可见点的搜索半径内时用原子操作累加到对应像素，迭代结束后按比例缩小半径。
+     *        镜面路径形成的焦散（如Mirror材质）由光子携带，因此收敛远快于路径追踪。
+     *        Progressive块的PassSPP表示每隔多少次迭代写出一次中间图像，TimeBudget为渲染时间上限（秒）。
+     */
+    class SPPMIntegrator : public Integrator
+    {
+    public:
+        SPPMIntegrator(const PropertyTree &root);
+
+        SPPMIntegrator(UPtr<Camera> camera, UPtr<Sampler> sampler, int iterations, int photons_per_iteration,
+                       int max_depth, float initial_radius)
+            : _camera(std::move(camera)), _sampler(std::move(sampler)), _iterations(iterations),
+              _photons_per_iteration(photons_per_iteration), _max_depth(max_depth), _initial_radius(initial_radius) {}
+
+        virtual void Render(const Scene &scene) override;
+
+        void SetProgressive(const ProgressiveSettings &settings) { _progressive = settings; }
+
+        virtual std::string ToString() const { return "SPPMIntegrator"; }
+
+    private:
+        UPtr<Camera> _camera;
+        UPtr<Sampler> _sampler;
+        ProgressiveSettings _progressive;
+        int _iterations;
+        //<= 0时每次迭代发射的光子数等于像素数
+        int _photons_per_iteration;
+        int _max_depth;
+        float _initial_radius;
+    };
+}
+
+#endif
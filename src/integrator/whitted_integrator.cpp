@@ -8,11 +8,8 @@ namespace platinum
     REGISTER_CLASS(WhittedIntegrator, "Whitted");
 
     WhittedIntegrator::WhittedIntegrator(const PropertyTree &root)
-        : SamplerIntegrator(nullptr, nullptr), _max_depth(root.Get<int>("Depth"))
+        : SamplerIntegrator(root), _max_depth(root.Get<int>("Depth"))
     {
-        _sampler = UPtr<Sampler>(static_cast<Sampler *>(ObjectFactory::CreateInstance(root.Get<std::string>("Sampler.Type"), root.GetChild("Sampler"))));
-
-        _camera = UPtr<Camera>(static_cast<Camera *>(ObjectFactory::CreateInstance(root.Get<std::string>("Camera.Type"), root.GetChild("Camera"))));
     }
 
     //https://pbr-book.org/3ed-2018/Introduction/pbrt_System_Overview#WhittedIntegrator
@@ -20,6 +17,7 @@ namespace platinum
     {
 
         Spectrum L{0.f};
+        AOVSample *aov = depth == 0 ? PrimaryAOVSample() : nullptr;
 
         SurfaceInteraction inter;
         // Find closest ray intersection or return background radiance
@@ -28,6 +26,8 @@ namespace platinum
             //返回lights emission
             for (const auto &light : scene._lights)
                 L += light->Le(ray);
+            if (aov)
+                aov->emission += L;
             return L;
         }
 
@@ -43,10 +43,13 @@ namespace platinum
 
         // 如果光线打到光源，计算其发光值 -> Le (emission term)
         L += inter.Le(wo);
+        if (aov)
+            aov->emission += L;
 
         //对每个光源，计算其贡献
-        for (const auto &light : scene._lights)
+        for (size_t i = 0; i < scene._lights.size(); ++i)
         {
+            const auto &light = scene._lights[i];
             float pdf;
             Vector3f wi;
             VisibilityTester visibility_tester;
@@ -60,7 +63,10 @@ namespace platinum
             //如果所采样的光源上的光线没被遮挡
             if (!f.isBlack() && visibility_tester.Unoccluded(scene))
             {
-                L += f * sampled_li * glm::abs(glm::dot(wi, n)) / pdf;
+                Spectrum Ld = f * sampled_li * glm::abs(glm::dot(wi, n)) / pdf;
+                if (aov)
+                    aov->AddLight(int(i), Ld);
+                L += Ld;
             }
         }
         if (depth + 1 < _max_depth)
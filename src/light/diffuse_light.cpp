@@ -31,12 +31,38 @@ namespace platinum
     Spectrum DiffuseAreaLight::SampleLe(const Vector2f &u1, const Vector2f &u2, Ray &ray,
                                         Vector3f &nLight, float &pdfPos, float &pdfDir) const
     {
-        //TODO::
-        return Spectrum(0.f);
+        Interaction pShape = _shape->Sample(u1, pdfPos);
+        nLight = pShape.n;
+
+        // Cosine-weighted direction about the normal, on a random side for two-sided emitters
+        Vector2f u = u2;
+        bool flip = false;
+        if (_two_sided)
+        {
+            flip = u[0] >= 0.5f;
+            u[0] = flip ? 2 * (u[0] - 0.5f) : 2 * u[0];
+            u[0] = glm::min(u[0], OneMinusEpsilon);
+        }
+        Vector3f w = CosineSampleHemisphere(u);
+        pdfDir = CosineHemispherePdf(w.z) * (_two_sided ? 0.5f : 1.f);
+        if (flip)
+            w.z = -w.z;
+
+        Vector3f v1, v2;
+        coordinateSystem(pShape.n, v1, v2);
+        w = w.x * v1 + w.y * v2 + w.z * pShape.n;
+        ray = pShape.SpawnRay(w);
+        return L(pShape, w);
     }
 
-    void DiffuseAreaLight::PdfLe(const Ray &, const Vector3f &, float &pdfPos, float &pdfDir) const
+    void DiffuseAreaLight::PdfLe(const Ray &ray, const Vector3f &n, float &pdfPos, float &pdfDir) const
     {
+        pdfPos = _shape->Pdf(Interaction());
+        float cosTheta = glm::dot(n, ray._direction);
+        if (_two_sided)
+            pdfDir = 0.5f * CosineHemispherePdf(glm::abs(cosTheta));
+        else
+            pdfDir = cosTheta > 0 ? CosineHemispherePdf(cosTheta) : 0.f;
     }
 
     Spectrum DiffuseAreaLight::SampleLi(const Interaction &inter, const Vector2f &u,
@@ -58,4 +84,15 @@ namespace platinum
     {
         return _shape->Pdf(inter, wi);
     }
+
+    bool DiffuseAreaLight::GetLightBounds(LightBounds &bounds) const
+    {
+        float phi = Power().maxComponentValue();
+        if (phi == 0)
+            return false;
+        // A diffuse emitter radiates over the whole hemisphere around its normal
+        DirectionCone normals = _shape->NormalBounds();
+        bounds = LightBounds(_shape->WorldBound(), normals.w, phi, normals.cosTheta, glm::cos(Pi / 2), _two_sided);
+        return true;
+    }
 }
\ No newline at end of file
@@ -39,6 +39,8 @@ namespace platinum
 
         virtual float PdfLi(const Interaction &inter, const Vector3f &wi) const;
 
+        virtual bool GetLightBounds(LightBounds &bounds) const override;
+
         virtual std::string ToString() const { return "DiffuseAreaLight"; }
 
         virtual void DiffuseAreaLight::SetParent(Object *parent) override;
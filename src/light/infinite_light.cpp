@@ -0,0 +1,188 @@
+#include <light/infinite_light.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <stb/stb_image.h>
+
+namespace platinum
+{
+    REGISTER_CLASS(InfiniteAreaLight, "InfiniteAreaLight");
+
+    InfiniteAreaLight::InfiniteAreaLight(const PropertyTree &node)
+        : Light(node)
+    {
+        _flags = (int)LightFlags::LightInfinite;
+        // Note: the map can be rotated around the up (y) axis, in degrees
+        _light2World = RotateY(node.Get<float>("RotateY", 0.f));
+        _world2Light = Inverse(_light2World);
+
+        auto filepath = node.Get<std::string>("Filepath", "");
+        Spectrum scale = node.GetChildOptional("Scale") ? Spectrum::fromRGB(node.Get<Vector3f>("Scale")) : Spectrum(1.f);
+        LoadImage(filepath + node.Get<std::string>("Filename"), scale);
+    }
+
+    InfiniteAreaLight::InfiniteAreaLight(const Transform &light2world, const Spectrum &scale, int nSamples, const std::string &texmap)
+        : Light((int)LightFlags::LightInfinite, light2world, nSamples)
+    {
+        LoadImage(texmap, scale);
+    }
+
+    void InfiniteAreaLight::LoadImage(const std::string &texmap, const Spectrum &scale)
+    {
+        int channels = 0;
+        float *data = texmap.empty() ? nullptr : stbi_loadf(texmap.c_str(), &_width, &_height, &channels, 3);
+        if (data == nullptr)
+        {
+            // Fall back to a constant environment
+            LOG(ERROR) << "Could not load environment map \"" << texmap << "\", using a constant environment instead";
+            _width = _height = 1;
+            _texels.assign(1, scale);
+        }
+        else
+        {
+            LOG(INFO) << "Environment map " << texmap << ": " << _width << "x" << _height;
+            _texels.resize(size_t(_width) * _height);
+            for (size_t i = 0; i < _texels.size(); ++i)
+                _texels[i] = Spectrum::fromRGB(Vector3f(data[3 * i + 0], data[3 * i + 1], data[3 * i + 2])) * scale;
+            stbi_image_free(data);
+        }
+
+        // Initialize sampling PDFs for infinite area light
+        // Note: the sin(theta) factor accounts for the distortion of the equirectangular
+        //       mapping, rows near the poles cover less solid angle.
+        std::vector<float> img(_texels.size());
+        for (int v = 0; v < _height; ++v)
+        {
+            float sinTheta = glm::sin(Pi * float(v + .5f) / float(_height));
+            for (int u = 0; u < _width; ++u)
+                img[v * _width + u] = _texels[v * _width + u].y() * sinTheta;
+        }
+        _distribution.reset(new Distribution2D(img.data(), _width, _height));
+    }
+
+    void InfiniteAreaLight::Preprocess(const Scene &scene)
+    {
+        const Bounds3f &bounds = scene.WorldBound();
+        _world_center = (bounds._p_min + bounds._p_max) * 0.5f;
+        _world_radius = glm::distance(_world_center, bounds._p_max);
+    }
+
+    Vector2f InfiniteAreaLight::DirectionToUV(const Vector3f &w)
+    {
+        float theta = glm::acos(glm::clamp(w.y, -1.f, 1.f));
+        float phi = glm::atan(w.z, w.x);
+        if (phi < 0)
+            phi += 2 * Pi;
+        return Vector2f(phi * Inv2Pi, theta * InvPi);
+    }
+
+    Vector3f InfiniteAreaLight::UVToDirection(const Vector2f &uv, float *sinTheta)
+    {
+        float theta = uv[1] * Pi, phi = uv[0] * 2 * Pi;
+        float cosTheta = glm::cos(theta), sinT = glm::sin(theta);
+        if (sinTheta)
+            *sinTheta = sinT;
+        return Vector3f(sinT * glm::cos(phi), cosTheta, sinT * glm::sin(phi));
+    }
+
+    Spectrum InfiniteAreaLight::Lookup(const Vector2f &uv) const
+    {
+        // Bilinear interpolation, wrapping in u and clamping in v
+        float x = uv[0] * _width - 0.5f, y = uv[1] * _height - 0.5f;
+        int x0 = (int)glm::floor(x), y0 = (int)glm::floor(y);
+        float dx = x - x0, dy = y - y0;
+        auto texel = [&](int s, int t) -> const Spectrum &
+        {
+            s = ((s % _width) + _width) % _width;
+            t = glm::clamp(t, 0, _height - 1);
+            return _texels[t * _width + s];
+        };
+        return (1 - dx) * (1 - dy) * texel(x0, y0) + dx * (1 - dy) * texel(x0 + 1, y0) +
+               (1 - dx) * dy * texel(x0, y0 + 1) + dx * dy * texel(x0 + 1, y0 + 1);
+    }
+
+    Spectrum InfiniteAreaLight::Power() const
+    {
+        Spectrum sum(0.f);
+        for (const Spectrum &texel : _texels)
+            sum += texel;
+        return Pi * _world_radius * _world_radius * sum / float(_texels.size());
+    }
+
+    Spectrum InfiniteAreaLight::Le(const Ray &ray) const
+    {
+        Vector3f wl = glm::normalize(_world2Light.ExecOn(ray._direction, 0.f));
+        return Lookup(DirectionToUV(wl));
+    }
+
+    Spectrum InfiniteAreaLight::SampleLi(const Interaction &ref, const Vector2f &u, Vector3f &wi,
+                                         float &pdf, VisibilityTester &vis) const
+    {
+        // Find $(u,v)$ sample coordinates in infinite light texture
+        float mapPdf;
+        Vector2f uv = _distribution->SampleContinuous(u, &mapPdf);
+        if (mapPdf == 0)
+        {
+            pdf = 0;
+            return Spectrum(0.f);
+        }
+
+        // Convert infinite light sample point to direction
+        float sinTheta;
+        wi = glm::normalize(_light2World.ExecOn(UVToDirection(uv, &sinTheta), 0.f));
+
+        // Compute PDF for sampled infinite light direction
+        pdf = (sinTheta == 0) ? 0 : mapPdf / (2 * Pi * Pi * sinTheta);
+
+        // Return radiance value for infinite light direction
+        vis = VisibilityTester(ref, Interaction(ref.p + wi * (2 * _world_radius)));
+        return Lookup(uv);
+    }
+
+    float InfiniteAreaLight::PdfLi(const Interaction &, const Vector3f &w) const
+    {
+        Vector3f wl = glm::normalize(_world2Light.ExecOn(w, 0.f));
+        Vector2f uv = DirectionToUV(wl);
+        float sinTheta = glm::sin(uv[1] * Pi);
+        if (sinTheta == 0)
+            return 0;
+        return _distribution->Pdf(uv) / (2 * Pi * Pi * sinTheta);
+    }
+
+    Spectrum InfiniteAreaLight::SampleLe(const Vector2f &u1, const Vector2f &u2, Ray &ray,
+                                         Vector3f &nLight, float &pdfPos, float &pdfDir) const
+    {
+        // Compute direction for infinite light sample ray
+        float mapPdf;
+        Vector2f uv = _distribution->SampleContinuous(u1, &mapPdf);
+        if (mapPdf == 0)
+        {
+            pdfPos = pdfDir = 0;
+            return Spectrum(0.f);
+        }
+        float sinTheta;
+        Vector3f d = -glm::normalize(_light2World.ExecOn(UVToDirection(uv, &sinTheta), 0.f));
+        nLight = d;
+
+        // Compute origin for infinite light sample ray on a disk facing _d_
+        Vector3f v1, v2;
+        coordinateSystem(-d, v1, v2);
+        Vector2f cd = ConcentricSampleDisk(u2);
+        Vector3f pDisk = _world_center + _world_radius * (cd.x * v1 + cd.y * v2);
+        ray = Ray(pDisk + _world_radius * -d, d);
+
+        // Compute _InfiniteAreaLight_ ray PDFs
+        pdfDir = (sinTheta == 0) ? 0 : mapPdf / (2 * Pi * Pi * sinTheta);
+        pdfPos = 1 / (Pi * _world_radius * _world_radius);
+        return Lookup(uv);
+    }
+
+    void InfiniteAreaLight::PdfLe(const Ray &ray, const Vector3f &, float &pdfPos, float &pdfDir) const
+    {
+        Vector3f d = -glm::normalize(_world2Light.ExecOn(ray._direction, 0.f));
+        Vector2f uv = DirectionToUV(d);
+        float sinTheta = glm::sin(uv[1] * Pi);
+        pdfDir = (sinTheta == 0) ? 0 : _distribution->Pdf(uv) / (2 * Pi * Pi * sinTheta);
+        pdfPos = 1 / (Pi * _world_radius * _world_radius);
+    }
+}
@@ -6,31 +6,51 @@
 
 namespace platinum
 {
-    // class InfiniteAreaLight : public Light
-    // {
-
-    // public:
-    //     InfiniteAreaLight(const Transform &light2world, const Spectrum &power, int nSamples, const std::string &texmap);
-
-    //     void Proprocess(const Scene &scene)
-    //     {
-    //         scene.WorldBound().BoundingSphere(&_world_center, &_world_radius);
-    //     }
-    //     Spectrum Power() const;
-    //     Spectrum Le(const Ray &ray) const;
-    //     Spectrum SampleLi(const Interaction &ref, const Vector2f &u, Vector3f *wi,
-    //                        float *pdf, VisibilityTester *vis) const;
-    //     float PdfLi(const Interaction &, const Vector3f &) const;
-    //     Spectrum SampleLe(const Vector2f &u1, const Vector2f &u2, float time,
-    //                        Ray *ray,  Vector3f *nLight, float *pdfPos,
-    //                        float *pdfDir) const;
-    //     void PdfLe(const Ray &, const Vector3f &, float *pdfPos,
-    //                 float *pdfDir) const;
-
-    // private:
-    //     Vector3f _world_center;
-    //     float _world_radius;
-    //     UPtr<Distribution2D> _distribution;
-    // };
+    /**
+     * @brief 基于HDR环境贴图的无穷远面光源。贴图采用经纬度（equirectangular）参数化，y轴朝上：
+     *        u = phi / 2π，v = theta / π，theta为与+y轴的夹角。
+     *        采样时按 亮度 * sin(theta) 构造的Distribution2D进行重要性采样。
+     */
+    class InfiniteAreaLight final : public Light
+    {
+    public:
+        InfiniteAreaLight(const PropertyTree &node);
+
+        InfiniteAreaLight(const Transform &light2world, const Spectrum &scale, int nSamples, const std::string &texmap);
+
+        virtual void Preprocess(const Scene &scene) override;
+
+        virtual Spectrum Power() const override;
+
+        virtual Spectrum Le(const Ray &ray) const override;
+
+        virtual Spectrum SampleLi(const Interaction &ref, const Vector2f &u, Vector3f &wi,
+                                  float &pdf, VisibilityTester &vis) const override;
+
+        virtual float PdfLi(const Interaction &, const Vector3f &) const override;
+
+        virtual Spectrum SampleLe(const Vector2f &u1, const Vector2f &u2, Ray &ray,
+                                  Vector3f &nLight, float &pdfPos, float &pdfDir) const override;
+
+        virtual void PdfLe(const Ray &, const Vector3f &, float &pdfPos, float &pdfDir) const override;
+
+        virtual std::string ToString() const { return "InfiniteAreaLight"; }
+
+    private:
+        void LoadImage(const std::string &texmap, const Spectrum &scale);
+
+        // 双线性插值查询贴图，uv ∈ [0,1]^2
+        Spectrum Lookup(const Vector2f &uv) const;
+
+        // 光源坐标系中的方向 <-> 贴图坐标
+        static Vector2f DirectionToUV(const Vector3f &w);
+        static Vector3f UVToDirection(const Vector2f &uv, float *sinTheta = nullptr);
+
+        int _width = 0, _height = 0;
+        std::vector<Spectrum> _texels;
+        Vector3f _world_center;
+        float _world_radius = 0;
+        UPtr<Distribution2D> _distribution;
+    };
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,314 @@
+
+
+#include <light/mesh_light.h>
+#include <glm/gtx/norm.hpp>
+#include <numeric>
+namespace platinum
+{
+    REGISTER_CLASS(MeshAreaLight, "MeshAreaLight");
+
+    MeshAreaLight::MeshAreaLight(const PropertyTree &node)
+        : AreaLight(node)
+    {
+        Vector3f spectrum = node.Get<Vector3f>("Radiance");
+        _Lemit = Spectrum::fromRGB(spectrum);
+        _two_sided = node.Get<bool>("TwoSided");
+    }
+
+    MeshAreaLight::MeshAreaLight(const Spectrum &Lemit, int n_samples, TriangleMesh *mesh,
+                                 Transform *object2world, Transform *world2object, bool two_sided)
+        : AreaLight(*object2world, n_samples), _Lemit(Lemit), _two_sided(two_sided)
+    {
+        SetMesh(mesh, object2world, world2object);
+    }
+
+    void MeshAreaLight::SetMesh(TriangleMesh *mesh, Transform *object2world, Transform *world2object)
+    {
+        _mesh = mesh;
+        _object2world = object2world;
+        _world2object = world2object;
+
+        // Mesh positions are stored in world space already
+        const auto &indices = _mesh->GetIndices();
+        int nTriangles = int(indices.size() / 3);
+        std::vector<Vector3f> centroids(nTriangles);
+        _area = 0.f;
+        for (int i = 0; i < nTriangles; ++i)
+        {
+            const auto &p0 = _mesh->GetPositionAt(indices[3 * i + 0]);
+            const auto &p1 = _mesh->GetPositionAt(indices[3 * i + 1]);
+            const auto &p2 = _mesh->GetPositionAt(indices[3 * i + 2]);
+            centroids[i] = (p0 + p1 + p2) / 3.f;
+            _area += 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
+        }
+
+        _clusters.clear();
+        _triangle_order.resize(nTriangles);
+        std::iota(_triangle_order.begin(), _triangle_order.end(), 0);
+        _cluster_cdf.assign(nTriangles, 0.f);
+        if (nTriangles > 0)
+            BuildClusters(0, nTriangles, centroids);
+    }
+
+    int MeshAreaLight::BuildClusters(int begin, int end, std::vector<Vector3f> &centroids)
+    {
+        int nodeIndex = int(_clusters.size());
+        _clusters.push_back({LightBounds(), begin, end, -1});
+
+        if (end - begin <= MaxClusterTriangles)
+        {
+            // Leaf: bound the triangles and tabulate their areas
+            const auto &indices = _mesh->GetIndices();
+            LightBounds lightBounds;
+            float clusterArea = 0.f;
+            for (int slot = begin; slot < end; ++slot)
+            {
+                int face = _triangle_order[slot];
+                const auto &p0 = _mesh->GetPositionAt(indices[3 * face + 0]);
+                const auto &p1 = _mesh->GetPositionAt(indices[3 * face + 1]);
+                const auto &p2 = _mesh->GetPositionAt(indices[3 * face + 2]);
+                Vector3f n = glm::cross(p1 - p0, p2 - p0);
+                float area = 0.5f * glm::length(n);
+                if (area > 0)
+                    lightBounds = Union(lightBounds, LightBounds(UnionBounds(Bounds3f(p0, p1), p2), n, area, 1.f, glm::cos(Pi / 2), _two_sided));
+                clusterArea += area;
+                _cluster_cdf[slot] = clusterArea;
+            }
+            for (int slot = begin; slot < end; ++slot)
+                _cluster_cdf[slot] = clusterArea > 0 ? _cluster_cdf[slot] / clusterArea : float(slot - begin + 1) / (end - begin);
+            _cluster_cdf[end - 1] = 1.f;
+            _clusters[nodeIndex].lightBounds = lightBounds;
+            return nodeIndex;
+        }
+
+        // Split at the median centroid along the widest axis
+        Bounds3f centroidBounds;
+        for (int slot = begin; slot < end; ++slot)
+            centroidBounds = UnionBounds(centroidBounds, centroids[_triangle_order[slot]]);
+        int dim = centroidBounds.MaximumExtent();
+        int mid = (begin + end) / 2;
+        std::nth_element(_triangle_order.begin() + begin, _triangle_order.begin() + mid, _triangle_order.begin() + end,
+                         [&](int a, int b) { return centroids[a][dim] < centroids[b][dim]; });
+
+        BuildClusters(begin, mid, centroids);
+        int secondChild = BuildClusters(mid, end, centroids);
+        _clusters[nodeIndex].lightBounds = Union(_clusters[nodeIndex + 1].lightBounds, _clusters[secondChild].lightBounds);
+        _clusters[nodeIndex].secondChild = secondChild;
+        return nodeIndex;
+    }
+
+    int MeshAreaLight::SampleSlot(const Interaction *inter, float u, float &pmf, float &uRemapped) const
+    {
+        auto weight = [&](const TriangleCluster &cluster)
+        {
+            return inter ? cluster.lightBounds.Importance(inter->p, inter->n) : cluster.lightBounds.phi;
+        };
+
+        pmf = 0;
+        if (_clusters.empty() || weight(_clusters[0]) == 0)
+            return -1;
+
+        // Descend to a cluster, choosing children according to their weights
+        int nodeIndex = 0;
+        pmf = 1;
+        while (_clusters[nodeIndex].secondChild >= 0)
+        {
+            const TriangleCluster &node = _clusters[nodeIndex];
+            float ci[2] = {weight(_clusters[nodeIndex + 1]), weight(_clusters[node.secondChild])};
+            // The bounds of the parent are wider than those of its children, it can be important
+            // to inter although neither child is
+            if (ci[0] == 0 && ci[1] == 0)
+            {
+                pmf = 0;
+                return -1;
+            }
+            float p0 = ci[0] / (ci[0] + ci[1]);
+            if (u < p0)
+            {
+                u = glm::min(u / p0, OneMinusEpsilon);
+                pmf *= p0;
+                nodeIndex = nodeIndex + 1;
+            }
+            else
+            {
+                u = glm::min((u - p0) / (1 - p0), OneMinusEpsilon);
+                pmf *= 1 - p0;
+                nodeIndex = node.secondChild;
+            }
+        }
+
+        // Pick a triangle of the cluster proportional to its area
+        const TriangleCluster &leaf = _clusters[nodeIndex];
+        int slot = leaf.begin;
+        while (slot < leaf.end - 1 && u >= _cluster_cdf[slot])
+            ++slot;
+        float cdf0 = slot > leaf.begin ? _cluster_cdf[slot - 1] : 0.f;
+        float p = _cluster_cdf[slot] - cdf0;
+        pmf *= p;
+        uRemapped = p > 0 ? glm::min((u - cdf0) / p, OneMinusEpsilon) : 0.f;
+        return slot;
+    }
+
+    float MeshAreaLight::SlotPmf(const Interaction *inter, int slot) const
+    {
+        auto weight = [&](const TriangleCluster &cluster)
+        {
+            return inter ? cluster.lightBounds.Importance(inter->p, inter->n) : cluster.lightBounds.phi;
+        };
+
+        if (_clusters.empty() || weight(_clusters[0]) == 0)
+            return 0.f;
+
+        // Follow the clusters containing slot, accumulating the probability of each choice
+        int nodeIndex = 0;
+        float pmf = 1;
+        while (_clusters[nodeIndex].secondChild >= 0)
+        {
+            const TriangleCluster &node = _clusters[nodeIndex];
+            float ci[2] = {weight(_clusters[nodeIndex + 1]), weight(_clusters[node.secondChild])};
+            int child = slot < _clusters[node.secondChild].begin ? 0 : 1;
+            if (ci[child] == 0)
+                return 0.f;
+            pmf *= ci[child] / (ci[0] + ci[1]);
+            nodeIndex = child ? node.secondChild : nodeIndex + 1;
+        }
+
+        const TriangleCluster &leaf = _clusters[nodeIndex];
+        return pmf * (_cluster_cdf[slot] - (slot > leaf.begin ? _cluster_cdf[slot - 1] : 0.f));
+    }
+
+    int MeshAreaLight::IntersectSlot(const Ray &ray) const
+    {
+        if (_clusters.empty())
+            return -1;
+
+        Ray r = ray;
+        Vector3f invDir(1.f / r._direction.x, 1.f / r._direction.y, 1.f / r._direction.z);
+        int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+        int nodesToVisit[64];
+        int toVisitOffset = 0;
+        nodesToVisit[toVisitOffset++] = 0;
+        int hitSlot = -1;
+        while (toVisitOffset > 0)
+        {
+            int nodeIndex = nodesToVisit[--toVisitOffset];
+            const TriangleCluster &node = _clusters[nodeIndex];
+            // Note: clusters without area have empty bounds and are never hit
+            if (node.lightBounds.phi == 0 || !node.lightBounds.bounds.Hit(r, invDir, dirIsNeg))
+                continue;
+            if (node.secondChild >= 0)
+            {
+                nodesToVisit[toVisitOffset++] = node.secondChild;
+                nodesToVisit[toVisitOffset++] = nodeIndex + 1;
+                continue;
+            }
+            for (int slot = node.begin; slot < node.end; ++slot)
+            {
+                float tHit;
+                SurfaceInteraction isect;
+                if (GetTriangle(_triangle_order[slot]).Hit(r, tHit, isect))
+                {
+                    r._t_max = tHit;
+                    hitSlot = slot;
+                }
+            }
+        }
+        return hitSlot;
+    }
+
+    Spectrum MeshAreaLight::SampleLe(const Vector2f &u1, const Vector2f &u2, Ray &ray,
+                                     Vector3f &nLight, float &pdfPos, float &pdfDir) const
+    {
+        // Pick a triangle proportional to its area and reuse the remapped sample on it,
+        // the area density is 1/_area on the whole mesh
+        float pmf, uRemapped;
+        int slot = SampleSlot(nullptr, u1[0], pmf, uRemapped);
+        if (slot < 0)
+        {
+            pdfPos = pdfDir = 0;
+            return Spectrum(0.f);
+        }
+        float pdfArea;
+        Interaction pShape = GetTriangle(_triangle_order[slot]).Sample(Vector2f(uRemapped, u1[1]), pdfArea);
+        pdfPos = 1 / _area;
+        nLight = pShape.n;
+
+        // Cosine-weighted direction about the normal, on a random side for two-sided emitters
+        Vector2f u = u2;
+        bool flip = false;
+        if (_two_sided)
+        {
+            flip = u[0] >= 0.5f;
+            u[0] = flip ? 2 * (u[0] - 0.5f) : 2 * u[0];
+            u[0] = glm::min(u[0], OneMinusEpsilon);
+        }
+        Vector3f w = CosineSampleHemisphere(u);
+        pdfDir = CosineHemispherePdf(w.z) * (_two_sided ? 0.5f : 1.f);
+        if (flip)
+            w.z = -w.z;
+
+        Vector3f v1, v2;
+        coordinateSystem(pShape.n, v1, v2);
+        w = w.x * v1 + w.y * v2 + w.z * pShape.n;
+        ray = pShape.SpawnRay(w);
+        return L(pShape, w);
+    }
+
+    void MeshAreaLight::PdfLe(const Ray &ray, const Vector3f &n, float &pdfPos, float &pdfDir) const
+    {
+        pdfPos = _area > 0 ? 1 / _area : 0.f;
+        float cosTheta = glm::dot(n, ray._direction);
+        if (_two_sided)
+            pdfDir = 0.5f * CosineHemispherePdf(glm::abs(cosTheta));
+        else
+            pdfDir = cosTheta > 0 ? CosineHemispherePdf(cosTheta) : 0.f;
+    }
+
+    Spectrum MeshAreaLight::SampleLi(const Interaction &inter, const Vector2f &u,
+                                     Vector3f &wi, float &pdf, VisibilityTester &vis) const
+    {
+        // Pick a triangle by its importance to inter, then sample the solid angle it subtends
+        float pmf, uRemapped;
+        int slot = SampleSlot(&inter, u[0], pmf, uRemapped);
+        if (slot < 0)
+        {
+            pdf = 0;
+            return 0.f;
+        }
+
+        float trianglePdf;
+        Interaction p_shape = GetTriangle(_triangle_order[slot]).Sample(inter, Vector2f(uRemapped, u[1]), trianglePdf);
+        if (trianglePdf == 0 || glm::distance2(p_shape.p, inter.p) == 0)
+        {
+            pdf = 0;
+            return 0.f;
+        }
+        wi = glm::normalize(p_shape.p - inter.p);
+        pdf = pmf * trianglePdf;
+
+        vis = VisibilityTester(inter, p_shape);
+        return L(p_shape, -wi);
+    }
+
+    float MeshAreaLight::PdfLi(const Interaction &inter, const Vector3f &wi) const
+    {
+        // Only the closest triangle along wi can have been sampled and seen
+        int slot = IntersectSlot(inter.SpawnRay(wi));
+        if (slot < 0)
+            return 0.f;
+        float pmf = SlotPmf(&inter, slot);
+        if (pmf == 0)
+            return 0.f;
+        return pmf * GetTriangle(_triangle_order[slot]).Pdf(inter, wi);
+    }
+
+    bool MeshAreaLight::GetLightBounds(LightBounds &bounds) const
+    {
+        float phi = Power().maxComponentValue();
+        if (phi == 0 || _clusters.empty() || _clusters[0].lightBounds.phi == 0)
+            return false;
+        bounds = _clusters[0].lightBounds;
+        bounds.phi = phi;
+        return true;
+    }
+}
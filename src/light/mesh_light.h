@@ -0,0 +1,107 @@
+
+
+#ifndef LIGHT_MESH_LIGHT_H_
+#define LIGHT_MESH_LIGHT_H_
+
+#include <core/light.h>
+#include <shape/triangle.h>
+
+namespace platinum
+{
+    /**
+     * @brief 整个发光三角网格共用的漫反射面光源。
+     *        网格中所有三角形图元都指向同一个光源对象，光源只保存网格指针和一棵三角形簇的光源树：
+     *        叶节点最多包含MaxClusterTriangles个三角形，每个三角形只占用两个数（在树中的顺序和簇内的面积CDF）。
+     *        SampleLi()像BVHLightDistribution一样按着色点处的重要性从根节点选到叶节点，在簇内按面积选择三角形，
+     *        再在三角形上按立体角采样（Triangle::Sample）；PdfLi()沿同一棵树求交找到三角形，开销与三角形数的对数成正比。
+     *        SampleLe()按功率（即面积）选择三角形，整个网格表面上关于面积的pdf恒为1/总面积。
+     */
+    class MeshAreaLight final : public AreaLight
+    {
+    public:
+        MeshAreaLight(const PropertyTree &node);
+
+        MeshAreaLight(const Spectrum &Lemit, int n_samples, TriangleMesh *mesh,
+                      Transform *object2world, Transform *world2object, bool two_sided = false);
+
+        /**
+         * @brief 设置发光的网格并构造三角形的面积分布
+         */
+        void SetMesh(TriangleMesh *mesh, Transform *object2world, Transform *world2object);
+
+        virtual Spectrum L(const Interaction &inter, const Vector3f &w) const override
+        {
+            return (_two_sided || glm::dot(inter.n, w) > 0) ? _Lemit : Spectrum(0.f);
+        }
+
+        virtual Spectrum Power() const override
+        {
+            return (_two_sided ? 2 : 1) * _Lemit * _area * Pi;
+        }
+
+        virtual Spectrum SampleLe(const Vector2f &u1, const Vector2f &u2, Ray &ray,
+                                  Vector3f &nLight, float &pdfPos, float &pdfDir) const override;
+
+        virtual void PdfLe(const Ray &, const Vector3f &, float &pdfPos, float &pdfDir) const override;
+
+        virtual Spectrum SampleLi(const Interaction &inter, const Vector2f &u,
+                                  Vector3f &wi, float &pdf, VisibilityTester &vis) const override;
+
+        virtual float PdfLi(const Interaction &inter, const Vector3f &wi) const override;
+
+        virtual bool GetLightBounds(LightBounds &bounds) const override;
+
+        //所有三角形图元共享同一个光源，不需要记录父节点
+        virtual void SetParent(Object *parent) override {}
+
+        virtual std::string ToString() const { return "MeshAreaLight"; }
+
+    private:
+        static constexpr int MaxClusterTriangles = 8;
+
+        struct TriangleCluster
+        {
+            LightBounds lightBounds; //phi为簇内三角形的面积之和
+            int begin, end;          //簇内三角形在_triangle_order中的范围
+            int secondChild;         //内部节点的第二个子节点（第一个紧跟在节点之后），叶节点为-1
+        };
+
+        int BuildClusters(int begin, int end, std::vector<Vector3f> &centroids);
+
+        Triangle GetTriangle(int face) const
+        {
+            const auto &indices = _mesh->GetIndices();
+            return Triangle(_object2world, _world2object, {indices[3 * face], indices[3 * face + 1], indices[3 * face + 2]}, _mesh);
+        }
+
+        /**
+         * @brief 选择一个三角形：inter不为nullptr时按簇对着色点的重要性，否则按面积
+         * @param  pmf              返回选中该三角形的概率
+         * @param  uRemapped        返回可以继续使用的一维随机变量
+         * @return int              三角形在_triangle_order中的位置，没有可选的三角形时返回-1
+         */
+        int SampleSlot(const Interaction *inter, float u, float &pmf, float &uRemapped) const;
+
+        /**
+         * @brief SampleSlot()选中位置slot的三角形的概率
+         */
+        float SlotPmf(const Interaction *inter, int slot) const;
+
+        /**
+         * @brief 在光源树中求ray与网格最近的交点，返回交到的三角形在_triangle_order中的位置，没有交点时返回-1
+         */
+        int IntersectSlot(const Ray &ray) const;
+
+    private:
+        Spectrum _Lemit;
+        TriangleMesh *_mesh = nullptr;
+        Transform *_object2world = nullptr, *_world2object = nullptr;
+        std::vector<TriangleCluster> _clusters;
+        std::vector<int> _triangle_order;   //按簇排列的三角形编号
+        std::vector<float> _cluster_cdf;    //与_triangle_order对应：簇内按面积累积到该三角形（含）的比例
+        float _area = 0.f;
+        bool _two_sided = false;
+    };
+}
+
+#endif
@@ -21,16 +21,33 @@ int main(int argc, char *argv[])
     google::SetLogDestination(google::GLOG_WARNING, log_warning_path.c_str());
     google::SetLogDestination(google::GLOG_ERROR, log_info_path.c_str());
     //第一个参数argv[0]一定是程序的名称
+    //用法: platinum <scene.json> [--resume]
     auto &parser = Parser::GetInstance();
     if (argc >= 2)
     {
         Ptr<Integrator> integrator = nullptr;
         Ptr<Scene> scene = nullptr;
-        std::string filename(argv[1]);
-        
-        parser.Parse(filename, scene, integrator);
+        std::string filename;
+        bool resume = false;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg(argv[i]);
+            if (arg == "--resume")
+                resume = true;
+            else
+                filename = arg;
+        }
+        if (filename.empty())
+        {
+            LOG(ERROR) << "No scene file given, usage: platinum <scene.json> [--resume]";
+            google::ShutdownGoogleLogging();
+            return 1;
+        }
 
+        parser.Parse(filename, scene, integrator);
 
+        //从积分器配置的检查点文件继续渲染
+        integrator->SetResume(resume);
 
         integrator->Render(*scene);
 
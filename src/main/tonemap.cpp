@@ -0,0 +1,152 @@
+
+
+#include <core/image_io.h>
+#include <tbb/parallel_for.h>
+#include <iostream>
+#include <stdexcept>
+
+using namespace platinum;
+using namespace std;
+
+namespace
+{
+    enum class Operator
+    {
+        Clamp,
+        Reinhard,
+        ACES
+    };
+
+    void PrintUsage()
+    {
+        cerr << "usage: platinum_tonemap <input.exr|input.pfm> [output.png] [options]\n"
+                "  --exposure <ev>       multiply by 2^ev before tonemapping (default 0)\n"
+                "  --scale <s>           multiply by s, e.g. the Film's Scale (default 1)\n"
+                "  --operator <name>     clamp, reinhard or aces (default clamp)\n"
+                "  --white <w>           luminance mapped to white by reinhard (default infinity)\n";
+    }
+
+    // Like stof, but reports malformed or out of range numbers instead of throwing
+    bool ParseFloat(const string &text, float &value)
+    {
+        try
+        {
+            size_t end;
+            value = stof(text, &end);
+            return end == text.size();
+        }
+        catch (const std::logic_error &)
+        {
+            return false;
+        }
+    }
+
+    float Luminance(const float *rgb) { return 0.212671f * rgb[0] + 0.715160f * rgb[1] + 0.072169f * rgb[2]; }
+
+    // Curve fit of the ACES filmic tonemapper by Krzysztof Narkowicz
+    float ACESFilm(float x)
+    {
+        return clamp(x * (2.51f * x + 0.03f) / (x * (2.43f * x + 0.59f) + 0.14f), 0.f, 1.f);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_logtostderr = true;
+
+    string input, output;
+    float exposure = 0.f, scale = 1.f, white = Infinity;
+    Operator op = Operator::Clamp;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg(argv[i]);
+        bool hasValue = i + 1 < argc;
+        float *value = arg == "--exposure" ? &exposure : (arg == "--scale" ? &scale : (arg == "--white" ? &white : nullptr));
+        if (value && hasValue)
+        {
+            if (!ParseFloat(argv[++i], *value))
+            {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (arg == "--operator" && hasValue)
+        {
+            string name(argv[++i]);
+            if (name == "clamp")
+                op = Operator::Clamp;
+            else if (name == "reinhard")
+                op = Operator::Reinhard;
+            else if (name == "aces")
+                op = Operator::ACES;
+            else
+            {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-')
+        {
+            PrintUsage();
+            return 1;
+        }
+        else if (input.empty())
+            input = arg;
+        else
+            output = arg;
+    }
+    if (input.empty())
+    {
+        PrintUsage();
+        return 1;
+    }
+    if (output.empty())
+        output = SiblingFilename(input, "", "png");
+
+    int width, height, channels;
+    vector<float> image;
+    if (!ReadFloatImage(input, width, height, channels, image))
+        return 1;
+
+    const float gain = scale * std::exp2(exposure);
+    const float invWhite2 = 1 / (white * white);
+    vector<Byte> dst(size_t(width) * height * 3);
+    const float *thresholds = SRGB8Thresholds();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size_t(width) * height, 4096), [&](const tbb::blocked_range<size_t> &range)
+    {
+        for (size_t i = range.begin(); i != range.end(); ++i)
+        {
+            float rgb[3];
+            for (int c = 0; c < 3; ++c)
+                rgb[c] = glm::max(0.f, gain * image[i * channels + (channels == 1 ? 0 : c)]);
+
+            if (op == Operator::Reinhard)
+            {
+                // Extended Reinhard on the luminance, so that the hue is preserved
+                float L = Luminance(rgb);
+                float mapped = L * (1 + L * invWhite2) / (1 + L);
+                for (int c = 0; c < 3; ++c)
+                    rgb[c] = L > 0 ? rgb[c] * mapped / L : 0.f;
+            }
+            else if (op == Operator::ACES)
+            {
+                for (int c = 0; c < 3; ++c)
+                    rgb[c] = ACESFilm(rgb[c]);
+            }
+
+            for (int c = 0; c < 3; ++c)
+                dst[3 * i + c] = ToSRGB8(rgb[c], thresholds);
+        }
+    });
+
+    if (!WritePNG(output, width, height, 3, dst.data()))
+    {
+        LOG(ERROR) << "Failed to write " << output;
+        return 1;
+    }
+    LOG(INFO) << "Wrote " << output;
+
+    google::ShutdownGoogleLogging();
+    return 0;
+}
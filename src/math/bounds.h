@@ -83,7 +83,7 @@ namespace platinum
 
         void BoundingSphere(Vector3<T> *center, float *radius) const
         {
-            *center = (_p_min + _p_max) / 2;
+            *center = (_p_min + _p_max) / T(2);
             *radius = Inside(*center, *this) ? glm::distance(*center, _p_max) : 0;
         }
 
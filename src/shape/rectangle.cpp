@@ -0,0 +1,157 @@
+
+
+#include <shape/rectangle.h>
+#include <core/interaction.h>
+#include <math/transform.h>
+#include <glm/gtx/norm.hpp>
+#include <math/bounds.h>
+#include <core/sampler.h>
+
+namespace platinum
+{
+
+    REGISTER_CLASS(Rectangle, "Rectangle");
+
+    // Below this solid angle the spherical rectangle sampling loses precision,
+    // area sampling is just as good there.
+    static constexpr float MinSphericalSampleArea = 1e-4f;
+
+    // 从p看三角形abc所张的立体角（Van Oosterom-Strackee公式）
+    static float SphericalTriangleSolidAngle(const Vector3f &p, const Vector3f &a, const Vector3f &b, const Vector3f &c)
+    {
+        Vector3f va = a - p, vb = b - p, vc = c - p;
+        float la = glm::length(va), lb = glm::length(vb), lc = glm::length(vc);
+        float numer = glm::abs(glm::dot(va, glm::cross(vb, vc)));
+        float denom = la * lb * lc + glm::dot(va, vb) * lc + glm::dot(va, vc) * lb + glm::dot(vb, vc) * la;
+        return 2 * std::atan2(numer, denom);
+    }
+
+    Rectangle::Rectangle(const PropertyTree &node)
+        : Shape(node), _width(node.Get<float>("Width", 1.f)), _height(node.Get<float>("Height", 1.f))
+    {
+    }
+
+    Rectangle::Rectangle(Transform *object2world, Transform *world2object, float width, float height)
+        : Shape(object2world, world2object), _width(width), _height(height)
+    {
+        UpdateWorldGeometry();
+    }
+
+    void Rectangle::SetTransform(Transform *objectToWorld, Transform *worldToObject)
+    {
+        Shape::SetTransform(objectToWorld, worldToObject);
+        UpdateWorldGeometry();
+    }
+
+    void Rectangle::UpdateWorldGeometry()
+    {
+        if (_object2world == nullptr)
+            return;
+        float hw = 0.5f * _width, hh = 0.5f * _height;
+        _s = _object2world->ExecOn(Vector3f(-hw, -hh, 0), 1.0f);
+        _ex = _object2world->ExecOn(Vector3f(_width, 0, 0), 0.0f);
+        _ey = _object2world->ExecOn(Vector3f(0, _height, 0), 0.0f);
+        Vector3f n = glm::cross(_ex, _ey);
+        _area = glm::length(n);
+        _n = _area > 0 ? n / _area : Vector3f(0, 0, 1);
+        float exl = glm::length(_ex), eyl = glm::length(_ey);
+        _orthogonal = glm::abs(glm::dot(_ex, _ey)) <= 1e-4f * exl * eyl;
+    }
+
+    Bounds3f Rectangle::ObjectBound() const
+    {
+        float hw = 0.5f * _width, hh = 0.5f * _height;
+        return Bounds3f(Vector3f(-hw, -hh, 0), Vector3f(hw, hh, 0));
+    }
+
+    Bounds3f Rectangle::WorldBound() const
+    {
+        Bounds3f bounds(_s, _s + _ex);
+        bounds = UnionBounds(bounds, _s + _ey);
+        return UnionBounds(bounds, _s + _ex + _ey);
+    }
+
+    bool Rectangle::Intersect(const Ray &ray, float &t, float &u, float &v) const
+    {
+        float denom = glm::dot(ray._direction, _n);
+        if (denom == 0 || _area == 0)
+            return false;
+        t = glm::dot(_s - ray._origin, _n) / denom;
+        if (t <= 0 || t > ray._t_max)
+            return false;
+
+        // Barycentric-like coordinates of the hit point w.r.t. the two edges,
+        // also valid for a sheared (parallelogram) rectangle
+        Vector3f q = ray.GetPointAt(t) - _s;
+        float invArea = 1 / _area;
+        u = glm::dot(glm::cross(q, _ey), _n) * invArea;
+        v = glm::dot(glm::cross(_ex, q), _n) * invArea;
+        return u >= 0 && u <= 1 && v >= 0 && v <= 1;
+    }
+
+    bool Rectangle::Hit(const Ray &ray) const
+    {
+        float t, u, v;
+        return Intersect(ray, t, u, v);
+    }
+
+    bool Rectangle::Hit(const Ray &ray, float &t_hit, SurfaceInteraction &inter) const
+    {
+        float t, u, v;
+        if (!Intersect(ray, t, u, v))
+            return false;
+
+        // Compute the hit point from the parametrization rather than the ray to stay on the plane
+        Vector3f p_hit = _s + u * _ex + v * _ey;
+        inter = SurfaceInteraction(p_hit, Vector2f(u, v), -ray._direction, _ex, _ey, this);
+        t_hit = t;
+        return true;
+    }
+
+    Interaction Rectangle::Sample(const Vector2f &u, float &pdf) const
+    {
+        Interaction it;
+        it.p = _s + u[0] * _ex + u[1] * _ey;
+        it.n = _n;
+        pdf = 1 / _area;
+        return it;
+    }
+
+    bool Rectangle::CanSampleSolidAngle(const Vector3f &p) const
+    {
+        return _orthogonal && SolidAngle(p) >= MinSphericalSampleArea;
+    }
+
+    Interaction Rectangle::Sample(const Interaction &ref, const Vector2f &u, float &pdf) const
+    {
+        if (!CanSampleSolidAngle(ref.p))
+            return Shape::Sample(ref, u, pdf);
+
+        Interaction it;
+        it.p = SampleSphericalRectangle(ref.p, _s, _ex, _ey, u, &pdf);
+        it.n = _n;
+        if (pdf == 0 || glm::distance2(it.p, ref.p) == 0)
+            pdf = 0;
+        return it;
+    }
+
+    float Rectangle::Pdf(const Interaction &ref, const Vector3f &wi) const
+    {
+        if (!CanSampleSolidAngle(ref.p))
+            return Shape::Pdf(ref, wi);
+
+        // Uniform over the subtended solid angle: only need to know whether wi hits the rectangle
+        if (!Hit(ref.SpawnRay(wi)))
+            return 0.f;
+        return 1 / SolidAngle(ref.p);
+    }
+
+    float Rectangle::SolidAngle(const Vector3f &p, int nSamples) const
+    {
+        // 错切后的平行四边形沿对角线拆成两个球面三角形
+        if (!_orthogonal)
+            return SphericalTriangleSolidAngle(p, _s, _s + _ex, _s + _ex + _ey) +
+                   SphericalTriangleSolidAngle(p, _s, _s + _ex + _ey, _s + _ey);
+        return SphericalRectangleSolidAngle(p, _s, _ex, _ey);
+    }
+} // namespace platinum
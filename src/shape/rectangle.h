@@ -0,0 +1,81 @@
+
+
+#ifndef GEOMETRY_RECTANGLE_H_
+#define GEOMETRY_RECTANGLE_H_
+
+#include <core/primitive.h>
+#include <math/ray.h>
+#include <core/interaction.h>
+#include <math/bounds.h>
+#include <core/shape.h>
+
+namespace platinum
+{
+    /**
+     * @brief
+     *      矩形（四边形）面片，常用作面光源
+     *      object坐标系中矩形位于z=0平面，以原点为中心，宽Width（x方向）、高Height（y方向），
+     *      法线为+z；表面参数uv为
+     *      p = s + u * ex + v * ey, 0 ≤ u,v ≤ 1
+     *      其中s为左下角顶点，ex、ey为两条边。
+     *      相交测试与采样都直接在世界坐标下进行，变换后的顶点与边在SetTransform时缓存；
+     *      从参考点采样时按Ureña等人的球面矩形方法在立体角上均匀采样。
+     */
+    class Rectangle final : public Shape
+    {
+    public:
+        Rectangle(const PropertyTree &node);
+
+        Rectangle(Transform *object2world, Transform *world2object, float width, float height);
+
+        virtual ~Rectangle() = default;
+
+        virtual void SetTransform(Transform *objectToWorld, Transform *worldToObject) override;
+
+        virtual float Area() const override { return _area; }
+
+        virtual DirectionCone NormalBounds() const override { return DirectionCone(_n, 1.f); }
+
+        virtual Interaction Sample(const Vector2f &u, float &pdf) const override;
+
+        virtual Interaction Sample(const Interaction &ref, const Vector2f &u, float &pdf) const override;
+
+        virtual float Pdf(const Interaction &ref, const Vector3f &wi) const override;
+
+        virtual Bounds3f ObjectBound() const override;
+
+        virtual Bounds3f WorldBound() const override;
+
+        virtual bool Hit(const Ray &ray) const override;
+
+        virtual bool Hit(const Ray &ray, float &t_hit, SurfaceInteraction &inter) const override;
+
+        virtual float SolidAngle(const Vector3f &p, int nSamples = 512) const override;
+
+        virtual std::string ToString() const { return "Rectangle"; }
+
+    private:
+        /**
+         * @brief 计算光线与矩形所在平面的交点，返回交点处的t和表面参数uv
+         */
+        bool Intersect(const Ray &ray, float &t, float &u, float &v) const;
+
+        /**
+         * @brief 变换后的边不再垂直时（如错切变换）不能使用球面矩形采样
+         */
+        bool CanSampleSolidAngle(const Vector3f &p) const;
+
+        void UpdateWorldGeometry();
+
+    private:
+        float _width, _height;
+
+        //世界坐标下的顶点s、边ex/ey、单位法线及面积
+        Vector3f _s, _ex, _ey, _n;
+        float _area = 0.f;
+        bool _orthogonal = true;
+    };
+
+} // namespace platinum
+
+#endif
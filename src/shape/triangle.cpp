@@ -136,6 +136,15 @@ namespace platinum
         return 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
     }
 
+    DirectionCone Triangle::NormalBounds() const
+    {
+        const auto &p0 = _mesh->GetPositionAt(_indices[0]);
+        const auto &p1 = _mesh->GetPositionAt(_indices[1]);
+        const auto &p2 = _mesh->GetPositionAt(_indices[2]);
+        // Same orientation as the normal returned by Sample()
+        return DirectionCone(glm::cross(p1 - p0, p2 - p0), 1.f);
+    }
+
     Interaction Triangle::Sample(const Vector2f &u, float &pdf) const
     {
         //重心坐标
@@ -154,6 +163,45 @@ namespace platinum
         return it;
     }
 
+    // Spherical triangle sampling is numerically unstable for triangles that subtend
+    // a tiny or (almost) a hemisphere of solid angle, area sampling is used instead
+    static constexpr float MinSphericalSampleArea = 3e-4f;
+    static constexpr float MaxSphericalSampleArea = 6.22f;
+
+    Interaction Triangle::Sample(const Interaction &ref, const Vector2f &u, float &pdf) const
+    {
+        float solidAngle = SolidAngle(ref.p);
+        if (solidAngle < MinSphericalSampleArea || solidAngle > MaxSphericalSampleArea)
+            return Shape::Sample(ref, u, pdf);
+
+        // Sample spherical triangle from reference point
+        const auto &p0 = _mesh->GetPositionAt(_indices[0]);
+        const auto &p1 = _mesh->GetPositionAt(_indices[1]);
+        const auto &p2 = _mesh->GetPositionAt(_indices[2]);
+        std::array<float, 3> b = SampleSphericalTriangle({p0, p1, p2}, ref.p, u, &pdf);
+
+        Interaction it;
+        it.p = b[0] * p0 + b[1] * p1 + b[2] * p2;
+        // Same orientation as the area sampling Sample()
+        it.n = glm::normalize(Vector3f(glm::cross(p1 - p0, p2 - p0)));
+        if (pdf == 0 || glm::distance2(it.p, ref.p) == 0)
+            pdf = 0;
+        return it;
+    }
+
+    float Triangle::Pdf(const Interaction &ref, const Vector3f &wi) const
+    {
+        float solidAngle = SolidAngle(ref.p);
+        if (solidAngle < MinSphericalSampleArea || solidAngle > MaxSphericalSampleArea)
+            return Shape::Pdf(ref, wi);
+
+        // The pdf is constant over the solid angle the triangle subtends,
+        // only a (cheap) occlusion test against this triangle is needed
+        if (!Hit(ref.SpawnRay(wi)))
+            return 0.f;
+        return 1 / solidAngle;
+    }
+
     bool Triangle::Hit(const Ray &ray) const
     {
         const auto &p0 = _mesh->GetPositionAt(_indices[0]);
@@ -172,8 +220,8 @@ namespace platinum
         int ky = (kx + 1) % 3;
         Vector3f d = permute(ray._direction, kx, ky, kz);
         p0t = permute(p0t, kx, ky, kz);
-        p1t = permute(p2t, kx, ky, kz);
-        p2t = permute(p1t, kx, ky, kz);
+        p1t = permute(p1t, kx, ky, kz);
+        p2t = permute(p2t, kx, ky, kz);
 
         float Sx = -d.x / d.z;
         float Sy = -d.y / d.z;
@@ -38,6 +38,15 @@ namespace platinum
         virtual float Area() const override;
         virtual Interaction Sample(const Vector2f &u, float &pdf) const override;
 
+        virtual DirectionCone NormalBounds() const override;
+
+        /**
+         * @brief 从ref处按立体角均匀采样三角形（球面三角形采样），立体角过小或过大时退化为按面积采样
+         */
+        virtual Interaction Sample(const Interaction &ref, const Vector2f &u, float &pdf) const override;
+
+        virtual float Pdf(const Interaction &ref, const Vector3f &wi) const override;
+
         virtual Bounds3f ObjectBound() const override;
         virtual Bounds3f WorldBound() const override;
 
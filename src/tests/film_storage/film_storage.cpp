@@ -0,0 +1,128 @@
+// Checks the compact film storage against Float storage. Many progressive passes of the same
+// noisy samples are merged into a Float film and into Half and RGB9E5 films prepared for
+// progressive rendering, which have to converge alike; a single pass of as many samples checks
+// the rounding of the compact layouts themselves. Tiles of a single sample merge every pixel
+// many times: fine with a Gaussian filter, while the negative lobes of a Catmull-Rom (Mitchell)
+// filter leave weight sums close to 0 after some merges and make the film store floats.
+
+#include <core/film.h>
+#include <filter/box_filter.h>
+#include <filter/gaussian_filter.h>
+#include <filter/mitchell_filter.h>
+#include <random>
+#include <cstdio>
+using namespace platinum;
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    const int resolution = 16;
+    const int passes = argc > 1 ? atoi(argv[1]) : 2048;
+
+    auto makeFilm = [&](FilmStorage storage, std::unique_ptr<Filter> filter = nullptr) {
+        if (!filter)
+            filter = std::make_unique<BoxFilter>(Vector2f(0.5f, 0.5f));
+        auto film = std::make_unique<Film>(Vector2i(resolution, resolution), Bounds2f(Vector2f(0, 0), Vector2f(1, 1)),
+                                           std::move(filter), "film_storage.png");
+        film->SetStorage(storage);
+        return film;
+    };
+
+    // The samples of a pass only depend on the pass, every film sees the same ones
+    auto addPass = [&](Film &film, int pass, int samples) {
+        mt19937 rng(pass);
+        uniform_real_distribution<float> noise(0.f, 2.f);
+        auto tile = film.GetFilmTile(film.GetSampleBounds());
+        Bounds2i bounds = tile->getPixelBounds();
+        for (int y = bounds._p_min.y; y < bounds._p_max.y; ++y)
+            for (int x = bounds._p_min.x; x < bounds._p_max.x; ++x)
+            {
+                float mean = 0.01f + 4.f * float(x + y * resolution) / (resolution * resolution);
+                for (int s = 0; s < samples; ++s)
+                    tile->AddSample(Vector2f(x + 0.5f, y + 0.5f), Spectrum(mean * noise(rng)));
+            }
+        film.MergeFilmTile(std::move(tile));
+    };
+
+    // Samples spread over the pixels, merged one tileSize x tileSize tile after the other
+    auto addTiles = [&](Film &film, int tileSize, int samples) {
+        mt19937 rng(1);
+        uniform_real_distribution<float> uniform(0.f, 1.f);
+        Bounds2i sampleBounds = film.GetSampleBounds();
+        for (int y0 = sampleBounds._p_min.y; y0 < sampleBounds._p_max.y; y0 += tileSize)
+            for (int x0 = sampleBounds._p_min.x; x0 < sampleBounds._p_max.x; x0 += tileSize)
+            {
+                Vector2i p1(glm::min(x0 + tileSize, sampleBounds._p_max.x), glm::min(y0 + tileSize, sampleBounds._p_max.y));
+                auto tile = film.GetFilmTile(Bounds2i(Vector2i(x0, y0), p1));
+                for (int y = y0; y < p1.y; ++y)
+                    for (int x = x0; x < p1.x; ++x)
+                        for (int s = 0; s < samples; ++s)
+                        {
+                            Vector2f pFilm(x + uniform(rng), y + uniform(rng));
+                            tile->AddSample(pFilm, Spectrum(0.1f + pFilm.x / resolution + 2.f * uniform(rng)));
+                        }
+                film.MergeFilmTile(std::move(tile));
+            }
+    };
+
+    auto maxRelativeError = [&](const Film &film, const Film &reference) {
+        float error = 0.f;
+        for (Vector2i pixel : reference.GetCroppedPixelBounds())
+        {
+            float expected = reference.GetPixelLuminance(pixel);
+            error = glm::max(error, glm::abs(film.GetPixelLuminance(pixel) - expected) / expected);
+        }
+        return error;
+    };
+
+    int failures = 0;
+    const char *names[3] = {"Float", "Half", "RGB9E5"};
+    const float singlePassTolerance[3] = {0.f, 2e-3f, 1e-2f};
+
+    auto reference = makeFilm(FilmStorage::Float);
+    for (int pass = 0; pass < passes; ++pass)
+        addPass(*reference, pass, 1);
+    auto singleReference = makeFilm(FilmStorage::Float);
+    addPass(*singleReference, 0, passes);
+
+    for (int storage = 1; storage < 3; ++storage)
+    {
+        auto progressive = makeFilm(FilmStorage(storage));
+        progressive->EnableProgressive();
+        auto compact = makeFilm(FilmStorage(storage));
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            addPass(*progressive, pass, 1);
+            addPass(*compact, pass, 1);
+        }
+        float progressiveError = maxRelativeError(*progressive, *reference);
+
+        auto single = makeFilm(FilmStorage(storage));
+        addPass(*single, 0, passes);
+        float singleError = maxRelativeError(*single, *singleReference);
+
+        printf("%s: %d passes max relative error %g (%g if every pass were rounded), single pass %g\n", names[storage],
+               passes, progressiveError, maxRelativeError(*compact, *reference), singleError);
+        failures += progressive->GetStorage() != FilmStorage::Float || progressiveError > 1e-6f ? 1 : 0;
+        failures += singleError > singlePassTolerance[storage] ? 1 : 0;
+
+        auto gaussianReference = makeFilm(FilmStorage::Float, std::make_unique<GaussianFilter>(Vector2f(1.5f, 1.5f), 2.f));
+        auto gaussian = makeFilm(FilmStorage(storage), std::make_unique<GaussianFilter>(Vector2f(1.5f, 1.5f), 2.f));
+        auto mitchellReference = makeFilm(FilmStorage::Float, std::make_unique<MitchellFilter>(Vector2f(2.f, 2.f), 0.f, 0.5f));
+        auto mitchell = makeFilm(FilmStorage(storage), std::make_unique<MitchellFilter>(Vector2f(2.f, 2.f), 0.f, 0.5f));
+        for (Film *film : {gaussianReference.get(), gaussian.get(), mitchellReference.get(), mitchell.get()})
+            addTiles(*film, 1, 1);
+        float gaussianError = maxRelativeError(*gaussian, *gaussianReference);
+        float mitchellError = maxRelativeError(*mitchell, *mitchellReference);
+
+        printf("%s: 1x1 tiles, Gaussian max relative error %g, Mitchell %g (stored as %s)\n", names[storage],
+               gaussianError, mitchellError, names[(int)mitchell->GetStorage()]);
+        failures += gaussian->GetStorage() != FilmStorage(storage) || gaussianError > singlePassTolerance[storage] ? 1 : 0;
+        failures += mitchell->GetStorage() != FilmStorage::Float || mitchellError > 1e-6f ? 1 : 0;
+    }
+
+    google::ShutdownGoogleLogging();
+    return failures == 0 ? 0 : 1;
+}
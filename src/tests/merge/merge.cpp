@@ -0,0 +1,75 @@
+// Benchmark of Film::MergeFilmTile: merges the film's tiles with 1..N threads
+// and reports the average time of one full-film merge for each thread count.
+
+#include <core/film.h>
+#include <filter/box_filter.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+using namespace platinum;
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    const int resolution = argc > 1 ? atoi(argv[1]) : 1024;
+    const int tileSize = argc > 2 ? atoi(argv[2]) : 8;
+    const int repeats = argc > 3 ? atoi(argv[3]) : 20;
+
+    Film film(Vector2i(resolution, resolution), Bounds2f(Vector2f(0, 0), Vector2f(1, 1)),
+              std::make_unique<BoxFilter>(Vector2f(0.5f, 0.5f)), "merge.png");
+
+    Bounds2i sampleBounds = film.GetSampleBounds();
+    Vector2i sampleExtent = sampleBounds.Diagonal();
+    Vector2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+    const int tileCount = nTiles.x * nTiles.y;
+
+    auto makeTile = [&](int t) {
+        int x0 = sampleBounds._p_min.x + (t % nTiles.x) * tileSize;
+        int y0 = sampleBounds._p_min.y + (t / nTiles.x) * tileSize;
+        int x1 = glm::min(x0 + tileSize, sampleBounds._p_max.x);
+        int y1 = glm::min(y0 + tileSize, sampleBounds._p_max.y);
+        auto tile = film.GetFilmTile(Bounds2i(Vector2i(x0, y0), Vector2i(x1, y1)));
+        Bounds2i bounds = tile->getPixelBounds();
+        for (int y = bounds._p_min.y; y < bounds._p_max.y; ++y)
+            for (int x = bounds._p_min.x; x < bounds._p_max.x; ++x)
+                tile->AddSample(Vector2f(x + 0.5f, y + 0.5f), Spectrum(1.f));
+        return tile;
+    };
+
+    const int maxThreads = glm::max(1, (int)std::thread::hardware_concurrency());
+    printf("film %dx%d, %d tiles of %dx%d\n", resolution, resolution, tileCount, tileSize, tileSize);
+    printf("%8s %14s %10s\n", "threads", "merge (ms)", "speedup");
+
+    double baseline = 0.0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        tbb::task_arena arena(threads);
+        double total = 0.0;
+        for (int r = 0; r < repeats; ++r)
+        {
+            // Tiles are created up front so that only the merge itself is timed
+            std::vector<std::unique_ptr<FilmTile>> tiles(tileCount);
+            arena.execute([&] {
+                tbb::parallel_for(0, tileCount, [&](int t) { tiles[t] = makeTile(t); });
+            });
+
+            auto start = std::chrono::steady_clock::now();
+            arena.execute([&] {
+                tbb::parallel_for(0, tileCount, [&](int t) { film.MergeFilmTile(std::move(tiles[t])); });
+            });
+            total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        double average = total / repeats;
+        if (threads == 1)
+            baseline = average;
+        printf("%8d %14.3f %10.2f\n", threads, average, baseline / average);
+    }
+
+    google::ShutdownGoogleLogging();
+    return 0;
+}
@@ -0,0 +1,89 @@
+// Checks MeshAreaLight sampling at points that its triangles face away from. Two small one-sided
+// quads face outwards on either side of the origin: the cone of the root cluster spans every
+// direction, while neither child cluster is important to a point between the quads.
+
+#include <light/mesh_light.h>
+#include <fstream>
+#include <random>
+#include <cstdio>
+using namespace platinum;
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    // Each quad is a 2x2 grid of 8 triangles, more than a single cluster holds
+    const string filename = "mesh_light.obj";
+    {
+        ofstream obj(filename);
+        for (int side = 0; side < 2; ++side)
+        {
+            float x = side == 0 ? 1.f : -1.f;
+            for (int j = 0; j <= 2; ++j)
+                for (int i = 0; i <= 2; ++i)
+                    obj << "v " << x << " " << 0.2f * (i - 1) << " " << 0.2f * (j - 1) << "\n";
+        }
+        for (int side = 0; side < 2; ++side)
+            for (int j = 0; j < 2; ++j)
+                for (int i = 0; i < 2; ++i)
+                {
+                    int a = 9 * side + 3 * j + i + 1, b = a + 1, c = a + 3, d = c + 1;
+                    //quad at x = 1 faces +x, quad at x = -1 faces -x
+                    if (side == 0)
+                        obj << "f " << a << " " << b << " " << c << "\nf " << b << " " << d << " " << c << "\n";
+                    else
+                        obj << "f " << a << " " << c << " " << b << "\nf " << b << " " << c << " " << d << "\n";
+                }
+    }
+    Transform identity;
+    TriangleMesh mesh(&identity, filename);
+    MeshAreaLight light(Spectrum(1.f), 1, &mesh, &identity, &identity, false);
+
+    mt19937 rng(7);
+    uniform_real_distribution<float> uniform(0.f, 1.f);
+    int failures = 0;
+
+    // Between the quads nothing can be sampled, the pdfs have to be 0 rather than NaN
+    {
+        Interaction ref(Vector3f(0.f, 0.05f, 0.f));
+        int bad = 0;
+        for (int i = 0; i < 1000; ++i)
+        {
+            Vector3f wi;
+            float pdf;
+            VisibilityTester vis;
+            light.SampleLi(ref, Vector2f(uniform(rng), uniform(rng)), wi, pdf, vis);
+            float pdfLi = light.PdfLi(ref, glm::normalize(Vector3f(uniform(rng) > 0.5f ? 1.f : -1.f, 0.1f * uniform(rng), 0.1f * uniform(rng))));
+            bad += (pdf != 0 || pdfLi != 0) ? 1 : 0;
+        }
+        printf("between the quads: %d of 1000 samples with a non-zero or NaN pdf\n", bad);
+        failures += bad;
+    }
+
+    // In front of a quad the sampled pdf agrees with PdfLi
+    {
+        Interaction ref(Vector3f(3.f, 0.1f, -0.05f));
+        int bad = 0, zero = 0;
+        for (int i = 0; i < 1000; ++i)
+        {
+            Vector3f wi;
+            float pdf;
+            VisibilityTester vis;
+            light.SampleLi(ref, Vector2f(uniform(rng), uniform(rng)), wi, pdf, vis);
+            if (pdf == 0)
+            {
+                ++zero;
+                continue;
+            }
+            float pdfLi = light.PdfLi(ref, wi);
+            bad += !(glm::abs(pdf - pdfLi) <= 5e-2f * pdf) ? 1 : 0;
+        }
+        printf("in front of a quad: %d of 1000 samples with pdf 0, %d disagree with PdfLi\n", zero, bad);
+        failures += zero + (bad > 10 ? 1 : 0);
+    }
+
+    remove(filename.c_str());
+    google::ShutdownGoogleLogging();
+    return failures == 0 ? 0 : 1;
+}
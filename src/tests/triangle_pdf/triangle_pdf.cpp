@@ -0,0 +1,80 @@
+// Checks Triangle::Pdf against the full ray-triangle intersection: the solid angle pdf of a
+// direction is 1/SolidAngle exactly when the ray hits the triangle. Three triangles face the
+// x, y and z axes, so that the rays towards them have every dominant axis.
+
+#include <shape/triangle.h>
+#include <fstream>
+#include <random>
+#include <cstdio>
+using namespace platinum;
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+
+    const string filename = "triangle_pdf.obj";
+    {
+        ofstream obj(filename);
+        obj << "v 2 -0.6 -0.4\nv 2 0.7 -0.5\nv 2 0.1 0.8\n"  //faces x
+               "v -0.4 2 -0.6\nv -0.5 2 0.7\nv 0.8 2 0.1\n"  //faces y
+               "v -0.6 -0.4 2\nv 0.7 -0.5 2\nv 0.1 0.8 2\n"  //faces z
+               "f 1 2 3\nf 4 5 6\nf 7 8 9\n";
+    }
+    Transform identity;
+    TriangleMesh mesh(&identity, filename);
+
+    const char *axes[3] = {"x", "y", "z"};
+    const Vector3f refs[3] = {Vector3f(0, 0, 0), Vector3f(0.3f, -0.2f, 0.1f), Vector3f(-0.5f, 0.4f, -0.3f)};
+    mt19937 rng(7);
+    uniform_real_distribution<float> uniform(0.f, 1.f);
+    int failures = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        Triangle triangle(&identity, &identity, {3 * axis, 3 * axis + 1, 3 * axis + 2}, &mesh);
+        int hits = 0, mismatches = 0, samples = 0, badSamples = 0, sampleHits = 0;
+        for (const Vector3f &p : refs)
+        {
+            Interaction ref(p);
+            float solidAngle = triangle.SolidAngle(p);
+
+            // Directions sampled on the triangle have the constant pdf, and (but for points
+            // sampled exactly on an edge) hit it
+            for (int i = 0; i < 1000; ++i, ++samples)
+            {
+                float pdf;
+                Interaction it = triangle.Sample(ref, Vector2f(uniform(rng), uniform(rng)), pdf);
+                Ray ray = ref.SpawnRay(glm::normalize(it.p - p));
+                float tHit;
+                SurfaceInteraction isect;
+                bool hit = triangle.Hit(ray, tHit, isect);
+                float pdfWi = triangle.Pdf(ref, ray._direction);
+                sampleHits += hit ? 1 : 0;
+                float expected = hit ? 1 / solidAngle : 0.f;
+                if (glm::abs(pdf - 1 / solidAngle) > 1e-3f / solidAngle || glm::abs(pdfWi - expected) > 1e-3f / solidAngle)
+                    ++badSamples;
+            }
+
+            // Directions around the triangle: the pdf is non-zero if and only if the ray hits it
+            Vector3f center = (mesh.GetPositionAt(3 * axis) + mesh.GetPositionAt(3 * axis + 1) + mesh.GetPositionAt(3 * axis + 2)) / 3.f;
+            for (int i = 0; i < 10000; ++i)
+            {
+                Vector3f target = center + 2.f * Vector3f(uniform(rng) - 0.5f, uniform(rng) - 0.5f, uniform(rng) - 0.5f);
+                Ray ray = ref.SpawnRay(glm::normalize(target - p));
+                float tHit;
+                SurfaceInteraction isect;
+                bool hit = triangle.Hit(ray, tHit, isect);
+                bool pdfHit = triangle.Pdf(ref, ray._direction) > 0;
+                hits += hit ? 1 : 0;
+                mismatches += (hit != triangle.Hit(ray) || hit != pdfHit) ? 1 : 0;
+            }
+        }
+        printf("%s-dominant: %d hits, %d pdf/hit mismatches, %d of %d sampled directions hit, %d with a wrong pdf\n",
+               axes[axis], hits, mismatches, sampleHits, samples, badSamples);
+        failures += mismatches + badSamples + (hits == 0 || sampleHits < samples * 99 / 100 ? 1 : 0);
+    }
+
+    remove(filename.c_str());
+    google::ShutdownGoogleLogging();
+    return failures == 0 ? 0 : 1;
+}